@@ -34,6 +34,29 @@ namespace
 unsigned fc(const unsigned int cfa[2][2], int r, int c) {
     return cfa[r & 1][c & 1];
 }
+
+// checksum of the raw data to detect whether the CA fits of a previous run can be reused
+uint64_t rawDataHash(const array2D<float> &rawData, int W, int H)
+{
+    uint64_t hash = (static_cast<uint64_t>(W) << 32) ^ H;
+
+#ifdef _OPENMP
+    #pragma omp parallel for reduction(^:hash) schedule(dynamic,16)
+#endif
+    for (int row = 0; row < H; ++row) {
+        uint64_t rowHash = 0xcbf29ce484222325ULL + row;
+        const uint32_t *const data = reinterpret_cast<const uint32_t*>(rawData[row]);
+
+        for (int col = 0; col < W; ++col) {
+            rowHash = (rowHash ^ data[col]) * 0x100000001b3ULL;
+        }
+
+        // mix the row index in, so swapped rows give a different hash
+        hash ^= (rowHash ^ (rowHash >> 29)) * (2 * static_cast<uint64_t>(row) + 1);
+    }
+
+    return hash;
+}
 }
 
 namespace {
@@ -228,6 +251,24 @@ float* RawImageSource::CA_correct_RT(
         }
     }
 
+    // The fits of the auto CA iterations only depend on the input data and avoidColourshift, so they are cached
+    // and reused when preprocessing runs again with unchanged data, e.g. after changing the demosaic settings
+    // or the number of iterations. Only the correction passes are done again then.
+    const bool useFitCache = autoCA && !fitParamsSet;
+
+    if (useFitCache) {
+        const uint64_t inputHash = rawDataHash(rawData, W, H);
+
+        if (inputHash != caFitCache.inputHash || avoidColourshift != caFitCache.avoidColourshift) {
+            caFitCache.inputHash = inputHash;
+            caFitCache.avoidColourshift = avoidColourshift;
+            caFitCache.failed = false;
+            caFitCache.fits.clear();
+        } else if (settings->verbose) {
+            std::cout << "CA correction: reusing " << std::min(caFitCache.fits.size(), iterations) << " cached fit(s)" << std::endl;
+        }
+    }
+
     for (size_t it = 0; it < iterations && processpasstwo; ++it) {
         float blockave[2][2] = {};
         float blocksqave[2][2] = {};
@@ -237,6 +278,20 @@ float* RawImageSource::CA_correct_RT(
         //order of 2d polynomial fit (polyord), and numpar=polyord^2
         int polyord = 4, numpar = 16;
 
+        const bool cachedFit = useFitCache && it < caFitCache.fits.size();
+
+        if (cachedFit) {
+            polyord = caFitCache.fits[it].polyord;
+            memcpy(fitparams, caFitCache.fits[it].params, sizeof(fitparams));
+        } else if (useFitCache && caFitCache.failed) {
+            // the fit of this iteration failed in the previous run
+            processpasstwo = false;
+            break;
+        }
+
+        // diagnostic pass to fit the CA shifts
+        const bool analyse = autoCA && !fitParamsSet && !cachedFit;
+
         constexpr float eps = 1e-5f, eps2 = 1e-10f; //tolerance to avoid dividing by zero
 
 #ifdef _OPENMP
@@ -257,7 +312,7 @@ float* RawImageSource::CA_correct_RT(
             // assign working space
             constexpr int buffersize = sizeof(float) * ts * ts + 8 * sizeof(float) * ts * tsh + 8 * 64 + 63;
             constexpr int buffersizePassTwo = sizeof(float) * ts * ts + 4 * sizeof(float) * ts * tsh + 4 * 64 + 63;
-            char * const bufferThr = (char *) malloc((autoCA && !fitParamsSet) ? buffersize : buffersizePassTwo);
+            char * const bufferThr = (char *) malloc(analyse ? buffersize : buffersizePassTwo);
 
             char * const data = (char*)((uintptr_t(bufferThr) + uintptr_t(63)) / 64 * 64);
 
@@ -269,7 +324,7 @@ float* RawImageSource::CA_correct_RT(
             rgb[1] = (float*) (data + sizeof(float) * ts * tsh + 1 * 64);
             rgb[2] = (float*) (data + sizeof(float) * (ts * ts + ts * tsh) + 2 * 64);
 
-            if (autoCA && !fitParamsSet) {
+            if (analyse) {
                 constexpr float caAutostrength = 8.f;
                 //high pass filter for R/B in vertical direction
                 float* rbhpfh  = (float*) (data + 2 * sizeof(float) * ts * ts + 3 * 64);
@@ -999,7 +1054,8 @@ float* RawImageSource::CA_correct_RT(
                         }
                         //end of border fill
 
-                        if (!autoCA || fitParamsIn) {
+                        if (!autoCA || fitParamsIn || cachedFit) {
+                            // Gtmp is only filled by the diagnostic pass, interpolate G at the R/B sites here otherwise
 #ifdef __SSE2__
                             const vfloat onev = F2V(1.f);
                             const vfloat epsv = F2V(eps);
@@ -1271,6 +1327,17 @@ float* RawImageSource::CA_correct_RT(
             // clean up
             free(bufferThr);
         }
+
+        if (analyse && useFitCache) {
+            if (processpasstwo) {
+                caFitCache.fits.emplace_back();
+                caFitCache.fits.back().polyord = polyord;
+                memcpy(caFitCache.fits.back().params, fitparams, sizeof(fitparams));
+            } else {
+                caFitCache.failed = true;
+            }
+        }
+
         if (avoidColourshift) {
             // to avoid or at least reduce the colour shift caused by raw ca correction we compute the per pixel difference factors
             // of red and blue channel and apply a gaussian blur to them.
@@ -5,11 +5,17 @@
 #include <omp.h>
 #endif
 #include "rt_algo.h"
+#include "settings.h"
 #include "sleef.h"
 
 #define DIAGONALS 5
 #define DIAGONALSP1 6
 
+namespace rtengine
+{
+extern const Settings* settings;
+}
+
 /* Solves A x = b by the conjugate gradient method, where instead of feeding it the matrix A you feed it a function which
 calculates A x where x is some vector. Stops when rms residual < RMSResidual or when maximum iterates is reached.
 Stops at n iterates if MaximumIterates = 0 since that many iterates gives exact solution. Applicable to symmetric positive
@@ -255,9 +261,9 @@ void MultiDiagonalSymmetricMatrix::VectorProduct(float* RESTRICT Product, float*
     int lm = DiagonalLength(srm);
 #ifdef _OPENMP
 #ifdef __SSE2__
-    const int chunkSize = (lm - srm) / (omp_get_num_procs() * 32);
+    const int chunkSize = std::max((lm - srm) / (omp_get_num_procs() * 32), 1);
 #else
-    const int chunkSize = (lm - srm) / (omp_get_num_procs() * 8);
+    const int chunkSize = std::max((lm - srm) / (omp_get_num_procs() * 8), 1);
 #endif
     #pragma omp parallel
 #endif
@@ -617,7 +623,625 @@ void MultiDiagonalSymmetricMatrix::CholeskyBackSolve(float* RESTRICT x, float* R
     }
 }
 
-EdgePreservingDecomposition::EdgePreservingDecomposition(int width, int height) : a0(nullptr) , a_1(nullptr), a_w(nullptr), a_w_1(nullptr), a_w1(nullptr)
+/* Grids of EdgePreservingMultigrid. Like in MultiDiagonalSymmetricMatrix, the diagonals hold the coefficients between a point
+and its right, lower left, lower and lower right neighbours at the index of the point, zero where the neighbour is outside.
+
+Coarse point (X, Y) sits on fine point (2 X, 2 Y). The interpolation to the other fine points is operator dependent as in
+Dendy's black box multigrid: a fine point takes the coarse values in proportion to how strongly it is coupled to them, so the
+coarse grid correction doesn't leak across the edges, where the edge stopping function makes the coupling weak. The weights
+of the fine points (2 X + 1, 2 Y), (2 X, 2 Y + 1) and (2 X + 1, 2 Y + 1) are kept with the coarse point (X, Y). */
+struct EdgePreservingMultigridLevel {
+    int w, h;
+    float *d0, *d1, *dwMinus1, *dw, *dwPlus1;   //Diagonals at the offsets 0, 1, w - 1, w and w + 1.
+    float *id0;                             //Inverse of the main diagonal.
+    MultiDiagonalSymmetricMatrix *Matrix;   //Owns the diagonals of the coarse grids.
+    float *x, *b;                           //Solution and right hand side of the coarse grids.
+    float *r;                               //Residual, not used on the coarsest grid.
+    float *px, *py, *pz;                    //Interpolation weights of the coarse grids, 2, 2 and 4 per point.
+};
+
+namespace
+{
+
+constexpr int MG_COARSEST = 1024;       //Grids of at most that many points aren't coarsened any further...
+constexpr int MG_COARSE_SWEEPS = 4;     //...and are solved by that many symmetric Gauss-Seidel sweeps.
+constexpr int MG_SMOOTHING = 1;         //Gauss-Seidel sweeps before and after the coarse grid correction.
+
+//Coefficient between (x, y) and (x + dx, y + dy), both inside the grid.
+inline float Entry(const EdgePreservingMultigridLevel &L, int x, int y, int dx, int dy)
+{
+    const int i = y * L.w + x;
+    const int j = i + dy * L.w + dx;
+
+    if(dy == 0) {
+        return dx == 0 ? L.d0[i] : L.d1[rtengine::min(i, j)];
+    } else if(dx == 0) {
+        return L.dw[rtengine::min(i, j)];
+    } else if(dx == dy) {
+        return L.dwPlus1[rtengine::min(i, j)];
+    } else {
+        return L.dwMinus1[rtengine::min(i, j)];
+    }
+}
+
+//Row of (x, y) as a 3 x 3 stencil, zero outside the grid.
+void Stencil(const EdgePreservingMultigridLevel &L, int x, int y, float a[3][3])
+{
+    if(x > 0 && x < L.w - 1 && y > 0 && y < L.h - 1) {
+        const int w = L.w;
+        const int i = y * w + x;
+        a[0][0] = L.dwPlus1[i - w - 1];
+        a[0][1] = L.dw[i - w];
+        a[0][2] = L.dwMinus1[i - w + 1];
+        a[1][0] = L.d1[i - 1];
+        a[1][1] = L.d0[i];
+        a[1][2] = L.d1[i];
+        a[2][0] = L.dwMinus1[i];
+        a[2][1] = L.dw[i];
+        a[2][2] = L.dwPlus1[i];
+        return;
+    }
+
+    for(int dy = -1; dy <= 1; dy++) {
+        for(int dx = -1; dx <= 1; dx++) {
+            const bool inside = x + dx >= 0 && x + dx < L.w && y + dy >= 0 && y + dy < L.h;
+            a[dy + 1][dx + 1] = inside ? Entry(L, x, y, dx, dy) : 0.f;
+        }
+    }
+}
+
+//Sum of the products of the off-diagonal coefficients of the row of point i with v, for points off the border.
+inline float OffDiagonalProduct(const EdgePreservingMultigridLevel &L, const float *v, int i)
+{
+    const int w = L.w;
+    return L.d1[i - 1] * v[i - 1] + L.d1[i] * v[i + 1]
+           + L.dw[i - w] * v[i - w] + L.dw[i] * v[i + w]
+           + L.dwPlus1[i - w - 1] * v[i - w - 1] + L.dwPlus1[i] * v[i + w + 1]
+           + L.dwMinus1[i - w + 1] * v[i - w + 1] + L.dwMinus1[i] * v[i + w - 1];
+}
+
+//Same for any point (x, y).
+float OffDiagonalProduct(const EdgePreservingMultigridLevel &L, const float *v, int x, int y)
+{
+    const int i = y * L.w + x;
+
+    if(x > 0 && x < L.w - 1 && y > 0 && y < L.h - 1) {
+        return OffDiagonalProduct(L, v, i);
+    }
+
+    float sum = 0.f;
+
+    for(int dy = -1; dy <= 1; dy++) {
+        for(int dx = -1; dx <= 1; dx++) {
+            if((dx || dy) && x + dx >= 0 && x + dx < L.w && y + dy >= 0 && y + dy < L.h) {
+                sum += Entry(L, x, y, dx, dy) * v[i + dy * L.w + dx];
+            }
+        }
+    }
+
+    return sum;
+}
+
+//Gauss-Seidel on the points of row y with x & 1 == parity.
+inline void GaussSeidelRow(const EdgePreservingMultigridLevel &L, float *x, const float *b, int y, int parity)
+{
+    const int i0 = y * L.w;
+
+    if(y == 0 || y == L.h - 1) {
+        for(int xx = parity; xx < L.w; xx += 2) {
+            x[i0 + xx] = (b[i0 + xx] - OffDiagonalProduct(L, x, xx, y)) * L.id0[i0 + xx];
+        }
+
+        return;
+    }
+
+    int xx = parity;
+
+    if(xx == 0) {
+        x[i0] = (b[i0] - OffDiagonalProduct(L, x, 0, y)) * L.id0[i0];
+        xx = 2;
+    }
+
+#ifdef __SSE2__
+    //Four points of the parity at once, the loads take every other value of eight.
+    const int w = L.w;
+    const auto every2 = [](const float *p) {
+        return _mm_shuffle_ps(LVFU(p[0]), LVFU(p[4]), _MM_SHUFFLE(2, 0, 2, 0));
+    };
+
+    for(; xx < w - 8; xx += 8) {
+        const int i = i0 + xx;
+        const __m128 others = every2(&x[i + 1]);
+        const __m128 sum = every2(&L.d1[i - 1]) * every2(&x[i - 1]) + every2(&L.d1[i]) * others
+                           + every2(&L.dw[i - w]) * every2(&x[i - w]) + every2(&L.dw[i]) * every2(&x[i + w])
+                           + every2(&L.dwPlus1[i - w - 1]) * every2(&x[i - w - 1]) + every2(&L.dwPlus1[i]) * every2(&x[i + w + 1])
+                           + every2(&L.dwMinus1[i - w + 1]) * every2(&x[i - w + 1]) + every2(&L.dwMinus1[i]) * every2(&x[i + w - 1]);
+        const __m128 result = (every2(&b[i]) - sum) * every2(&L.id0[i]);
+        _mm_storeu_ps(&x[i], _mm_unpacklo_ps(result, others));
+        _mm_storeu_ps(&x[i + 4], _mm_unpackhi_ps(result, others));
+    }
+
+#endif
+
+    for(; xx < L.w - 1; xx += 2) {
+        const int i = i0 + xx;
+        x[i] = (b[i] - OffDiagonalProduct(L, x, i)) * L.id0[i];
+    }
+
+    if(xx == L.w - 1) {
+        x[i0 + xx] = (b[i0 + xx] - OffDiagonalProduct(L, x, xx, y)) * L.id0[i0 + xx];
+    }
+}
+
+//One Gauss-Seidel sweep over the colours (x & 1, y & 1), which are independent in a nine point stencil. The two colours of
+//a row only depend on each other within the row, so they are swept together. Sweeps in the reverse order are the adjoints
+//of the forward ones, smoothing with them after the coarse grid correction keeps the V-cycle symmetric.
+void GaussSeidel(const EdgePreservingMultigridLevel &L, float *x, const float *b, bool Reverse)
+{
+    for(int c = 0; c < 2; c++) {
+        const int rowParity = Reverse ? 1 - c : c;
+#ifdef _OPENMP
+        #pragma omp parallel for if(L.w * L.h > 65536)
+#endif
+
+        for(int y = rowParity; y < L.h; y += 2) {
+            GaussSeidelRow(L, x, b, y, Reverse ? 1 : 0);
+            GaussSeidelRow(L, x, b, y, Reverse ? 0 : 1);
+        }
+    }
+}
+
+void Residual(const EdgePreservingMultigridLevel &L, const float *x, const float *b, float *r)
+{
+#ifdef _OPENMP
+    #pragma omp parallel for if(L.w * L.h > 65536)
+#endif
+
+    for(int y = 0; y < L.h; y++) {
+        const int i0 = y * L.w;
+
+        if(y == 0 || y == L.h - 1) {
+            for(int xx = 0; xx < L.w; xx++) {
+                r[i0 + xx] = b[i0 + xx] - L.d0[i0 + xx] * x[i0 + xx] - OffDiagonalProduct(L, x, xx, y);
+            }
+        } else {
+            r[i0] = b[i0] - L.d0[i0] * x[i0] - OffDiagonalProduct(L, x, 0, y);
+            int i = i0 + 1;
+#ifdef __SSE2__
+            const int w = L.w;
+
+            for(; i < i0 + w - 4; i += 4) {
+                const __m128 sum = LVFU(L.d0[i]) * LVFU(x[i])
+                                   + LVFU(L.d1[i - 1]) * LVFU(x[i - 1]) + LVFU(L.d1[i]) * LVFU(x[i + 1])
+                                   + LVFU(L.dw[i - w]) * LVFU(x[i - w]) + LVFU(L.dw[i]) * LVFU(x[i + w])
+                                   + LVFU(L.dwPlus1[i - w - 1]) * LVFU(x[i - w - 1]) + LVFU(L.dwPlus1[i]) * LVFU(x[i + w + 1])
+                                   + LVFU(L.dwMinus1[i - w + 1]) * LVFU(x[i - w + 1]) + LVFU(L.dwMinus1[i]) * LVFU(x[i + w - 1]);
+                _mm_storeu_ps(&r[i], LVFU(b[i]) - sum);
+            }
+
+#endif
+
+            for(; i < i0 + L.w - 1; i++) {
+                r[i] = b[i] - L.d0[i] * x[i] - OffDiagonalProduct(L, x, i);
+            }
+
+            r[i0 + L.w - 1] = b[i0 + L.w - 1] - L.d0[i0 + L.w - 1] * x[i0 + L.w - 1] - OffDiagonalProduct(L, x, L.w - 1, y);
+        }
+    }
+}
+
+//Weights of the coarse point (X, Y) of C at the fine points (2 X + dx, 2 Y + dy) of F, in p[dy + 1][dx + 1], zero outside.
+void InterpolationStencil(const EdgePreservingMultigridLevel &F, const EdgePreservingMultigridLevel &C, int X, int Y, float p[3][3])
+{
+    const int I = Y * C.w + X;
+    const bool left = X > 0, up = Y > 0;
+    const bool right = 2 * X + 1 < F.w, down = 2 * Y + 1 < F.h;
+
+    p[1][1] = 2 * X < F.w && 2 * Y < F.h ? 1.f : 0.f;
+    p[1][0] = left ? C.px[2 * (I - 1) + 1] : 0.f;
+    p[1][2] = right ? C.px[2 * I] : 0.f;
+    p[0][1] = up ? C.py[2 * (I - C.w) + 1] : 0.f;
+    p[2][1] = down ? C.py[2 * I] : 0.f;
+    p[0][0] = left && up ? C.pz[4 * (I - C.w - 1) + 3] : 0.f;
+    p[0][2] = right && up ? C.pz[4 * (I - C.w) + 2] : 0.f;
+    p[2][0] = left && down ? C.pz[4 * (I - 1) + 1] : 0.f;
+    p[2][2] = right && down ? C.pz[4 * I] : 0.f;
+}
+
+//Splits the coupling strengths wa and wb of a fine point to two coarse points into normalized weights, halves if there's no coupling.
+inline void Normalize(float wa, float wb, float *p)
+{
+    const float sum = wa + wb;
+
+    if(sum > 1e-20f) {
+        p[0] = wa / sum;
+        p[1] = wb / sum;
+    } else {
+        p[0] = p[1] = 0.5f;
+    }
+}
+
+//Interpolation weights from C to F, from the matrix of F. The edge (2 X + 1, 2 Y) collapses its stencil on the columns, and
+//(2 X, 2 Y + 1) on the rows, of the two coarse points. The centre (2 X + 1, 2 Y + 1) averages its eight neighbours, the
+//edges among them already interpolated. Only the off-diagonal couplings count, so the weights sum to one.
+void InterpolationWeights(const EdgePreservingMultigridLevel &F, EdgePreservingMultigridLevel &C)
+{
+#ifdef _OPENMP
+    #pragma omp parallel for if(F.w * F.h > 65536)
+#endif
+
+    for(int Y = 0; Y < C.h; Y++) {
+        for(int X = 0; X < C.w; X++) {
+            const int I = Y * C.w + X;
+            float a[3][3];
+
+            if(2 * X + 1 < F.w && 2 * Y < F.h) {
+                Stencil(F, 2 * X + 1, 2 * Y, a);
+                Normalize(-(a[0][0] + a[1][0] + a[2][0]), -(a[0][2] + a[1][2] + a[2][2]), &C.px[2 * I]);
+            } else {
+                C.px[2 * I] = C.px[2 * I + 1] = 0.f;
+            }
+
+            if(2 * X < F.w && 2 * Y + 1 < F.h) {
+                Stencil(F, 2 * X, 2 * Y + 1, a);
+                Normalize(-(a[0][0] + a[0][1] + a[0][2]), -(a[2][0] + a[2][1] + a[2][2]), &C.py[2 * I]);
+            } else {
+                C.py[2 * I] = C.py[2 * I + 1] = 0.f;
+            }
+        }
+    }
+
+#ifdef _OPENMP
+    #pragma omp parallel for if(F.w * F.h > 65536)
+#endif
+
+    for(int Y = 0; Y < C.h; Y++) {
+        for(int X = 0; X < C.w; X++) {
+            const int I = Y * C.w + X;
+            float *p = &C.pz[4 * I];
+            p[0] = p[1] = p[2] = p[3] = 0.f;
+
+            if(2 * X + 1 >= F.w || 2 * Y + 1 >= F.h) {
+                continue;
+            }
+
+            float a[3][3];
+            Stencil(F, 2 * X + 1, 2 * Y + 1, a);
+            //The edges below and right of the centre belong to the next coarse points, which exist as the centre is inside.
+            const float *below = &C.px[2 * (I + C.w)];
+            const float *right = &C.py[2 * (I + 1)];
+            p[0] = -a[0][0] - a[0][1] * C.px[2 * I] - a[1][0] * C.py[2 * I];
+            p[1] = -a[0][2] - a[0][1] * C.px[2 * I + 1] - a[1][2] * right[0];
+            p[2] = -a[2][0] - a[2][1] * below[0] - a[1][0] * C.py[2 * I + 1];
+            p[3] = -a[2][2] - a[2][1] * below[1] - a[1][2] * right[1];
+            const float sum = p[0] + p[1] + p[2] + p[3];
+
+            for(int k = 0; k < 4; k++) {
+                p[k] = sum > 1e-20f ? p[k] / sum : 0.25f;
+            }
+        }
+    }
+}
+
+//Fine residual to coarse right hand side, the transpose of Prolongate().
+void Restrict(const EdgePreservingMultigridLevel &F, const float *r, EdgePreservingMultigridLevel &C)
+{
+#ifdef _OPENMP
+    #pragma omp parallel for if(F.w * F.h > 65536)
+#endif
+
+    for(int Y = 0; Y < C.h; Y++) {
+        for(int X = 0; X < C.w; X++) {
+            const int I = Y * C.w + X;
+
+            if(X > 0 && 2 * X + 1 < F.w && Y > 0 && 2 * Y + 1 < F.h) {
+                const int i = 2 * Y * F.w + 2 * X;
+                const int w = F.w;
+                C.b[I] = r[i]
+                         + C.px[2 * (I - 1) + 1] * r[i - 1] + C.px[2 * I] * r[i + 1]
+                         + C.py[2 * (I - C.w) + 1] * r[i - w] + C.py[2 * I] * r[i + w]
+                         + C.pz[4 * (I - C.w - 1) + 3] * r[i - w - 1] + C.pz[4 * (I - C.w) + 2] * r[i - w + 1]
+                         + C.pz[4 * (I - 1) + 1] * r[i + w - 1] + C.pz[4 * I] * r[i + w + 1];
+                continue;
+            }
+
+            float p[3][3];
+            InterpolationStencil(F, C, X, Y, p);
+            float sum = 0.f;
+
+            for(int dy = -1; dy <= 1; dy++) {
+                for(int dx = -1; dx <= 1; dx++) {
+                    if(p[dy + 1][dx + 1] != 0.f) {
+                        sum += p[dy + 1][dx + 1] * r[(2 * Y + dy) * F.w + 2 * X + dx];
+                    }
+                }
+            }
+
+            C.b[I] = sum;
+        }
+    }
+}
+
+//Adds the interpolation of the coarse solution to x.
+void Prolongate(const EdgePreservingMultigridLevel &C, const EdgePreservingMultigridLevel &F, float *x)
+{
+#ifdef _OPENMP
+    #pragma omp parallel for if(F.w * F.h > 65536)
+#endif
+
+    for(int y = 0; y < F.h; y++) {
+        const int Y = y >> 1;
+        const float *c0 = C.x + Y * C.w;
+        const float *c1 = c0 + C.w;     //Only read at odd y, below an existing coarse row.
+        float *row = x + y * F.w;
+
+        for(int xx = 0; xx < F.w; xx++) {
+            const int X = xx >> 1;
+            const int I = Y * C.w + X;
+
+            if(y & 1) {
+                if(xx & 1) {
+                    const float *p = &C.pz[4 * I];
+                    row[xx] += p[0] * c0[X] + p[1] * c0[X + 1] + p[2] * c1[X] + p[3] * c1[X + 1];
+                } else {
+                    row[xx] += C.py[2 * I] * c0[X] + C.py[2 * I + 1] * c1[X];
+                }
+            } else if(xx & 1) {
+                row[xx] += C.px[2 * I] * c0[X] + C.px[2 * I + 1] * c0[X + 1];
+            } else {
+                row[xx] += c0[X];
+            }
+        }
+    }
+}
+
+//Weights of the coarse point I as in InterpolationStencil(), without checking the grid borders.
+inline void InterpolationStencil(const EdgePreservingMultigridLevel &C, int I, float p[3][3])
+{
+    p[0][0] = C.pz[4 * (I - C.w - 1) + 3];
+    p[0][1] = C.py[2 * (I - C.w) + 1];
+    p[0][2] = C.pz[4 * (I - C.w) + 2];
+    p[1][0] = C.px[2 * (I - 1) + 1];
+    p[1][1] = 1.f;
+    p[1][2] = C.px[2 * I];
+    p[2][0] = C.pz[4 * (I - 1) + 1];
+    p[2][1] = C.py[2 * I];
+    p[2][2] = C.pz[4 * I];
+}
+
+//Coarse neighbour at (X + DX, Y + DY) of the window t described in CoarseMatrix(), which sits at (2 + 2 DX, 2 + 2 DY) in it.
+inline float CoarseEntry(const float t[5][5], const float p[3][3], int DX, int DY)
+{
+    float sum = 0.f;
+
+    for(int e = -1; e <= rtengine::min(1, 2 - 2 * DY); e++) {
+        for(int c = rtengine::max(-1, -2 - 2 * DX); c <= rtengine::min(1, 2 - 2 * DX); c++) {
+            sum += p[e + 1][c + 1] * t[2 + 2 * DY + e][2 + 2 * DX + c];
+        }
+    }
+
+    return sum;
+}
+
+//Galerkin product: the coarse matrix is the transpose of the interpolation times the fine matrix times the interpolation.
+//For each coarse point, the fine rows it interpolates to are summed into the window t of their neighbours first. The
+//entries of the lower triangle then are the window weighted by the interpolation of the neighbouring coarse points.
+void CoarseMatrix(const EdgePreservingMultigridLevel &F, EdgePreservingMultigridLevel &C)
+{
+#ifdef _OPENMP
+    #pragma omp parallel for if(F.w * F.h > 65536)
+#endif
+
+    for(int Y = 0; Y < C.h; Y++) {
+        for(int X = 0; X < C.w; X++) {
+            const int I = Y * C.w + X;
+            //The window is inside the fine grid, and so are the points the neighbours interpolate to within it.
+            const bool interior = X > 0 && 2 * X + 2 < F.w && Y > 0 && 2 * Y + 2 < F.h;
+            float p[3][3];
+            float t[5][5] = {};
+
+            if(interior) {
+                InterpolationStencil(C, I, p);
+            } else {
+                InterpolationStencil(F, C, X, Y, p);
+            }
+
+            for(int b = 0; b < 3; b++) {
+                for(int a = 0; a < 3; a++) {
+                    const float wi = p[b][a];
+
+                    if(interior) {
+                        const int w = F.w;
+                        const int i = (2 * Y + b - 1) * w + 2 * X + a - 1;
+                        t[b][a] += wi * F.dwPlus1[i - w - 1];
+                        t[b][a + 1] += wi * F.dw[i - w];
+                        t[b][a + 2] += wi * F.dwMinus1[i - w + 1];
+                        t[b + 1][a] += wi * F.d1[i - 1];
+                        t[b + 1][a + 1] += wi * F.d0[i];
+                        t[b + 1][a + 2] += wi * F.d1[i];
+                        t[b + 2][a] += wi * F.dwMinus1[i];
+                        t[b + 2][a + 1] += wi * F.dw[i];
+                        t[b + 2][a + 2] += wi * F.dwPlus1[i];
+                    } else if(wi != 0.f) { //Zero for the points outside too.
+                        float s[3][3];
+                        Stencil(F, 2 * X + a - 1, 2 * Y + b - 1, s);
+
+                        for(int dy = 0; dy < 3; dy++) {
+                            for(int dx = 0; dx < 3; dx++) {
+                                t[b + dy][a + dx] += wi * s[dy][dx];
+                            }
+                        }
+                    }
+                }
+            }
+
+            const auto entry = [&](int DX, int DY) {
+                if(interior) {
+                    InterpolationStencil(C, I + DY * C.w + DX, p);
+                } else {
+                    InterpolationStencil(F, C, X + DX, Y + DY, p);
+                }
+
+                return CoarseEntry(t, p, DX, DY);
+            };
+
+            C.d0[I] = CoarseEntry(t, p, 0, 0);
+
+            if(X < C.w - 1) {
+                C.d1[I] = entry(1, 0);
+            }
+
+            if(Y < C.h - 1) {
+                C.dw[I] = entry(0, 1);
+
+                if(X > 0) {
+                    C.dwMinus1[I] = entry(-1, 1);
+                }
+
+                if(X < C.w - 1) {
+                    C.dwPlus1[I] = entry(1, 1);
+                }
+            }
+
+            //Points beyond an even fine size interpolate to no fine point, they are left alone.
+            if(C.d0[I] <= 0.f) {
+                C.d0[I] = 1.f;
+            }
+
+            C.id0[I] = 1.f / C.d0[I];
+        }
+    }
+}
+
+void MultigridCycle(EdgePreservingMultigridLevel *Levels, int NumberOfLevels, int l, float *x, float *b)
+{
+    const EdgePreservingMultigridLevel &L = Levels[l];
+    memset(x, 0, sizeof(float) * L.w * L.h);
+
+    if(l == NumberOfLevels - 1) {
+        for(int i = 0; i < MG_COARSE_SWEEPS; i++) {
+            GaussSeidel(L, x, b, false);
+            GaussSeidel(L, x, b, true);
+        }
+
+        return;
+    }
+
+    EdgePreservingMultigridLevel &C = Levels[l + 1];
+
+    for(int i = 0; i < MG_SMOOTHING; i++) {
+        GaussSeidel(L, x, b, false);
+    }
+
+    Residual(L, x, b, L.r);
+    Restrict(L, L.r, C);
+    MultigridCycle(Levels, NumberOfLevels, l + 1, C.x, C.b);
+    Prolongate(C, L, x);
+
+    for(int i = 0; i < MG_SMOOTHING; i++) {
+        GaussSeidel(L, x, b, true);
+    }
+}
+
+}
+
+EdgePreservingMultigrid::EdgePreservingMultigrid(int width, int height) : A(nullptr), Valid(true)
+{
+    //Count the levels first, each coarse point sits on every other fine point.
+    NumberOfLevels = 1;
+
+    for(int w = width, h = height; w * h > MG_COARSEST && w >= 8 && h >= 8; w = w / 2 + 1, h = h / 2 + 1) {
+        NumberOfLevels++;
+    }
+
+    Levels = new EdgePreservingMultigridLevel[NumberOfLevels];
+    memset(Levels, 0, sizeof(EdgePreservingMultigridLevel) * NumberOfLevels);
+
+    for(int l = 0; l < NumberOfLevels; l++) {
+        EdgePreservingMultigridLevel &L = Levels[l];
+        L.w = l ? Levels[l - 1].w / 2 + 1 : width;
+        L.h = l ? Levels[l - 1].h / 2 + 1 : height;
+        const int n = L.w * L.h;
+        L.id0 = new float[n];
+
+        if(l < NumberOfLevels - 1) {
+            L.r = new float[n];
+        }
+
+        if(l > 0) {
+            L.Matrix = new MultiDiagonalSymmetricMatrix(n, DIAGONALS);
+
+            if(!(
+                        L.Matrix->CreateDiagonal(0, 0) &&
+                        L.Matrix->CreateDiagonal(1, 1) &&
+                        L.Matrix->CreateDiagonal(2, L.w - 1) &&
+                        L.Matrix->CreateDiagonal(3, L.w) &&
+                        L.Matrix->CreateDiagonal(4, L.w + 1))) {
+                printf("Error in EdgePreservingMultigrid construction: out of memory.\n");
+                Valid = false;
+                break;
+            }
+
+            L.d0       = L.Matrix->Diagonals[0];
+            L.d1       = L.Matrix->Diagonals[1];
+            L.dwMinus1 = L.Matrix->Diagonals[2];
+            L.dw       = L.Matrix->Diagonals[3];
+            L.dwPlus1  = L.Matrix->Diagonals[4];
+            L.x = new float[n];
+            L.b = new float[n];
+            L.px = new float[2 * n];
+            L.py = new float[2 * n];
+            L.pz = new float[4 * n];
+        }
+    }
+}
+
+EdgePreservingMultigrid::~EdgePreservingMultigrid()
+{
+    for(int l = 0; l < NumberOfLevels; l++) {
+        delete Levels[l].Matrix;
+        delete[] Levels[l].id0;
+        delete[] Levels[l].r;
+        delete[] Levels[l].x;
+        delete[] Levels[l].b;
+        delete[] Levels[l].px;
+        delete[] Levels[l].py;
+        delete[] Levels[l].pz;
+    }
+
+    delete[] Levels;
+}
+
+void EdgePreservingMultigrid::Setup(MultiDiagonalSymmetricMatrix *Matrix)
+{
+    A = Matrix;
+    EdgePreservingMultigridLevel &F = Levels[0];
+    F.d0       = A->Diagonals[0];
+    F.d1       = A->Diagonals[1];
+    F.dwMinus1 = A->Diagonals[2];
+    F.dw       = A->Diagonals[3];
+    F.dwPlus1  = A->Diagonals[4];
+
+#ifdef _OPENMP
+    #pragma omp parallel for
+#endif
+
+    for(int i = 0; i < F.w * F.h; i++) {
+        F.id0[i] = 1.f / F.d0[i];
+    }
+
+    for(int l = 1; l < NumberOfLevels; l++) {
+        InterpolationWeights(Levels[l - 1], Levels[l]);
+        CoarseMatrix(Levels[l - 1], Levels[l]);
+    }
+}
+
+void EdgePreservingMultigrid::VCycle(float *x, float *b)
+{
+    MultigridCycle(Levels, NumberOfLevels, 0, x, b);
+}
+
+EdgePreservingDecomposition::EdgePreservingDecomposition(int width, int height) : Multigrid(nullptr), a0(nullptr) , a_1(nullptr), a_w(nullptr), a_w_1(nullptr), a_w1(nullptr)
 {
     w = width;
     h = height;
@@ -646,6 +1270,7 @@ EdgePreservingDecomposition::EdgePreservingDecomposition(int width, int height)
 
 EdgePreservingDecomposition::~EdgePreservingDecomposition()
 {
+    delete Multigrid;
     delete A;
 }
 
@@ -798,7 +1423,25 @@ float *EdgePreservingDecomposition::CreateBlur(float *Source, float Scale, float
         delete[] a;
     }
 
-    //Solve & return.
+    //Solve & return. Strips too thin to be coarsened are left to the incomplete Cholesky factorization, as well as the grids whose coarse matrices couldn't be allocated.
+    const bool UseMultigrid = rtengine::settings->epd_solver == rtengine::Settings::EPDSolver::MULTIGRID && w >= 8 && h >= 8;
+
+    if(UseMultigrid && Multigrid == nullptr) {
+        Multigrid = new EdgePreservingMultigrid(w, h);
+    }
+
+    if(UseMultigrid && Multigrid->IsValid()) {
+        Multigrid->Setup(A);
+
+        if(!UseBlurForEdgeStop) {
+            memcpy(Blur, Source, n * sizeof(float));
+        }
+
+        //A V-cycle costs about two back solves of the incomplete Cholesky factorization, and a quarter of the iterates still converges further.
+        SparseConjugateGradient(EdgePreservingMultigrid::PassThroughVectorProduct, Source, n, false, Blur, 0.0f, (void *)Multigrid, (Iterates + 3) / 4, EdgePreservingMultigrid::PassThroughVCycle);
+        return Blur;
+    }
+
     bool success = A->CreateIncompleteCholeskyFactorization(1); //Fill-in of 1 seems to work really good. More doesn't really help and less hurts (slightly).
 
     if(!success) {
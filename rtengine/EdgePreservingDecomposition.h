@@ -134,6 +134,50 @@ public:
 
 };
 
+/* Multigrid preconditioner for the matrices of EdgePreservingDecomposition, an alternative to the incomplete Cholesky
+factorization. The matrices of the coarser grids are the Galerkin products of the finer ones with an operator dependent
+interpolation, which follows the edge stopping function instead of blurring across the edges like a bilinear one would.
+They keep the five diagonals 0, 1, w - 1, w and w + 1 of a nine point stencil on a w wide grid. Smoothing is a four
+colour Gauss-Seidel, which unlike the Cholesky back solve runs in parallel, and the V-cycle is symmetric, as needed by
+SparseConjugateGradient. */
+struct EdgePreservingMultigridLevel;
+
+class EdgePreservingMultigrid :
+    public rtengine::NonCopyable
+{
+public:
+    EdgePreservingMultigrid(int width, int height);
+    ~EdgePreservingMultigrid();
+
+    //False if the coarse grids couldn't be allocated, the preconditioner can't be used then.
+    bool IsValid() const
+    {
+        return Valid;
+    };
+
+    //Computes the coarse matrices from A, the n x n matrix of a width x height grid with the above diagonals. A is kept and has to outlive its use.
+    void Setup(MultiDiagonalSymmetricMatrix *A);
+
+    //Approximates the solution of A x = b by one V-cycle started from x = 0.
+    void VCycle(float *x, float *b);
+
+    static void PassThroughVectorProduct(float *Product, float *x, void *Pass)
+    {
+        (static_cast<EdgePreservingMultigrid *>(Pass))->A->VectorProduct(Product, x);
+    };
+
+    static void PassThroughVCycle(float *Product, float *x, void *Pass)
+    {
+        (static_cast<EdgePreservingMultigrid *>(Pass))->VCycle(Product, x);
+    };
+
+private:
+    MultiDiagonalSymmetricMatrix *A;
+    EdgePreservingMultigridLevel *Levels;   //Levels[0] is the grid of A.
+    int NumberOfLevels;
+    bool Valid;
+};
+
 class EdgePreservingDecomposition :
     public rtengine::NonCopyable
 {
@@ -156,6 +200,7 @@ public:
 
 private:
     MultiDiagonalSymmetricMatrix *A;    //The equations are simple enough to not mandate a matrix class, but fast solution NEEDS a complicated preconditioner.
+    EdgePreservingMultigrid *Multigrid; //Used instead of the incomplete Cholesky factorization if Settings::epd_solver says so, created on first use.
     int w, h, n;
 
     //Convenient access to the data in A.
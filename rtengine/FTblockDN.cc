@@ -22,7 +22,9 @@
 //
 ////////////////////////////////////////////////////////////////
 
+#include <algorithm>
 #include <cmath>
+#include <vector>
 
 #include <fftw3.h>
 
@@ -31,6 +33,7 @@
 #include "cplx_wavelet_dec.h"
 #include "color.h"
 #include "curves.h"
+#include "fftwplans.h"
 #include "iccmatrices.h"
 #include "iccstore.h"
 #include "imagefloat.h"
@@ -52,6 +55,7 @@
 
 //#define BENCHMARK
 #include "StopWatch.h"
+#include "trace.h"
 
 #define TS 64       // Tile size
 #define offset 25   // shift between tiles
@@ -59,6 +63,99 @@
 
 #define epsilon 0.001f/(TS*TS) //tolerance
 
+namespace
+{
+
+/*
+ * Shares the threads and the DCT buffers among the tiles of RGB_denoise.
+ *
+ * The number of tiles in flight is bounded by the memory budget, the threads left over run the nested loops
+ * of the tiles. A tile gets its share of the free threads when it starts, so the threads of the workers which
+ * ran out of tiles go to the last tiles. The DCT buffers are handed from tile to tile instead of being
+ * allocated for every thread which could use them.
+ */
+class DenoiseTileScheduler final
+{
+public:
+    DenoiseTileScheduler(int numTiles, int numWorkers, int numThreads, std::size_t bloxSize) :
+        tilesLeft(numTiles),
+        workers(numWorkers),
+        freeThreads(numThreads),
+        running(0),
+        bloxSize(bloxSize)
+    {
+    }
+
+    ~DenoiseTileScheduler()
+    {
+        for (float* buffer : blox) {
+            fftwf_free(buffer);
+        }
+    }
+
+    DenoiseTileScheduler(const DenoiseTileScheduler&) = delete;
+    DenoiseTileScheduler& operator =(const DenoiseTileScheduler&) = delete;
+
+    // Returns the number of threads of the tile
+    int startTile()
+    {
+        MyMutex::MyLock lock(mutex);
+        // the free threads are shared by this tile and the ones the other idle workers are about to start
+        const int starting = rtengine::LIM(tilesLeft, 1, workers - running);
+        const int threads = std::max(1, freeThreads / starting);
+        --tilesLeft;
+        ++running;
+        freeThreads -= threads;
+        return threads;
+    }
+
+    void finishTile(int threads)
+    {
+        MyMutex::MyLock lock(mutex);
+        --running;
+        freeThreads += threads;
+    }
+
+    // Returns a buffer of the blocks of a row and their DCT, bloxSize floats each
+    float* acquireBlox()
+    {
+        MyMutex::MyLock lock(mutex);
+
+        if (blox.empty()) {
+            return reinterpret_cast<float*>(fftwf_malloc(2 * bloxSize * sizeof(float)));
+        }
+
+        float* const buffer = blox.back();
+        blox.pop_back();
+        return buffer;
+    }
+
+    void releaseBlox(float* buffer)
+    {
+        MyMutex::MyLock lock(mutex);
+        blox.push_back(buffer);
+    }
+
+private:
+    MyMutex mutex;
+    int tilesLeft;
+    const int workers;
+    int freeThreads;
+    int running;
+    const std::size_t bloxSize;
+    std::vector<float*> blox;
+};
+
+// Rough peak memory of a tile: the Lab tile, the input L, the detail and weight planes of the DCT pass,
+// and the wavelet decompositions of L and a or b with 3/4 of a plane per level
+std::size_t denoiseTileMemory(int width, int height)
+{
+    constexpr int maxLevels = 8;
+    return static_cast<std::size_t>(width) * height * sizeof(float) * (6 + 2 * (1 + 3 * maxLevels / 4));
+}
+
+}
+
 namespace rtengine
 {
 
@@ -477,11 +574,11 @@ void ImProcFunctions::Tile_calc(int tilesize, int overlap, int kall, int imwidth
     //  printf("Nw=%d NH=%d tileW=%d tileH=%d\n",numtiles_W,numtiles_H,tileWskip,tileHskip);
 }
 
-int denoiseNestedLevels = 1;
 enum nrquality {QUALITY_STANDARD, QUALITY_HIGH};
 
 void ImProcFunctions::RGB_denoise(int kall, Imagefloat * src, Imagefloat * dst, Imagefloat * calclum, float * ch_M, float *max_r, float *max_b, bool isRAW, const procparams::DirPyrDenoiseParams & dnparams, const double expcomp, const NoiseCurve & noiseLCurve, const NoiseCurve & noiseCCurve, float &nresi, float &highresi)
 {
+    TRACEFUN;
 BENCHFUN
     MyTime t1e, t2e;
     t1e.set();
@@ -710,6 +807,10 @@ BENCHFUN
 
         bool memoryAllocationFailed = false;
 
+        // the whole image is processed at once if it fits into the memory budget, and tiled if that fails
+        const std::size_t memoryBudget = static_cast<std::size_t>(std::max(0, options.denoiseMemory)) << 20;
+        const bool tiledFirst = ponder || (memoryBudget && denoiseTileMemory(imwidth, imheight) > memoryBudget);
+
         do {
             ++numTries;
 
@@ -719,7 +820,7 @@ BENCHFUN
 
             int numtiles_W, numtiles_H, tilewidth, tileheight, tileWskip, tileHskip;
 
-            Tile_calc(tilesize, overlap, (options.rgbDenoiseThreadLimit == 0 && !ponder) ? (numTries == 1 ? 0 : 2) : 2, imwidth, imheight, numtiles_W, numtiles_H, tilewidth, tileheight, tileWskip, tileHskip);
+            Tile_calc(tilesize, overlap, (!tiledFirst && numTries == 1) ? 0 : 2, imwidth, imheight, numtiles_W, numtiles_H, tilewidth, tileheight, tileWskip, tileHskip);
             memoryAllocationFailed = false;
             const int numtiles = numtiles_W * numtiles_H;
 
@@ -754,76 +855,46 @@ BENCHFUN
             // calculate min size of numblox_W.
             int min_numblox_W = ceil((static_cast<float>((MIN(imwidth, ((numtiles_W - 1) * tileWskip) + tilewidth)) - ((numtiles_W - 1) * tileWskip))) / (offset)) + 2 * blkrad;
 
-            // these are needed only for creation of the plans and will be freed before entering the parallel loop
-            fftwf_plan plan_forward_blox[2];
-            fftwf_plan plan_backward_blox[2];
+            // DCT plans of an entire row of tiles, for the full rows and the last one
+            fftw::Plan plan_forward_blox[2];
+            fftw::Plan plan_backward_blox[2];
 
             if (denoiseLuminance) {
-                float *Lbloxtmp  = reinterpret_cast<float*>(fftwf_malloc(max_numblox_W * TS * TS * sizeof(float)));
-                float *fLbloxtmp = reinterpret_cast<float*>(fftwf_malloc(max_numblox_W * TS * TS * sizeof(float)));
-
-                int nfwd[2] = {TS, TS};
-
-                //for DCT:
-                fftw_r2r_kind fwdkind[2] = {FFTW_REDFT10, FFTW_REDFT10};
-                fftw_r2r_kind bwdkind[2] = {FFTW_REDFT01, FFTW_REDFT01};
-
                 // Creating the plans with FFTW_MEASURE instead of FFTW_ESTIMATE speeds up the execute a bit
-                plan_forward_blox[0]  = fftwf_plan_many_r2r(2, nfwd, max_numblox_W, Lbloxtmp, nullptr, 1, TS * TS, fLbloxtmp, nullptr, 1, TS * TS, fwdkind, FFTW_MEASURE | FFTW_DESTROY_INPUT);
-                plan_backward_blox[0] = fftwf_plan_many_r2r(2, nfwd, max_numblox_W, fLbloxtmp, nullptr, 1, TS * TS, Lbloxtmp, nullptr, 1, TS * TS, bwdkind, FFTW_MEASURE | FFTW_DESTROY_INPUT);
-                plan_forward_blox[1]  = fftwf_plan_many_r2r(2, nfwd, min_numblox_W, Lbloxtmp, nullptr, 1, TS * TS, fLbloxtmp, nullptr, 1, TS * TS, fwdkind, FFTW_MEASURE | FFTW_DESTROY_INPUT);
-                plan_backward_blox[1] = fftwf_plan_many_r2r(2, nfwd, min_numblox_W, fLbloxtmp, nullptr, 1, TS * TS, Lbloxtmp, nullptr, 1, TS * TS, bwdkind, FFTW_MEASURE | FFTW_DESTROY_INPUT);
-                fftwf_free(Lbloxtmp);
-                fftwf_free(fLbloxtmp);
-            }
-
-#ifndef _OPENMP
-            int numthreads = 1;
-#else
-            // Calculate number of tiles. If less than omp_get_max_threads(), then limit num_threads to number of tiles
-            int numthreads = MIN(numtiles, omp_get_max_threads());
-
-            if (options.rgbDenoiseThreadLimit > 0) {
-                numthreads = MIN(numthreads, options.rgbDenoiseThreadLimit);
+                plan_forward_blox[0]  = fftw::planR2r2d(TS, TS, FFTW_REDFT10, FFTW_MEASURE | FFTW_DESTROY_INPUT, nullptr, nullptr, false, max_numblox_W);
+                plan_backward_blox[0] = fftw::planR2r2d(TS, TS, FFTW_REDFT01, FFTW_MEASURE | FFTW_DESTROY_INPUT, nullptr, nullptr, false, max_numblox_W);
+                plan_forward_blox[1]  = fftw::planR2r2d(TS, TS, FFTW_REDFT10, FFTW_MEASURE | FFTW_DESTROY_INPUT, nullptr, nullptr, false, min_numblox_W);
+                plan_backward_blox[1] = fftw::planR2r2d(TS, TS, FFTW_REDFT01, FFTW_MEASURE | FFTW_DESTROY_INPUT, nullptr, nullptr, false, min_numblox_W);
             }
 
 #ifdef _OPENMP
-            denoiseNestedLevels = omp_get_max_threads() / numthreads;
-            bool oldNested = omp_get_nested();
+            int numThreads = omp_get_max_threads();
 
-            if (denoiseNestedLevels < 2) {
-                denoiseNestedLevels = 1;
-            } else {
-                omp_set_nested(true);
+            if (options.rgbDenoiseThreadLimit > 0) {
+                numThreads = MIN(numThreads, options.rgbDenoiseThreadLimit);
             }
-
-            if (options.rgbDenoiseThreadLimit > 0)
-                while (denoiseNestedLevels * numthreads > options.rgbDenoiseThreadLimit) {
-                    denoiseNestedLevels--;
-                }
-
+#else
+            constexpr int numThreads = 1;
 #endif
+            // the tiles in flight are bounded by the memory budget, the remaining threads run the nested loops
+            int numWorkers = MIN(numtiles, numThreads);
 
-            if (settings->verbose) {
-                printf("RGB_denoise uses %d main thread(s) and up to %d nested thread(s) for each main thread\n", numthreads, denoiseNestedLevels);
+            if (memoryBudget) {
+                numWorkers = std::max<std::size_t>(1, std::min<std::size_t>(numWorkers, memoryBudget / denoiseTileMemory(tilewidth, tileheight)));
             }
 
-#endif
-            const std::size_t blox_array_size = denoiseNestedLevels * numthreads;
+            DenoiseTileScheduler scheduler(numtiles, numWorkers, numThreads, max_numblox_W * TS * TS);
 
-            float *LbloxArray[blox_array_size];
-            float *fLbloxArray[blox_array_size];
+#ifdef _OPENMP
+            const bool oldNested = omp_get_nested();
 
-            for (std::size_t i = 0; i < blox_array_size; ++i) {
-                LbloxArray[i] = nullptr;
-                fLbloxArray[i] = nullptr;
+            if (numWorkers < numThreads) {
+                omp_set_nested(true);
             }
+#endif
 
-            if (numtiles > 1 && denoiseLuminance) {
-                for (int i = 0; i < denoiseNestedLevels * numthreads; ++i) {
-                    LbloxArray[i]  = reinterpret_cast<float*>(fftwf_malloc(max_numblox_W * TS * TS * sizeof(float)));
-                    fLbloxArray[i] = reinterpret_cast<float*>(fftwf_malloc(max_numblox_W * TS * TS * sizeof(float)));
-                }
+            if (settings->verbose) {
+                printf("RGB_denoise processes %d tile(s) by %d worker(s) sharing %d thread(s)\n", numtiles, numWorkers, numThreads);
             }
 
             TMatrix wiprof = ICCStore::getInstance()->workingSpaceInverseMatrix(params->icm.workingProfile);
@@ -850,7 +921,7 @@ BENCHFUN
 
             // begin tile processing of image
 #ifdef _OPENMP
-            #pragma omp parallel num_threads(numthreads) if (numthreads>1)
+            #pragma omp parallel num_threads(numWorkers) if (numWorkers>1)
 #endif
             {
                 int pos;
@@ -871,6 +942,14 @@ BENCHFUN
 
                 for (int tiletop = 0; tiletop < imheight; tiletop += tileHskip) {
                     for (int tileleft = 0; tileleft < imwidth ; tileleft += tileWskip) {
+                        if (isCancelled()) {
+                            // newer parameters arrived, the remaining tiles are left noisy and the result is thrown away
+                            continue;
+                        }
+
+                        TRACE_SCOPE("denoise tile", "omp");
+                        // the nested loops of the tile use this share of the threads
+                        const int denoiseNestedLevels = scheduler.startTile();
                         //printf("titop=%d tileft=%d\n",tiletop/tileHskip, tileleft/tileWskip);
                         pos = (tiletop / tileHskip) * numtiles_W + tileleft / tileWskip ;
                         int tileright = MIN(imwidth, tileleft + tilewidth);
@@ -1203,7 +1282,7 @@ BENCHFUN
 
                             if (!memoryAllocationFailed) {
                                 if (kall == 0) {
-                                    Noise_residualAB(*adecomp, chresid, chmaxresid, denoiseMethodRgb);
+                                    Noise_residualAB(*adecomp, chresid, chmaxresid, denoiseMethodRgb, denoiseNestedLevels);
                                     chresidtemp = chresid;
                                     chmaxresidtemp = chmaxresid;
                                 }
@@ -1240,7 +1319,7 @@ BENCHFUN
 
                                 if (!memoryAllocationFailed) {
                                     if (kall == 0) {
-                                        Noise_residualAB(*bdecomp, chresid, chmaxresid, denoiseMethodRgb);
+                                        Noise_residualAB(*bdecomp, chresid, chmaxresid, denoiseMethodRgb, denoiseNestedLevels);
                                         chresid += chresidtemp;
                                         chmaxresid += chmaxresidtemp;
                                         chresid = sqrt(chresid / (6 * (levwav)));
@@ -1320,26 +1399,13 @@ BENCHFUN
                                 //pixel weight
                                 array2D<float> totwt(width, height, ARRAY2D_CLEAR_DATA); //weight for combining DCT blocks
 
-                                if (numtiles == 1) {
-                                    for (int i = 0; i < denoiseNestedLevels * numthreads; ++i) {
-                                        LbloxArray[i]  = reinterpret_cast<float*>(fftwf_malloc(max_numblox_W * TS * TS * sizeof(float)));
-                                        fLbloxArray[i] = reinterpret_cast<float*>(fftwf_malloc(max_numblox_W * TS * TS * sizeof(float)));
-                                    }
-                                }
-
 #ifdef _OPENMP
-                                int masterThread = omp_get_thread_num();
                                 #pragma omp parallel num_threads(denoiseNestedLevels) if (denoiseNestedLevels>1)
 #endif
                                 {
-#ifdef _OPENMP
-                                    int subThread = masterThread * denoiseNestedLevels + omp_get_thread_num();
-#else
-                                    int subThread = 0;
-#endif
 //                                    float blurbuffer[TS * TS] ALIGNED64;
-                                    float *Lblox = LbloxArray[subThread];
-                                    float *fLblox = fLbloxArray[subThread];
+                                    float *Lblox = scheduler.acquireBlox();
+                                    float *fLblox = Lblox + max_numblox_W * TS * TS;
                                     float pBuf[width + TS + 2 * blkrad * offset] ALIGNED16;
 //                                    float nbrwt[TS * TS] ALIGNED64;
 #ifdef _OPENMP
@@ -1406,9 +1472,9 @@ BENCHFUN
                                         //%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
                                         //fftwf_print_plan (plan_forward_blox);
                                         if (numblox_W == max_numblox_W) {
-                                            fftwf_execute_r2r(plan_forward_blox[0], Lblox, fLblox);    // DCT an entire row of tiles
+                                            fftwf_execute_r2r(plan_forward_blox[0].get(), Lblox, fLblox);    // DCT an entire row of tiles
                                         } else {
-                                            fftwf_execute_r2r(plan_forward_blox[1], Lblox, fLblox);    // DCT an entire row of tiles
+                                            fftwf_execute_r2r(plan_forward_blox[1].get(), Lblox, fLblox);    // DCT an entire row of tiles
                                         }
 
                                         //%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
@@ -1424,9 +1490,9 @@ BENCHFUN
 
                                         //now perform inverse FT of an entire row of blocks
                                         if (numblox_W == max_numblox_W) {
-                                            fftwf_execute_r2r(plan_backward_blox[0], fLblox, Lblox);    //for DCT
+                                            fftwf_execute_r2r(plan_backward_blox[0].get(), fLblox, Lblox);    //for DCT
                                         } else {
-                                            fftwf_execute_r2r(plan_backward_blox[1], fLblox, Lblox);    //for DCT
+                                            fftwf_execute_r2r(plan_backward_blox[1].get(), fLblox, Lblox);    //for DCT
                                         }
 
                                         int topproc = (vblk - blkrad) * offset;
@@ -1438,6 +1504,8 @@ BENCHFUN
 
                                     }//end of vertical block loop
 
+                                    scheduler.releaseBlox(Lblox);
+
                                     //%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 
                                 }
@@ -1705,6 +1773,7 @@ BENCHFUN
 
                         delete labdn;
                         delete Lin;
+                        scheduler.finishTile(denoiseNestedLevels);
 
                     }//end of tile row
                 }//end of tile loop
@@ -1716,15 +1785,6 @@ BENCHFUN
 
             }
 
-            for (size_t i = 0; i < blox_array_size; ++i) {
-                if (LbloxArray[i]) {
-                    fftwf_free(LbloxArray[i]);
-                }
-                if (fLbloxArray[i]) {
-                    fftwf_free(fLbloxArray[i]);
-                }
-            }
-
 #ifdef _OPENMP
             omp_set_nested(oldNested);
 #endif
@@ -1754,14 +1814,7 @@ BENCHFUN
                 }
             }
 
-            if (denoiseLuminance) {
-                // destroy the plans
-                fftwf_destroy_plan(plan_forward_blox[0]);
-                fftwf_destroy_plan(plan_backward_blox[0]);
-                fftwf_destroy_plan(plan_forward_blox[1]);
-                fftwf_destroy_plan(plan_backward_blox[1]);
-            }
-        } while (memoryAllocationFailed && numTries < 2 && (options.rgbDenoiseThreadLimit == 0) && !ponder);
+        } while (memoryAllocationFailed && numTries < 2 && !tiledFirst);
 
         if (memoryAllocationFailed) {
             printf("tiled denoise failed due to isufficient memory. Output is not denoised!\n");
@@ -2158,7 +2211,7 @@ float ImProcFunctions::MadRgb(const float * DataList, const int datalen)
 
 
 
-void ImProcFunctions::Noise_residualAB(const wavelet_decomposition &WaveletCoeffs_ab, float &chresid, float &chmaxresid, bool denoiseMethodRgb)
+void ImProcFunctions::Noise_residualAB(const wavelet_decomposition &WaveletCoeffs_ab, float &chresid, float &chmaxresid, bool denoiseMethodRgb, int denoiseNestedLevels)
 {
 
     float resid = 0.f;
@@ -0,0 +1,107 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <cmath>
+
+#include "opthelper.h"
+
+namespace rtengine
+{
+
+/*
+ * Widest float vector of the target, used by the separable blurs.
+ *
+ * The filters run along a line with one line per lane. Rows are moved into the lanes by transposing square blocks
+ * of 'size' rows and 'size' columns. Without SSE the vector is a single float, so the same code runs on all targets.
+ */
+#ifdef __AVX__
+struct BlurVector {
+    typedef __m256 type;
+    static constexpr int size = 8;
+
+    static type set1(float a) { return _mm256_set1_ps(a); }
+    static type load(const float *p) { return _mm256_load_ps(p); }
+    static type loadu(const float *p) { return _mm256_loadu_ps(p); }
+    static void store(float *p, type v) { _mm256_store_ps(p, v); }
+    static void storeu(float *p, type v) { _mm256_storeu_ps(p, v); }
+    static type abs(type v) { return _mm256_andnot_ps(_mm256_set1_ps(-0.f), v); }
+
+    static void transpose(type v[size])
+    {
+        const type t0 = _mm256_unpacklo_ps(v[0], v[1]);
+        const type t1 = _mm256_unpackhi_ps(v[0], v[1]);
+        const type t2 = _mm256_unpacklo_ps(v[2], v[3]);
+        const type t3 = _mm256_unpackhi_ps(v[2], v[3]);
+        const type t4 = _mm256_unpacklo_ps(v[4], v[5]);
+        const type t5 = _mm256_unpackhi_ps(v[4], v[5]);
+        const type t6 = _mm256_unpacklo_ps(v[6], v[7]);
+        const type t7 = _mm256_unpackhi_ps(v[6], v[7]);
+        const type s0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+        const type s1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+        const type s2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+        const type s3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+        const type s4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+        const type s5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+        const type s6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+        const type s7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+        v[0] = _mm256_permute2f128_ps(s0, s4, 0x20);
+        v[1] = _mm256_permute2f128_ps(s1, s5, 0x20);
+        v[2] = _mm256_permute2f128_ps(s2, s6, 0x20);
+        v[3] = _mm256_permute2f128_ps(s3, s7, 0x20);
+        v[4] = _mm256_permute2f128_ps(s0, s4, 0x31);
+        v[5] = _mm256_permute2f128_ps(s1, s5, 0x31);
+        v[6] = _mm256_permute2f128_ps(s2, s6, 0x31);
+        v[7] = _mm256_permute2f128_ps(s3, s7, 0x31);
+    }
+};
+#elif defined(__SSE2__)
+struct BlurVector {
+    typedef vfloat type;
+    static constexpr int size = 4;
+
+    static type set1(float a) { return F2V(a); }
+    static type load(const float *p) { return _mm_load_ps(p); }
+    static type loadu(const float *p) { return _mm_loadu_ps(p); }
+    static void store(float *p, type v) { _mm_store_ps(p, v); }
+    static void storeu(float *p, type v) { _mm_storeu_ps(p, v); }
+    static type abs(type v) { return vabsf(v); }
+
+    static void transpose(type v[size])
+    {
+        _MM_TRANSPOSE4_PS(v[0], v[1], v[2], v[3]);
+    }
+};
+#else
+struct BlurVector {
+    typedef float type;
+    static constexpr int size = 1;
+
+    static type set1(float a) { return a; }
+    static type load(const float *p) { return *p; }
+    static type loadu(const float *p) { return *p; }
+    static void store(float *p, type v) { *p = v; }
+    static void storeu(float *p, type v) { *p = v; }
+    static type abs(type v) { return std::fabs(v); }
+
+    static void transpose(type v[size])
+    {
+    }
+};
+#endif
+
+}
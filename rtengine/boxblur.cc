@@ -18,382 +18,342 @@
  *  along with RawTherapee.  If not, see <https://www.gnu.org/licenses/>.
 */
 
-#include <memory>
+#include <algorithm>
+#include <cassert>
 #include <cmath>
+#include <cstring>
+#include <vector>
 
 #include "boxblur.h"
 
+#include "alignedbuffer.h"
+#include "blurvector.h"
 #include "rt_math.h"
 #include "opthelper.h"
 
-namespace rtengine
+namespace
 {
 
-void boxblur(float** src, float** dst, int radius, int W, int H, bool multiThread)
-{
-    //box blur using rowbuffers and linebuffers instead of a full size buffer
+using rtengine::BlurVector;
 
-    radius = rtengine::min(radius, W - 1, H - 1);
-    if (radius == 0) {
-        if (src != dst) {
-#ifdef _OPENMP
-            #pragma omp parallel for if (multiThread)
-#endif
+// One sliding window pass along the lines
+struct BoxPass {
+    int radius;
+    float alpha; // weight of the two pixels next to the box, 0 for a plain box filter
+};
 
-            for (int row = 0; row < H; ++row) {
-                for (int col = 0; col < W; ++col) {
-                    dst[row][col] = src[row][col];
-                }
-            }
+/*
+ * Scale of the sums along a line of 'n' pixels. With 'extend' the lines are extended by their end pixels and the
+ * weights always sum up to 2 * radius + 1 + 2 * alpha, otherwise the box is cut at the ends of the lines and the
+ * sum is divided by the number of pixels in the line (alpha has to be 0).
+ */
+std::vector<float> passScale(int n, const BoxPass &pass, bool extend)
+{
+    std::vector<float> scale(n);
+
+    for (int j = 0; j < n; ++j) {
+        if (extend) {
+            scale[j] = 1.f / (2 * pass.radius + 1 + 2 * pass.alpha);
+        } else {
+            scale[j] = 1.f / (std::min(j + pass.radius, n - 1) - std::max(j - pass.radius, 0) + 1);
         }
-        return;
     }
 
-    constexpr int numCols = 8; // process numCols columns at once for better usage of L1 cpu cache
-#ifdef _OPENMP
-    #pragma omp parallel if (multiThread)
-#endif
-    {
-        std::unique_ptr<float[]> buffer(new float[numCols * (radius + 1)]);
+    return scale;
+}
 
-        //horizontal blur
-        float* const lineBuffer = buffer.get();
-#ifdef _OPENMP
-        #pragma omp for
-#endif
-        for (int row = 0; row < H; ++row) {
-            float len = radius + 1;
-            float tempval = src[row][0];
-            lineBuffer[0] = tempval;
-            for (int j = 1; j <= radius; j++) {
-                tempval += src[row][j];
-            }
+/*
+ * Sliding window of one pass. A pixel of the lines holds 'k' vectors, one line per lane. 'in' points at the first
+ * pixel and has pass.radius + 1 padding pixels on both sides, the sum is updated with the pixels entering and
+ * leaving the box, so the cost doesn't depend on the radius.
+ */
+template<int k>
+void slideBox(const float *in, float *out, int n, const BoxPass &pass, const float *scale)
+{
+    typedef BlurVector::type vec;
+    constexpr int L = k * BlurVector::size;
+    const int r = pass.radius;
 
-            tempval /= len;
-            dst[row][0] = tempval;
+    vec sum[k];
 
-            for (int col = 1; col <= radius; ++col) {
-                lineBuffer[col] = src[row][col];
-                tempval = (tempval * len + src[row][col + radius]) / (len + 1);
-                dst[row][col] = tempval;
-                ++len;
-            }
-            int pos = 0;
-            for (int col = radius + 1; col < W - radius; ++col) {
-                const float oldVal = lineBuffer[pos];
-                lineBuffer[pos] = src[row][col];
-                tempval = tempval + (src[row][col + radius] - oldVal) / len;
-                dst[row][col] = tempval;
-                ++pos;
-                pos = pos <= radius ? pos : 0;
+    for (int v = 0; v < k; ++v) {
+        sum[v] = BlurVector::set1(0.f);
+
+        for (int i = -r - 1; i < r; ++i) {
+            sum[v] += BlurVector::load(&in[i * L + v * BlurVector::size]);
+        }
+    }
+
+    if (pass.alpha == 0.f) {
+        for (int j = 0; j < n; ++j) {
+            const vec scalev = BlurVector::set1(scale[j]);
+
+            for (int v = 0; v < k; ++v) {
+                sum[v] += BlurVector::load(&in[(j + r) * L + v * BlurVector::size]) - BlurVector::load(&in[(j - r - 1) * L + v * BlurVector::size]);
+                BlurVector::store(&out[j * L + v * BlurVector::size], sum[v] * scalev);
             }
+        }
+    } else {
+        const vec alphav = BlurVector::set1(pass.alpha);
 
-            for (int col = W - radius; col < W; ++col) {
-                tempval = (tempval * len - lineBuffer[pos]) / (len - 1);
-                dst[row][col] = tempval;
-                --len;
-                ++pos;
-                pos = pos <= radius ? pos : 0;
+        for (int j = 0; j < n; ++j) {
+            const vec scalev = BlurVector::set1(scale[j]);
+
+            for (int v = 0; v < k; ++v) {
+                const vec leaving = BlurVector::load(&in[(j - r - 1) * L + v * BlurVector::size]);
+                sum[v] += BlurVector::load(&in[(j + r) * L + v * BlurVector::size]) - leaving;
+                BlurVector::store(&out[j * L + v * BlurVector::size], (sum[v] + alphav * (leaving + BlurVector::load(&in[(j + r + 1) * L + v * BlurVector::size]))) * scalev);
             }
         }
+    }
+}
 
-        //vertical blur
-#ifdef __SSE2__
-        vfloat (* const rowBuffer)[2] = (vfloat(*)[2]) buffer.get();
-        const vfloat leninitv = F2V(radius + 1);
-        const vfloat onev = F2V(1.f);
-        vfloat tempv, temp1v, lenv, lenp1v, lenm1v, rlenv;
+// Fills the 'pad' padding pixels of a line of 'n' pixels of 'L' floats
+void padLine(float *line, int n, int pad, int L, bool extend)
+{
+    for (int i = 1; i <= pad; ++i) {
+        if (extend) {
+            memcpy(&line[-i * L], &line[0], L * sizeof(float));
+            memcpy(&line[(n - 1 + i) * L], &line[(n - 1) * L], L * sizeof(float));
+        } else {
+            memset(&line[-i * L], 0, L * sizeof(float));
+            memset(&line[(n - 1 + i) * L], 0, L * sizeof(float));
+        }
+    }
+}
 
-#ifdef _OPENMP
-        #pragma omp for nowait
-#endif
+// Runs the passes on a line, 'lines' are two buffers of n + 2 * pad pixels, the result is in lines[0]
+template<int k>
+void blurLine(float* const lines[2], int n, int pad, const std::vector<BoxPass> &passes, const std::vector<std::vector<float>> &scales, bool extend)
+{
+    constexpr int L = k * BlurVector::size;
+    float *in = lines[0] + pad * L;
+    float *out = lines[1] + pad * L;
+
+    for (size_t p = 0; p < passes.size(); ++p) {
+        padLine(in, n, pad, L, extend);
+        slideBox<k>(in, out, n, passes[p], scales[p].data());
+        std::swap(in, out);
+    }
 
-        for (int col = 0; col < W - 7; col += 8) {
-            lenv = leninitv;
-            tempv = LVFU(dst[0][col]);
-            temp1v = LVFU(dst[0][col + 4]);
-            rowBuffer[0][0] = tempv;
-            rowBuffer[0][1] = temp1v;
+    if (in != lines[0] + pad * L) {
+        memcpy(lines[0] + pad * L, in, n * L * sizeof(float));
+    }
+}
 
-            for (int i = 1; i <= radius; ++i) {
-                tempv = tempv + LVFU(dst[i][col]);
-                temp1v = temp1v + LVFU(dst[i][col + 4]);
+// Horizontal passes of 'count' <= BlurVector::size rows starting at 'row'. The rows are transposed block by block
+// into the lanes, missing rows are filled with the last one. 'src' may be 'dst'.
+void blurRows(float** src, float** dst, int row, int count, int W, int pad, const std::vector<BoxPass> &passes, const std::vector<std::vector<float>> &scales, bool extend, bool absolute, float* const lines[2])
+{
+    typedef BlurVector::type vec;
+    constexpr int n = BlurVector::size;
+    float* const line = lines[0] + pad * n;
+    vec block[n];
+    int j = 0;
+
+    if (count == n) {
+        for (; j < W - n + 1; j += n) {
+            for (int k = 0; k < n; ++k) {
+                block[k] = BlurVector::loadu(&src[row + k][j]);
             }
 
-            tempv = tempv / lenv;
-            temp1v = temp1v / lenv;
-            STVFU(dst[0][col], tempv);
-            STVFU(dst[0][col + 4], temp1v);
-
-            for (int row = 1; row <= radius; ++row) {
-                rowBuffer[row][0] = LVFU(dst[row][col]);
-                rowBuffer[row][1] = LVFU(dst[row][col + 4]);
-                lenp1v = lenv + onev;
-                tempv = (tempv * lenv + LVFU(dst[row + radius][col])) / lenp1v;
-                temp1v = (temp1v * lenv + LVFU(dst[row + radius][col + 4])) / lenp1v;
-                STVFU(dst[row][col], tempv);
-                STVFU(dst[row][col + 4], temp1v);
-                lenv = lenp1v;
-            }
+            BlurVector::transpose(block);
 
-            rlenv = onev / lenv;
-            int pos = 0;
-            for (int row = radius + 1; row < H - radius; ++row) {
-                vfloat oldVal0 = rowBuffer[pos][0];
-                vfloat oldVal1 = rowBuffer[pos][1];
-                rowBuffer[pos][0] = LVFU(dst[row][col]);
-                rowBuffer[pos][1] = LVFU(dst[row][col + 4]);
-                tempv = tempv + (LVFU(dst[row + radius][col]) - oldVal0) * rlenv ;
-                temp1v = temp1v + (LVFU(dst[row + radius][col + 4]) - oldVal1) * rlenv ;
-                STVFU(dst[row][col], tempv);
-                STVFU(dst[row][col + 4], temp1v);
-                ++pos;
-                pos = pos <= radius ? pos : 0;
+            for (int k = 0; k < n; ++k) {
+                BlurVector::store(&line[(j + k) * n], absolute ? BlurVector::abs(block[k]) : block[k]);
             }
+        }
+    }
 
-            for (int row = H - radius; row < H; ++row) {
-                lenm1v = lenv - onev;
-                tempv = (tempv * lenv - rowBuffer[pos][0]) / lenm1v;
-                temp1v = (temp1v * lenv - rowBuffer[pos][1]) / lenm1v;
-                STVFU(dst[row][col], tempv);
-                STVFU(dst[row][col + 4], temp1v);
-                lenv = lenm1v;
-                ++pos;
-                pos = pos <= radius ? pos : 0;
-            }
+    for (; j < W; ++j) {
+        for (int k = 0; k < n; ++k) {
+            const float val = src[row + std::min(k, count - 1)][j];
+            line[j * n + k] = absolute ? std::fabs(val) : val;
         }
+    }
 
-#else
-        float (* const rowBuffer)[8] = (float(*)[8]) buffer.get();
-#ifdef _OPENMP
-        #pragma omp for nowait
-#endif
+    blurLine<1>(lines, W, pad, passes, scales, extend);
 
-        for (int col = 0; col < W - numCols + 1; col += 8) {
-            float len = radius + 1;
+    j = 0;
 
-            for (int k = 0; k < numCols; ++k) {
-                rowBuffer[0][k] = dst[0][col + k];
+    if (count == n) {
+        for (; j < W - n + 1; j += n) {
+            for (int k = 0; k < n; ++k) {
+                block[k] = BlurVector::load(&line[(j + k) * n]);
             }
 
-            for (int i = 1; i <= radius; ++i) {
-                for (int k = 0; k < numCols; ++k) {
-                    dst[0][col + k] += dst[i][col + k];
-                }
-            }
+            BlurVector::transpose(block);
 
-            for(int k = 0; k < numCols; ++k) {
-                dst[0][col + k] /= len;
+            for (int k = 0; k < n; ++k) {
+                BlurVector::storeu(&dst[row + k][j], block[k]);
             }
+        }
+    }
 
-            for (int row = 1; row <= radius; ++row) {
-                for(int k = 0; k < numCols; ++k) {
-                    rowBuffer[row][k] = dst[row][col + k];
-                    dst[row][col + k] = (dst[row - 1][col + k] * len + dst[row + radius][col + k]) / (len + 1);
-                }
-
-                len ++;
-            }
+    for (; j < W; ++j) {
+        for (int k = 0; k < count; ++k) {
+            dst[row + k][j] = line[j * n + k];
+        }
+    }
+}
 
-            int pos = 0;
-            for (int row = radius + 1; row < H - radius; ++row) {
-                for(int k = 0; k < numCols; ++k) {
-                    float oldVal = rowBuffer[pos][k];
-                    rowBuffer[pos][k] = dst[row][col + k];
-                    dst[row][col + k] = dst[row - 1][col + k] + (dst[row + radius][col + k] - oldVal) / len;
-                }
-                ++pos;
-                pos = pos <= radius ? pos : 0;
-            }
+// Vertical passes of 'count' <= 2 * BlurVector::size columns starting at 'col', two vectors per row.
+// Missing columns are filled with the last one. 'src' may be 'dst'.
+void blurColumns(float** src, float** dst, int col, int count, int H, int pad, const std::vector<BoxPass> &passes, const std::vector<std::vector<float>> &scales, bool extend, float* const lines[2])
+{
+    constexpr int L = 2 * BlurVector::size;
+    float* const line = lines[0] + pad * L;
 
-            for (int row = H - radius; row < H; ++row) {
-                for(int k = 0; k < numCols; ++k) {
-                    dst[row][col + k] = (dst[row - 1][col + k] * len - rowBuffer[pos][k]) / (len - 1);
-                }
-                len --;
-                ++pos;
-                pos = pos <= radius ? pos : 0;
+    for (int i = 0; i < H; ++i) {
+        if (count == L) {
+            BlurVector::store(&line[i * L], BlurVector::loadu(&src[i][col]));
+            BlurVector::store(&line[i * L + BlurVector::size], BlurVector::loadu(&src[i][col + BlurVector::size]));
+        } else {
+            for (int k = 0; k < L; ++k) {
+                line[i * L + k] = src[i][col + std::min(k, count - 1)];
             }
         }
+    }
 
-#endif
-        //vertical blur, remaining columns
-#ifdef _OPENMP
-        #pragma omp single
-#endif
-        {
-            const int remaining = W % numCols;
-
-            if (remaining > 0) {
-                float (* const rowBuffer)[8] = (float(*)[8]) buffer.get();
-                const int col = W - remaining;
+    blurLine<2>(lines, H, pad, passes, scales, extend);
 
-                float len = radius + 1;
-                for(int k = 0; k < remaining; ++k) {
-                    rowBuffer[0][k] = dst[0][col + k];
-                }
-                for (int row = 1; row <= radius; ++row) {
-                    for(int k = 0; k < remaining; ++k) {
-                        dst[0][col + k] += dst[row][col + k];
-                    }
-                }
-                for(int k = 0; k < remaining; ++k) {
-                    dst[0][col + k] /= len;
-                }
-                for (int row = 1; row <= radius; ++row) {
-                    for(int k = 0; k < remaining; ++k) {
-                        rowBuffer[row][k] = dst[row][col + k];
-                        dst[row][col + k] = (dst[row - 1][col + k] * len + dst[row + radius][col + k]) / (len + 1);
-                    }
-                    len ++;
-                }
-                const float rlen = 1.f / len;
-                int pos = 0;
-                for (int row = radius + 1; row < H - radius; ++row) {
-                    for(int k = 0; k < remaining; ++k) {
-                        float oldVal = rowBuffer[pos][k];
-                        rowBuffer[pos][k] = dst[row][col + k];
-                        dst[row][col + k] = dst[row - 1][col + k] + (dst[row + radius][col + k] - oldVal) * rlen;
-                    }
-                    ++pos;
-                    pos = pos <= radius ? pos : 0;
-                }
-                for (int row = H - radius; row < H; ++row) {
-                    for(int k = 0; k < remaining; ++k) {
-                        dst[row][col + k] = (dst[(row - 1)][col + k] * len - rowBuffer[pos][k]) / (len - 1);
-                    }
-                    len --;
-                    ++pos;
-                    pos = pos <= radius ? pos : 0;
-                }
+    for (int i = 0; i < H; ++i) {
+        if (count == L) {
+            BlurVector::storeu(&dst[i][col], BlurVector::load(&line[i * L]));
+            BlurVector::storeu(&dst[i][col + BlurVector::size], BlurVector::load(&line[i * L + BlurVector::size]));
+        } else {
+            for (int k = 0; k < count; ++k) {
+                dst[i][col + k] = line[i * L + k];
             }
         }
     }
 }
 
-void boxabsblur(float** src, float** dst, int radius, int W, int H, bool multiThread)
+/*
+ * Box filter engine: runs the passes along the rows, then along the columns of all planes.
+ * The threads share one loop over the planes for each direction, and each line is blurred by all passes while it is
+ * in the cache. With 'absolute' the absolute values of 'src' are blurred.
+ */
+void boxBlurPlanes(float** const* src, float** const* dst, int planes, const std::vector<BoxPass> &passes, int W, int H, bool extend, bool absolute, bool multiThread)
 {
-    //abs box blur using rowbuffers and linebuffers instead of a full size buffer, W should be a multiple of 16
+    constexpr int rowLanes = BlurVector::size;
+    constexpr int columnLanes = 2 * BlurVector::size;
 
-    if (radius == 0) {
-        if (src != dst) {
-#ifdef _OPENMP
-            #pragma omp parallel for if (multiThread)
-#endif
+    int pad = 0;
+    std::vector<std::vector<float>> rowScales;
+    std::vector<std::vector<float>> columnScales;
 
-            for (int row = 0; row < H; ++row) {
-                for (int col = 0; col < W; ++col) {
-                    dst[row][col] = std::fabs(src[row][col]);
-                }
-            }
-        }
-        return;
+    for (const auto &pass : passes) {
+        pad = std::max(pad, pass.radius + 1);
+        rowScales.push_back(passScale(W, pass, extend));
+        columnScales.push_back(passScale(H, pass, extend));
     }
 
-    constexpr int numCols = 16; // process numCols columns at once for better usage of L1 cpu cache
+    const int rowGroups = (H + rowLanes - 1) / rowLanes;
+    const int columnGroups = (W + columnLanes - 1) / columnLanes;
+    const size_t lineSize = static_cast<size_t>(std::max(W, H) + 2 * pad) * columnLanes;
+
 #ifdef _OPENMP
     #pragma omp parallel if (multiThread)
 #endif
     {
-        float buffer[numCols * (radius + 1)] ALIGNED64;
+        AlignedBuffer<float> buffer(2 * lineSize, 64);
+        float* const lines[2] = {buffer.data, buffer.data + lineSize};
 
-        //horizontal blur
-        float* const lineBuffer = buffer;
 #ifdef _OPENMP
         #pragma omp for
 #endif
-        for (int row = 0; row < H; ++row) {
-            float len = radius + 1;
-            float tempval = std::fabs(src[row][0]);
-            lineBuffer[0] = tempval;
-            for (int j = 1; j <= radius; j++) {
-                tempval += std::fabs(src[row][j]);
-            }
-
-            tempval /= len;
-            dst[row][0] = tempval;
-
-            for (int col = 1; col <= radius; ++col) {
-                lineBuffer[col] = std::fabs(src[row][col]);
-                tempval = (tempval * len + std::fabs(src[row][col + radius])) / (len + 1);
-                dst[row][col] = tempval;
-                ++len;
-            }
-
-            const float rlen = 1.f / len;
-            int pos = 0;
-            for (int col = radius + 1; col < W - radius; ++col) {
-                const float oldVal = lineBuffer[pos];
-                lineBuffer[pos] = std::fabs(src[row][col]);
-                tempval = tempval + (std::fabs(src[row][col + radius]) - oldVal) * rlen;
-                dst[row][col] = tempval;
-                ++pos;
-                pos = pos <= radius ? pos : 0;
-            }
 
-            for (int col = W - radius; col < W; ++col) {
-                tempval = (tempval * len - lineBuffer[pos]) / (len - 1);
-                dst[row][col] = tempval;
-                --len;
-                ++pos;
-                pos = pos <= radius ? pos : 0;
-            }
+        for (int k = 0; k < planes * rowGroups; ++k) {
+            const int plane = k / rowGroups;
+            const int row = (k % rowGroups) * rowLanes;
+            blurRows(src[plane], dst[plane], row, std::min(rowLanes, H - row), W, pad, passes, rowScales, extend, absolute, lines);
         }
 
-        //vertical blur
-        float (* const rowBuffer)[numCols] = (float(*)[numCols]) buffer;
 #ifdef _OPENMP
         #pragma omp for
 #endif
 
-        for (int col = 0; col < W; col += numCols) {
-            float len = radius + 1;
+        for (int k = 0; k < planes * columnGroups; ++k) {
+            const int plane = k / columnGroups;
+            const int col = (k % columnGroups) * columnLanes;
+            blurColumns(dst[plane], dst[plane], col, std::min(columnLanes, W - col), H, pad, passes, columnScales, extend, lines);
+        }
+    }
+}
 
-            for (int k = 0; k < numCols; ++k) {
-                rowBuffer[0][k] = dst[0][col + k];
-            }
+void boxBlur(float** const* src, float** const* dst, int planes, int radius, int W, int H, bool multiThread)
+{
+    radius = rtengine::min(radius, W - 1, H - 1);
 
-            for (int i = 1; i <= radius; ++i) {
-                for (int k = 0; k < numCols; ++k) {
-                    dst[0][col + k] += dst[i][col + k];
+    if (radius == 0) {
+        for (int plane = 0; plane < planes; ++plane) {
+            if (src[plane] != dst[plane]) {
+#ifdef _OPENMP
+                #pragma omp parallel for if (multiThread)
+#endif
+
+                for (int row = 0; row < H; ++row) {
+                    for (int col = 0; col < W; ++col) {
+                        dst[plane][row][col] = src[plane][row][col];
+                    }
                 }
             }
+        }
 
-            for(int k = 0; k < numCols; ++k) {
-                dst[0][col + k] /= len;
-            }
+        return;
+    }
 
-            for (int row = 1; row <= radius; ++row) {
-                for(int k = 0; k < numCols; ++k) {
-                    rowBuffer[row][k] = dst[row][col + k];
-                    dst[row][col + k] = (dst[row - 1][col + k] * len + dst[row + radius][col + k]) / (len + 1);
-                }
+    boxBlurPlanes(src, dst, planes, {{radius, 0.f}}, W, H, false, false, multiThread);
+}
 
-                ++len;
-            }
+}
 
-            const float rlen = 1.f / len;
-            int pos = 0;
-            for (int row = radius + 1; row < H - radius; ++row) {
-                for(int k = 0; k < numCols; ++k) {
-                    float oldVal = rowBuffer[pos][k];
-                    rowBuffer[pos][k] = dst[row][col + k];
-                    dst[row][col + k] = dst[row - 1][col + k] + (dst[row + radius][col + k] - oldVal) * rlen;
-                }
-                ++pos;
-                pos = pos <= radius ? pos : 0;
-            }
+namespace rtengine
+{
+
+void boxblur(float** src, float** dst, int radius, int W, int H, bool multiThread)
+{
+    boxBlur(&src, &dst, 1, radius, W, H, multiThread);
+}
 
-            for (int row = H - radius; row < H; ++row) {
-                for(int k = 0; k < numCols; ++k) {
-                    dst[row][col + k] = (dst[row - 1][col + k] * len - rowBuffer[pos][k]) / (len - 1);
+void boxblur(const std::vector<float**> &src, const std::vector<float**> &dst, int radius, int W, int H, bool multiThread)
+{
+    assert(src.size() == dst.size());
+    boxBlur(src.data(), dst.data(), src.size(), radius, W, H, multiThread);
+}
+
+void boxabsblur(float** src, float** dst, int radius, int W, int H, bool multiThread)
+{
+    if (radius == 0) {
+        if (src != dst) {
+#ifdef _OPENMP
+            #pragma omp parallel for if (multiThread)
+#endif
+
+            for (int row = 0; row < H; ++row) {
+                for (int col = 0; col < W; ++col) {
+                    dst[row][col] = std::fabs(src[row][col]);
                 }
-                --len;
-                ++pos;
-                pos = pos <= radius ? pos : 0;
             }
         }
+        return;
     }
+
+    boxBlurPlanes(&src, &dst, 1, {{radius, 0.f}}, W, H, false, true, multiThread);
+}
+
+void extendedBoxBlur(float** src, float** dst, double sigma, int W, int H, bool multiThread)
+{
+    // From: Pascal Gwosdek, Sven Grewenig, Andres Bruhn, Joachim Weickert: Theoretical Foundations of Gaussian Convolution by Extended Box Filtering
+    // Each pass gets a third of the variance. The box has the largest radius with a variance below it,
+    // the weight of the pixels next to the box makes up for the rest.
+    constexpr int numPasses = 3;
+    const double variance = sigma * sigma / numPasses;
+    const int radius = std::floor(0.5 * std::sqrt(12.0 * variance + 1.0) - 0.5);
+    const double alpha = (2 * radius + 1) * (radius * (radius + 1) - 3.0 * variance) / (6.0 * (variance - (radius + 1) * (radius + 1)));
+
+    boxBlurPlanes(&src, &dst, 1, std::vector<BoxPass>(numPasses, {radius, static_cast<float>(alpha)}), W, H, true, false, multiThread);
 }
 
 void boxblur(float* src, float* dst, int radius, int W, int H, bool multiThread)
@@ -18,12 +18,20 @@
 */
 #pragma once
 
+#include <vector>
+
 namespace rtengine
 {
 
 void boxblur(float** src, float** dst, int radius, int W, int H, bool multiThread);
 void boxblur(float* src, float* dst, int radius, int W, int H, bool multiThread);
+// Blurs several planes of the same size with the same radius, a destination plane may be its source plane but not another plane of the call
+void boxblur(const std::vector<float**> &src, const std::vector<float**> &dst, int radius, int W, int H, bool multiThread);
 void boxabsblur(float** src, float** dst, int radius, int W, int H, bool multiThread);
 void boxabsblur(float* src, float* dst, int radius, int W, int H, bool multiThread);
 
+// Approximates a gaussian blur by three passes of an extended box filter, the cost doesn't depend on sigma.
+// The image is extended by its border pixels.
+void extendedBoxBlur(float** src, float** dst, double sigma, int W, int H, bool multiThread);
+
 }
@@ -0,0 +1,188 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <cstdlib>
+#include <map>
+#include <vector>
+
+#include "bufferpool.h"
+
+#include "../rtgui/options.h"
+#include "../rtgui/threadutils.h"
+
+namespace
+{
+
+// 8 size classes per octave, so a buffer is at most 12.5% larger than requested
+size_t classSize(size_t size)
+{
+    size_t octave = rtengine::BufferPool::MIN_POOLED_SIZE;
+
+    while (octave <= size / 2) {
+        octave *= 2;
+    }
+
+    const size_t step = octave / 8;
+    return (size + step - 1) / step * step;
+}
+
+struct RetainedBuffer {
+    void* buffer;
+    unsigned long generation; // scope generation in which the buffer was released
+};
+
+struct PoolState {
+    MyMutex mutex;
+    std::map<size_t, std::vector<RetainedBuffer>> freeLists; // per size class
+    int scopeDepth = 0;
+    unsigned long generation = 0;
+    rtengine::BufferPool::Statistics statistics = {};
+};
+
+// Never destroyed, as static objects holding buffers may be destroyed after it
+PoolState& getState()
+{
+    static PoolState* const state = new PoolState;
+    return *state;
+}
+
+size_t getMemoryBudget()
+{
+    return static_cast<size_t>(std::max(0, options.bufferPoolMemory)) << 20;
+}
+
+}
+
+namespace rtengine
+{
+
+constexpr size_t BufferPool::MIN_POOLED_SIZE;
+
+BufferPool::Scope::Scope()
+{
+    PoolState& state = getState();
+    MyMutex::MyLock lock(state.mutex);
+
+    if (state.scopeDepth++ == 0) {
+        ++state.generation;
+    }
+}
+
+BufferPool::Scope::~Scope()
+{
+    PoolState& state = getState();
+    MyMutex::MyLock lock(state.mutex);
+
+    if (--state.scopeDepth > 0) {
+        return;
+    }
+
+    // free the buffers which were retained before this scope and not reused during it
+    for (auto &freeList : state.freeLists) {
+        auto &buffers = freeList.second;
+
+        for (auto it = buffers.begin(); it != buffers.end();) {
+            if (it->generation < state.generation) {
+                std::free(it->buffer);
+                state.statistics.retainedBytes -= freeList.first;
+                it = buffers.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+}
+
+void* BufferPool::allocate(size_t size)
+{
+    if (size < MIN_POOLED_SIZE) {
+        return std::malloc(size);
+    }
+
+    const size_t pooledSize = classSize(size);
+
+    {
+        PoolState& state = getState();
+        MyMutex::MyLock lock(state.mutex);
+        ++state.statistics.requests;
+
+        const auto freeList = state.freeLists.find(pooledSize);
+
+        if (freeList != state.freeLists.end() && !freeList->second.empty()) {
+            // most recently released first, its pages are the most likely to be resident
+            void* const buffer = freeList->second.back().buffer;
+            freeList->second.pop_back();
+            state.statistics.retainedBytes -= pooledSize;
+            ++state.statistics.hits;
+            return buffer;
+        }
+    }
+
+    return std::malloc(pooledSize);
+}
+
+void BufferPool::release(void* buffer, size_t size)
+{
+    if (!buffer) {
+        return;
+    }
+
+    if (size < MIN_POOLED_SIZE) {
+        std::free(buffer);
+        return;
+    }
+
+    const size_t pooledSize = classSize(size);
+
+    {
+        PoolState& state = getState();
+        MyMutex::MyLock lock(state.mutex);
+
+        if (state.statistics.retainedBytes + pooledSize <= getMemoryBudget()) {
+            state.freeLists[pooledSize].push_back({buffer, state.generation});
+            state.statistics.retainedBytes += pooledSize;
+            state.statistics.peakRetainedBytes = std::max(state.statistics.peakRetainedBytes, state.statistics.retainedBytes);
+            return;
+        }
+    }
+
+    std::free(buffer);
+}
+
+BufferPool::Statistics BufferPool::getStatistics()
+{
+    PoolState& state = getState();
+    MyMutex::MyLock lock(state.mutex);
+    return state.statistics;
+}
+
+void BufferPool::trim()
+{
+    PoolState& state = getState();
+    MyMutex::MyLock lock(state.mutex);
+
+    for (auto &freeList : state.freeLists) {
+        for (const auto &retained : freeList.second) {
+            std::free(retained.buffer);
+        }
+    }
+
+    state.freeLists.clear();
+    state.statistics.retainedBytes = 0;
+}
+
+}
@@ -0,0 +1,114 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <cstddef>
+#include <new>
+
+namespace rtengine
+{
+
+/**
+ * Engine wide pool of the large image buffers (Imagefloat, LabImage, CieImage, array2D...).
+ *
+ * Released buffers are kept in size classes instead of being returned to the system, so the next
+ * update gets them back without page faults. Buffers below MIN_POOLED_SIZE go directly to malloc().
+ *
+ * The pipeline runs inside a Scope. When the outermost scope ends, the buffers which were not
+ * reused during it are freed, so the pool only keeps what the current kind of update needs. The
+ * retained memory is bounded by the Performance/BufferPoolMemory option, and everything is freed
+ * when an editor is closed.
+ */
+class BufferPool final
+{
+public:
+    static constexpr size_t MIN_POOLED_SIZE = 1 << 20;
+
+    struct Statistics {
+        unsigned long requests;     // pooled size requests since the start
+        unsigned long hits;         // requests served from the pool
+        size_t retainedBytes;       // memory kept for reuse right now
+        size_t peakRetainedBytes;
+    };
+
+    // Lifetime scope of the buffers of one pipeline run, can be nested
+    class Scope final
+    {
+    public:
+        Scope();
+        ~Scope();
+
+        Scope(const Scope&) = delete;
+        Scope& operator =(const Scope&) = delete;
+    };
+
+    BufferPool() = delete;
+
+    // Returns at least 'size' bytes aligned for malloc(), or nullptr if the allocation failed
+    static void* allocate(size_t size);
+    // 'size' has to be the size passed to allocate()
+    static void release(void* buffer, size_t size);
+
+    static Statistics getStatistics();
+    // Frees all retained buffers
+    static void trim();
+};
+
+// Allocator for containers holding image data, e.g. the buffer of array2D
+template<typename T>
+class BufferPoolAllocator
+{
+public:
+    using value_type = T;
+
+    BufferPoolAllocator() = default;
+
+    template<typename U>
+    BufferPoolAllocator(const BufferPoolAllocator<U>&)
+    {
+    }
+
+    T* allocate(size_t n)
+    {
+        void* const buffer = BufferPool::allocate(n * sizeof(T));
+
+        if (!buffer) {
+            throw std::bad_alloc();
+        }
+
+        return static_cast<T*>(buffer);
+    }
+
+    void deallocate(T* buffer, size_t n)
+    {
+        BufferPool::release(buffer, n * sizeof(T));
+    }
+};
+
+template<typename T, typename U>
+bool operator ==(const BufferPoolAllocator<T>&, const BufferPoolAllocator<U>&)
+{
+    return true;
+}
+
+template<typename T, typename U>
+bool operator !=(const BufferPoolAllocator<T>&, const BufferPoolAllocator<U>&)
+{
+    return false;
+}
+
+}
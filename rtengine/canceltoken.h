@@ -0,0 +1,61 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <atomic>
+
+#include "noncopyable.h"
+
+namespace rtengine
+{
+
+/**
+ * Cooperative cancellation of a running update.
+ *
+ * The long running kernels poll the token at tile and row band boundaries and skip the
+ * remaining work once it is requested. Their output is undefined then, so the caller has
+ * to discard it and redo the work in the next update.
+ */
+class CancelToken final :
+    public NonCopyable
+{
+public:
+    CancelToken() :
+        cancelled(false)
+    {
+    }
+
+    void request()
+    {
+        cancelled.store(true, std::memory_order_relaxed);
+    }
+
+    void reset()
+    {
+        cancelled.store(false, std::memory_order_relaxed);
+    }
+
+    bool isRequested() const
+    {
+        return cancelled.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<bool> cancelled;
+};
+
+}
@@ -20,6 +20,7 @@
 #include <iostream>
 
 #include "rtengine.h"
+#include "canceltoken.h"
 #include "rawimage.h"
 #include "rawimagesource.h"
 #include "rt_math.h"
@@ -28,6 +29,7 @@
 #include "rt_algo.h"
 //#define BENCHMARK
 #include "StopWatch.h"
+#include "trace.h"
 #include "opthelper.h"
 #include "../rtgui/multilangmgr.h"
 
@@ -757,7 +759,7 @@ bool checkForStop(float** tmpIThr, float** iterCheck, int fullTileSize, int bord
     return false;
 }
 
-void CaptureDeconvSharpening (float** luminance, const float* const * oldLuminance, const float * const * blend, int W, int H, float sigma, float sigmaCornerOffset, int iterations, bool checkIterStop, rtengine::ProgressListener* plistener, double startVal, double endVal)
+void CaptureDeconvSharpening (float** luminance, const float* const * oldLuminance, const float * const * blend, int W, int H, float sigma, float sigmaCornerOffset, int iterations, bool checkIterStop, rtengine::ProgressListener* plistener, double startVal, double endVal, const rtengine::CancelToken* cancelToken)
 {
 BENCHFUN
     const bool is9x9 = (sigma <= 1.5f && sigmaCornerOffset == 0.f);
@@ -808,6 +810,10 @@ BENCHFUN
 #endif
         for (int i = border; i < H - border; i+= tileSize) {
             for(int j = border; j < W - border; j+= tileSize) {
+                if (cancelToken && cancelToken->isRequested()) {
+                    // the caller drops the half sharpened image, no need to deconvolve the other tiles
+                    continue;
+                }
                 const bool endOfCol = (i + tileSize + border) >= H;
                 const bool endOfRow = (j + tileSize + border) >= W;
                 // fill tiles
@@ -999,7 +1005,8 @@ BENCHFUN
 namespace rtengine
 {
 
-void RawImageSource::captureSharpening(const procparams::CaptureSharpeningParams &sharpeningParams, bool showMask, double &conrastThreshold, double &radius) {
+void RawImageSource::captureSharpening(const procparams::CaptureSharpeningParams &sharpeningParams, bool showMask, double &conrastThreshold, double &radius, const CancelToken *cancelToken) {
+    TRACEFUN;
 
     if (!(ri->getSensorType() == ST_BAYER || ri->getSensorType() == ST_FUJI_XTRANS || ri->get_colors() == 1)) {
         return;
@@ -1130,6 +1137,11 @@ BENCHFUN
     array2D<float>& YOld = YOldbuffer.get() ? *YOldbuffer.get() : green;
     array2D<float>& YNew = YNewbuffer.get() ? *YNewbuffer.get() : blue;
 
+    if (!redCache) {
+        // without the caches the demosaiced data is overwritten, so we can't stop halfway
+        cancelToken = nullptr;
+    }
+
 #ifdef _OPENMP
     #pragma omp parallel for schedule(dynamic, 16)
 #endif
@@ -1147,11 +1159,16 @@ BENCHFUN
         plistener->setProgress(0.2);
     }
     conrastThreshold = contrast * 100.f;
-    CaptureDeconvSharpening(YNew, YOld, clipMask, W, H, radius, sharpeningParams.deconvradiusOffset, sharpeningParams.deconviter, sharpeningParams.deconvitercheck, plistener, 0.2, 0.9);
+    CaptureDeconvSharpening(YNew, YOld, clipMask, W, H, radius, sharpeningParams.deconvradiusOffset, sharpeningParams.deconviter, sharpeningParams.deconvitercheck, plistener, 0.2, 0.9, cancelToken);
     if (plistener) {
         plistener->setProgress(0.9);
     }
 
+    if (cancelToken && cancelToken->isRequested()) {
+        // keep the previous output, the next update starts over from the cached demosaiced data
+        return;
+    }
+
 #ifdef _OPENMP
     #pragma omp parallel for schedule(dynamic, 16)
 #endif
@@ -2,6 +2,9 @@
 
 #include <new>
 #include <cstring>
+
+#include "bufferpool.h"
+
 namespace rtengine
 {
 
@@ -20,7 +23,7 @@ CieImage::CieImage (int w, int h) : fromImage(false), W(w), H(h)
     }
 
     // Trying to allocate all in one block
-    data[0] = new (std::nothrow) float [W * H * 6];
+    data[0] = static_cast<float*>(BufferPool::allocate(static_cast<size_t>(W) * H * 6 * sizeof(float)));
 
     if (data[0]) {
         float * index = data[0];
@@ -117,10 +120,14 @@ CieImage::~CieImage ()
 //      delete [] ch_p;
         delete [] h_p;
 
-        for (unsigned int c = 0; c < 6; ++c)
-            if (data[c]) {
+        if (!data[1]) {
+            // only one allocated block
+            BufferPool::release(data[0], static_cast<size_t>(W) * H * 6 * sizeof(float));
+        } else {
+            for (unsigned int c = 0; c < 6; ++c) {
                 delete [] data[c];
             }
+        }
     }
 }
 
@@ -18,11 +18,79 @@
  *  2012 Emil Martinec <ejmartin@uchicago.edu>
  */
 
+#include <algorithm>
+#include <new>
+
 #include "cplx_wavelet_dec.h"
 
 namespace rtengine
 {
 
+wavelet_decomposition::wavelet_decomposition(const wavelet_decomposition &other) :
+    lvltot(other.lvltot),
+    subsamp(other.subsamp),
+    m_w(other.m_w),
+    m_h(other.m_h),
+    wavfilt_len(other.wavfilt_len),
+    wavfilt_offset(other.wavfilt_offset),
+    wavfilt_anal(new float[2 * wavfilt_len]),
+    wavfilt_synth(new float[2 * wavfilt_len]),
+    coeff0(nullptr),
+    memoryAllocationFailed(other.memoryAllocationFailed)
+{
+    std::copy(other.wavfilt_anal, other.wavfilt_anal + 2 * wavfilt_len, wavfilt_anal);
+    std::copy(other.wavfilt_synth, other.wavfilt_synth + 2 * wavfilt_len, wavfilt_synth);
+
+    for(int i = 0; i <= lvltot; i++) {
+        wavelet_decomp[i] = other.wavelet_decomp[i] ? new wavelet_level<internal_type>(*other.wavelet_decomp[i]) : nullptr;
+
+        if(wavelet_decomp[i] && wavelet_decomp[i]->memoryAllocationFailed) {
+            memoryAllocationFailed = true;
+        }
+    }
+
+    if(other.coeff0) {
+        // size of the buffers the decomposition is computed in
+        const std::size_t size = static_cast<std::size_t>(m_w / 2 + 1) * (m_h / 2 + 1);
+        coeff0 = new (std::nothrow) internal_type[size];
+
+        if(coeff0) {
+            std::copy(other.coeff0, other.coeff0 + size, coeff0);
+        } else {
+            memoryAllocationFailed = true;
+        }
+    }
+}
+
+std::unique_ptr<wavelet_decomposition> wavelet_decomposition::copy() const
+{
+    return std::unique_ptr<wavelet_decomposition>(new wavelet_decomposition(*this));
+}
+
+void wavelet_decomposition::pack()
+{
+    if(memoryAllocationFailed) {
+        return;
+    }
+
+    for(int i = 0; i <= lvltot; i++) {
+        wavelet_decomp[i]->pack();
+    }
+}
+
+std::size_t wavelet_decomposition::memory_size() const
+{
+    std::size_t size = coeff0 ? static_cast<std::size_t>(m_w / 2 + 1) * (m_h / 2 + 1) * sizeof(internal_type) : 0;
+
+    for(int i = 0; i <= lvltot; i++) {
+        if(wavelet_decomp[i]) {
+            size += wavelet_decomp[i]->memorySize();
+        }
+    }
+
+    return size;
+}
+
 wavelet_decomposition::~wavelet_decomposition()
 {
     for(int i = 0; i <= lvltot; i++) {
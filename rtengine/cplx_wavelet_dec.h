@@ -21,6 +21,7 @@
 
 #include <cstddef>
 #include <cmath>
+#include <memory>
 
 #include "cplx_wavelet_level.h"
 #include "cplx_wavelet_filter_coeffs.h"
@@ -40,6 +41,16 @@ public:
 
     ~wavelet_decomposition();
 
+    // Returns a copy of the coefficients, check memory_allocation_failed() of the copy
+    std::unique_ptr<wavelet_decomposition> copy() const;
+
+    // Stores the detail levels as half floats where they fit, for keeping the decomposition.
+    // Afterwards it can only be copied, the copies have float coefficients again.
+    void pack();
+
+    // Memory used by the coefficients in bytes
+    std::size_t memory_size() const;
+
     bool memory_allocation_failed() const
     {
         return memoryAllocationFailed;
@@ -96,6 +107,8 @@ public:
 private:
     static const int maxlevels = 10; // should be greater than any conceivable order of decimation
 
+    explicit wavelet_decomposition(const wavelet_decomposition &other);
+
     int lvltot;
     int subsamp;
     // Dimensions
@@ -20,7 +20,12 @@
 */
 #pragma once
 
+#include <cmath>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include "bufferpool.h"
+#include "halffloat.h"
 #include "rt_math.h"
 #include "opthelper.h"
 #include "stdio.h"
@@ -43,6 +48,10 @@ class wavelet_level
     int skip;
 
     bool bigBlockOfMemory;
+
+    // detail coefficients stored as half floats by pack(), wavcoeffs is released then
+    uint16_t *halfCoeffs;
+
     // allocation and destruction of data storage
     T ** create(int n);
     void destroy(T ** subbands);
@@ -82,7 +91,7 @@ public:
 
     template<typename E>
     wavelet_level(E * src, E * dst, int level, int subsamp, int w, int h, float *filterV, float *filterH, int len, int offset, int skipcrop, int numThreads)
-        : lvl(level), subsamp_out((subsamp >> level) & 1), numThreads(numThreads), skip(1 << level), bigBlockOfMemory(true), memoryAllocationFailed(false), wavcoeffs(nullptr), m_w(w), m_h(h), m_w2(w), m_h2(h)
+        : lvl(level), subsamp_out((subsamp >> level) & 1), numThreads(numThreads), skip(1 << level), bigBlockOfMemory(true), halfCoeffs(nullptr), memoryAllocationFailed(false), wavcoeffs(nullptr), m_w(w), m_h(h), m_w2(w), m_h2(h)
     {
         if (subsamp) {
             skip = 1;
@@ -110,9 +119,39 @@ public:
 
     }
 
+    // Copies the coefficients, expanding packed ones, check memoryAllocationFailed of the copy
+    wavelet_level(const wavelet_level &other)
+        : lvl(other.lvl), subsamp_out(other.subsamp_out), numThreads(other.numThreads), skip(other.skip), bigBlockOfMemory(true), halfCoeffs(nullptr), memoryAllocationFailed(false), wavcoeffs(nullptr), m_w(other.m_w), m_h(other.m_h), m_w2(other.m_w2), m_h2(other.m_h2)
+    {
+        wavcoeffs = create(m_w2 * m_h2);
+
+        if(!memoryAllocationFailed) {
+            const size_t n = static_cast<size_t>(m_w2) * m_h2;
+
+            for(int j = 1; j < 4; j++) {
+                if(other.halfCoeffs) {
+                    halfToFloat(other.halfCoeffs + (j - 1) * n, wavcoeffs[j], n);
+                } else {
+                    memcpy(wavcoeffs[j], other.wavcoeffs[j], n * sizeof(T));
+                }
+            }
+        }
+    }
+
+    wavelet_level& operator =(const wavelet_level&) = delete;
+
     ~wavelet_level()
     {
         destroy(wavcoeffs);
+        delete[] halfCoeffs;
+    }
+
+    // Stores the detail coefficients as half floats if they are within their range, a packed level can only be copied
+    bool pack();
+
+    size_t memorySize() const
+    {
+        return 3 * static_cast<size_t>(m_w2) * m_h2 * (halfCoeffs ? sizeof(uint16_t) : sizeof(T));
     }
 
     T ** subbands() const
@@ -155,7 +194,8 @@ public:
 template<typename T>
 T ** wavelet_level<T>::create(int n)
 {
-    T * data = new (std::nothrow) T[3 * n];
+    // pooled, the levels of the next tile or update get the same sizes
+    T * data = static_cast<T*>(BufferPool::allocate(3 * n * sizeof(T)));
 
     if(data == nullptr) {
         bigBlockOfMemory = false;
@@ -184,7 +224,7 @@ void wavelet_level<T>::destroy(T ** subbands)
 {
     if(subbands) {
         if(bigBlockOfMemory) {
-            delete[] subbands[1];
+            BufferPool::release(subbands[1], 3 * m_w2 * m_h2 * sizeof(T));
         } else {
             for(int j = 1; j < 4; j++) {
                 if(subbands[j] != nullptr) {
@@ -197,6 +237,45 @@ void wavelet_level<T>::destroy(T ** subbands)
     }
 }
 
+template<typename T>
+bool wavelet_level<T>::pack()
+{
+    if(memoryAllocationFailed || halfCoeffs) {
+        return halfCoeffs;
+    }
+
+    const size_t n = static_cast<size_t>(m_w2) * m_h2;
+    float maxAbs = 0.f;
+
+    for(int j = 1; j < 4; j++) {
+#ifdef _OPENMP
+        #pragma omp parallel for reduction(max:maxAbs) num_threads(numThreads) if(numThreads>1)
+#endif
+
+        for(size_t i = 0; i < n; i++) {
+            maxAbs = std::max(maxAbs, std::fabs(wavcoeffs[j][i]));
+        }
+    }
+
+    if(!(maxAbs <= HALF_MAX)) { // NaNs are kept as well
+        return false;
+    }
+
+    halfCoeffs = new (std::nothrow) uint16_t[3 * n];
+
+    if(halfCoeffs == nullptr) {
+        return false;
+    }
+
+    for(int j = 1; j < 4; j++) {
+        floatToHalf(wavcoeffs[j], halfCoeffs + (j - 1) * n, n);
+    }
+
+    destroy(wavcoeffs);
+    wavcoeffs = nullptr;
+    return true;
+}
+
 template<typename T>
 void wavelet_level<T>::AnalysisFilterHaarHorizontal (const T * const RESTRICT srcbuffer, T * RESTRICT dstLo, T * RESTRICT dstHi, const int width, const int row)
 {
@@ -302,11 +381,45 @@ void wavelet_level<T>::AnalysisFilterSubsampHorizontal (T * RESTRICT srcbuffer,
      * the input pixel, and skipping 'skip' pixels between taps
      * Output is subsampled by two
      */
+#ifdef __SSE2__
+    // split the row into its even and odd samples, the taps of consecutive outputs are consecutive in them
+    T srcEven[(srcwidth + 1) / 2] ALIGNED16;
+    T srcOdd[srcwidth / 2 + 1] ALIGNED16;
+
+    for(int i = 0; i < srcwidth / 2; i++) {
+        srcEven[i] = srcbuffer[2 * i];
+        srcOdd[i] = srcbuffer[2 * i + 1];
+    }
+
+    if(srcwidth & 1) {
+        srcEven[srcwidth / 2] = srcbuffer[srcwidth - 1];
+    }
+
+#endif
     // calculate coefficients
     for(int i = 0; i < srcwidth; i += 2) {
         float lo = 0.f, hi = 0.f;
 
         if (LIKELY(i > skip * taps && i < srcwidth - skip * taps)) { //bulk
+#ifdef __SSE2__
+            if (i + 6 < srcwidth - skip * taps) { // four outputs at once
+                vfloat lov = ZEROV;
+                vfloat hiv = ZEROV;
+
+                for (int j = 0; j < taps; j++) {
+                    const int d = skip * (offset - j);
+                    const vfloat srcv = LVFU((d & 1 ? srcOdd : srcEven)[i / 2 + (d >> 1)]);
+                    lov += F2V(filterLo[j]) * srcv;//lopass channel
+                    hiv += F2V(filterHi[j]) * srcv;//hipass channel
+                }
+
+                STVFU(dstLo[row * dstwidth + i / 2], lov);
+                STVFU(dstHi[row * dstwidth + i / 2], hiv);
+                i += 6;
+                continue;
+            }
+
+#endif
             for (int j = 0, l = -skip * offset; j < taps; j++, l += skip) {
                 float src = srcbuffer[i - l];
                 lo += filterLo[j] * src;//lopass channel
@@ -474,6 +587,27 @@ template<typename T> void wavelet_level<T>::SynthesisFilterSubsampHorizontal (T
             dst[k * dstwidth + i] = tot;
         }
 
+#ifdef __SSE2__
+        // the outputs of even and odd i + shift use every other tap, each class is computed
+        // for four consecutive outputs at once and the two are interleaved
+        for(; i < min(dstwidth - skip * taps, dstwidth) - 7; i += 8) {
+            vfloat totv[2];
+
+            for (int c = 0; c < 2; c++) {
+                int i_src = (i + c + shift) / 2;
+                int begin = (i + c + shift) % 2;
+                totv[c] = ZEROV;
+
+                for (int j = begin, l = 0; j < taps; j += 2, l += skip) {
+                    totv[c] += F2V(filterLo[j]) * LVFU(srcLo[k * srcwidth + i_src - l]) + F2V(filterHi[j]) * LVFU(srcHi[k * srcwidth + i_src - l]);
+                }
+            }
+
+            STVFU(dst[k * dstwidth + i], _mm_unpacklo_ps(totv[0], totv[1]));
+            STVFU(dst[k * dstwidth + i + 4], _mm_unpackhi_ps(totv[0], totv[1]));
+        }
+
+#endif
         for(; i < min(dstwidth - skip * taps, dstwidth); i++) {
             float tot = 0.f;
             //TODO: this is correct only if skip=1; otherwise, want to work with cosets of length 'skip'
@@ -18,6 +18,7 @@
  *  along with RawTherapee.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include "bufferpool.h"
 #include "cieimage.h"
 #include "color.h"
 #include "curves.h"
@@ -32,9 +33,12 @@
 #include "procparams.h"
 #include "refreshmap.h"
 #include "rt_math.h"
+#include "taskgraph.h"
+#include "trace.h"
 #include "utils.h"
 
 #include "../rtgui/editcallbacks.h"
+#include "../rtgui/options.h"
 
 #pragma GCC diagnostic warning "-Wall"
 #pragma GCC diagnostic warning "-Wextra"
@@ -62,7 +66,13 @@ Crop::Crop(ImProcCoordinator* parent, EditDataProvider *editDataProvider, bool i
       rqcropx(0), rqcropy(0), rqcropw(-1), rqcroph(-1),
       borderRequested(32), upperBorder(0), leftBorder(0),
       cropAllocated(false),
-      cropImageListener(nullptr), parent(parent), isDetailWindow(isDetailWindow)
+      cropImageListener(nullptr),
+      buffersStale(false),
+      lastWindowX(0), lastWindowY(0), lastWindowW(-1), lastWindowH(-1), lastWindowSkip(0),
+      panX(0), panY(0),
+      prefetching(false),
+      prefetchX(0), prefetchY(0), prefetchW(0), prefetchH(0),
+      parent(parent), isDetailWindow(isDetailWindow)
 {
     parent->crops.push_back(this);
 }
@@ -143,6 +153,7 @@ bool Crop::hasListener()
 void Crop::update(int todo)
 {
     MyMutex::MyLock cropLock(cropMutex);
+    TRACE_SCOPE("Crop::update", "pipeline");
 
     ProcParams& params = *parent->params;
 //       CropGUIListener* cropgl;
@@ -155,7 +166,13 @@ void Crop::update(int todo)
     const bool overrideWindow = cropImageListener;
     bool spotsDone = false;
 
-    if (overrideWindow) {
+    if (prefetching) {
+        wx = prefetchX;
+        wy = prefetchY;
+        ww = prefetchW;
+        wh = prefetchH;
+        ws = 1;
+    } else if (overrideWindow) {
         cropImageListener->getWindow(wx, wy, ww, wh, ws);
     }
 
@@ -169,10 +186,48 @@ void Crop::update(int todo)
     }
 
     // it something has been reallocated, all processing steps have to be performed
-    if (needsinitupdate || (todo & M_HIGHQUAL)) {
+    if (needsinitupdate || (todo & M_HIGHQUAL) || buffersStale) {
         todo = ALL;
     }
 
+    // the requested window is not rendered into the buffers when prefetching
+    buffersStale = prefetching;
+
+    // output rendered at 100% is kept for panning, the pipette buffer has to follow the window though
+    const bool useViewportCache = skip == 1 && cropImageListener && getCurrEditID() == EUID_None;
+    const unsigned int generation = parent->paramsGeneration;
+
+    if (!prefetching) {
+        if (skip == 1 && lastWindowSkip == 1 && rqcropw == lastWindowW && rqcroph == lastWindowH) {
+            if (rqcropx != lastWindowX || rqcropy != lastWindowY) {
+                panX = rqcropx - lastWindowX;
+                panY = rqcropy - lastWindowY;
+            }
+        } else {
+            panX = panY = 0;
+        }
+
+        lastWindowX = rqcropx;
+        lastWindowY = rqcropy;
+        lastWindowW = rqcropw;
+        lastWindowH = rqcroph;
+        lastWindowSkip = skip;
+
+        const int finalW = std::min(rqcropw, cropw - leftBorder);
+        const int finalH = std::min(rqcroph, croph - upperBorder);
+
+        if (useViewportCache && finalW > 0 && finalH > 0) {
+            Image8 final(finalW, finalH);
+            Image8 finaltrue(finalW, finalH);
+
+            if (viewportCache.fetch(generation, cropx + leftBorder, cropy + upperBorder, &final, &finaltrue)) {
+                buffersStale = true;
+                cropImageListener->setDetailedCrop(&final, &finaltrue, params.icm, params.crop, rqcropx, rqcropy, rqcropw, rqcroph, skip);
+                return;
+            }
+        }
+    }
+
     // Tells to the ImProcFunctions' tool what is the preview scale, which may lead to some simplifications
     parent->ipf.setScale(skip);
 
@@ -180,7 +235,25 @@ void Crop::update(int todo)
     int widIm = parent->fw;//full image
     int heiIm = parent->fh;
 
-    if (todo & (M_INIT | M_LINDENOISE | M_HDR)) {
+    // denoised crops depend on their tiling, they can't be shared
+    const bool useUpstreamCache = (todo & (M_INIT | M_LINDENOISE | M_HDR)) && !(skip == 1 && params.dirpyrDenoise.enabled);
+    bool upstreamCached = false;
+    PipelineCache::Key upstreamKey{};
+
+    if (useUpstreamCache) {
+        upstreamKey = parent->pipelineCache.getKey(params, parent->currWB, trafx, trafy, trafw, trafh, skip);
+        upstreamCached = parent->pipelineCache.fetch(upstreamKey, origCrop);
+
+        if (upstreamCached) {
+            // the cached image already went through spot removal, dehaze and dynamic range compression
+            spotsDone = true;
+            delete spotCrop;
+            spotCrop = nullptr;
+        }
+    }
+
+    if ((todo & (M_INIT | M_LINDENOISE | M_HDR)) && !upstreamCached) {
+        MyMutex::MyLock sourceLock(parent->sourceMutex);
         MyMutex::MyLock lock(parent->minit);  // Also used in improccoord
 
         int tr = getCoarseBitMask(params.coarse);
@@ -393,221 +466,228 @@ void Crop::update(int todo)
             }
         }
 
-        if (skip == 1 && params.dirpyrDenoise.enabled && !parent->denoiseInfoStore.valid && ((settings->leveldnautsimpl == 1 && params.dirpyrDenoise.Cmethod == "AUT")  || (settings->leveldnautsimpl == 0 && params.dirpyrDenoise.C2method == "AUTO"))) {
-            MyTime t1aue, t2aue;
-            t1aue.set();
+        // the noise analysis of the sample tiles runs while the crop is fetched, the denoising consumes it
+        TaskGraph analyses;
+        const bool autoDenoiseInfo = skip == 1 && params.dirpyrDenoise.enabled && !parent->denoiseInfoStore.valid && ((settings->leveldnautsimpl == 1 && params.dirpyrDenoise.Cmethod == "AUT")  || (settings->leveldnautsimpl == 0 && params.dirpyrDenoise.C2method == "AUTO"));
+        TaskGraph::TaskId autoDenoiseInfoTask = 0;
 
-            int crW = 100; // settings->leveldnv == 0
-            int crH = 100; // settings->leveldnv == 0
+        if (autoDenoiseInfo) {
+            autoDenoiseInfoTask = analyses.add([&]() {
+                MyTime t1aue, t2aue;
+                t1aue.set();
 
-            if (settings->leveldnv == 1) {
-                crW = 250;
-                crH = 250;
-            }
+                int crW = 100; // settings->leveldnv == 0
+                int crH = 100; // settings->leveldnv == 0
 
-            //  if (settings->leveldnv ==2) {crW=int(tileWskip/2);crH=int((tileWskip/2));}//adapted to scale of preview
-            if (settings->leveldnv == 2) {
-                crW = int (tileWskip / 2);
-                crH = int (tileHskip / 2);
-            }
+                if (settings->leveldnv == 1) {
+                    crW = 250;
+                    crH = 250;
+                }
 
-            if (settings->leveldnv == 3) {
-                crW = tileWskip - 10;
-                crH = tileHskip - 10;
-            }
+                //  if (settings->leveldnv ==2) {crW=int(tileWskip/2);crH=int((tileWskip/2));}//adapted to scale of preview
+                if (settings->leveldnv == 2) {
+                    crW = int (tileWskip / 2);
+                    crH = int (tileHskip / 2);
+                }
 
-            float lowdenoise = 1.f;
-            int levaut = settings->leveldnaut;
+                if (settings->leveldnv == 3) {
+                    crW = tileWskip - 10;
+                    crH = tileHskip - 10;
+                }
 
-            if (levaut == 1) { //Standard
-                lowdenoise = 0.7f;
-            }
+                float lowdenoise = 1.f;
+                int levaut = settings->leveldnaut;
 
-            LUTf gamcurve(65536, 0);
-            float gam, gamthresh, gamslope;
-            parent->ipf.RGB_denoise_infoGamCurve(params.dirpyrDenoise, parent->imgsrc->isRAW(), gamcurve, gam, gamthresh, gamslope);
-            int Nb[9];
+                if (levaut == 1) { //Standard
+                    lowdenoise = 0.7f;
+                }
+
+                LUTf gamcurve(65536, 0);
+                float gam, gamthresh, gamslope;
+                parent->ipf.RGB_denoise_infoGamCurve(params.dirpyrDenoise, parent->imgsrc->isRAW(), gamcurve, gam, gamthresh, gamslope);
+                int Nb[9];
 #ifdef _OPENMP
-            #pragma omp parallel
+                #pragma omp parallel
 #endif
-            {
-                Imagefloat *origCropPart = new Imagefloat(crW, crH); //allocate memory
-                Imagefloat *provicalc = new Imagefloat((crW + 1) / 2, (crH + 1) / 2);  //for denoise curves
-
-                int  coordW[3];//coordinate of part of image to measure noise
-                int  coordH[3];
-                int begW = 50;
-                int begH = 50;
-                coordW[0] = begW;
-                coordW[1] = widIm / 2 - crW / 2;
-                coordW[2] = widIm - crW - begW;
-                coordH[0] = begH;
-                coordH[1] = heiIm / 2 - crH / 2;
-                coordH[2] = heiIm - crH - begH;
+                {
+                    Imagefloat *origCropPart = new Imagefloat(crW, crH); //allocate memory
+                    Imagefloat *provicalc = new Imagefloat((crW + 1) / 2, (crH + 1) / 2);  //for denoise curves
+
+                    int  coordW[3];//coordinate of part of image to measure noise
+                    int  coordH[3];
+                    int begW = 50;
+                    int begH = 50;
+                    coordW[0] = begW;
+                    coordW[1] = widIm / 2 - crW / 2;
+                    coordW[2] = widIm - crW - begW;
+                    coordH[0] = begH;
+                    coordH[1] = heiIm / 2 - crH / 2;
+                    coordH[2] = heiIm - crH - begH;
 #ifdef _OPENMP
-                #pragma omp for schedule(dynamic) collapse(2) nowait
+                    #pragma omp for schedule(dynamic) collapse(2) nowait
 #endif
 
-                for (int wcr = 0; wcr <= 2; wcr++) {
-                    for (int hcr = 0; hcr <= 2; hcr++) {
-                        PreviewProps ppP(coordW[wcr], coordH[hcr], crW, crH, 1);
-                        parent->imgsrc->getImage(parent->currWB, tr, origCropPart, ppP, params.toneCurve, params.raw);
-
-                        // we only need image reduced to 1/4 here
-                        for (int ii = 0; ii < crH; ii += 2) {
-                            for (int jj = 0; jj < crW; jj += 2) {
-                                provicalc->r(ii >> 1, jj >> 1) = origCropPart->r(ii, jj);
-                                provicalc->g(ii >> 1, jj >> 1) = origCropPart->g(ii, jj);
-                                provicalc->b(ii >> 1, jj >> 1) = origCropPart->b(ii, jj);
+                    for (int wcr = 0; wcr <= 2; wcr++) {
+                        for (int hcr = 0; hcr <= 2; hcr++) {
+                            PreviewProps ppP(coordW[wcr], coordH[hcr], crW, crH, 1);
+                            parent->imgsrc->getImage(parent->currWB, tr, origCropPart, ppP, params.toneCurve, params.raw);
+
+                            // we only need image reduced to 1/4 here
+                            for (int ii = 0; ii < crH; ii += 2) {
+                                for (int jj = 0; jj < crW; jj += 2) {
+                                    provicalc->r(ii >> 1, jj >> 1) = origCropPart->r(ii, jj);
+                                    provicalc->g(ii >> 1, jj >> 1) = origCropPart->g(ii, jj);
+                                    provicalc->b(ii >> 1, jj >> 1) = origCropPart->b(ii, jj);
+                                }
                             }
-                        }
 
-                        parent->imgsrc->convertColorSpace(provicalc, params.icm, parent->currWB);  //for denoise luminance curve
-
-                        float pondcorrec = 1.0f;
-                        float chaut = 0.f, redaut = 0.f, blueaut = 0.f, maxredaut = 0.f, maxblueaut = 0.f, minredaut = 0.f, minblueaut = 0.f, chromina = 0.f, sigma = 0.f, lumema = 0.f, sigma_L = 0.f, redyel = 0.f, skinc = 0.f, nsknc = 0.f;
-                        int nb = 0;
-                        parent->ipf.RGB_denoise_info(origCropPart, provicalc, parent->imgsrc->isRAW(), gamcurve, gam, gamthresh, gamslope, params.dirpyrDenoise, parent->imgsrc->getDirPyrDenoiseExpComp(), chaut, nb, redaut, blueaut, maxredaut, maxblueaut, minredaut, minblueaut, chromina, sigma, lumema, sigma_L, redyel, skinc, nsknc);
-
-                        //printf("DCROP skip=%d cha=%f red=%f bl=%f redM=%f bluM=%f chrom=%f sigm=%f lum=%f\n",skip, chaut,redaut,blueaut, maxredaut, maxblueaut, chromina, sigma, lumema);
-                        Nb[hcr * 3 + wcr] = nb;
-                        parent->denoiseInfoStore.ch_M[hcr * 3 + wcr] = pondcorrec * chaut;
-                        parent->denoiseInfoStore.max_r[hcr * 3 + wcr] = pondcorrec * maxredaut;
-                        parent->denoiseInfoStore.max_b[hcr * 3 + wcr] = pondcorrec * maxblueaut;
-                        min_r[hcr * 3 + wcr] = pondcorrec * minredaut;
-                        min_b[hcr * 3 + wcr] = pondcorrec * minblueaut;
-                        lumL[hcr * 3 + wcr] = lumema;
-                        chromC[hcr * 3 + wcr] = chromina;
-                        ry[hcr * 3 + wcr] = redyel;
-                        sk[hcr * 3 + wcr] = skinc;
-                        pcsk[hcr * 3 + wcr] = nsknc;
+                            parent->imgsrc->convertColorSpace(provicalc, params.icm, parent->currWB);  //for denoise luminance curve
+
+                            float pondcorrec = 1.0f;
+                            float chaut = 0.f, redaut = 0.f, blueaut = 0.f, maxredaut = 0.f, maxblueaut = 0.f, minredaut = 0.f, minblueaut = 0.f, chromina = 0.f, sigma = 0.f, lumema = 0.f, sigma_L = 0.f, redyel = 0.f, skinc = 0.f, nsknc = 0.f;
+                            int nb = 0;
+                            parent->ipf.RGB_denoise_info(origCropPart, provicalc, parent->imgsrc->isRAW(), gamcurve, gam, gamthresh, gamslope, params.dirpyrDenoise, parent->imgsrc->getDirPyrDenoiseExpComp(), chaut, nb, redaut, blueaut, maxredaut, maxblueaut, minredaut, minblueaut, chromina, sigma, lumema, sigma_L, redyel, skinc, nsknc);
+
+                            //printf("DCROP skip=%d cha=%f red=%f bl=%f redM=%f bluM=%f chrom=%f sigm=%f lum=%f\n",skip, chaut,redaut,blueaut, maxredaut, maxblueaut, chromina, sigma, lumema);
+                            Nb[hcr * 3 + wcr] = nb;
+                            parent->denoiseInfoStore.ch_M[hcr * 3 + wcr] = pondcorrec * chaut;
+                            parent->denoiseInfoStore.max_r[hcr * 3 + wcr] = pondcorrec * maxredaut;
+                            parent->denoiseInfoStore.max_b[hcr * 3 + wcr] = pondcorrec * maxblueaut;
+                            min_r[hcr * 3 + wcr] = pondcorrec * minredaut;
+                            min_b[hcr * 3 + wcr] = pondcorrec * minblueaut;
+                            lumL[hcr * 3 + wcr] = lumema;
+                            chromC[hcr * 3 + wcr] = chromina;
+                            ry[hcr * 3 + wcr] = redyel;
+                            sk[hcr * 3 + wcr] = skinc;
+                            pcsk[hcr * 3 + wcr] = nsknc;
 
+                        }
                     }
-                }
 
-                delete provicalc;
-                delete origCropPart;
-            }
-            float chM = 0.f;
-            float MaxR = 0.f;
-            float MaxB = 0.f;
-            float MinR = 100000000000.f;
-            float MinB = 100000000000.f;
-            float maxr = 0.f;
-            float maxb = 0.f;
-            float Max_R[9] = {0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f};
-            float Max_B[9] = {0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f};
-            float Min_R[9];
-            float Min_B[9];
-            float MaxRMoy = 0.f;
-            float MaxBMoy = 0.f;
-            float MinRMoy = 0.f;
-            float MinBMoy = 0.f;
-
-            float multip = 1.f;
-
-            if (!parent->imgsrc->isRAW()) {
-                multip = 2.f;    //take into account gamma for TIF / JPG approximate value...not good for gamma=1
-            }
+                    delete provicalc;
+                    delete origCropPart;
+                }
+                float chM = 0.f;
+                float MaxR = 0.f;
+                float MaxB = 0.f;
+                float MinR = 100000000000.f;
+                float MinB = 100000000000.f;
+                float maxr = 0.f;
+                float maxb = 0.f;
+                float Max_R[9] = {0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f};
+                float Max_B[9] = {0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f};
+                float Min_R[9];
+                float Min_B[9];
+                float MaxRMoy = 0.f;
+                float MaxBMoy = 0.f;
+                float MinRMoy = 0.f;
+                float MinBMoy = 0.f;
 
-            float adjustr = 1.f;
-
-            if (params.icm.workingProfile == "ProPhoto")   {
-                adjustr = 1.f;   //
-            } else if (params.icm.workingProfile == "Adobe RGB")  {
-                adjustr = 1.f / 1.3f;
-            } else if (params.icm.workingProfile == "sRGB")       {
-                adjustr = 1.f / 1.3f;
-            } else if (params.icm.workingProfile == "WideGamut")  {
-                adjustr = 1.f / 1.1f;
-            } else if (params.icm.workingProfile == "Beta RGB")   {
-                adjustr = 1.f / 1.2f;
-            } else if (params.icm.workingProfile == "BestRGB")    {
-                adjustr = 1.f / 1.2f;
-            } else if (params.icm.workingProfile == "BruceRGB")   {
-                adjustr = 1.f / 1.2f;
-            }
+                float multip = 1.f;
 
-            float delta[9];
-            int mode = 1;
-            int lissage = settings->leveldnliss;
+                if (!parent->imgsrc->isRAW()) {
+                    multip = 2.f;    //take into account gamma for TIF / JPG approximate value...not good for gamma=1
+                }
 
-            for (int k = 0; k < 9; k++) {
-                float maxmax = max(parent->denoiseInfoStore.max_r[k], parent->denoiseInfoStore.max_b[k]);
-                parent->ipf.calcautodn_info(parent->denoiseInfoStore.ch_M[k], delta[k], Nb[k], levaut, maxmax, lumL[k], chromC[k], mode, lissage, ry[k], sk[k], pcsk[k]);
-                //  printf("ch_M=%f delta=%f\n",ch_M[k], delta[k]);
-            }
+                float adjustr = 1.f;
 
-            for (int k = 0; k < 9; k++) {
-                if (parent->denoiseInfoStore.max_r[k] > parent->denoiseInfoStore.max_b[k]) {
-                    Max_R[k] = (delta[k]) / ((autoNRmax * multip * adjustr * lowdenoise) / 2.f);
-                    Min_B[k] = - (parent->denoiseInfoStore.ch_M[k] - min_b[k]) / (autoNRmax * multip * adjustr * lowdenoise);
-                    Max_B[k] = 0.f;
-                    Min_R[k] = 0.f;
-                } else {
-                    Max_B[k] = (delta[k]) / ((autoNRmax * multip * adjustr * lowdenoise) / 2.f);
-                    Min_R[k] = - (parent->denoiseInfoStore.ch_M[k] - min_r[k])   / (autoNRmax * multip * adjustr * lowdenoise);
-                    Min_B[k] = 0.f;
-                    Max_R[k] = 0.f;
+                if (params.icm.workingProfile == "ProPhoto")   {
+                    adjustr = 1.f;   //
+                } else if (params.icm.workingProfile == "Adobe RGB")  {
+                    adjustr = 1.f / 1.3f;
+                } else if (params.icm.workingProfile == "sRGB")       {
+                    adjustr = 1.f / 1.3f;
+                } else if (params.icm.workingProfile == "WideGamut")  {
+                    adjustr = 1.f / 1.1f;
+                } else if (params.icm.workingProfile == "Beta RGB")   {
+                    adjustr = 1.f / 1.2f;
+                } else if (params.icm.workingProfile == "BestRGB")    {
+                    adjustr = 1.f / 1.2f;
+                } else if (params.icm.workingProfile == "BruceRGB")   {
+                    adjustr = 1.f / 1.2f;
                 }
-            }
 
-            for (int k = 0; k < 9; k++) {
-                //  printf("ch_M= %f Max_R=%f Max_B=%f min_r=%f min_b=%f\n",ch_M[k],Max_R[k], Max_B[k],Min_R[k], Min_B[k]);
-                chM += parent->denoiseInfoStore.ch_M[k];
-                MaxBMoy += Max_B[k];
-                MaxRMoy += Max_R[k];
-                MinRMoy += Min_R[k];
-                MinBMoy += Min_B[k];
+                float delta[9];
+                int mode = 1;
+                int lissage = settings->leveldnliss;
 
-                if (Max_R[k] > MaxR) {
-                    MaxR = Max_R[k];
+                for (int k = 0; k < 9; k++) {
+                    float maxmax = max(parent->denoiseInfoStore.max_r[k], parent->denoiseInfoStore.max_b[k]);
+                    parent->ipf.calcautodn_info(parent->denoiseInfoStore.ch_M[k], delta[k], Nb[k], levaut, maxmax, lumL[k], chromC[k], mode, lissage, ry[k], sk[k], pcsk[k]);
+                    //  printf("ch_M=%f delta=%f\n",ch_M[k], delta[k]);
                 }
 
-                if (Max_B[k] > MaxB) {
-                    MaxB = Max_B[k];
+                for (int k = 0; k < 9; k++) {
+                    if (parent->denoiseInfoStore.max_r[k] > parent->denoiseInfoStore.max_b[k]) {
+                        Max_R[k] = (delta[k]) / ((autoNRmax * multip * adjustr * lowdenoise) / 2.f);
+                        Min_B[k] = - (parent->denoiseInfoStore.ch_M[k] - min_b[k]) / (autoNRmax * multip * adjustr * lowdenoise);
+                        Max_B[k] = 0.f;
+                        Min_R[k] = 0.f;
+                    } else {
+                        Max_B[k] = (delta[k]) / ((autoNRmax * multip * adjustr * lowdenoise) / 2.f);
+                        Min_R[k] = - (parent->denoiseInfoStore.ch_M[k] - min_r[k])   / (autoNRmax * multip * adjustr * lowdenoise);
+                        Min_B[k] = 0.f;
+                        Max_R[k] = 0.f;
+                    }
                 }
 
-                if (Min_R[k] < MinR) {
-                    MinR = Min_R[k];
-                }
+                for (int k = 0; k < 9; k++) {
+                    //  printf("ch_M= %f Max_R=%f Max_B=%f min_r=%f min_b=%f\n",ch_M[k],Max_R[k], Max_B[k],Min_R[k], Min_B[k]);
+                    chM += parent->denoiseInfoStore.ch_M[k];
+                    MaxBMoy += Max_B[k];
+                    MaxRMoy += Max_R[k];
+                    MinRMoy += Min_R[k];
+                    MinBMoy += Min_B[k];
+
+                    if (Max_R[k] > MaxR) {
+                        MaxR = Max_R[k];
+                    }
+
+                    if (Max_B[k] > MaxB) {
+                        MaxB = Max_B[k];
+                    }
 
-                if (Min_B[k] < MinB) {
-                    MinB = Min_B[k];
+                    if (Min_R[k] < MinR) {
+                        MinR = Min_R[k];
+                    }
+
+                    if (Min_B[k] < MinB) {
+                        MinB = Min_B[k];
+                    }
                 }
-            }
 
-            chM /= 9;
-            MaxBMoy /= 9;
-            MaxRMoy /= 9;
-            MinBMoy /= 9;
-            MinRMoy /= 9;
+                chM /= 9;
+                MaxBMoy /= 9;
+                MaxRMoy /= 9;
+                MinBMoy /= 9;
+                MinRMoy /= 9;
 
-            if (MaxR > MaxB) {
-                maxr = MaxRMoy + (MaxR - MaxRMoy) * 0.66f; //#std Dev
-                //maxb=MinB;
-                maxb = MinBMoy + (MinB - MinBMoy) * 0.66f;
-            } else {
-                maxb = MaxBMoy + (MaxB - MaxBMoy) * 0.66f;
-                maxr = MinRMoy + (MinR - MinRMoy) * 0.66f;
-            }
+                if (MaxR > MaxB) {
+                    maxr = MaxRMoy + (MaxR - MaxRMoy) * 0.66f; //#std Dev
+                    //maxb=MinB;
+                    maxb = MinBMoy + (MinB - MinBMoy) * 0.66f;
+                } else {
+                    maxb = MaxBMoy + (MaxB - MaxBMoy) * 0.66f;
+                    maxr = MinRMoy + (MinR - MinRMoy) * 0.66f;
+                }
 
-//                  printf("DCROP skip=%d cha=%f red=%f bl=%f \n",skip, chM,maxr,maxb);
-            params.dirpyrDenoise.chroma = chM / (autoNR * multip * adjustr);
-            params.dirpyrDenoise.redchro = maxr;
-            params.dirpyrDenoise.bluechro = maxb;
-            parent->denoiseInfoStore.valid = true;
+    //                  printf("DCROP skip=%d cha=%f red=%f bl=%f \n",skip, chM,maxr,maxb);
+                params.dirpyrDenoise.chroma = chM / (autoNR * multip * adjustr);
+                params.dirpyrDenoise.redchro = maxr;
+                params.dirpyrDenoise.bluechro = maxb;
+                parent->denoiseInfoStore.valid = true;
 
-            if (parent->adnListener) {
-                parent->adnListener->chromaChanged(params.dirpyrDenoise.chroma, params.dirpyrDenoise.redchro, params.dirpyrDenoise.bluechro);
-            }
+                if (parent->adnListener) {
+                    parent->adnListener->chromaChanged(params.dirpyrDenoise.chroma, params.dirpyrDenoise.redchro, params.dirpyrDenoise.bluechro);
+                }
 
-            if (settings->verbose) {
-                t2aue.set();
-                printf("Info denoise auto performed in %d usec:\n", t2aue.etime(t1aue));
-            }
+                if (settings->verbose) {
+                    t2aue.set();
+                    printf("Info denoise auto performed in %d usec:\n", t2aue.etime(t1aue));
+                }
 
-            //end evaluate noise
+                //end evaluate noise
+            });
         }
 
         //  if (params.dirpyrDenoise.Cmethod=="AUT" || params.dirpyrDenoise.Cmethod=="PON") {//reinit origCrop after Auto
@@ -623,6 +703,10 @@ void Crop::update(int todo)
             parent->ipf.removeSpots(origCrop, parent->imgsrc, params.spot.entries, pp, parent->currWB, nullptr, tr);
         }
 
+        if (autoDenoiseInfo) {
+            analyses.join(autoDenoiseInfoTask);
+        }
+
         DirPyrDenoiseParams denoiseParams = params.dirpyrDenoise;
 
         if (params.dirpyrDenoise.Lmethod == "CUR") {
@@ -702,6 +786,13 @@ void Crop::update(int todo)
 
     }
 
+    if (parent->ipf.isCancelled()) {
+        // newer parameters arrived while denoising, the next update starts over. The pipette keeps reading
+        // the previous values until then, instead of waiting for a buffer which won't be filled.
+        PipetteBuffer::setReady();
+        return;
+    }
+
     // has to be called after setCropSizes! Tools prior to this point can't handle the Edit mechanism, but that shouldn't be a problem.
     createBuffer(cropw, croph);
 
@@ -729,7 +820,7 @@ void Crop::update(int todo)
 
     std::unique_ptr<Imagefloat> fattalCrop;
 
-    if ((todo & M_HDR) && (params.fattal.enabled || params.dehaze.enabled)) {
+    if ((todo & M_HDR) && (params.fattal.enabled || params.dehaze.enabled) && !upstreamCached) {
         Imagefloat *f = origCrop;
         int fw = skips(parent->fw, skip);
         int fh = skips(parent->fh, skip);
@@ -779,7 +870,18 @@ void Crop::update(int todo)
 
         if (need_fattal) {
             parent->ipf.dehaze(f, params.dehaze);
-            parent->ipf.ToneMapFattal02(f, params.fattal, 3, 0, nullptr, 0, 0, 0);
+            parent->ipf.ToneMapFattal02(f, params.fattal, 3, 0, nullptr, 0, 0, 0, true);
+
+            if (parent->ipf.isCancelled()) {
+                if (f == parent->fattal_11_dcrop_cache) {
+                    // don't keep the incomplete result in the cache
+                    delete parent->fattal_11_dcrop_cache;
+                    parent->fattal_11_dcrop_cache = nullptr;
+                }
+
+                PipetteBuffer::setReady();
+                return;
+            }
         }
 
         // crop back to the size expected by the rest of the pipeline
@@ -809,9 +911,15 @@ void Crop::update(int todo)
         }
     }
 
+    if (useUpstreamCache && !upstreamCached) {
+        parent->pipelineCache.store(upstreamKey, baseCrop, static_cast<size_t>(options.pipelineCacheMemory) << 20);
+    }
+
     const bool needstransform  = parent->ipf.needsTransform(skips(parent->fw, skip), skips(parent->fh, skip), parent->imgsrc->getRotateDegree(), parent->imgsrc->getMetaData());
     // transform
     if (needstransform || ((todo & (M_TRANSFORM | M_RGBCURVE)) && params.dirpyrequalizer.cbdlMethod == "bef" && params.dirpyrequalizer.enabled && !params.colorappearance.enabled)) {
+        TRACE_SCOPE("transform", "stage");
+
         if (!transCrop) {
             transCrop = new Imagefloat(cropw, croph);
         }
@@ -848,6 +956,7 @@ void Crop::update(int todo)
     
         //I made a little change here. Rather than have luminanceCurve (and others) use in/out lab images, we can do more if we copy right here.
         parent->ipf.rgb2lab(*baseCrop, *laboCrop, params.icm.workingProfile);
+        labCheckpoints.clear();
  
 
         labnCrop->CopyFrom(laboCrop);
@@ -953,6 +1062,10 @@ void Crop::update(int todo)
         fabrefp = new float[sizespot];
 */
         for (int sp = 0; sp < (int)params.locallab.spots.size(); sp++) {
+            if (parent->ipf.isCancelled()) {
+                break;
+            }
+
             locRETgainCurve.Set(params.locallab.spots.at(sp).localTgaincurve);
             locRETtransCurve.Set(params.locallab.spots.at(sp).localTtranscurve);
             const bool LHutili = loclhCurve.Set(params.locallab.spots.at(sp).LHcurve);
@@ -1243,11 +1356,17 @@ void Crop::update(int todo)
                 delete [] lumarefp;
                 delete [] fabrefp;
         */
-        
+
+        if (parent->ipf.isCancelled()) {
+            PipetteBuffer::setReady();
+            return;
+        }
+
         parent->ipf.lab2rgb(*labnCrop, *baseCrop, params.icm.workingProfile);
     }
 
     if (todo & M_RGBCURVE) {
+        TRACE_SCOPE("rgbProc", "stage");
         double rrm, ggm, bbm;
         DCPProfileApplyState as;
         DCPProfile *dcpProf = parent->imgsrc->getDCP(params.icm, as);
@@ -1257,12 +1376,20 @@ void Crop::update(int todo)
                             params.toneCurve.saturation, parent->rCurve, parent->gCurve, parent->bCurve, parent->colourToningSatLimit, parent->colourToningSatLimitOpacity, parent->ctColorCurve, parent->ctOpacityCurve, parent->opautili, parent->clToningcurve, parent->cl2Toningcurve,
                             parent->customToneCurve1, parent->customToneCurve2, parent->beforeToneCurveBW, parent->afterToneCurveBW, rrm, ggm, bbm,
                             parent->bwAutoR, parent->bwAutoG, parent->bwAutoB, dcpProf, as, histToneCurve);
+        labCheckpoints.clear();
     }
 
     // apply luminance operations
     if (todo & (M_LUMINANCE + M_COLOR)) { //
         //I made a little change here. Rather than have luminanceCurve (and others) use in/out lab images, we can do more if we copy right here.
-        labnCrop->CopyFrom(laboCrop);
+        // The copy is skipped for the stages which are not affected by the changes, their cached output is restored instead.
+        const LabCheckpoints::Stage firstStage = labCheckpoints.restart(params, laboCrop, labnCrop, static_cast<size_t>(options.labCheckpointMemory) << 20);
+        const auto storeCheckpoint = [this](LabCheckpoints::Stage stage) {
+            // the output of a cancelled update must not be reused
+            if (!parent->ipf.isCancelled()) {
+                labCheckpoints.store(stage, labnCrop);
+            }
+        };
 
         bool utili = parent->utili;
         bool autili = parent->autili;
@@ -1272,50 +1399,61 @@ void Crop::update(int todo)
         bool cclutili = parent->cclutili;
 
         LUTu dummy;
-        if (params.colorToning.enabled && params.colorToning.method == "LabGrid") {
-            parent->ipf.colorToningLabGrid(labnCrop, 0,labnCrop->W , 0, labnCrop->H, false);
-        }
+        if (firstStage <= LabCheckpoints::ADJUSTMENTS) {
+            if (params.colorToning.enabled && params.colorToning.method == "LabGrid") {
+                parent->ipf.colorToningLabGrid(labnCrop, 0,labnCrop->W , 0, labnCrop->H, false);
+            }
 
-        parent->ipf.shadowsHighlights(labnCrop, params.sh.enabled, params.sh.lab,params.sh.highlights ,params.sh.shadows, params.sh.radius, skip, params.sh.htonalwidth, params.sh.stonalwidth);
-        
-        if (params.localContrast.enabled) {
-        // Alberto's local contrast
-            parent->ipf.localContrast(labnCrop, labnCrop->L, params.localContrast, false, skip);
+            parent->ipf.shadowsHighlights(labnCrop, params.sh.enabled, params.sh.lab,params.sh.highlights ,params.sh.shadows, params.sh.radius, skip, params.sh.htonalwidth, params.sh.stonalwidth);
+
+            if (params.localContrast.enabled) {
+            // Alberto's local contrast
+                parent->ipf.localContrast(labnCrop, labnCrop->L, params.localContrast, false, skip);
+            }
+            parent->ipf.chromiLuminanceCurve(this, 1, labnCrop, labnCrop, parent->chroma_acurve, parent->chroma_bcurve, parent->satcurve, parent->lhskcurve,  parent->clcurve, parent->lumacurve, utili, autili, butili, ccutili, cclutili, clcutili, dummy, dummy);
+            parent->ipf.vibrance(labnCrop, params.vibrance, params.toneCurve.hrenabled, params.icm.workingProfile);
+            parent->ipf.labColorCorrectionRegions(labnCrop);
+            storeCheckpoint(LabCheckpoints::ADJUSTMENTS);
         }
-        parent->ipf.chromiLuminanceCurve(this, 1, labnCrop, labnCrop, parent->chroma_acurve, parent->chroma_bcurve, parent->satcurve, parent->lhskcurve,  parent->clcurve, parent->lumacurve, utili, autili, butili, ccutili, cclutili, clcutili, dummy, dummy);
-        parent->ipf.vibrance(labnCrop, params.vibrance, params.toneCurve.hrenabled, params.icm.workingProfile);
-        parent->ipf.labColorCorrectionRegions(labnCrop);
 
-        if ((params.colorappearance.enabled && !params.colorappearance.tonecie) || (!params.colorappearance.enabled)) {
-            parent->ipf.EPDToneMap(labnCrop, 0, skip);
+        if (firstStage <= LabCheckpoints::TONEMAPPING && params.epd.enabled) {
+            if ((params.colorappearance.enabled && !params.colorappearance.tonecie) || (!params.colorappearance.enabled)) {
+                parent->ipf.EPDToneMap(labnCrop, 0, skip);
+            }
+
+            storeCheckpoint(LabCheckpoints::TONEMAPPING);
         }
 
         //parent->ipf.EPDToneMap(labnCrop, 5, 1);    //Go with much fewer than normal iterates for fast redisplay.
         // for all treatments Defringe, Sharpening, Contrast detail , Microcontrast they are activated if "CIECAM" function are disabled
-        if (skip == 1) {
-            if ((params.colorappearance.enabled && !settings->autocielab)  || (!params.colorappearance.enabled)) {
-                parent->ipf.impulsedenoise(labnCrop);
-                parent->ipf.defringe(labnCrop);
-            }
+        if (firstStage <= LabCheckpoints::DETAIL) {
+            if (skip == 1) {
+                if ((params.colorappearance.enabled && !settings->autocielab)  || (!params.colorappearance.enabled)) {
+                    parent->ipf.impulsedenoise(labnCrop);
+                    parent->ipf.defringe(labnCrop);
+                }
 
-            parent->ipf.MLsharpen(labnCrop);
+                parent->ipf.MLsharpen(labnCrop);
 
-            if ((params.colorappearance.enabled && !settings->autocielab)  || (!params.colorappearance.enabled)) {
-                parent->ipf.MLmicrocontrast(labnCrop);
-                parent->ipf.sharpening(labnCrop, params.sharpening, parent->sharpMask);
+                if ((params.colorappearance.enabled && !settings->autocielab)  || (!params.colorappearance.enabled)) {
+                    parent->ipf.MLmicrocontrast(labnCrop);
+                    parent->ipf.sharpening(labnCrop, params.sharpening, parent->sharpMask);
+                }
             }
-        }
 
-        //   if (skip==1) {
+            //   if (skip==1) {
 
-        if (params.dirpyrequalizer.cbdlMethod == "aft") {
-            if (((params.colorappearance.enabled && !settings->autocielab)  || (!params.colorappearance.enabled))) {
-                parent->ipf.dirpyrequalizer(labnCrop, skip);
-                //  parent->ipf.Lanczoslab (labnCrop,labnCrop , 1.f/skip);
+            if (params.dirpyrequalizer.cbdlMethod == "aft") {
+                if (((params.colorappearance.enabled && !settings->autocielab)  || (!params.colorappearance.enabled))) {
+                    parent->ipf.dirpyrequalizer(labnCrop, skip);
+                    //  parent->ipf.Lanczoslab (labnCrop,labnCrop , 1.f/skip);
+                }
             }
+
+            storeCheckpoint(LabCheckpoints::DETAIL);
         }
 
-        if ((params.wavelet.enabled)) {
+        if (firstStage <= LabCheckpoints::WAVELET && params.wavelet.enabled) {
             WaveletParams WaveParams = params.wavelet;
             int kall = 0;
             int minwin = min(labnCrop->W, labnCrop->H);
@@ -1440,7 +1578,7 @@ void Crop::update(int todo)
         
 //        parent->ipf.ip_wavelet(labnCrop, labnCrop, kall, WaveParams, wavCLVCurve, wavblcurve, waOpacityCurveRG, waOpacityCurveBY, waOpacityCurveW, waOpacityCurveWL, parent->wavclCurve, skip);
         
-        parent->ipf.ip_wavelet(labnCrop, labnCrop, kall, WaveParams, wavCLVCurve, wavdenoise, wavdenoiseh, wavblcurve, waOpacityCurveRG, waOpacityCurveSH, waOpacityCurveBY, waOpacityCurveW, waOpacityCurveWL, parent->wavclCurve, skip);
+        parent->ipf.ip_wavelet(labnCrop, labnCrop, kall, WaveParams, wavCLVCurve, wavdenoise, wavdenoiseh, wavblcurve, waOpacityCurveRG, waOpacityCurveSH, waOpacityCurveBY, waOpacityCurveW, waOpacityCurveWL, parent->wavclCurve, skip, &waveletCache);
 
             if ((WaveParams.ushamethod == "sharp" || WaveParams.ushamethod == "clari") && WaveParams.expclari && WaveParams.CLmethod != "all") {
                 WaveParams.expcontrast = procont;
@@ -1565,11 +1703,14 @@ void Crop::update(int todo)
         
 
 
+            storeCheckpoint(LabCheckpoints::WAVELET);
         }
-        
-        parent->ipf.softLight(labnCrop, params.softlight);
 
-        if (params.icm.workingTRC != ColorManagementParams::WorkingTrc::NONE) {
+        if (firstStage <= LabCheckpoints::FINISHING) {
+            parent->ipf.softLight(labnCrop, params.softlight);
+        }
+
+        if (firstStage <= LabCheckpoints::FINISHING && params.icm.workingTRC != ColorManagementParams::WorkingTrc::NONE) {
             const int GW = labnCrop->W;
             const int GH = labnCrop->H;
             std::unique_ptr<LabImage> provis;
@@ -1613,7 +1754,11 @@ void Crop::update(int todo)
             }
         }
 
-        if (params.colorappearance.enabled) {
+        if (firstStage <= LabCheckpoints::FINISHING) {
+            storeCheckpoint(LabCheckpoints::FINISHING);
+        }
+
+        if (firstStage <= LabCheckpoints::CIECAM && params.colorappearance.enabled) {
             float fnum = parent->imgsrc->getMetaData()->getFNumber();          // F number
             float fiso = parent->imgsrc->getMetaData()->getISOSpeed() ;        // ISO
             float fspeed = parent->imgsrc->getMetaData()->getShutterSpeed() ;  // Speed
@@ -1644,7 +1789,8 @@ void Crop::update(int todo)
             float d, dj, yb; // not used after this block
             parent->ipf.ciecam_02float(cieCrop, float (adap), 1, 2, labnCrop, &params, parent->customColCurve1, parent->customColCurve2, parent->customColCurve3,
                                        dummy, dummy, parent->CAMBrightCurveJ, parent->CAMBrightCurveQ, parent->CAMMean, 0, skip, execsharp, d, dj, yb, 1, parent->sharpMask);
-        } else {
+            storeCheckpoint(LabCheckpoints::CIECAM);
+        } else if (!params.colorappearance.enabled) {
             // CIECAM is disabled, we free up its image buffer to save some space
             if (cieCrop) {
                 delete cieCrop;
@@ -1657,6 +1803,11 @@ void Crop::update(int todo)
     // all pipette buffer processing should be finished now
     PipetteBuffer::setReady();
 
+    if (parent->ipf.isCancelled()) {
+        // don't show the incomplete result
+        return;
+    }
+
 
 
     // Computing the preview image, i.e. converting from lab->Monitor color space (soft-proofing disabled) or lab->Output profile->Monitor color space (soft-proofing enabled)
@@ -1688,7 +1839,14 @@ void Crop::update(int todo)
             memcpy(finaltrue->data + 3 * i * finalW, cropImgtrue->data + 3 * (i + upperBorder)*cropw + 3 * leftBorder, 3 * finalW);
         }
 
-        cropImageListener->setDetailedCrop(final, finaltrue, params.icm, params.crop, rqcropx, rqcropy, rqcropw, rqcroph, skip);
+        if (useViewportCache) {
+            viewportCache.store(generation, cropx + leftBorder, cropy + upperBorder, final, finaltrue);
+        }
+
+        if (!prefetching) {
+            cropImageListener->setDetailedCrop(final, finaltrue, params.icm, params.crop, rqcropx, rqcropy, rqcropw, rqcroph, skip);
+        }
+
         delete final;
         delete finaltrue;
         delete cropImgtrue;
@@ -1720,6 +1878,8 @@ void Crop::freeAll()
             labnCrop = nullptr;
         }
 
+        labCheckpoints.clear();
+
         if (cropImg) {
             delete    cropImg;
             cropImg = nullptr;
@@ -1897,6 +2057,7 @@ bool Crop::setCropSizes(int cropX, int cropY, int cropW, int cropH, int skip, bo
         }
 
         labnCrop = new LabImage(cropw, croph);
+        labCheckpoints.clear();
 
         if (!cropImg) {
             cropImg = new Image8;
@@ -1965,9 +2126,102 @@ bool Crop::tryUpdate()
         updating = true;
     }
 
+    if (!needsNewThread) {
+        // a render ahead of the panning must not delay the requested one
+        cancelPrefetch();
+    }
+
     return needsNewThread;
 }
 
+void Crop::cancelPrefetch()
+{
+    MyMutex::MyLock lock(prefetchMutex);
+
+    if (prefetching) {
+        parent->cancelToken.request();
+    }
+}
+
+/** @brief Window to render ahead of the panning at 100%
+  *
+  * The last window, extended by half its size in the panning direction, so that the next moves are cut
+  * from a single render.
+  *
+  * @return false if there is nothing to prefetch
+  */
+bool Crop::getPrefetchWindow(int &x, int &y, int &w, int &h) const
+{
+    if (!cropImageListener || lastWindowSkip != 1 || (panX == 0 && panY == 0) || getCurrEditID() != EUID_None) {
+        return false;
+    }
+
+    x = lastWindowX;
+    y = lastWindowY;
+    w = lastWindowW;
+    h = lastWindowH;
+
+    if (panX > 0) {
+        w += lastWindowW / 2;
+    } else if (panX < 0) {
+        x -= lastWindowW / 2;
+        w += lastWindowW / 2;
+    }
+
+    if (panY > 0) {
+        h += lastWindowH / 2;
+    } else if (panY < 0) {
+        y -= lastWindowH / 2;
+        h += lastWindowH / 2;
+    }
+
+    if (x < 0) {
+        w += x;
+        x = 0;
+    }
+
+    if (y < 0) {
+        h += y;
+        y = 0;
+    }
+
+    w = std::min(w, parent->fullw - x);
+    h = std::min(h, parent->fullh - y);
+
+    return w > 0 && h > 0 && !viewportCache.contains(parent->paramsGeneration, x, y, w, h);
+}
+
+/** @brief Renders ahead of the panning into the viewport cache
+  *
+  * Called by the updater thread when no update is pending, it is cancelled by the next request.
+  */
+void Crop::prefetch()
+{
+    {
+        MyMutex::MyLock cropLock(cropMutex);
+
+        if (!getPrefetchWindow(prefetchX, prefetchY, prefetchW, prefetchH)) {
+            return;
+        }
+    }
+
+    {
+        MyMutex::MyLock lock(prefetchMutex);
+
+        if (newUpdatePending) {
+            return;
+        }
+
+        prefetching = true;
+    }
+
+    update(ALL);
+
+    MyMutex::MyLock lock(prefetchMutex);
+    prefetching = false;
+    parent->cancelToken.reset();
+}
+
 /* @brief Handles Crop updating in its own thread
  *
  * This method will cycle updates as long as Crop::newUpdatePending will be true. During the processing,
@@ -1991,12 +2245,19 @@ void Crop::fullUpdate()
         parent->plistener->setProgressState(true);
     }
 
+    BufferPool::Scope bufferScope;
+    trace::setThreadName("Crop");
+
     // If there are more update request, the following WHILE will collect it
     newUpdatePending = true;
 
     while (newUpdatePending) {
         newUpdatePending = false;
         update(ALL);
+
+        if (!newUpdatePending) {
+            prefetch();
+        }
     }
 
     updating = false;  // end of crop update
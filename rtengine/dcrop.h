@@ -18,8 +18,11 @@
  */
 #pragma once
 
+#include "labcheckpoints.h"
 #include "rtengine.h"
 #include "pipettebuffer.h"
+#include "viewportcache.h"
+#include "waveletcache.h"
 #include "../rtgui/threadutils.h"
 
 namespace rtengine
@@ -41,6 +44,8 @@ protected:
     Imagefloat*  spotCrop;   // "one chunk" allocation
     LabImage*    laboCrop;   // "one chunk" allocation
     LabImage*    labnCrop;   // "one chunk" allocation
+    LabCheckpoints labCheckpoints; // cached outputs of the Lab stages computing labnCrop from laboCrop
+    WaveletCache waveletCache; // decompositions of the wavelet levels tool of the crop
     Image8*      cropImg;    // "one chunk" allocation ; displayed image in monitor color space, showing the output profile as well (soft-proofing enabled, which then correspond to workimg) or not
     float *      shbuf_real;  // "one chunk" allocation
 
@@ -62,11 +67,22 @@ protected:
     bool cropAllocated;
     DetailedCropListener* cropImageListener;
 
+    // --- panning at 100%
+    ViewportCache viewportCache;            /// output of the last renders, windows inside them are not rendered again
+    bool buffersStale;                      /// the buffers above don't belong to the current window, the next update has to do everything
+    int lastWindowX, lastWindowY, lastWindowW, lastWindowH, lastWindowSkip; /// last displayed window
+    int panX, panY;                         /// last panning move
+    bool prefetching;                       /// rendering ahead of the panning instead of the requested window, guarded by prefetchMutex
+    int prefetchX, prefetchY, prefetchW, prefetchH;
+    MyMutex prefetchMutex;
+
     MyMutex cropMutex;
     ImProcCoordinator* const parent;
     const bool isDetailWindow;
     EditUniqueID getCurrEditID() const;
     bool setCropSizes(int cropX, int cropY, int cropW, int cropH, int skip, bool internal);
+    bool getPrefetchWindow(int &x, int &y, int &w, int &h) const;
+    void prefetch();
     void freeAll();
 
 public:
@@ -87,6 +103,8 @@ public:
     bool tryUpdate   () override;
     /** @brief Asynchronously reprocess the detailed crop */
     void fullUpdate  () override;  // called via thread
+    /** @brief Aborts a running render ahead of the panning, which holds the updater lock of the parent */
+    void cancelPrefetch();
 
     void setListener    (DetailedCropListener* il) override;
     void destroy        () override;
@@ -0,0 +1,506 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <ostream>
+#include <sstream>
+
+#include "demosaicbenchmark.h"
+#include "iccmatrices.h"
+#include "mytime.h"
+#include "procparams.h"
+#include "rawimage.h"
+#include "rawimagesource.h"
+#include "rt_math.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace
+{
+
+using rtengine::procparams::RAWParams;
+
+// standard X-Trans layout, 0 = red, 1 = green, 2 = blue
+constexpr int xtransPattern[6][6] = {
+    {1, 1, 0, 1, 1, 2},
+    {1, 1, 2, 1, 1, 0},
+    {2, 0, 1, 0, 2, 1},
+    {1, 1, 2, 1, 1, 0},
+    {1, 1, 0, 1, 1, 2},
+    {0, 2, 1, 2, 0, 1}
+};
+
+// RGGB
+constexpr unsigned bayerFilters = 0x94949494;
+
+// pixels near the frame are excluded from the quality measurement, demosaicers treat them differently
+constexpr int qualityMargin = 16;
+
+struct BenchMethod {
+    bool isBayer;
+    std::string name;
+    bool autoContrast;
+};
+
+std::vector<BenchMethod> getMethods(const rtengine::DemosaicBenchmark::Config &config)
+{
+    using Bayer = RAWParams::BayerSensor::Method;
+    using XTrans = RAWParams::XTransSensor::Method;
+
+    std::vector<BenchMethod> methods;
+
+    if (config.bayer) {
+        for (const auto method : {Bayer::AMAZE, Bayer::AMAZEBILINEAR, Bayer::AMAZEVNG4, Bayer::RCD, Bayer::RCDBILINEAR, Bayer::RCDVNG4,
+                                  Bayer::DCB, Bayer::DCBBILINEAR, Bayer::DCBVNG4, Bayer::LMMSE, Bayer::IGV, Bayer::AHD, Bayer::EAHD,
+                                  Bayer::HPHD, Bayer::VNG4, Bayer::FAST}) {
+            const Glib::ustring name = RAWParams::BayerSensor::getMethodString(method);
+            const bool dual = method == Bayer::AMAZEBILINEAR || method == Bayer::AMAZEVNG4 || method == Bayer::RCDBILINEAR
+                              || method == Bayer::RCDVNG4 || method == Bayer::DCBBILINEAR || method == Bayer::DCBVNG4;
+            methods.push_back({true, name.raw(), dual});
+        }
+    }
+
+    if (config.xtrans) {
+        for (const auto method : {XTrans::FOUR_PASS, XTrans::THREE_PASS, XTrans::TWO_PASS, XTrans::ONE_PASS, XTrans::FAST}) {
+            const Glib::ustring name = RAWParams::XTransSensor::getMethodString(method);
+            const bool dual = method == XTrans::FOUR_PASS || method == XTrans::TWO_PASS;
+            methods.push_back({false, name.raw(), dual});
+        }
+    }
+
+    if (!config.methods.empty()) {
+        methods.erase(std::remove_if(methods.begin(), methods.end(), [&config](const BenchMethod &m) {
+            return std::find(config.methods.begin(), config.methods.end(), m.name) == config.methods.end();
+        }), methods.end());
+    }
+
+    return methods;
+}
+
+#ifdef __linux__
+long readProcStatusKB(const char *key)
+{
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    const size_t keyLen = strlen(key);
+
+    while (std::getline(status, line)) {
+        if (line.compare(0, keyLen, key) == 0) {
+            return std::atol(line.c_str() + keyLen + 1);
+        }
+    }
+
+    return -1;
+}
+
+bool resetPeakRSS()
+{
+    // writing "5" to clear_refs resets VmHWM (Linux >= 4.0)
+    std::ofstream clearRefs("/proc/self/clear_refs");
+    clearRefs << "5";
+    return clearRefs.good();
+}
+#endif
+
+void rgb2lab(double r, double g, double b, double &L, double &a, double &bb)
+{
+    const auto f = [](double t) {
+        return t > 216.0 / 24389.0 ? std::cbrt(t) : (24389.0 / 27.0 * t + 16.0) / 116.0;
+    };
+
+    const double x = (xyz_sRGB[0][0] * r + xyz_sRGB[0][1] * g + xyz_sRGB[0][2] * b) / 0.9642;
+    const double y = xyz_sRGB[1][0] * r + xyz_sRGB[1][1] * g + xyz_sRGB[1][2] * b;
+    const double z = (xyz_sRGB[2][0] * r + xyz_sRGB[2][1] * g + xyz_sRGB[2][2] * b) / 0.8249;
+    const double fx = f(x);
+    const double fy = f(y);
+    const double fz = f(z);
+    L = 116.0 * fy - 16.0;
+    a = 500.0 * (fx - fy);
+    bb = 200.0 * (fy - fz);
+}
+
+}
+
+namespace rtengine
+{
+
+void DemosaicBenchmark::buildTestChart(array2D<float> (&truth)[3])
+{
+    const int W = truth[0].getWidth();
+    const int H = truth[0].getHeight();
+    const int halfW = W / 2;
+    const int halfH = H / 2;
+    // the zone plate reaches Nyquist frequency at the corners of its quadrant
+    const double zoneK = RT_PI / (2.0 * std::max(halfW, halfH));
+    const double slope = std::tan(5.0 * RT_PI / 180.0);
+    static constexpr float patches[8][3] = {
+        {0.9f, 0.05f, 0.05f}, {0.05f, 0.9f, 0.05f}, {0.05f, 0.05f, 0.9f}, {0.05f, 0.9f, 0.9f},
+        {0.9f, 0.05f, 0.9f}, {0.9f, 0.9f, 0.05f}, {0.9f, 0.9f, 0.9f}, {0.05f, 0.05f, 0.05f}
+    };
+
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic, 16)
+#endif
+    for (int i = 0; i < H; ++i) {
+        for (int j = 0; j < W; ++j) {
+            float rgb[3];
+
+            if (i < halfH && j < halfW) {
+                // zone plate, slightly tinted
+                const double dx = j - halfW / 2.0;
+                const double dy = i - halfH / 2.0;
+                const float v = 0.5 + 0.45 * std::cos(zoneK * (dx * dx + dy * dy));
+                rgb[0] = v;
+                rgb[1] = 0.9f * v + 0.05f;
+                rgb[2] = 0.8f * v + 0.1f;
+            } else if (i < halfH) {
+                // saturated patches with slanted edges
+                const int band = static_cast<int>(std::floor((j - halfW + slope * i) / 64.0));
+                const int stripe = static_cast<int>(std::floor((i - slope * (j - halfW)) / 64.0));
+                const int patch = (((band + 3 * stripe) % 8) + 8) % 8;
+                rgb[0] = patches[patch][0];
+                rgb[1] = patches[patch][1];
+                rgb[2] = patches[patch][2];
+            } else if (j < halfW) {
+                // smooth hue sweep horizontally, brightness vertically
+                const double hue = 6.0 * j / halfW;
+                const double value = 0.05 + 0.9 * (i - halfH) / std::max(1, H - halfH - 1);
+
+                for (int c = 0; c < 3; ++c) {
+                    const double d = std::fabs(std::fmod(hue + 4.0 - 2.0 * c, 6.0) - 3.0);
+                    rgb[c] = value * (0.1 + 0.9 * LIM01(d - 1.0));
+                }
+            } else {
+                // fine colour gratings of rising frequency, phase shifted per channel
+                const double t = static_cast<double>(j - halfW) / std::max(1, W - halfW);
+                const double freq = 0.02 + 0.45 * t * t;
+
+                for (int c = 0; c < 3; ++c) {
+                    rgb[c] = 0.5 + 0.4 * std::sin(2.0 * RT_PI * freq * (j + 0.3 * i) + c * 2.0 * RT_PI / 3.0);
+                }
+            }
+
+            for (int c = 0; c < 3; ++c) {
+                truth[c][i][j] = 65535.f * rtengine::LIM(rgb[c], 0.02f, 0.95f);
+            }
+        }
+    }
+}
+
+void DemosaicBenchmark::setupSource(RawImageSource &src, const array2D<float> (&truth)[3], bool xtrans)
+{
+    const int W = truth[0].getWidth();
+    const int H = truth[0].getHeight();
+
+    RawImage *ri = new RawImage("");
+    ri->initSyntheticCFA(W, H, xtrans ? 9 : bayerFilters, xtrans ? xtransPattern : nullptr);
+
+#ifdef _OPENMP
+    #pragma omp parallel for
+#endif
+    for (int i = 0; i < H; ++i) {
+        for (int j = 0; j < W; ++j) {
+            ri->data[i][j] = truth[xtrans ? ri->XTRANSFC(i, j) : ri->FC(i, j)][i][j];
+        }
+    }
+
+    src.riFrames[0] = ri;
+    src.numFrames = 1;
+    src.currFrame = 0;
+    src.ri = ri;
+    src.W = W;
+    src.H = H;
+    src.border = xtrans ? 7 : 4;
+    src.initialGain = 1.0;
+
+    for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            src.imatrices.rgb_cam[i][j] = src.imatrices.cam_rgb[i][j] = i == j;
+            src.imatrices.xyz_cam[i][j] = xyz_sRGB[i][j];
+        }
+    }
+
+    RawImageSource::inverse33(src.imatrices.xyz_cam, src.imatrices.cam_xyz);
+
+    src.red(W, H);
+    src.green(W, H);
+    src.blue(W, H);
+    src.rawData(W, H);
+    restoreRawData(src);
+}
+
+void DemosaicBenchmark::restoreRawData(RawImageSource &src)
+{
+#ifdef _OPENMP
+    #pragma omp parallel for
+#endif
+    for (int i = 0; i < src.H; ++i) {
+        memcpy(src.rawData[i], src.ri->data[i], src.W * sizeof(float));
+    }
+}
+
+void DemosaicBenchmark::measureQuality(const RawImageSource &src, const array2D<float> (&truth)[3], Result &result)
+{
+    const int W = src.W;
+    const int H = src.H;
+    const array2D<float> *out[3] = {&src.red, &src.green, &src.blue};
+    std::vector<float> deltaE(static_cast<size_t>(W - 2 * qualityMargin) * (H - 2 * qualityMargin));
+    double sqErr[3] = {};
+    double sumDeltaE = 0.0;
+    double sqErr0 = 0.0, sqErr1 = 0.0, sqErr2 = 0.0;
+
+#ifdef _OPENMP
+    #pragma omp parallel for reduction(+:sqErr0,sqErr1,sqErr2,sumDeltaE) schedule(dynamic, 16)
+#endif
+    for (int i = qualityMargin; i < H - qualityMargin; ++i) {
+        for (int j = qualityMargin; j < W - qualityMargin; ++j) {
+            double ref[3], val[3];
+
+            for (int c = 0; c < 3; ++c) {
+                ref[c] = truth[c][i][j] / 65535.0;
+                val[c] = LIM01((*out[c])[i][j] / 65535.f);
+            }
+
+            sqErr0 += SQR(val[0] - ref[0]);
+            sqErr1 += SQR(val[1] - ref[1]);
+            sqErr2 += SQR(val[2] - ref[2]);
+
+            double Lr, ar, br, Lv, av, bv;
+            rgb2lab(ref[0], ref[1], ref[2], Lr, ar, br);
+            rgb2lab(val[0], val[1], val[2], Lv, av, bv);
+            const double dE = std::sqrt(SQR(Lv - Lr) + SQR(av - ar) + SQR(bv - br));
+            sumDeltaE += dE;
+            deltaE[static_cast<size_t>(i - qualityMargin) * (W - 2 * qualityMargin) + j - qualityMargin] = dE;
+        }
+    }
+
+    sqErr[0] = sqErr0;
+    sqErr[1] = sqErr1;
+    sqErr[2] = sqErr2;
+    const double n = deltaE.size();
+
+    for (int c = 0; c < 3; ++c) {
+        result.psnr[c] = 10.0 * std::log10(n / std::max(sqErr[c], 1e-20));
+    }
+
+    result.psnrAll = 10.0 * std::log10(3.0 * n / std::max(sqErr[0] + sqErr[1] + sqErr[2], 1e-20));
+    result.meanDeltaE = sumDeltaE / n;
+    const auto p99 = deltaE.begin() + static_cast<size_t>(0.99 * (deltaE.size() - 1));
+    std::nth_element(deltaE.begin(), p99, deltaE.end());
+    result.maxDeltaE = *p99;
+}
+
+std::vector<DemosaicBenchmark::Result> DemosaicBenchmark::run(const Config &config, std::ostream &log)
+{
+    std::vector<Result> results;
+    const std::vector<BenchMethod> methods = getMethods(config);
+
+    if (methods.empty() || config.width < 4 * qualityMargin || config.height < 4 * qualityMargin) {
+        return results;
+    }
+
+#ifdef _OPENMP
+    const int maxThreads = omp_get_max_threads();
+#else
+    const int maxThreads = 1;
+#endif
+    std::vector<int> threads = config.threads;
+
+    if (threads.empty()) {
+        threads.push_back(maxThreads);
+    }
+
+    array2D<float> truth[3];
+
+    for (auto &channel : truth) {
+        channel(config.width, config.height);
+    }
+
+    buildTestChart(truth);
+
+    const double mpix = config.width * static_cast<double>(config.height) / 1000000.0;
+
+    for (const bool xtrans : {false, true}) {
+        if ((xtrans && !config.xtrans) || (!xtrans && !config.bayer)) {
+            continue;
+        }
+
+        RawImageSource src;
+        setupSource(src, truth, xtrans);
+
+        for (const auto &method : methods) {
+            if (method.isBayer == xtrans) {
+                continue;
+            }
+
+            RAWParams raw;
+
+            if (xtrans) {
+                raw.xtranssensor.method = method.name;
+            } else {
+                raw.bayersensor.method = method.name;
+            }
+
+            bool qualityDone = false;
+            Result quality;
+
+            for (const int numThreads : threads) {
+#ifdef _OPENMP
+                omp_set_num_threads(std::max(1, numThreads));
+#endif
+                Result result;
+                result.sensor = xtrans ? "X-Trans" : "Bayer";
+                result.method = method.name;
+                result.threads = std::max(1, numThreads);
+                int bestTime = 0;
+
+                for (int run = 0; run < std::max(1, config.runs); ++run) {
+                    restoreRawData(src);
+                    double contrast = xtrans ? raw.xtranssensor.dualDemosaicContrast : raw.bayersensor.dualDemosaicContrast;
+#ifdef __linux__
+                    const long baseRSS = readProcStatusKB("VmRSS:");
+                    const bool peakReset = resetPeakRSS();
+#endif
+                    MyTime t1, t2;
+                    t1.set();
+                    src.demosaic(raw, method.autoContrast, contrast);
+                    t2.set();
+#ifdef __linux__
+                    const long peakRSS = readProcStatusKB("VmHWM:");
+
+                    if (peakReset && baseRSS >= 0 && peakRSS >= 0) {
+                        result.peakMemoryMB = std::max(result.peakMemoryMB, std::max(0L, peakRSS - baseRSS) / 1024.0);
+                    }
+#endif
+                    const int elapsed = std::max(1, t2.etime(t1));
+                    bestTime = run == 0 ? elapsed : std::min(bestTime, elapsed);
+                }
+
+                result.mpixPerSecond = mpix / (bestTime / 1000000.0);
+
+                // the output does not depend on the number of threads, so measure it only once
+                if (!qualityDone) {
+                    measureQuality(src, truth, quality);
+                    qualityDone = true;
+                }
+
+                std::copy(quality.psnr, quality.psnr + 3, result.psnr);
+                result.psnrAll = quality.psnrAll;
+                result.meanDeltaE = quality.meanDeltaE;
+                result.maxDeltaE = quality.maxDeltaE;
+                results.push_back(result);
+
+                log << std::left << std::setw(8) << result.sensor << std::setw(16) << result.method << std::right
+                    << std::setw(4) << result.threads << " threads: "
+                    << std::fixed << std::setprecision(1) << result.mpixPerSecond << " MPix/s, "
+                    << std::setprecision(2) << result.psnrAll << " dB" << std::endl;
+            }
+        }
+    }
+
+#ifdef _OPENMP
+    omp_set_num_threads(maxThreads);
+#endif
+
+    return results;
+}
+
+void DemosaicBenchmark::printReport(const std::vector<Result> &results, std::ostream &out)
+{
+    out << std::left << std::setw(8) << "Sensor" << std::setw(16) << "Method" << std::right
+        << std::setw(8) << "Threads" << std::setw(10) << "MPix/s" << std::setw(10) << "Peak MB"
+        << std::setw(9) << "PSNR R" << std::setw(9) << "PSNR G" << std::setw(9) << "PSNR B" << std::setw(9) << "PSNR"
+        << std::setw(9) << "dE mean" << std::setw(9) << "dE 99%" << std::endl;
+
+    for (const auto &r : results) {
+        std::ostringstream peak;
+
+        if (r.peakMemoryMB < 0.0) {
+            peak << "n/a";
+        } else {
+            peak << std::fixed << std::setprecision(0) << r.peakMemoryMB;
+        }
+
+        out << std::left << std::setw(8) << r.sensor << std::setw(16) << r.method << std::right << std::fixed
+            << std::setw(8) << r.threads << std::setw(10) << std::setprecision(1) << r.mpixPerSecond << std::setw(10) << peak.str()
+            << std::setprecision(2) << std::setw(9) << r.psnr[0] << std::setw(9) << r.psnr[1] << std::setw(9) << r.psnr[2] << std::setw(9) << r.psnrAll
+            << std::setw(9) << r.meanDeltaE << std::setw(9) << r.maxDeltaE << std::endl;
+    }
+
+    // suggest defaults per sensor class, based on the runs with the highest thread count
+    for (const char *sensor : {"Bayer", "X-Trans"}) {
+        int maxThreads = 0;
+
+        for (const auto &r : results) {
+            if (r.sensor == sensor) {
+                maxThreads = std::max(maxThreads, r.threads);
+            }
+        }
+
+        const Result *best = nullptr;
+        const Result *fastest = nullptr;
+
+        for (const auto &r : results) {
+            if (r.sensor == sensor && r.threads == maxThreads) {
+                if (!best || r.psnrAll > best->psnrAll) {
+                    best = &r;
+                }
+
+                if (!fastest || r.mpixPerSecond > fastest->mpixPerSecond) {
+                    fastest = &r;
+                }
+            }
+        }
+
+        if (!best) {
+            continue;
+        }
+
+        // fastest method within 0.5 dB of the best one
+        const Result *balanced = best;
+
+        for (const auto &r : results) {
+            if (r.sensor == sensor && r.threads == maxThreads && r.psnrAll >= best->psnrAll - 0.5 && r.mpixPerSecond > balanced->mpixPerSecond) {
+                balanced = &r;
+            }
+        }
+
+        out << std::endl << sensor << " (" << maxThreads << " threads):" << std::endl
+            << "  best quality: " << best->method << std::endl
+            << "  balanced:     " << balanced->method << std::endl
+            << "  fastest:      " << fastest->method << std::endl;
+    }
+}
+
+void DemosaicBenchmark::writeCSV(const std::vector<Result> &results, std::ostream &out)
+{
+    out << "sensor,method,threads,mpix_per_s,peak_mb,psnr_r,psnr_g,psnr_b,psnr,delta_e_mean,delta_e_99" << std::endl;
+
+    for (const auto &r : results) {
+        out << r.sensor << ',' << r.method << ',' << r.threads << ',' << r.mpixPerSecond << ',' << r.peakMemoryMB << ','
+            << r.psnr[0] << ',' << r.psnr[1] << ',' << r.psnr[2] << ',' << r.psnrAll << ','
+            << r.meanDeltaE << ',' << r.maxDeltaE << std::endl;
+    }
+}
+
+}
@@ -0,0 +1,74 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+#include "array2D.h"
+
+namespace rtengine
+{
+
+class RawImageSource;
+
+/**
+ * Offline benchmark of the RawImageSource demosaicers.
+ *
+ * A synthetic RGB test chart (zone plate, slanted colour edges, gradients and fine
+ * colour patterns) is generated in memory, mosaiced into a Bayer (RGGB) and an
+ * X-Trans pattern and fed through RawImageSource::demosaic() for every method.
+ * Speed, peak memory and the error against the ground truth are reported.
+ */
+class DemosaicBenchmark
+{
+public:
+    struct Config {
+        int width = 3000;
+        int height = 2000;
+        int runs = 3;                  ///< timed runs per method and thread count, the fastest one is reported
+        std::vector<int> threads;      ///< thread counts to test, empty = maximum available
+        std::vector<std::string> methods; ///< methods to test, empty = all
+        bool bayer = true;
+        bool xtrans = true;
+    };
+
+    struct Result {
+        std::string sensor;            ///< "Bayer" or "X-Trans"
+        std::string method;
+        int threads = 1;
+        double mpixPerSecond = 0.0;
+        double peakMemoryMB = -1.0;    ///< additional peak resident memory, < 0 if not available on this platform
+        double psnr[3] = {};           ///< per channel PSNR in dB
+        double psnrAll = 0.0;          ///< PSNR over all channels in dB
+        double meanDeltaE = 0.0;       ///< mean CIE76 colour error
+        double maxDeltaE = 0.0;        ///< 99th percentile CIE76 colour error
+    };
+
+    static std::vector<Result> run(const Config &config, std::ostream &log);
+    static void printReport(const std::vector<Result> &results, std::ostream &out);
+    static void writeCSV(const std::vector<Result> &results, std::ostream &out);
+
+private:
+    static void buildTestChart(array2D<float> (&truth)[3]);
+    static void setupSource(RawImageSource &src, const array2D<float> (&truth)[3], bool xtrans);
+    static void restoreRawData(RawImageSource &src);
+    static void measureQuality(const RawImageSource &src, const array2D<float> (&truth)[3], Result &result);
+};
+
+}
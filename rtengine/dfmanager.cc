@@ -20,8 +20,11 @@
 #include <sstream>
 #include <iostream>
 #include <cstdio>
+#include <cstdint>
+#include <set>
 #include <giomm.h>
 #include <glibmm/ustring.h>
+#include <glib/gstdio.h>
 
 #include "dfmanager.h"
 #include "../rtgui/options.h"
@@ -29,6 +32,48 @@
 #include "imagedata.h"
 #include "utils.h"
 
+namespace
+{
+
+constexpr char darkFrameCacheMagic[4] = {'R', 'T', 'D', 'F'};
+constexpr uint32_t darkFrameCacheVersion = 1;
+
+Glib::ustring getCacheDir()
+{
+    return Glib::build_filename(options.cacheBaseDir, "darkframes");
+}
+
+// size and modification time, a changed file invalidates the cached data built from it
+std::string getFileSignature(const Glib::ustring &filename)
+{
+    try {
+        auto info = Gio::File::create_for_path(filename)->query_info("standard::size,time::modified");
+
+        if (info) {
+            std::ostringstream s;
+            s << info->get_size() << ":" << info->get_attribute_uint64("time::modified");
+            return s.str();
+        }
+    } catch (Gio::Error&) {}
+
+    return std::string();
+}
+
+// FNV-1a, stable across builds unlike std::hash
+uint64_t hashString(const std::string &str)
+{
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (const unsigned char c : str) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+}
+
 namespace rtengine
 {
 
@@ -116,7 +161,6 @@ RawImage* dfInfo::getRawImage()
     }
 
     updateRawImage();
-    updateBadPixelList( ri );
 
     return ri;
 }
@@ -125,20 +169,150 @@ std::vector<badPix>& dfInfo::getHotPixels()
 {
     if( !ri ) {
         updateRawImage();
-        updateBadPixelList( ri );
     }
 
     return badPixels;
 }
+
+Glib::ustring dfInfo::cacheFileName() const
+{
+    if( pathNames.empty() ) {
+        return Glib::ustring();
+    }
+
+    // the order of the files does not matter for the average
+    std::set<Glib::ustring> names(pathNames.begin(), pathNames.end());
+    std::ostringstream s;
+    s << maker << '\n' << model << '\n' << iso << '\n' << shutter;
+
+    for( const auto &name : names ) {
+        s << '\n' << name << '\n' << getFileSignature(name);
+    }
+
+    char hash[17];
+    snprintf(hash, sizeof(hash), "%016llx", static_cast<unsigned long long>(hashString(s.str())));
+    return Glib::build_filename(getCacheDir(), Glib::ustring(hash) + ".rtdark");
+}
+
+bool dfInfo::loadFromCache( const Glib::ustring &cacheFile )
+{
+    FILE *file = g_fopen(cacheFile.c_str(), "rb");
+
+    if( !file ) {
+        return false;
+    }
+
+    char magic[4];
+    uint32_t version;
+    int32_t dims[3]; // width, height, values per pixel
+    uint64_t numBadPixels;
+    bool ok = fread(magic, sizeof(magic), 1, file) == 1 && !memcmp(magic, darkFrameCacheMagic, sizeof(magic))
+              && fread(&version, sizeof(version), 1, file) == 1 && version == darkFrameCacheVersion
+              && fread(dims, sizeof(dims), 1, file) == 1 && dims[0] > 0 && dims[1] > 0 && (dims[2] == 1 || dims[2] == 3)
+              && fread(&numBadPixels, sizeof(numBadPixels), 1, file) == 1;
+
+    if( ok ) {
+        // the first file still provides all information other than pixels
+        ri = new RawImage(*pathNames.begin());
+        ok = !ri->loadRaw(false) && ri->get_width() == dims[0] && ri->get_height() == dims[1];
+
+        if( ok ) {
+            ri->allocateData(dims[0], dims[1], dims[2]);
+        }
+
+        const size_t rowSize = static_cast<size_t>(dims[0]) * dims[2];
+
+        for( int row = 0; ok && row < dims[1]; row++ ) {
+            ok = fread(ri->data[row], sizeof(float), rowSize, file) == rowSize;
+        }
+
+        std::vector<uint16_t> coords(2 * numBadPixels);
+        ok = ok && (numBadPixels == 0 || fread(coords.data(), sizeof(uint16_t), coords.size(), file) == coords.size());
+
+        if( ok ) {
+            badPixels.clear();
+            badPixels.reserve(numBadPixels);
+
+            for( size_t i = 0; i < coords.size(); i += 2 ) {
+                badPixels.emplace_back(coords[i], coords[i + 1]);
+            }
+        } else {
+            delete ri;
+            ri = nullptr;
+        }
+    }
+
+    fclose(file);
+
+    if( ok && settings->verbose ) {
+        printf("Loaded dark frame template %s from %s\n", key().c_str(), cacheFile.c_str());
+    }
+
+    return ok;
+}
+
+void dfInfo::saveToCache( const Glib::ustring &cacheFile ) const
+{
+    if( !ri || g_mkdir_with_parents(getCacheDir().c_str(), 0755) != 0 ) {
+        return;
+    }
+
+    // write to a temporary file first, so an interrupted write never leaves a truncated cache entry behind
+    const Glib::ustring tempFile = cacheFile + ".tmp";
+    FILE *file = g_fopen(tempFile.c_str(), "wb");
+
+    if( !file ) {
+        return;
+    }
+
+    const bool isCFA = ri->getSensorType() == ST_BAYER || ri->getSensorType() == ST_FUJI_XTRANS;
+    const int32_t dims[3] = {ri->get_width(), ri->get_height(), isCFA ? 1 : 3};
+    const uint64_t numBadPixels = badPixels.size();
+    const size_t rowSize = static_cast<size_t>(dims[0]) * dims[2];
+    bool ok = fwrite(darkFrameCacheMagic, sizeof(darkFrameCacheMagic), 1, file) == 1
+              && fwrite(&darkFrameCacheVersion, sizeof(darkFrameCacheVersion), 1, file) == 1
+              && fwrite(dims, sizeof(dims), 1, file) == 1
+              && fwrite(&numBadPixels, sizeof(numBadPixels), 1, file) == 1;
+
+    for( int row = 0; ok && row < dims[1]; row++ ) {
+        ok = fwrite(ri->data[row], sizeof(float), rowSize, file) == rowSize;
+    }
+
+    for( size_t i = 0; ok && i < badPixels.size(); i++ ) {
+        const uint16_t coords[2] = {badPixels[i].x, badPixels[i].y};
+        ok = fwrite(coords, sizeof(coords), 1, file) == 1;
+    }
+
+    ok = fclose(file) == 0 && ok;
+
+    if( ok ) {
+        g_remove(cacheFile.c_str());
+        ok = g_rename(tempFile.c_str(), cacheFile.c_str()) == 0;
+    }
+
+    if( !ok ) {
+        g_remove(tempFile.c_str());
+    } else if( settings->verbose ) {
+        printf("Saved dark frame template %s to %s\n", key().c_str(), cacheFile.c_str());
+    }
+}
+
 /* updateRawImage() load into ri the actual pixel data from pathname if there is a single shot
  * otherwise load each file from the pathNames list and extract a template from the media;
- * the first file is used also for reading all information other than pixels
+ * the first file is used also for reading all information other than pixels.
+ * Templates and their hot pixels are stored in the cache, so they are only computed once.
  */
 void dfInfo::updateRawImage()
 {
     typedef unsigned int acc_t;
 
     if( !pathNames.empty() ) {
+        const Glib::ustring cacheFile = cacheFileName();
+
+        if( loadFromCache(cacheFile) ) {
+            return;
+        }
+
         std::list<Glib::ustring>::iterator iName = pathNames.begin();
         ri = new RawImage(*iName); // First file used also for extra pixels information (width,height, shutter, filters etc.. )
 
@@ -200,6 +374,9 @@ void dfInfo::updateRawImage()
             }
 
             delete [] acc;
+
+            updateBadPixelList( ri );
+            saveToCache( cacheFile );
         }
     } else {
         ri = new RawImage(pathname);
@@ -209,6 +386,7 @@ void dfInfo::updateRawImage()
             ri = nullptr;
         } else {
             ri->compress_image(0);
+            updateBadPixelList( ri );
         }
     }
 }
@@ -298,6 +476,7 @@ void DFManager::init(const Glib::ustring& pathname)
 
     dfList.clear();
     bpList.clear();
+    loadFileIndex();
 
     for (size_t i = 0; i < names.size(); i++) {
         size_t lastdot = names[i].find_last_of ('.');
@@ -341,10 +520,105 @@ void DFManager::init(const Glib::ustring& pathname)
         }
     }
 
+    saveFileIndex();
+    pruneCache();
+
     currentPath = pathname;
     return;
 }
 
+void DFManager::loadFileIndex()
+{
+    fileIndex.clear();
+    fileIndexDirty = false;
+
+    FILE *file = g_fopen(Glib::build_filename(getCacheDir(), "index").c_str(), "r");
+
+    if( !file ) {
+        return;
+    }
+
+    // one line per dark frame: path, signature, maker, model, iso, shutter, timestamp separated by tabs
+    char line[4096];
+
+    while( fgets(line, sizeof(line), file) ) {
+        std::vector<std::string> fields;
+        std::istringstream s(line);
+        std::string field;
+
+        while( std::getline(s, field, '\t') ) {
+            fields.push_back(field);
+        }
+
+        if( fields.size() != 7 ) {
+            continue;
+        }
+
+        IndexEntry &entry = fileIndex[fields[0]];
+        entry.signature = fields[1];
+        entry.maker = fields[2];
+        entry.model = fields[3];
+        entry.iso = atoi(fields[4].c_str());
+        entry.shutter = g_ascii_strtod(fields[5].c_str(), nullptr);
+        entry.timestamp = atoll(fields[6].c_str());
+    }
+
+    fclose(file);
+}
+
+void DFManager::saveFileIndex()
+{
+    if( !fileIndexDirty || g_mkdir_with_parents(getCacheDir().c_str(), 0755) != 0 ) {
+        return;
+    }
+
+    FILE *file = g_fopen(Glib::build_filename(getCacheDir(), "index").c_str(), "w");
+
+    if( !file ) {
+        return;
+    }
+
+    for( const auto &entry : fileIndex ) {
+        char shutter[G_ASCII_DTOSTR_BUF_SIZE];
+        g_ascii_dtostr(shutter, sizeof(shutter), entry.second.shutter);
+        fprintf(file, "%s\t%s\t%s\t%s\t%d\t%s\t%lld\n", entry.first.c_str(), entry.second.signature.c_str(), entry.second.maker.c_str(),
+                entry.second.model.c_str(), entry.second.iso, shutter, static_cast<long long>(entry.second.timestamp));
+    }
+
+    fclose(file);
+    fileIndexDirty = false;
+}
+
+// remove cached templates which do not belong to the current dark frame library anymore
+void DFManager::pruneCache()
+{
+    std::set<std::string> current;
+
+    for( const auto &df : dfList ) {
+        if( !df.second.pathNames.empty() ) {
+            current.insert(Glib::path_get_basename(df.second.cacheFileName()));
+        }
+    }
+
+    try {
+        auto dir = Gio::File::create_for_path(getCacheDir());
+
+        if( !dir || !dir->query_exists() ) {
+            return;
+        }
+
+        auto enumerator = dir->enumerate_children("standard::name");
+
+        while( auto file = enumerator->next_file() ) {
+            const std::string name = file->get_name();
+
+            if( name.size() > 7 && name.compare(name.size() - 7, 7, ".rtdark") == 0 && current.find(name) == current.end() ) {
+                g_remove(Glib::build_filename(getCacheDir(), name).c_str());
+            }
+        }
+    } catch (Glib::Exception&) {}
+}
+
 dfInfo* DFManager::addFileInfo (const Glib::ustring& filename, bool pool)
 {
     auto ext = getFileExtension(filename);
@@ -365,7 +639,7 @@ dfInfo* DFManager::addFileInfo (const Glib::ustring& filename, bool pool)
 
     try {
 
-        auto info = file->query_info("standard::name,standard::type,standard::is-hidden");
+        auto info = file->query_info("standard::name,standard::type,standard::is-hidden,standard::size,time::modified");
 
         if (!info || info->get_file_type() == Gio::FILE_TYPE_DIRECTORY) {
             return nullptr;
@@ -375,38 +649,62 @@ dfInfo* DFManager::addFileInfo (const Glib::ustring& filename, bool pool)
             return nullptr;
         }
 
-        RawImage ri(filename);
-        int res = ri.loadRaw(false); // Read information about shot
-
-        if (res != 0) {
-            return nullptr;
-        }
-
         dfList_t::iterator iter;
 
         if(!pool) {
+            RawImage ri(filename);
+
+            if (ri.loadRaw(false) != 0) { // Read information about shot
+                return nullptr;
+            }
+
             dfInfo n(filename, "", "", 0, 0, 0);
             iter = dfList.emplace("", n);
             return &(iter->second);
         }
 
-        FramesData idata(filename, std::unique_ptr<RawMetaDataLocation>(new RawMetaDataLocation(ri.get_exifBase(), ri.get_ciffBase(), ri.get_ciffLen())), true);
+        // parsing the shot information of every file is slow for large libraries, so it is taken from the index if the file did not change
+        std::ostringstream signature;
+        signature << info->get_size() << ":" << info->get_attribute_uint64("time::modified");
+        auto indexEntry = fileIndex.find(filename);
+
+        if (indexEntry == fileIndex.end() || indexEntry->second.signature != signature.str()) {
+            RawImage ri(filename);
+            int res = ri.loadRaw(false); // Read information about shot
+
+            if (res != 0) {
+                return nullptr;
+            }
+
+            FramesData idata(filename, std::unique_ptr<RawMetaDataLocation>(new RawMetaDataLocation(ri.get_exifBase(), ri.get_ciffBase(), ri.get_ciffLen())), true);
+            IndexEntry &entry = fileIndex[filename];
+            entry.signature = signature.str();
+            entry.maker = ((Glib::ustring)idata.getMake()).uppercase();
+            entry.model = ((Glib::ustring)idata.getModel()).uppercase();
+            entry.iso = idata.getISOSpeed();
+            entry.shutter = idata.getShutterSpeed();
+            entry.timestamp = idata.getDateTimeAsTS();
+            indexEntry = fileIndex.find(filename);
+            fileIndexDirty = true;
+        }
+
+        const IndexEntry &shot = indexEntry->second;
         /* Files are added in the map, divided by same maker/model,ISO and shutter*/
-        std::string key(dfInfo::key(((Glib::ustring)idata.getMake()).uppercase(), ((Glib::ustring)idata.getModel()).uppercase(), idata.getISOSpeed(), idata.getShutterSpeed()));
+        std::string key(dfInfo::key(shot.maker, shot.model, shot.iso, shot.shutter));
         iter = dfList.find(key);
 
         if(iter == dfList.end()) {
-            dfInfo n(filename, ((Glib::ustring)idata.getMake()).uppercase(), ((Glib::ustring)idata.getModel()).uppercase(), idata.getISOSpeed(), idata.getShutterSpeed(), idata.getDateTimeAsTS());
+            dfInfo n(filename, shot.maker, shot.model, shot.iso, shot.shutter, shot.timestamp);
             iter = dfList.emplace(key, n);
         } else {
-            while(iter != dfList.end() && iter->second.key() == key && ABS(iter->second.timestamp - idata.getDateTimeAsTS()) > 60 * 60 * 6) { // 6 hour difference
+            while(iter != dfList.end() && iter->second.key() == key && ABS(iter->second.timestamp - shot.timestamp) > 60 * 60 * 6) { // 6 hour difference
                 ++iter;
             }
 
             if(iter != dfList.end()) {
                 iter->second.pathNames.push_back(filename);
             } else {
-                dfInfo n(filename, ((Glib::ustring)idata.getMake()).uppercase(), ((Glib::ustring)idata.getModel()).uppercase(), idata.getISOSpeed(), idata.getShutterSpeed(), idata.getDateTimeAsTS());
+                dfInfo n(filename, shot.maker, shot.model, shot.iso, shot.shutter, shot.timestamp);
                 iter = dfList.emplace(key, n);
             }
         }
@@ -463,11 +761,12 @@ dfInfo* DFManager::find( const std::string &mak, const std::string &mod, int iso
 
         return &(bestMatch->second);
     } else {
-        iter = dfList.begin();
-        dfList_t::iterator bestMatch = iter;
-        double bestD = iter->second.distance(  mak, mod, isospeed, shut );
+        // the keys start with maker and model, so only the range of the same camera has to be searched
+        const std::string prefix = mak + " " + mod + " ";
+        dfList_t::iterator bestMatch = dfList.end();
+        double bestD = RT_INFINITY;
 
-        for( ++iter; iter != dfList.end(); ++iter ) {
+        for( iter = dfList.lower_bound( prefix ); iter != dfList.end() && !iter->first.compare( 0, prefix.size(), prefix ); ++iter ) {
             double d = iter->second.distance(  mak, mod, isospeed, shut );
 
             if( d < bestD ) {
@@ -58,7 +58,7 @@ public:
     double distance(const std::string &mak, const std::string &mod, int iso, double shutter) const;
 
     static std::string key(const std::string &mak, const std::string &mod, int iso, double shut );
-    std::string key()
+    std::string key() const
     {
         return key( maker, model, iso, shutter);
     }
@@ -72,6 +72,13 @@ protected:
 
     void updateBadPixelList( RawImage *df );
     void updateRawImage();
+
+    // averaged templates and their hot pixels are persisted in the cache directory
+    Glib::ustring cacheFileName() const;
+    bool loadFromCache( const Glib::ustring &cacheFile );
+    void saveToCache( const Glib::ustring &cacheFile ) const;
+
+    friend class DFManager;
 };
 
 class DFManager final
@@ -92,13 +99,30 @@ public:
 protected:
     typedef std::multimap<std::string, dfInfo> dfList_t;
     typedef std::map<std::string, std::vector<badPix> > bpList_t;
+
+    // shot information of already parsed dark frames, persisted in the cache directory
+    struct IndexEntry {
+        std::string signature; ///< file size and modification time
+        std::string maker;
+        std::string model;
+        int iso;
+        double shutter;
+        time_t timestamp;
+    };
+    typedef std::map<std::string, IndexEntry> fileIndex_t;
+
     dfList_t dfList;
     bpList_t bpList;
+    fileIndex_t fileIndex;
+    bool fileIndexDirty = false;
     bool initialized;
     Glib::ustring currentPath;
     dfInfo *addFileInfo(const Glib::ustring &filename, bool pool = true );
     dfInfo *find( const std::string &mak, const std::string &mod, int isospeed, double shut, time_t t );
     int scanBadPixelsFile( Glib::ustring filename );
+    void loadFileIndex();
+    void saveFileIndex();
+    void pruneCache();
 };
 
 extern DFManager dfm;
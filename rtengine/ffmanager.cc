@@ -261,6 +261,12 @@ void FFManager::init(const Glib::ustring& pathname)
 
     } catch (Glib::Exception&) {}
 
+    {
+        // the cached maps reference the raw images of the old list
+        MyMutex::MyLock lock(flatFieldMapsMutex);
+        flatFieldMaps.clear();
+    }
+
     ffList.clear();
 
     for (size_t i = 0; i < names.size(); i++) {
@@ -460,6 +466,32 @@ RawImage* FFManager::searchFlatField( const Glib::ustring filename )
     return nullptr;
 }
 
+FFManager::FlatFieldMap FFManager::getFlatFieldMap( const RawImage *riFlatFile, const std::string &id, const std::function<void(float *)> &compute )
+{
+    {
+        MyMutex::MyLock lock(flatFieldMapsMutex);
+
+        for (auto iter = flatFieldMaps.begin(); iter != flatFieldMaps.end(); ++iter) {
+            if (iter->flatField == riFlatFile && iter->id == id) {
+                flatFieldMaps.splice(flatFieldMaps.begin(), flatFieldMaps, iter);
+                return iter->map;
+            }
+        }
+    }
+
+    // compute without holding the lock, images using other flat fields need not wait
+    std::shared_ptr<std::vector<float>> map = std::make_shared<std::vector<float>>(static_cast<size_t>(riFlatFile->get_width()) * riFlatFile->get_height());
+    compute(map->data());
+
+    MyMutex::MyLock lock(flatFieldMapsMutex);
+    flatFieldMaps.push_front({riFlatFile, id, map});
+
+    if (flatFieldMaps.size() > maxFlatFieldMaps) {
+        flatFieldMaps.pop_back();
+    }
+
+    return map;
+}
 
 // Global variable
 FFManager ffm;
@@ -19,12 +19,17 @@
 #pragma once
 
 #include <cmath>
+#include <functional>
 #include <list>
 #include <map>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include <glibmm/ustring.h>
 
+#include "../rtgui/threadutils.h"
+
 namespace rtengine
 {
 
@@ -83,9 +88,25 @@ public:
     RawImage *searchFlatField( const std::string &mak, const std::string &mod, const std::string &len, double focallength, double apert, time_t t );
     RawImage *searchFlatField( const Glib::ustring filename );
 
+    typedef std::shared_ptr<const std::vector<float>> FlatFieldMap;
+    /** Returns a full frame map (blurred flat field or gain map) derived from riFlatFile, identified by id.
+     *  The map is computed by compute() on the first request and then shared by all images using the same flat field. */
+    FlatFieldMap getFlatFieldMap( const RawImage *riFlatFile, const std::string &id, const std::function<void(float *)> &compute );
+
 protected:
     typedef std::multimap<std::string, ffInfo> ffList_t;
+
+    struct FlatFieldMapEntry {
+        const RawImage *flatField;
+        std::string id;
+        FlatFieldMap map;
+    };
+
+    static constexpr size_t maxFlatFieldMaps = 4; ///< each map is a full frame, so only keep the most recently used ones
+
     ffList_t ffList;
+    std::list<FlatFieldMapEntry> flatFieldMaps; ///< most recently used first
+    MyMutex flatFieldMapsMutex;
     bool initialized;
     Glib::ustring currentPath;
     ffInfo *addFileInfo(const Glib::ustring &filename, bool pool = true );
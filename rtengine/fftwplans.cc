@@ -0,0 +1,219 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <cstdio>
+#include <map>
+#include <tuple>
+#include <vector>
+
+#include <glib/gstdio.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "fftwplans.h"
+
+#include "settings.h"
+
+#include "../rtgui/threadutils.h"
+
+namespace
+{
+
+constexpr std::size_t MAX_PLANS = 64; // plans in use are kept beyond that
+
+struct PlanKey {
+    int n0;
+    int n1;
+    int howmany;
+    int kind;
+    unsigned int flags;
+    int threads;
+
+    bool operator <(const PlanKey &other) const
+    {
+        return std::tie(n0, n1, howmany, kind, flags, threads) < std::tie(other.n0, other.n1, other.howmany, other.kind, other.flags, other.threads);
+    }
+};
+
+struct CachedPlan {
+    rtengine::fftw::Plan plan;
+    unsigned long lastUse;
+};
+
+struct PlannerState {
+    MyMutex mutex; // guards the FFTW planner as well
+    std::map<PlanKey, CachedPlan> plans;
+    unsigned long useCounter = 0;
+    Glib::ustring wisdomFile;
+};
+
+// Never destroyed, plans may still be released while static objects are destroyed
+PlannerState& getState()
+{
+    static PlannerState* const state = new PlannerState;
+    return *state;
+}
+
+void destroyPlan(fftwf_plan plan)
+{
+    MyMutex::MyLock lock(getState().mutex);
+    fftwf_destroy_plan(plan);
+}
+
+}
+
+namespace rtengine
+{
+
+extern const Settings* settings;
+
+namespace fftw
+{
+
+void init(const Glib::ustring &wisdomFile)
+{
+    PlannerState& state = getState();
+    MyMutex::MyLock lock(state.mutex);
+
+#ifdef RT_FFTW3F_OMP
+    fftwf_init_threads();
+#endif
+
+    state.wisdomFile = wisdomFile;
+
+    if (wisdomFile.empty()) {
+        return;
+    }
+
+    FILE* const file = g_fopen(wisdomFile.c_str(), "r");
+
+    if (file) {
+        if (!fftwf_import_wisdom_from_file(file) && settings->verbose) {
+            printf("Could not read the FFTW wisdom from %s\n", wisdomFile.c_str());
+        }
+
+        fclose(file);
+    }
+}
+
+void cleanup()
+{
+    PlannerState& state = getState();
+    std::map<PlanKey, CachedPlan> plans;
+
+    {
+        MyMutex::MyLock lock(state.mutex);
+        plans.swap(state.plans);
+
+        if (!state.wisdomFile.empty()) {
+            FILE* const file = g_fopen(state.wisdomFile.c_str(), "w");
+
+            if (file) {
+                fftwf_export_wisdom_to_file(file);
+                fclose(file);
+            }
+        }
+    }
+
+    // the plans lock the planner when they are destroyed
+    plans.clear();
+}
+
+Plan planR2r2d(int n0, int n1, fftwf_r2r_kind kind, unsigned int flags, const float *in, const float *out, bool multithread, int howmany)
+{
+#ifdef RT_FFTW3F_OMP
+    const int threads = multithread ? omp_get_max_threads() : 1;
+#else
+    const int threads = 1;
+#endif
+
+    if (fftwf_alignment_of(const_cast<float*>(in)) || fftwf_alignment_of(const_cast<float*>(out))) {
+        flags |= FFTW_UNALIGNED;
+    }
+
+    const PlanKey key = {n0, n1, howmany, kind, flags, threads};
+    PlannerState& state = getState();
+
+    // released after the lock, the plans lock it when they are destroyed
+    std::vector<Plan> evicted;
+    MyMutex::MyLock lock(state.mutex);
+
+    const auto cached = state.plans.find(key);
+
+    if (cached != state.plans.end()) {
+        cached->second.lastUse = ++state.useCounter;
+        return cached->second.plan;
+    }
+
+    // planning may overwrite the arrays, it gets its own ones
+    const std::size_t size = static_cast<std::size_t>(n0) * n1 * howmany;
+    float* const planIn = static_cast<float*>(fftwf_malloc(size * sizeof(float)));
+    float* const planOut = static_cast<float*>(fftwf_malloc(size * sizeof(float)));
+
+    if (!planIn || !planOut) {
+        fftwf_free(planIn);
+        fftwf_free(planOut);
+        return Plan();
+    }
+
+#ifdef RT_FFTW3F_OMP
+    fftwf_plan_with_nthreads(threads);
+#endif
+
+    const int n[2] = {n0, n1};
+    const fftwf_r2r_kind kinds[2] = {kind, kind};
+    const fftwf_plan newPlan = fftwf_plan_many_r2r(2, n, howmany, planIn, nullptr, 1, n0 * n1, planOut, nullptr, 1, n0 * n1, kinds, flags);
+    fftwf_free(planIn);
+    fftwf_free(planOut);
+
+    if (!newPlan) {
+        return Plan();
+    }
+
+    const Plan plan(newPlan, destroyPlan);
+
+    // forget the least recently used plans nobody holds any more
+    while (state.plans.size() >= MAX_PLANS) {
+        auto oldest = state.plans.end();
+
+        for (auto it = state.plans.begin(); it != state.plans.end(); ++it) {
+            if (it->second.plan.use_count() == 1 && (oldest == state.plans.end() || it->second.lastUse < oldest->second.lastUse)) {
+                oldest = it;
+            }
+        }
+
+        if (oldest == state.plans.end()) {
+            break;
+        }
+
+        evicted.push_back(std::move(oldest->second.plan));
+        state.plans.erase(oldest);
+    }
+
+    state.plans[key] = {plan, ++state.useCounter};
+
+    if (settings->verbose) {
+        printf("FFTW plan created for %d x %d x %d, %zu plans cached\n", n0, n1, howmany, state.plans.size());
+    }
+
+    return plan;
+}
+
+}
+
+}
@@ -0,0 +1,64 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <memory>
+
+#include <fftw3.h>
+
+#include <glibmm/ustring.h>
+
+namespace rtengine
+{
+
+/*
+ * FFTW plans shared by the whole engine.
+ *
+ * Creating a plan takes from a few to hundreds of milliseconds (FFTW_MEASURE), and the FFTW planner isn't
+ * thread safe. Plans are created once per geometry under a lock, and kept while they are used or among
+ * the recently used ones. The new-array execute functions are thread safe, so a plan can be executed by
+ * several threads at once:
+ *
+ *      const fftw::Plan plan = fftw::planR2r2d(height, width, FFTW_REDFT10, FFTW_ESTIMATE, in, out, multiThread);
+ *      fftwf_execute_r2r(plan.get(), in, out);
+ *
+ * The plans are out of place. They are never created on the arrays passed, which are only inspected for
+ * their alignment, nullptr standing for arrays allocated by fftwf_malloc(). The arrays they are executed
+ * on have to be aligned like them.
+ *
+ * The FFTW wisdom is read from the cache directory by init() and written back by cleanup(), so the
+ * measured plans are cheap from the second session on.
+ */
+namespace fftw
+{
+
+using Plan = std::shared_ptr<fftwf_plan_s>;
+
+void init(const Glib::ustring &wisdomFile);
+// Writes the wisdom and drops the cached plans
+void cleanup();
+
+/**
+ * Returns the plan of a 2D real to real transform of 'howmany' consecutive arrays of n0 rows and n1 columns,
+ * the same kind in both dimensions. Returns an empty plan if FFTW failed to create it.
+ * @param multithread if true, the transform is executed by omp_get_max_threads() threads when FFTW is built with OpenMP support
+ */
+Plan planR2r2d(int n0, int n1, fftwf_r2r_kind kind, unsigned int flags, const float *in, const float *out, bool multithread, int howmany = 1);
+
+}
+
+}
@@ -16,12 +16,15 @@
  *  You should have received a copy of the GNU General Public License
  *  along with RawTherapee.  If not, see <https://www.gnu.org/licenses/>.
  */
+#include <cassert>
 #include <cmath>
 #include <cstdlib>
 #include <cstring>
 
 #include "gauss.h"
 
+#include "alignedbuffer.h"
+#include "blurvector.h"
 #include "boxblur.h"
 #include "opthelper.h"
 #include "rt_math.h"
@@ -527,115 +530,175 @@ template<class T> void gaussVertical3 (T** src, T** dst, int W, int H, const flo
 #endif
 
 #ifdef __SSE2__
-// fast gaussian approximation if the support window is large
-template<class T> void gaussHorizontalSse (T** src, T** dst, const int W, const int H, const float sigma)
+using rtengine::BlurVector;
+
+// Young - van Vliet coefficients with the Triggs - Sdika boundary matrix, shared by the channels of a blur
+struct YvVCoefficients {
+    double B, b1, b2, b3;
+    double M[3][3];
+
+    explicit YvVCoefficients(double sigma)
+    {
+        calculateYvVFactors<double>(sigma, b1, b2, b3, B, M);
+
+        for (int i = 0; i < 3; i++)
+            for (int j = 0; j < 3; j++) {
+                M[i][j] *= (1.0 + b2 + (b1 - b3) * b3);
+                M[i][j] /= (1.0 + b1 - b2 + b3) * (1.0 - b1 - b2 - b3);
+            }
+    }
+};
+
+// Filters 'size' consecutive rows starting at 'row'. The rows are transposed block by block into the lanes of the
+// vectors, filtered in 'tmp' (W * size floats, aligned) and transposed back into 'dst'. 'src' may be 'dst'.
+void gaussHorizontalRows(float** src, float** dst, const int row, const int W, const YvVCoefficients &c, float *tmp)
 {
-    double b1, b2, b3, B, M[3][3];
-    calculateYvVFactors<double>(sigma, b1, b2, b3, B, M);
+    typedef BlurVector::type vec;
+    constexpr int n = BlurVector::size;
 
-    for (int i = 0; i < 3; i++)
-        for (int j = 0; j < 3; j++) {
-            M[i][j] *= (1.0 + b2 + (b1 - b3) * b3);
-            M[i][j] /= (1.0 + b1 - b2 + b3) * (1.0 - b1 - b2 - b3);
-        }
+    const vec Bv = BlurVector::set1(c.B);
+    const vec b1v = BlurVector::set1(c.b1);
+    const vec b2v = BlurVector::set1(c.b2);
+    const vec b3v = BlurVector::set1(c.b3);
 
-    vfloat Rv;
-    vfloat Tv, Tm2v, Tm3v;
-    vfloat Bv, b1v, b2v, b3v;
-    vfloat temp2W, temp2Wp1;
-    float tmp[W][4] ALIGNED16;
-    Bv = F2V(B);
-    b1v = F2V(b1);
-    b2v = F2V(b2);
-    b3v = F2V(b3);
+    float column[n] ALIGNED64;
+    vec block[n];
 
-#ifdef _OPENMP
-    #pragma omp for nowait
-#endif
+    // the pixels left of the row are taken as the first one
+    for (int k = 0; k < n; ++k) {
+        column[k] = src[row + k][0];
+    }
 
-    for (int i = 0; i < H - 3; i += 4) {
-        Tv = _mm_set_ps(src[i][0], src[i + 1][0], src[i + 2][0], src[i + 3][0]);
-        Tm3v = Tv * (Bv + b1v + b2v + b3v);
-        STVF( tmp[0][0], Tm3v );
+    vec Tm1v = BlurVector::load(column);
+    vec Tm2v = Tm1v;
+    vec Tm3v = Tm1v;
+    int j = 0;
 
-        Tm2v = _mm_set_ps(src[i][1], src[i + 1][1], src[i + 2][1], src[i + 3][1]) * Bv + Tm3v * b1v + Tv * (b2v + b3v);
-        STVF( tmp[1][0], Tm2v );
+    for (; j < W - n + 1; j += n) {
+        for (int k = 0; k < n; ++k) {
+            block[k] = BlurVector::loadu(&src[row + k][j]);
+        }
 
-        Rv = _mm_set_ps(src[i][2], src[i + 1][2], src[i + 2][2], src[i + 3][2]) * Bv + Tm2v * b1v + Tm3v * b2v + Tv * b3v;
-        STVF( tmp[2][0], Rv );
+        BlurVector::transpose(block);
 
-        for (int j = 3; j < W; j++) {
-            Tv = Rv;
-            Rv = _mm_set_ps(src[i][j], src[i + 1][j], src[i + 2][j], src[i + 3][j]) * Bv + Tv * b1v + Tm2v * b2v + Tm3v * b3v;
-            STVF( tmp[j][0], Rv );
+        for (int k = 0; k < n; ++k) {
+            const vec Rv = block[k] * Bv + Tm1v * b1v + Tm2v * b2v + Tm3v * b3v;
+            BlurVector::store(&tmp[(j + k) * n], Rv);
             Tm3v = Tm2v;
-            Tm2v = Tv;
+            Tm2v = Tm1v;
+            Tm1v = Rv;
         }
+    }
 
-        Tv = _mm_set_ps(src[i][W - 1], src[i + 1][W - 1], src[i + 2][W - 1], src[i + 3][W - 1]);
+    for (; j < W; ++j) {
+        for (int k = 0; k < n; ++k) {
+            column[k] = src[row + k][j];
+        }
 
-        temp2Wp1 = Tv + F2V(M[2][0]) * (Rv - Tv) + F2V(M[2][1]) * ( Tm2v - Tv ) +  F2V(M[2][2]) * (Tm3v - Tv);
-        temp2W = Tv + F2V(M[1][0]) * (Rv - Tv) + F2V(M[1][1]) * (Tm2v - Tv) + F2V(M[1][2]) * (Tm3v - Tv);
+        const vec Rv = BlurVector::load(column) * Bv + Tm1v * b1v + Tm2v * b2v + Tm3v * b3v;
+        BlurVector::store(&tmp[j * n], Rv);
+        Tm3v = Tm2v;
+        Tm2v = Tm1v;
+        Tm1v = Rv;
+    }
 
-        Rv = Tv + F2V(M[0][0]) * (Rv - Tv) + F2V(M[0][1]) * (Tm2v - Tv) + F2V(M[0][2]) * (Tm3v - Tv);
-        STVF(tmp[W - 1][0], Rv);
+    for (int k = 0; k < n; ++k) {
+        column[k] = src[row + k][W - 1];
+    }
 
-        Tm2v = Bv * Tm2v + b1v * Rv + b2v * temp2W + b3v * temp2Wp1;
-        STVF(tmp[W - 2][0], Tm2v);
+    const vec Tv = BlurVector::load(column);
 
-        Tm3v = Bv * Tm3v + b1v * Tm2v + b2v * Rv + b3v * temp2W;
-        STVF(tmp[W - 3][0], Tm3v);
+    const vec temp2Wp1 = Tv + BlurVector::set1(c.M[2][0]) * (Tm1v - Tv) + BlurVector::set1(c.M[2][1]) * (Tm2v - Tv) + BlurVector::set1(c.M[2][2]) * (Tm3v - Tv);
+    const vec temp2W = Tv + BlurVector::set1(c.M[1][0]) * (Tm1v - Tv) + BlurVector::set1(c.M[1][1]) * (Tm2v - Tv) + BlurVector::set1(c.M[1][2]) * (Tm3v - Tv);
 
-        Tv = Rv;
-        Rv = Tm3v;
-        Tm3v = Tv;
+    vec Y3v = Tv + BlurVector::set1(c.M[0][0]) * (Tm1v - Tv) + BlurVector::set1(c.M[0][1]) * (Tm2v - Tv) + BlurVector::set1(c.M[0][2]) * (Tm3v - Tv);
+    BlurVector::store(&tmp[(W - 1) * n], Y3v);
 
-        for (int j = W - 4; j >= 0; j--) {
-            Tv = Rv;
-            Rv = LVF(tmp[j][0]) * Bv + Tv * b1v + Tm2v * b2v + Tm3v * b3v;
-            STVF(tmp[j][0], Rv);
-            Tm3v = Tm2v;
-            Tm2v = Tv;
+    vec Y2v = Bv * Tm2v + b1v * Y3v + b2v * temp2W + b3v * temp2Wp1;
+    BlurVector::store(&tmp[(W - 2) * n], Y2v);
+
+    vec Y1v = Bv * Tm3v + b1v * Y2v + b2v * Y3v + b3v * temp2W;
+    BlurVector::store(&tmp[(W - 3) * n], Y1v);
+
+    for (j = W - 4; j >= 0; j--) {
+        const vec Rv = BlurVector::load(&tmp[j * n]) * Bv + Y1v * b1v + Y2v * b2v + Y3v * b3v;
+        BlurVector::store(&tmp[j * n], Rv);
+        Y3v = Y2v;
+        Y2v = Y1v;
+        Y1v = Rv;
+    }
+
+    for (j = 0; j < W - n + 1; j += n) {
+        for (int k = 0; k < n; ++k) {
+            block[k] = BlurVector::load(&tmp[(j + k) * n]);
         }
 
-        for (int j = 0; j < W; j++) {
-            dst[i + 3][j] = tmp[j][0];
-            dst[i + 2][j] = tmp[j][1];
-            dst[i + 1][j] = tmp[j][2];
-            dst[i + 0][j] = tmp[j][3];
+        BlurVector::transpose(block);
+
+        for (int k = 0; k < n; ++k) {
+            BlurVector::storeu(&dst[row + k][j], block[k]);
         }
+    }
+
+    for (; j < W; ++j) {
+        for (int k = 0; k < n; ++k) {
+            dst[row + k][j] = tmp[j * n + k];
+        }
+    }
+}
+
+// Remaining rows of the horizontal pass, 'tmp' holds W floats
+void gaussHorizontalRow(const float* src, float* dst, const int W, const YvVCoefficients &c, float *tmp)
+{
+    const double B = c.B, b1 = c.b1, b2 = c.b2, b3 = c.b3;
 
+    tmp[0] = src[0] * (B + b1 + b2 + b3);
+    tmp[1] = B * src[1] + b1 * tmp[0]  + src[0] * (b2 + b3);
+    tmp[2] = B * src[2] + b1 * tmp[1]  + b2 * tmp[0]  + b3 * src[0];
 
+    for (int j = 3; j < W; j++) {
+        tmp[j] = B * src[j] + b1 * tmp[j - 1] + b2 * tmp[j - 2] + b3 * tmp[j - 3];
     }
 
-// Borders are done without SSE
-#ifdef _OPENMP
-    #pragma omp single
-#endif
+    const float temp2Wm1 = src[W - 1] + c.M[0][0] * (tmp[W - 1] - src[W - 1]) + c.M[0][1] * (tmp[W - 2] - src[W - 1]) + c.M[0][2] * (tmp[W - 3] - src[W - 1]);
+    const float temp2W   = src[W - 1] + c.M[1][0] * (tmp[W - 1] - src[W - 1]) + c.M[1][1] * (tmp[W - 2] - src[W - 1]) + c.M[1][2] * (tmp[W - 3] - src[W - 1]);
+    const float temp2Wp1 = src[W - 1] + c.M[2][0] * (tmp[W - 1] - src[W - 1]) + c.M[2][1] * (tmp[W - 2] - src[W - 1]) + c.M[2][2] * (tmp[W - 3] - src[W - 1]);
 
-    for (int i = H - (H % 4); i < H; i++) {
-        tmp[0][0] = src[i][0] * (B + b1 + b2 + b3);
-        tmp[1][0] = B * src[i][1] + b1 * tmp[0][0]  + src[i][0] * (b2 + b3);
-        tmp[2][0] = B * src[i][2] + b1 * tmp[1][0]  + b2 * tmp[0][0]  + b3 * src[i][0];
+    tmp[W - 1] = temp2Wm1;
+    tmp[W - 2] = B * tmp[W - 2] + b1 * tmp[W - 1] + b2 * temp2W + b3 * temp2Wp1;
+    tmp[W - 3] = B * tmp[W - 3] + b1 * tmp[W - 2] + b2 * tmp[W - 1] + b3 * temp2W;
 
-        for (int j = 3; j < W; j++) {
-            tmp[j][0] = B * src[i][j] + b1 * tmp[j - 1][0] + b2 * tmp[j - 2][0] + b3 * tmp[j - 3][0];
-        }
+    for (int j = W - 4; j >= 0; j--) {
+        tmp[j] = B * tmp[j] + b1 * tmp[j + 1] + b2 * tmp[j + 2] + b3 * tmp[j + 3];
+    }
 
-        float temp2Wm1 = src[i][W - 1] + M[0][0] * (tmp[W - 1][0] - src[i][W - 1]) + M[0][1] * (tmp[W - 2][0] - src[i][W - 1]) + M[0][2] * (tmp[W - 3][0] - src[i][W - 1]);
-        float temp2W   = src[i][W - 1] + M[1][0] * (tmp[W - 1][0] - src[i][W - 1]) + M[1][1] * (tmp[W - 2][0] - src[i][W - 1]) + M[1][2] * (tmp[W - 3][0] - src[i][W - 1]);
-        float temp2Wp1 = src[i][W - 1] + M[2][0] * (tmp[W - 1][0] - src[i][W - 1]) + M[2][1] * (tmp[W - 2][0] - src[i][W - 1]) + M[2][2] * (tmp[W - 3][0] - src[i][W - 1]);
+    for (int j = 0; j < W; j++) {
+        dst[j] = tmp[j];
+    }
+}
 
-        tmp[W - 1][0] = temp2Wm1;
-        tmp[W - 2][0] = B * tmp[W - 2][0] + b1 * tmp[W - 1][0] + b2 * temp2W + b3 * temp2Wp1;
-        tmp[W - 3][0] = B * tmp[W - 3][0] + b1 * tmp[W - 2][0] + b2 * tmp[W - 1][0] + b3 * temp2W;
+// fast gaussian approximation if the support window is large
+void gaussHorizontalSse(float** const* src, float** const* dst, const int channels, const int W, const int H, const YvVCoefficients &c)
+{
+    constexpr int n = BlurVector::size;
+    const int rowGroups = (H + n - 1) / n;
+    AlignedBuffer<float> buffer(W * n, 64);
 
-        for (int j = W - 4; j >= 0; j--) {
-            tmp[j][0] = B * tmp[j][0] + b1 * tmp[j + 1][0] + b2 * tmp[j + 2][0] + b3 * tmp[j + 3][0];
-        }
+    // the channels share one loop, the threads don't wait for each other between them
+#ifdef _OPENMP
+    #pragma omp for
+#endif
 
-        for (int j = 0; j < W; j++) {
-            dst[i][j] = tmp[j][0];
+    for (int k = 0; k < channels * rowGroups; ++k) {
+        const int channel = k / rowGroups;
+        const int row = (k % rowGroups) * n;
+
+        if (row + n <= H) {
+            gaussHorizontalRows(src[channel], dst[channel], row, W, c, buffer.data);
+        } else {
+            for (int i = row; i < H; ++i) {
+                gaussHorizontalRow(src[channel][i], dst[channel][i], W, c, buffer.data);
+            }
         }
     }
 }
@@ -688,144 +751,116 @@ template<class T> void gaussHorizontal (T** src, T** dst, const int W, const int
 }
 
 #ifdef __SSE2__
-template<class T> void gaussVerticalSse (T** src, T** dst, const int W, const int H, const float sigma)
+// Filters 2 * BlurVector::size consecutive columns starting at 'col', 'tmp' holds 2 * H * BlurVector::size floats (aligned).
+// 'src' may be 'dst'.
+void gaussVerticalColumns(float** src, float** dst, const int col, const int H, const YvVCoefficients &c, float *tmp)
 {
-    double b1, b2, b3, B, M[3][3];
-    calculateYvVFactors<double>(sigma, b1, b2, b3, B, M);
+    typedef BlurVector::type vec;
+    constexpr int n = BlurVector::size;
 
-    for (int i = 0; i < 3; i++)
-        for (int j = 0; j < 3; j++) {
-            M[i][j] *= (1.0 + b2 + (b1 - b3) * b3);
-            M[i][j] /= (1.0 + b1 - b2 + b3) * (1.0 - b1 - b2 - b3);
+    const vec Bv = BlurVector::set1(c.B);
+    const vec b1v = BlurVector::set1(c.b1);
+    const vec b2v = BlurVector::set1(c.b2);
+    const vec b3v = BlurVector::set1(c.b3);
+
+    // two vectors per row for better usage of cpu cache and to hide the latency of the recursion
+    vec Tm1v[2], Tm2v[2], Tm3v[2];
+
+    for (int v = 0; v < 2; ++v) {
+        Tm1v[v] = Tm2v[v] = Tm3v[v] = BlurVector::loadu(&src[0][col + v * n]);
+    }
+
+    for (int j = 0; j < H; j++) {
+        for (int v = 0; v < 2; ++v) {
+            const vec Rv = BlurVector::loadu(&src[j][col + v * n]) * Bv + Tm1v[v] * b1v + Tm2v[v] * b2v + Tm3v[v] * b3v;
+            BlurVector::store(&tmp[(2 * j + v) * n], Rv);
+            Tm3v[v] = Tm2v[v];
+            Tm2v[v] = Tm1v[v];
+            Tm1v[v] = Rv;
         }
+    }
 
-    float tmp[H][8] ALIGNED16;
-    vfloat Rv;
-    vfloat Tv, Tm2v, Tm3v;
-    vfloat Rv1;
-    vfloat Tv1, Tm2v1, Tm3v1;
-    vfloat Bv, b1v, b2v, b3v;
-    vfloat temp2W, temp2Wp1;
-    vfloat temp2W1, temp2Wp11;
-    Bv = F2V(B);
-    b1v = F2V(b1);
-    b2v = F2V(b2);
-    b3v = F2V(b3);
+    vec Y1v[2], Y2v[2], Y3v[2];
 
-#ifdef _OPENMP
-    #pragma omp for nowait
-#endif
+    for (int v = 0; v < 2; ++v) {
+        const vec Tv = BlurVector::loadu(&src[H - 1][col + v * n]);
 
-    // process 8 columns per iteration for better usage of cpu cache
-    for (int i = 0; i < W - 7; i += 8) {
-        Tv = LVFU( src[0][i]);
-        Tv1 = LVFU( src[0][i + 4]);
-        Rv = Tv * (Bv + b1v + b2v + b3v);
-        Rv1 = Tv1 * (Bv + b1v + b2v + b3v);
-        Tm3v = Rv;
-        Tm3v1 = Rv1;
-        STVF( tmp[0][0], Rv );
-        STVF( tmp[0][4], Rv1 );
+        const vec temp2Hp1 = Tv + BlurVector::set1(c.M[2][0]) * (Tm1v[v] - Tv) + BlurVector::set1(c.M[2][1]) * (Tm2v[v] - Tv) + BlurVector::set1(c.M[2][2]) * (Tm3v[v] - Tv);
+        const vec temp2H = Tv + BlurVector::set1(c.M[1][0]) * (Tm1v[v] - Tv) + BlurVector::set1(c.M[1][1]) * (Tm2v[v] - Tv) + BlurVector::set1(c.M[1][2]) * (Tm3v[v] - Tv);
 
-        Rv = LVFU(src[1][i]) * Bv + Rv * b1v + Tv * (b2v + b3v);
-        Rv1 = LVFU(src[1][i + 4]) * Bv + Rv1 * b1v + Tv1 * (b2v + b3v);
-        Tm2v = Rv;
-        Tm2v1 = Rv1;
-        STVF( tmp[1][0], Rv );
-        STVF( tmp[1][4], Rv1 );
+        Y3v[v] = Tv + BlurVector::set1(c.M[0][0]) * (Tm1v[v] - Tv) + BlurVector::set1(c.M[0][1]) * (Tm2v[v] - Tv) + BlurVector::set1(c.M[0][2]) * (Tm3v[v] - Tv);
+        Y2v[v] = Bv * Tm2v[v] + b1v * Y3v[v] + b2v * temp2H + b3v * temp2Hp1;
+        Y1v[v] = Bv * Tm3v[v] + b1v * Y2v[v] + b2v * Y3v[v] + b3v * temp2H;
+    }
 
-        Rv = LVFU(src[2][i]) * Bv + Rv * b1v + Tm3v * b2v + Tv * b3v;
-        Rv1 = LVFU(src[2][i + 4]) * Bv + Rv1 * b1v + Tm3v1 * b2v + Tv1 * b3v;
-        STVF( tmp[2][0], Rv );
-        STVF( tmp[2][4], Rv1 );
+    for (int v = 0; v < 2; ++v) {
+        BlurVector::storeu(&dst[H - 1][col + v * n], Y3v[v]);
+        BlurVector::storeu(&dst[H - 2][col + v * n], Y2v[v]);
+        BlurVector::storeu(&dst[H - 3][col + v * n], Y1v[v]);
+    }
 
-        for (int j = 3; j < H; j++) {
-            Tv = Rv;
-            Tv1 = Rv1;
-            Rv = LVFU(src[j][i]) * Bv +  Tv * b1v + Tm2v * b2v + Tm3v * b3v;
-            Rv1 = LVFU(src[j][i + 4]) * Bv +  Tv1 * b1v + Tm2v1 * b2v + Tm3v1 * b3v;
-            STVF( tmp[j][0], Rv );
-            STVF( tmp[j][4], Rv1 );
-            Tm3v = Tm2v;
-            Tm3v1 = Tm2v1;
-            Tm2v = Tv;
-            Tm2v1 = Tv1;
+    for (int j = H - 4; j >= 0; j--) {
+        for (int v = 0; v < 2; ++v) {
+            const vec Rv = BlurVector::load(&tmp[(2 * j + v) * n]) * Bv + Y1v[v] * b1v + Y2v[v] * b2v + Y3v[v] * b3v;
+            BlurVector::storeu(&dst[j][col + v * n], Rv);
+            Y3v[v] = Y2v[v];
+            Y2v[v] = Y1v[v];
+            Y1v[v] = Rv;
         }
+    }
+}
 
-        Tv = LVFU(src[H - 1][i]);
-        Tv1 = LVFU(src[H - 1][i + 4]);
+// Remaining columns of the vertical pass, 'tmp' holds H floats
+void gaussVerticalColumn(float** src, float** dst, const int col, const int H, const YvVCoefficients &c, float *tmp)
+{
+    const double B = c.B, b1 = c.b1, b2 = c.b2, b3 = c.b3;
 
-        temp2Wp1 = Tv + F2V(M[2][0]) * (Rv - Tv) + F2V(M[2][1]) * (Tm2v - Tv) + F2V(M[2][2]) * (Tm3v - Tv);
-        temp2Wp11 = Tv1 + F2V(M[2][0]) * (Rv1 - Tv1) + F2V(M[2][1]) * (Tm2v1 - Tv1) + F2V(M[2][2]) * (Tm3v1 - Tv1);
-        temp2W = Tv + F2V(M[1][0]) * (Rv - Tv) + F2V(M[1][1]) * (Tm2v - Tv) + F2V(M[1][2]) * (Tm3v - Tv);
-        temp2W1 = Tv1 + F2V(M[1][0]) * (Rv1 - Tv1) + F2V(M[1][1]) * (Tm2v1 - Tv1) + F2V(M[1][2]) * (Tm3v1 - Tv1);
+    tmp[0] = src[0][col] * (B + b1 + b2 + b3);
+    tmp[1] = B * src[1][col] + b1 * tmp[0] + src[0][col] * (b2 + b3);
+    tmp[2] = B * src[2][col] + b1 * tmp[1] + b2 * tmp[0] + b3 * src[0][col];
 
-        Rv = Tv + F2V(M[0][0]) * (Rv - Tv) + F2V(M[0][1]) * (Tm2v - Tv) + F2V(M[0][2]) * (Tm3v - Tv);
-        Rv1 = Tv1 + F2V(M[0][0]) * (Rv1 - Tv1) + F2V(M[0][1]) * (Tm2v1 - Tv1) + F2V(M[0][2]) * (Tm3v1 - Tv1);
-        STVFU( dst[H - 1][i], Rv );
-        STVFU( dst[H - 1][i + 4], Rv1 );
+    for (int j = 3; j < H; j++) {
+        tmp[j] = B * src[j][col] + b1 * tmp[j - 1] + b2 * tmp[j - 2] + b3 * tmp[j - 3];
+    }
 
-        Tm2v = Bv * Tm2v + b1v * Rv + b2v * temp2W + b3v * temp2Wp1;
-        Tm2v1 = Bv * Tm2v1 + b1v * Rv1 + b2v * temp2W1 + b3v * temp2Wp11;
-        STVFU( dst[H - 2][i], Tm2v );
-        STVFU( dst[H - 2][i + 4], Tm2v1 );
+    const float temp2Hm1 = src[H - 1][col] + c.M[0][0] * (tmp[H - 1] - src[H - 1][col]) + c.M[0][1] * (tmp[H - 2] - src[H - 1][col]) + c.M[0][2] * (tmp[H - 3] - src[H - 1][col]);
+    const float temp2H   = src[H - 1][col] + c.M[1][0] * (tmp[H - 1] - src[H - 1][col]) + c.M[1][1] * (tmp[H - 2] - src[H - 1][col]) + c.M[1][2] * (tmp[H - 3] - src[H - 1][col]);
+    const float temp2Hp1 = src[H - 1][col] + c.M[2][0] * (tmp[H - 1] - src[H - 1][col]) + c.M[2][1] * (tmp[H - 2] - src[H - 1][col]) + c.M[2][2] * (tmp[H - 3] - src[H - 1][col]);
 
-        Tm3v = Bv * Tm3v + b1v * Tm2v + b2v * Rv + b3v * temp2W;
-        Tm3v1 = Bv * Tm3v1 + b1v * Tm2v1 + b2v * Rv1 + b3v * temp2W1;
-        STVFU( dst[H - 3][i], Tm3v );
-        STVFU( dst[H - 3][i + 4], Tm3v1 );
+    tmp[H - 1] = temp2Hm1;
+    tmp[H - 2] = B * tmp[H - 2] + b1 * tmp[H - 1] + b2 * temp2H + b3 * temp2Hp1;
+    tmp[H - 3] = B * tmp[H - 3] + b1 * tmp[H - 2] + b2 * tmp[H - 1] + b3 * temp2H;
 
-        Tv = Rv;
-        Tv1 = Rv1;
-        Rv = Tm3v;
-        Rv1 = Tm3v1;
-        Tm3v = Tv;
-        Tm3v1 = Tv1;
+    for (int j = H - 4; j >= 0; j--) {
+        tmp[j] = B * tmp[j] + b1 * tmp[j + 1] + b2 * tmp[j + 2] + b3 * tmp[j + 3];
+    }
 
-        for (int j = H - 4; j >= 0; j--) {
-            Tv = Rv;
-            Tv1 = Rv1;
-            Rv = LVF(tmp[j][0]) * Bv +  Tv * b1v + Tm2v * b2v + Tm3v * b3v;
-            Rv1 = LVF(tmp[j][4]) * Bv +  Tv1 * b1v + Tm2v1 * b2v + Tm3v1 * b3v;
-            STVFU( dst[j][i], Rv );
-            STVFU( dst[j][i + 4], Rv1 );
-            Tm3v = Tm2v;
-            Tm3v1 = Tm2v1;
-            Tm2v = Tv;
-            Tm2v1 = Tv1;
-        }
+    for (int j = 0; j < H; j++) {
+        dst[j][col] = tmp[j];
     }
+}
+
+void gaussVerticalSse(float** const* src, float** const* dst, const int channels, const int W, const int H, const YvVCoefficients &c)
+{
+    constexpr int n = 2 * BlurVector::size;
+    const int columnGroups = (W + n - 1) / n;
+    AlignedBuffer<float> buffer(H * n, 64);
 
-// Borders are done without SSE
 #ifdef _OPENMP
-    #pragma omp single
+    #pragma omp for
 #endif
 
-    for (int i = W - (W % 8); i < W; i++) {
-        tmp[0][0] = src[0][i] * (B + b1 + b2 + b3);
-        tmp[1][0] = B * src[1][i] + b1 * tmp[0][0] + src[0][i] * (b2 + b3);
-        tmp[2][0] = B * src[2][i] + b1 * tmp[1][0] + b2 * tmp[0][0] + b3 * src[0][i];
+    for (int k = 0; k < channels * columnGroups; ++k) {
+        const int channel = k / columnGroups;
+        const int col = (k % columnGroups) * n;
 
-        for (int j = 3; j < H; j++) {
-            tmp[j][0] = B * src[j][i] + b1 * tmp[j - 1][0] + b2 * tmp[j - 2][0] + b3 * tmp[j - 3][0];
-        }
-
-        float temp2Hm1 = src[H - 1][i] + M[0][0] * (tmp[H - 1][0] - src[H - 1][i]) + M[0][1] * (tmp[H - 2][0] - src[H - 1][i]) + M[0][2] * (tmp[H - 3][0] - src[H - 1][i]);
-        float temp2H   = src[H - 1][i] + M[1][0] * (tmp[H - 1][0] - src[H - 1][i]) + M[1][1] * (tmp[H - 2][0] - src[H - 1][i]) + M[1][2] * (tmp[H - 3][0] - src[H - 1][i]);
-        float temp2Hp1 = src[H - 1][i] + M[2][0] * (tmp[H - 1][0] - src[H - 1][i]) + M[2][1] * (tmp[H - 2][0] - src[H - 1][i]) + M[2][2] * (tmp[H - 3][0] - src[H - 1][i]);
-
-        tmp[H - 1][0] = temp2Hm1;
-        tmp[H - 2][0] = B * tmp[H - 2][0] + b1 * tmp[H - 1][0] + b2 * temp2H + b3 * temp2Hp1;
-        tmp[H - 3][0] = B * tmp[H - 3][0] + b1 * tmp[H - 2][0] + b2 * tmp[H - 1][0] + b3 * temp2H;
-
-        for (int j = H - 4; j >= 0; j--) {
-            tmp[j][0] = B * tmp[j][0] + b1 * tmp[j + 1][0] + b2 * tmp[j + 2][0] + b3 * tmp[j + 3][0];
-        }
-
-        for (int j = 0; j < H; j++) {
-            dst[j][i] = tmp[j][0];
+        if (col + n <= W) {
+            gaussVerticalColumns(src[channel], dst[channel], col, H, c, buffer.data);
+        } else {
+            for (int i = col; i < W; ++i) {
+                gaussVerticalColumn(src[channel], dst[channel], i, H, c, buffer.data);
+            }
         }
-
     }
 }
 #endif
@@ -1353,54 +1388,17 @@ template<class T> void gaussVerticalmult (T** src, T** dst, const int W, const i
 }
 #endif
 
+constexpr auto GAUSS_3X3_LIMIT = 0.6;
+constexpr auto GAUSS_5X5_LIMIT = 0.84;
+constexpr auto GAUSS_7X7_LIMIT = 1.15;
+constexpr auto GAUSS_DOUBLE = 25.0;
+
 template<class T> void gaussianBlurImpl(T** src, T** dst, const int W, const int H, const double sigma, bool useBoxBlur, eGaussType gausstype = GAUSS_STANDARD, T** buffer2 = nullptr)
 {
-    static constexpr auto GAUSS_3X3_LIMIT = 0.6;
-    static constexpr auto GAUSS_5X5_LIMIT = 0.84;
-    static constexpr auto GAUSS_7X7_LIMIT = 1.15;
-    static constexpr auto GAUSS_DOUBLE = 25.0;
-
     if (useBoxBlur) {
         // special variant for very large sigma, currently only used by retinex algorithm
-        // use iterated boxblur to approximate gaussian blur
-        // Compute ideal averaging filter width and number of iterations
-        int n = 1;
-        double wIdeal = sqrt((12 * sigma * sigma) + 1);
-
-        while(wIdeal > W || wIdeal > H) {
-            n++;
-            wIdeal = sqrt((12 * sigma * sigma / n) + 1);
-        }
-
-        if(n < 3) {
-            n = 3;
-            wIdeal = sqrt((12 * sigma * sigma / n) + 1);
-        } else if(n > 6) {
-            n = 6;
-        }
-
-        int wl = wIdeal;
-
-        if(wl % 2 == 0) {
-            wl--;
-        }
-
-        int wu = wl + 2;
-
-        double mIdeal = (12 * sigma * sigma - n * wl * wl - 4 * n * wl - 3 * n) / (-4 * wl - 4);
-        int m = round(mIdeal);
-
-        int sizes[n];
-
-        for(int i = 0; i < n; i++) {
-            sizes[i] = ((i < m ? wl : wu) - 1) / 2;
-        }
-
-        rtengine::boxblur(src, dst, sizes[0], W, H, true);
-
-        for(int i = 1; i < n; i++) {
-            rtengine::boxblur(dst, dst, sizes[i], W, H, true);
-        }
+        // extended box filters approximate the gaussian blur in a time independent of sigma
+        rtengine::extendedBoxBlur(src, dst, sigma, W, H, true);
     } else {
         if (sigma < GAUSS_SKIP) {
             // don't perform filtering
@@ -1464,7 +1462,7 @@ template<class T> void gaussianBlurImpl(T** src, T** dst, const int W, const int
                     } else if (sigma <= GAUSS_7X7_LIMIT && src != dst) {
                         gauss7x7mult(src, dst, W, H, sigma);
                     } else {
-                        gaussHorizontalSse<T> (src, src, W, H, sigma);
+                        gaussHorizontalSse(&src, &src, 1, W, H, YvVCoefficients(sigma));
                         gaussVerticalSsemult<T> (src, dst, W, H, sigma);
                     }
                     break;
@@ -1476,15 +1474,16 @@ template<class T> void gaussianBlurImpl(T** src, T** dst, const int W, const int
                     } else if (sigma <= GAUSS_7X7_LIMIT && src != dst) {
                         gauss7x7div (src, dst, buffer2, W, H, sigma);
                     } else {
-                        gaussHorizontalSse<T> (src, dst, W, H, sigma);
+                        gaussHorizontalSse(&src, &dst, 1, W, H, YvVCoefficients(sigma));
                         gaussVerticalSsediv<T> (dst, dst, buffer2, W, H, sigma);
                     }
                     break;
                 }
 
                 case GAUSS_STANDARD : {
-                    gaussHorizontalSse<T> (src, dst, W, H, sigma);
-                    gaussVerticalSse<T> (dst, dst, W, H, sigma);
+                    const YvVCoefficients coefficients(sigma);
+                    gaussHorizontalSse(&src, &dst, 1, W, H, coefficients);
+                    gaussVerticalSse(&dst, &dst, 1, W, H, coefficients);
                     break;
                 }
                 }
@@ -1543,3 +1542,22 @@ void gaussianBlur(float** src, float** dst, const int W, const int H, const doub
     gaussianBlurImpl<float>(src, dst, W, H, sigma, useBoxBlur, gausstype, buffer2);
 }
 
+void gaussianBlur(std::initializer_list<float**> src, std::initializer_list<float**> dst, const int W, const int H, const double sigma)
+{
+    assert(src.size() == dst.size());
+
+#ifdef __SSE2__
+
+    if (sigma >= GAUSS_3X3_LIMIT && sigma < GAUSS_DOUBLE) {
+        const YvVCoefficients coefficients(sigma);
+        gaussHorizontalSse(src.begin(), dst.begin(), src.size(), W, H, coefficients);
+        gaussVerticalSse(dst.begin(), dst.begin(), dst.size(), W, H, coefficients);
+        return;
+    }
+
+#endif
+
+    for (auto s = src.begin(), d = dst.begin(); s != src.end(); ++s, ++d) {
+        gaussianBlurImpl<float>(*s, *d, W, H, sigma, false);
+    }
+}
@@ -18,8 +18,16 @@
  */
 #pragma once
 
+#include <initializer_list>
+
 enum eGaussType {GAUSS_STANDARD, GAUSS_MULT, GAUSS_DIV};
 static constexpr auto GAUSS_SKIP = 0.25;
 
 
+// useBoxBlur: approximation by extended box filters for large sigma, runs its own parallel region (unlike the other variants, which have to be called by all threads of one)
 void gaussianBlur(float** src, float** dst, const int W, const int H, const double sigma, bool useBoxBlur = false, eGaussType gausstype = GAUSS_STANDARD, float** buffer2 = nullptr);
+
+// Blurs several planes of the same size with the same sigma, e.g. gaussianBlur({lab->L, lab->a, lab->b}, {blur->L, blur->a, blur->b}, W, H, sigma).
+// Gives the same result as calling gaussianBlur() for each plane, but the planes share the passes of the threads.
+// A destination plane may be its source plane, but not another plane of the call.
+void gaussianBlur(std::initializer_list<float**> src, std::initializer_list<float**> dst, const int W, const int H, const double sigma);
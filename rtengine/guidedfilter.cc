@@ -28,13 +28,16 @@
  * available at https://arxiv.org/abs/1505.00996
  */
 
+#include <cassert>
+#include <vector>
+
 #include "array2D.h"
 #include "boxblur.h"
 #include "guidedfilter.h"
-#include "boxblur.h"
 #include "sleef.h"
 #include "rescale.h"
 #include "imagefloat.h"
+#include "opthelper.h"
 
 namespace rtengine {
 
@@ -81,164 +84,208 @@ int calculate_subsampling(int w, int h, int r)
 
 void guidedFilter(const array2D<float> &guide, const array2D<float> &src, array2D<float> &dst, int r, float epsilon, bool multithread, int subsampling)
 {
+    guidedFilter(guide, {&src}, {&dst}, r, epsilon, multithread, subsampling);
+}
+
+
+void guidedFilter(const array2D<float> &guide, const std::vector<const array2D<float>*> &src, const std::vector<array2D<float>*> &dst, int r, float epsilon, bool multithread, int subsampling)
+{
+    assert(src.size() == dst.size());
+
+    if (src.empty()) {
+        return;
+    }
 
-    const int W = src.getWidth();
-    const int H = src.getHeight();
+    const int n = src.size();
+    const int W = src[0]->getWidth();
+    const int H = src[0]->getHeight();
 
     if (subsampling <= 0) {
         subsampling = calculate_subsampling(W, H, r);
     }
 
-    enum Op { MUL, DIVEPSILON, ADD, SUB, ADDMUL, SUBMUL };
+    const int w = W / subsampling;
+    const int h = H / subsampling;
+    const int r1 = LIM<int>(float(r) / subsampling, 0, (min(w, h) - 1) / 2 - 1);
 
-    const auto apply =
-        [=](Op op, array2D<float> &res, const array2D<float> &a, const array2D<float> &b, const array2D<float> &c=array2D<float>()) -> void
-        {
-            const int w = res.getWidth();
-            const int h = res.getHeight();
-            
-#ifdef _OPENMP
-            #pragma omp parallel for if (multithread)
-#endif
-            for (int y = 0; y < h; ++y) {
-                for (int x = 0; x < w; ++x) {
-                    float r;
-                    float aa = a[y][x];
-                    float bb = b[y][x];
-                    switch (op) {
-                    case MUL:
-                        r = aa * bb;
-                        break;
-                    case DIVEPSILON:
-                        r = aa / (bb + epsilon);
-                        break;
-                    case ADD:
-                        r = aa + bb;
-                        break;
-                    case SUB:
-                        r = aa - bb;
-                        break;
-                    case ADDMUL:
-                        r = aa * bb + c[y][x];
-                        break;
-                    case SUBMUL:
-                        r = c[y][x] - (aa * bb);
-                        break;
-                    default:
-                        assert(false);
-                        r = 0;
-                        break;
-                    }
-                    res[y][x] = r;
-                }
-            }
-        };
+    // use the terminology of the paper (Algorithm 2). The statistics of the guide are shared by all channels,
+    // corrIp and meanp of a channel become its a and b.
+    array2D<float> meanI(w, h);
+    array2D<float> varI(w, h);
+    std::vector<array2D<float>> corrIp(n);
+    std::vector<array2D<float>> meanp(n);
 
-    // use the terminology of the paper (Algorithm 2)
-    const array2D<float> &I = guide;
-    const array2D<float> &p = src;
-    array2D<float> &q = dst;
+    for (int k = 0; k < n; ++k) {
+        corrIp[k](w, h);
+        meanp[k](w, h);
+    }
+
+    // the subsampled planes are blurred in place, the full size ones are blurred into the statistics
+    const array2D<float> *I1 = &guide;
+    std::vector<const array2D<float>*> p1(src);
+
+    if (subsampling > 1) {
+        rescaleBilinear(guide, meanI, multithread);
+        I1 = &meanI;
+
+        for (int k = 0; k < n; ++k) {
+            rescaleBilinear(*src[k], meanp[k], multithread);
+            p1[k] = &meanp[k];
+        }
+    }
 
-    const auto f_subsample =
-        [=](array2D<float> &d, const array2D<float> &s) -> void
-        {
-            if (d.getWidth() == s.getWidth() && d.getHeight() == s.getHeight()) {
 #ifdef _OPENMP
-#               pragma omp parallel for if (multithread)
+    #pragma omp parallel for if (multithread)
 #endif
-                for (int y = 0; y < s.getHeight(); ++y) {
-                    for (int x = 0; x < s.getWidth(); ++x) {
-                        d[y][x] = s[y][x];
-                    }
-                }
-            } else {
-                rescaleBilinear(s, d, multithread);
+    for (int y = 0; y < h; ++y) {
+        const float* const Irow = (*I1)[y];
+        int x = 0;
+#ifdef __SSE2__
+        for (; x < w - 3; x += 4) {
+            const vfloat Iv = LVFU(Irow[x]);
+            STVFU(varI[y][x], Iv * Iv);
+
+            for (int k = 0; k < n; ++k) {
+                STVFU(corrIp[k][y][x], Iv * LVFU((*p1[k])[y][x]));
             }
-        };
+        }
+#endif
+        for (; x < w; ++x) {
+            varI[y][x] = Irow[x] * Irow[x];
 
-    // const auto f_upsample = f_subsample;
-    
-    const size_t w = W / subsampling;
-    const size_t h = H / subsampling;
+            for (int k = 0; k < n; ++k) {
+                corrIp[k][y][x] = Irow[x] * (*p1[k])[y][x];
+            }
+        }
+    }
 
-    const auto f_mean =
-        [multithread](array2D<float> &d, array2D<float> &s, int rad) -> void
+    // boxblur only reads its sources
+    const auto rows =
+        [](const array2D<float> &a) -> float**
         {
-            rad = LIM(rad, 0, (min(s.getWidth(), s.getHeight()) - 1) / 2 - 1);
-           // boxblur(s, d, rad, s.getWidth(), s.getHeight(), multithread);
-            boxblur(static_cast<float**>(s), static_cast<float**>(d), rad, s.getWidth(), s.getHeight(), multithread);
+            return static_cast<float**>(const_cast<array2D<float>&>(a));
         };
 
-    array2D<float> I1(w, h);
-    array2D<float> p1(w, h);
-
-    f_subsample(I1, I);
-    f_subsample(p1, p);
-
-    DEBUG_DUMP(I);
-    DEBUG_DUMP(p);
-    DEBUG_DUMP(I1);
-    DEBUG_DUMP(p1);
+    std::vector<float**> blurSrc = {rows(*I1), varI};
+    std::vector<float**> blurDst = {meanI, varI};
 
-    float r1 = float(r) / subsampling;
+    for (int k = 0; k < n; ++k) {
+        blurSrc.push_back(rows(*p1[k]));
+        blurDst.push_back(meanp[k]);
+        blurSrc.push_back(corrIp[k]);
+        blurDst.push_back(corrIp[k]);
+    }
 
-    array2D<float> meanI(w, h);
-    f_mean(meanI, I1, r1);
+    boxblur(blurSrc, blurDst, r1, w, h, multithread);
     DEBUG_DUMP(meanI);
 
-    array2D<float> meanp(w, h);
-    f_mean(meanp, p1, r1);
-    DEBUG_DUMP(meanp);
+    // varI = corrI - meanI * meanI, a = covIp / (varI + epsilon), b = meanp - a * meanI
+#ifdef _OPENMP
+    #pragma omp parallel for if (multithread)
+#endif
+    for (int y = 0; y < h; ++y) {
+        int x = 0;
+#ifdef __SSE2__
+        const vfloat epsilonv = F2V(epsilon);
+
+        for (; x < w - 3; x += 4) {
+            const vfloat meanIv = LVFU(meanI[y][x]);
+            const vfloat varIv = LVFU(varI[y][x]) - meanIv * meanIv + epsilonv;
+
+            for (int k = 0; k < n; ++k) {
+                const vfloat meanpv = LVFU(meanp[k][y][x]);
+                const vfloat av = (LVFU(corrIp[k][y][x]) - meanIv * meanpv) / varIv;
+                STVFU(corrIp[k][y][x], av);
+                STVFU(meanp[k][y][x], meanpv - av * meanIv);
+            }
+        }
+#endif
+        for (; x < w; ++x) {
+            const float varIe = varI[y][x] - meanI[y][x] * meanI[y][x] + epsilon;
 
-    array2D<float> &corrIp = p1;
-    apply(MUL, corrIp, I1, p1);
-    f_mean(corrIp, corrIp, r1);
-    DEBUG_DUMP(corrIp);
+            for (int k = 0; k < n; ++k) {
+                const float a = (corrIp[k][y][x] - meanI[y][x] * meanp[k][y][x]) / varIe;
+                corrIp[k][y][x] = a;
+                meanp[k][y][x] -= a * meanI[y][x];
+            }
+        }
+    }
 
-    array2D<float> &corrI = I1;
-    apply(MUL, corrI, I1, I1);
-    f_mean(corrI, corrI, r1);
-    DEBUG_DUMP(corrI);
+    blurSrc.clear();
 
-    array2D<float> &varI = corrI;
-    apply(SUBMUL, varI, meanI, meanI, corrI);
-    DEBUG_DUMP(varI);
+    for (int k = 0; k < n; ++k) {
+        blurSrc.push_back(corrIp[k]);
+        blurSrc.push_back(meanp[k]);
+    }
 
-    array2D<float> &covIp = corrIp;
-    apply(SUBMUL, covIp, meanI, meanp, corrIp);
-    DEBUG_DUMP(covIp);
+    boxblur(blurSrc, blurSrc, r1, w, h, multithread);
+    DEBUG_DUMP(corrIp[0]);
+    DEBUG_DUMP(meanp[0]);
 
-    array2D<float> &a = varI;
-    apply(DIVEPSILON, a, covIp, varI);
-    DEBUG_DUMP(a);
+    const array2D<float> &I = guide;
+    const std::vector<array2D<float>*> &q = dst;
+    const int Wd = q[0]->getWidth();
+    const int Hd = q[0]->getHeight();
 
-    array2D<float> &b = covIp;
-    apply(SUBMUL, b, a, meanI, meanp);
-    DEBUG_DUMP(b);
+    // a destination may be the guide, so the guide value of a pixel is read before any channel of it is written
+    if (subsampling == 1) {
+#ifdef _OPENMP
+        #pragma omp parallel for if (multithread)
+#endif
+        for (int y = 0; y < Hd; ++y) {
+            int x = 0;
+#ifdef __SSE2__
+            for (; x < Wd - 3; x += 4) {
+                const vfloat Iv = LVFU(I[y][x]);
+
+                for (int k = 0; k < n; ++k) {
+                    STVFU((*q[k])[y][x], LVFU(corrIp[k][y][x]) * Iv + LVFU(meanp[k][y][x]));
+                }
+            }
+#endif
+            for (; x < Wd; ++x) {
+                const float Iv = I[y][x];
 
-    array2D<float> &meana = a;
-    f_mean(meana, a, r1);
-    DEBUG_DUMP(meana);
+                for (int k = 0; k < n; ++k) {
+                    (*q[k])[y][x] = corrIp[k][y][x] * Iv + meanp[k][y][x];
+                }
+            }
+        }
+    } else {
+        // speedup by heckflosse67
+        const float col_scale = float(w) / float(Wd);
+        const float row_scale = float(h) / float(Hd);
 
-    array2D<float> &meanb = b;
-    f_mean(meanb, b, r1);
-    DEBUG_DUMP(meanb);
+        // the interpolation weights are the same for all channels
+        std::vector<int> xi(Wd);
+        std::vector<int> xi1(Wd);
+        std::vector<float> xf(Wd);
 
-    // speedup by heckflosse67
-    const int Ws = meana.getWidth();
-    const int Hs = meana.getHeight();
-    const int Wd = q.getWidth();
-    const int Hd = q.getHeight();
-    const float col_scale = float(Ws) / float(Wd);
-    const float row_scale = float(Hs) / float(Hd);
+        for (int x = 0; x < Wd; ++x) {
+            const float xs = x * col_scale;
+            xi[x] = xs;
+            xi1[x] = std::min(xi[x] + 1, w - 1);
+            xf[x] = xs - xi[x];
+        }
 
 #ifdef _OPENMP
-#   pragma omp parallel for if (multithread)
+        #pragma omp parallel for if (multithread)
 #endif
-    for (int y = 0; y < Hd; ++y) {
-        float ymrs = y * row_scale; 
-        for (int x = 0; x < Wd; ++x) {
-            q[y][x] = getBilinearValue(meana, x * col_scale, ymrs) * I[y][x] + getBilinearValue(meanb, x * col_scale, ymrs);
+        for (int y = 0; y < Hd; ++y) {
+            const float ys = y * row_scale;
+            const int yi = ys;
+            const int yi1 = std::min(yi + 1, h - 1);
+            const float yf = ys - yi;
+
+            for (int x = 0; x < Wd; ++x) {
+                const float Iv = I[y][x];
+
+                for (int k = 0; k < n; ++k) {
+                    const float a = intp(yf, intp(xf[x], corrIp[k][yi1][xi1[x]], corrIp[k][yi1][xi[x]]), intp(xf[x], corrIp[k][yi][xi1[x]], corrIp[k][yi][xi[x]]));
+                    const float b = intp(yf, intp(xf[x], meanp[k][yi1][xi1[x]], meanp[k][yi1][xi[x]]), intp(xf[x], meanp[k][yi][xi1[x]], meanp[k][yi][xi[x]]));
+                    (*q[k])[y][x] = a * Iv + b;
+                }
+            }
         }
     }
 }
@@ -20,6 +20,8 @@
 
 #pragma once
 
+#include <vector>
+
 template<typename T> class array2D;
 
 namespace rtengine
@@ -28,6 +30,10 @@ namespace rtengine
 
 void guidedFilter(const array2D<float> &guide, const array2D<float> &src, array2D<float> &dst, int r, float epsilon, bool multithread, int subsampling=0);
 
+// Filters several channels with the same guide in one go, the statistics of the guide are computed once.
+// A destination may be its own source or the guide.
+void guidedFilter(const array2D<float> &guide, const std::vector<const array2D<float>*> &src, const std::vector<array2D<float>*> &dst, int r, float epsilon, bool multithread, int subsampling=0);
+
 void guidedFilterLog(float base, array2D<float> &chan, int r, float eps, bool multithread, int subsampling=0);
 
 void guidedFilterLog(const array2D<float> &guide, float base, array2D<float> &chan, int r, float eps, bool multithread, int subsampling=0);
@@ -0,0 +1,111 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "opthelper.h"
+
+namespace rtengine
+{
+
+// Largest finite half float
+constexpr float HALF_MAX = 65504.f;
+
+// Rounds to nearest even. Values beyond HALF_MAX become infinite, NaNs stay NaNs
+inline uint16_t floatToHalf(float value)
+{
+    uint32_t f;
+    memcpy(&f, &value, sizeof(f));
+    const uint32_t sign = (f >> 16) & 0x8000;
+    f &= 0x7fffffff;
+
+    if (f >= 0x47800000) { // overflow, infinity or NaN
+        return sign | (f > 0x7f800000 ? 0x7e00 : 0x7c00);
+    }
+
+    if (f < 0x38800000) { // denormal or zero, the addition shifts the mantissa in place and rounds it
+        float denormal;
+        memcpy(&denormal, &f, sizeof(denormal));
+        denormal += 0.5f;
+        uint32_t result;
+        memcpy(&result, &denormal, sizeof(result));
+        return sign | (result - 0x3f000000);
+    }
+
+    const uint32_t mantissaOdd = (f >> 13) & 1;
+    f += 0xc8000fff + mantissaOdd; // rebias the exponent from 127 to 15 and round
+    return sign | (f >> 13);
+}
+
+inline float halfToFloat(uint16_t value)
+{
+    uint32_t f = static_cast<uint32_t>(value & 0x7fff) << 13;
+    const uint32_t exponent = f & 0x0f800000;
+    f += (127 - 15) << 23;
+
+    if (exponent == 0x0f800000) { // infinity or NaN
+        f += (128 - 16) << 23;
+    } else if (exponent == 0) { // denormal or zero, renormalized by the subtraction
+        f += 1 << 23;
+        float result;
+        memcpy(&result, &f, sizeof(result));
+        result -= 6.10351562e-05f; // 2^-14
+        memcpy(&f, &result, sizeof(f));
+    }
+
+    f |= static_cast<uint32_t>(value & 0x8000) << 16;
+    float result;
+    memcpy(&result, &f, sizeof(result));
+    return result;
+}
+
+inline void floatToHalf(const float *src, uint16_t *dst, size_t n)
+{
+    size_t i = 0;
+#ifdef __F16C__
+
+    for (; i + 3 < n; i += 4) {
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + i), _mm_cvtps_ph(LVFU(src[i]), _MM_FROUND_TO_NEAREST_INT));
+    }
+
+#endif
+
+    for (; i < n; ++i) {
+        dst[i] = floatToHalf(src[i]);
+    }
+}
+
+inline void halfToFloat(const uint16_t *src, float *dst, size_t n)
+{
+    size_t i = 0;
+#ifdef __F16C__
+
+    for (; i + 3 < n; i += 4) {
+        STVFU(dst[i], _mm_cvtph_ps(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i))));
+    }
+
+#endif
+
+    for (; i < n; ++i) {
+        dst[i] = halfToFloat(src[i]);
+    }
+}
+
+}
@@ -1185,19 +1185,9 @@ void RawImageSource::HLRecovery_inpaint(float** red, float** green, float** blue
             plistener->setProgress(progress);
         }
         if (blur > 0) { //no use of 2nd guidedFilter if Blur = 0 (slider to 1)..speed-up and very small differences.
-            guidedFilter(guide, rbuf, rbuf, rad2, 0.01f * 65535.f, true, 1);
+            guidedFilter(guide, {&rbuf, &gbuf, &bbuf}, {&rbuf, &gbuf, &bbuf}, rad2, 0.01f * 65535.f, true, 1);
             if (plistener) {
-                progress += 0.03;
-                plistener->setProgress(progress);
-            }
-            guidedFilter(guide, gbuf, gbuf, rad2, 0.01f * 65535.f, true, 1);
-            if (plistener) {
-                progress += 0.03;
-                plistener->setProgress(progress);
-            }
-            guidedFilter(guide, bbuf, bbuf, rad2, 0.01f * 65535.f, true, 1);
-            if (plistener) {
-                progress += 0.03;
+                progress += 0.09;
                 plistener->setProgress(progress);
             }
         }
@@ -45,6 +45,7 @@
 #include "color.h"
 
 #include "jpeg.h"
+#include "trace.h"
 
 using namespace std;
 using namespace rtengine;
@@ -294,6 +295,7 @@ int ImageIO::getPNGSampleFormat (const Glib::ustring &fname, IIOSampleFormat &sF
 
 int ImageIO::loadPNG  (const Glib::ustring &fname)
 {
+    TRACEFUN;
 
     FILE *file = g_fopen (fname.c_str (), "rb");
 
@@ -563,6 +565,7 @@ int ImageIO::loadJPEGFromMemory (const char* buffer, int bufsize)
 
 int ImageIO::loadJPEG (const Glib::ustring &fname)
 {
+    TRACEFUN;
     FILE *file = g_fopen(fname.c_str (), "rb");
 
     if (!file) {
@@ -757,6 +760,7 @@ int ImageIO::getTIFFSampleFormat (const Glib::ustring &fname, IIOSampleFormat &s
 
 int ImageIO::loadTIFF (const Glib::ustring &fname)
 {
+    TRACEFUN;
 
     static MyMutex thumbMutex;
     MyMutex::MyLock lock(thumbMutex);
@@ -1001,6 +1005,7 @@ void PNGwriteRawProfile(png_struct *ping, png_info *ping_info, const char *profi
 
 int ImageIO::savePNG  (const Glib::ustring &fname, int bps) const
 {
+    TRACEFUN;
     if (getWidth() < 1 || getHeight() < 1) {
         return IMIO_HEADERERROR;
     }
@@ -1140,6 +1145,7 @@ int ImageIO::savePNG  (const Glib::ustring &fname, int bps) const
 // Quality 0..100, subsampling: 1=low quality, 2=medium, 3=high
 int ImageIO::saveJPEG (const Glib::ustring &fname, int quality, int subSamp) const
 {
+    TRACEFUN;
     if (getWidth() < 1 || getHeight() < 1) {
         return IMIO_HEADERERROR;
     }
@@ -1330,6 +1336,7 @@ int ImageIO::saveJPEG (const Glib::ustring &fname, int quality, int subSamp) con
 
 int ImageIO::saveTIFF (const Glib::ustring &fname, int bps, bool isFloat, bool uncompressed) const
 {
+    TRACEFUN;
     if (getWidth() < 1 || getHeight() < 1) {
         return IMIO_HEADERERROR;
     }
@@ -40,6 +40,7 @@ class multi_array2D;
 namespace rtengine
 {
 
+class CancelToken;
 class ColorTemp;
 class DCPProfile;
 class DCPProfileApplyState;
@@ -193,7 +194,7 @@ public:
         return this;
     }
     virtual void getRawValues(int x, int y, int rotate, int &R, int &G, int &B) = 0;
-    virtual void captureSharpening(const procparams::CaptureSharpeningParams &sharpeningParams, bool showMask, double &conrastThreshold, double &radius) = 0;
+    virtual void captureSharpening(const procparams::CaptureSharpeningParams &sharpeningParams, bool showMask, double &conrastThreshold, double &radius, const CancelToken *cancelToken) = 0;
 };
 
 }
@@ -16,6 +16,7 @@
  *  You should have received a copy of the GNU General Public License
  *  along with RawTherapee.  If not, see <https://www.gnu.org/licenses/>.
  */
+#include <algorithm>
 #include <fstream>
 
 #include <glibmm/thread.h>
@@ -23,6 +24,7 @@
 #include "improccoordinator.h"
 
 #include "array2D.h"
+#include "bufferpool.h"
 #include "cieimage.h"
 #include "color.h"
 #include "colortemp.h"
@@ -38,6 +40,9 @@
 #include "procparams.h"
 #include "tweakoperator.h"
 #include "refreshmap.h"
+#include "scopestatistics.h"
+#include "taskgraph.h"
+#include "trace.h"
 #include "utils.h"
 
 #include "../rtgui/options.h"
@@ -56,12 +61,15 @@ constexpr int VECTORSCOPE_SIZE = 128;
 namespace rtengine
 {
 
-ImProcCoordinator::ImProcCoordinator() :
+ImProcCoordinator::ImProcCoordinator(ImProcCoordinator* sourceOwner) :
     orig_prev(nullptr),
     oprevi(nullptr),
     spotprev(nullptr),
     oprevl(nullptr),
     nprevl(nullptr),
+    sourceOwner(sourceOwner),
+    pipelineCache(sourceOwner ? sourceOwner->ownPipelineCache : ownPipelineCache),
+    paramsGeneration(0),
     fattal_11_dcrop_cache(nullptr),
     previmg(nullptr),
     workimg(nullptr),
@@ -168,6 +176,9 @@ ImProcCoordinator::ImProcCoordinator() :
     dehaListener(nullptr),
     hListener(nullptr),
     resultValid(false),
+    sourceMutex(sourceOwner ? sourceOwner->ownSourceMutex : ownSourceMutex),
+    sourceRevision(0),
+    renderedSourceRevision(sourceOwner ? sourceOwner->sourceRevision.load() : 0),
     params(new procparams::ProcParams),
     tweakOperator(nullptr),
     lastOutputProfile("BADFOOD"),
@@ -178,6 +189,7 @@ ImProcCoordinator::ImProcCoordinator() :
     updaterRunning(false),
     nextParams(new procparams::ProcParams),
     destroying(false),
+    processingUpdate(false),
     utili(false),
     autili(false),
     butili(false),
@@ -243,11 +255,26 @@ ImProcCoordinator::ImProcCoordinator() :
     locallcieMask(0),
     retistrsav(nullptr)
 {
+    ipf.setCancelToken(&cancelToken);
+
+    if (sourceOwner) {
+        assign(sourceOwner->imgsrc);
+        imgsrc->increaseRef();
+
+        MyMutex::MyLock lock(sourceOwner->sharersMutex);
+        sourceOwner->sourceSharers.push_back(this);
+    }
 }
 
 ImProcCoordinator::~ImProcCoordinator()
 {
 
+    if (sourceOwner) {
+        // no more notifications from the owner from now on
+        MyMutex::MyLock lock(sourceOwner->sharersMutex);
+        sourceOwner->sourceSharers.erase(std::find(sourceOwner->sourceSharers.begin(), sourceOwner->sourceSharers.end(), this));
+    }
+
     destroying = true;
     updaterThreadStart.lock();
 
@@ -282,6 +309,9 @@ ImProcCoordinator::~ImProcCoordinator()
         customTransformOut = nullptr;
     }
 
+    // the editor is closed, don't keep its buffers around for the next one
+    BufferPool::trim();
+
     updaterThreadStart.unlock();
 }
 
@@ -290,6 +320,20 @@ void ImProcCoordinator::assign(ImageSource* imgsrc)
     this->imgsrc = imgsrc;
 }
 
+bool StagedImageProcessor::canShareSource(const procparams::ProcParams& a, const procparams::ProcParams& b)
+{
+    // everything read by the raw stages, up to and including retinex
+    return
+        a.raw == b.raw
+        && a.lensProf == b.lensProf
+        && a.coarse == b.coarse
+        && a.pdsharpening == b.pdsharpening
+        && a.retinex == b.retinex
+        && (!a.retinex.enabled || a.icm == b.icm)
+        && a.toneCurve.hrenabled == b.toneCurve.hrenabled
+        && a.toneCurve.method == b.toneCurve.method;
+}
+
 void ImProcCoordinator::getParams(procparams::ProcParams* dst, bool tweaked)
 {
     if (!tweaked && paramsBackup.operator bool()) {
@@ -331,6 +375,26 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
     // TODO Locallab printf
 
     MyMutex::MyLock processingLock(mProcessing);
+    BufferPool::Scope bufferScope;
+    TRACE_SCOPE("updatePreviewImage", "pipeline");
+    ++paramsGeneration;
+
+    if (sourceOwner) {
+        // the raw stages are run by the owner of the image source
+        if (todo & M_HIGHQUAL) {
+            sourceOwner->startProcessing(M_HIGHQUAL);
+        }
+
+        todo &= ~(M_PREPROC | M_RAW | M_CSHARP | M_RETINEX);
+
+        const unsigned int revision = sourceOwner->sourceRevision;
+
+        if (revision != renderedSourceRevision) {
+            renderedSourceRevision = revision;
+            todo |= ALLNORAW;
+            panningRelatedChange = true;
+        }
+    }
 
     bool highDetailNeeded = options.prevdemo == PD_Sidecar ? true : (todo & M_HIGHQUAL);
                 //    printf("metwb=%s \n", params->wb.method.c_str());
@@ -345,6 +409,19 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
         }
     }
 
+    if (!highDetailNeeded && !sourceOwner) {
+        // the detail windows of the coordinators sharing the source need it as well
+        MyMutex::MyLock sharersLock(sharersMutex);
+
+        for (const auto sharer : sourceSharers) {
+            for (const auto crop : sharer->crops) {
+                if (crop->get_skip() == 1) {
+                    highDetailNeeded = true;
+                }
+            }
+        }
+    }
+
     if (((todo & ALL) == ALL) || (todo & M_MONITOR) || panningRelatedChange || (highDetailNeeded && options.prevdemo != PD_Sidecar)) {
         bwAutoR = bwAutoG = bwAutoB = -9000.f;
 
@@ -356,7 +433,18 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
         ColorManagementParams cmp = params->icm;
         LCurveParams  lcur = params->labCurve;
         bool spotsDone = false;
-        
+
+        // The results of the analyses and the source lock are declared before the graph, so that on early returns
+        // the destructor of the graph joins the tasks before their results are destroyed and the source is unlocked
+        std::vector<double> matchedToneCurve;
+        LUTu aehist;
+        int aehistcompr = 0;
+        double rawAutoWBMul[3] = {-1.0, -1.0, -1.0};
+        MyMutex::MyLock sourceLock(sourceMutex, Glib::Threads::NOT_LOCK);
+
+        // Analyses running concurrently with the pipeline, each one is joined where its result is consumed
+        TaskGraph analyses;
+
         if (!highDetailNeeded) {
             // if below 100% magnification, take a fast path
             if (rp.bayersensor.method != RAWParams::BayerSensor::getMethodString(RAWParams::BayerSensor::Method::NONE) && rp.bayersensor.method != RAWParams::BayerSensor::getMethodString(RAWParams::BayerSensor::Method::MONO)) {
@@ -378,10 +466,28 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
             frameCountListener->FrameCountChanged(imgsrc->getFrameCount(), params->raw.bayersensor.imageNum);
         }
 
+        sourceLock.acquire();
+        bool sourceChanged = false;
+
+        const bool matchToneCurve = (todo & M_AUTOEXP) && params->toneCurve.histmatching && !params->toneCurve.fromHistMatching;
+        TaskGraph::TaskId matchedToneCurveTask = 0;
+
+        if (matchToneCurve) {
+            // reads the embedded thumbnail and the raw file, and caches the curve in the source, which may be shared
+            matchedToneCurveTask = analyses.add(
+                [this, cmp, &matchedToneCurve]()
+                {
+                    imgsrc->getAutoMatchedToneCurve(cmp, matchedToneCurve);
+                }
+            );
+        }
+
+
         // raw auto CA is bypassed if no high detail is needed, so we have to compute it when high detail is needed
-        if ((todo & M_PREPROC) || (!highDetailPreprocessComputed && highDetailNeeded)) {
+        if (!sourceOwner && ((todo & M_PREPROC) || (!highDetailPreprocessComputed && highDetailNeeded))) {
             imgsrc->setCurrentFrame(params->raw.bayersensor.imageNum);
 
+            TRACE_SCOPE("preprocess", "stage");
             imgsrc->preprocess(rp, params->lensProf, params->coarse);
 
             if (flatFieldAutoClipListener && rp.ff_AutoClipControl) {
@@ -394,6 +500,38 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
             highDetailPreprocessComputed = highDetailNeeded;
         }
 
+        // the following analyses only need the preprocessed raw data, so they run alongside the demosaic
+        const bool autoExpHistogram = (todo & M_AUTOEXP) && params->toneCurve.autoexp;
+        TaskGraph::TaskId autoExpHistogramTask = 0;
+
+        if (autoExpHistogram) {
+            autoExpHistogramTask = analyses.add(
+                [this, &aehist, &aehistcompr]()
+                {
+                    imgsrc->getAutoExpHistogram(aehist, aehistcompr);
+                }
+            );
+        }
+
+        const bool rawAutoWB =
+            params->wb.enabled
+            && params->wb.method == "autold"
+            && (lastAwbEqual != params->wb.equal || lastAwbTempBias != params->wb.tempBias || lastAwbauto != params->wb.method);
+        TaskGraph::TaskId rawAutoWBTask = 0;
+
+        if (rawAutoWB) {
+            const WBParams wbp = params->wb;
+            rawAutoWBTask = analyses.add(
+                [this, wbp, cmp, &rawAutoWBMul]()
+                {
+                    // the raw auto WB doesn't use the area and reference temperature arguments
+                    double tempref = 0.0, greenref = 0.0, tempitc = 0.0, greenitc = 0.0;
+                    float studgood = 1000.f;
+                    imgsrc->getAutoWBMultipliersitc(tempref, greenref, tempitc, greenitc, studgood, 0, 0, 0, 0, 0, 0, 0, 0, rawAutoWBMul[0], rawAutoWBMul[1], rawAutoWBMul[2], wbp, cmp, params->raw);
+                }
+            );
+        }
+
         /*
         Demosaic is kicked off only when
         Detail considerations:
@@ -410,10 +548,10 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
             imageTypeListener->imageTypeChanged(imgsrc->isRAW(), imgsrc->getSensorType() == ST_BAYER, imgsrc->getSensorType() == ST_FUJI_XTRANS, imgsrc->isMono());
         }
 
-        if ((todo & M_RAW)
+        if (!sourceOwner && ((todo & M_RAW)
                 || (!highDetailRawComputed && highDetailNeeded)
                 || (params->toneCurve.hrenabled && params->toneCurve.method != "Color" && imgsrc->isRGBSourceModified())
-                || (!params->toneCurve.hrenabled && params->toneCurve.method == "Color" && imgsrc->isRGBSourceModified())) {
+                || (!params->toneCurve.hrenabled && params->toneCurve.method == "Color" && imgsrc->isRGBSourceModified()))) {
 
             if (settings->verbose) {
                 if (imgsrc->getSensorType() == ST_BAYER) {
@@ -435,6 +573,7 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
 
             bool autoContrast = imgsrc->getSensorType() == ST_BAYER ? params->raw.bayersensor.dualDemosaicAutoContrast : params->raw.xtranssensor.dualDemosaicAutoContrast;
             double contrastThreshold = imgsrc->getSensorType() == ST_BAYER ? params->raw.bayersensor.dualDemosaicContrast : params->raw.xtranssensor.dualDemosaicContrast;
+            TRACE_SCOPE("demosaic", "stage");
             imgsrc->demosaic(rp, autoContrast, contrastThreshold, params->pdsharpening.enabled);
 
             if (imgsrc->getSensorType() == ST_BAYER && bayerAutoContrastListener && autoContrast) {
@@ -452,7 +591,12 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
         if ((todo & (M_RAW | M_CSHARP)) && params->pdsharpening.enabled) {
             double pdSharpencontrastThreshold = params->pdsharpening.contrast;
             double pdSharpenRadius = params->pdsharpening.deconvradius;
-            imgsrc->captureSharpening(params->pdsharpening, sharpMask, pdSharpencontrastThreshold, pdSharpenRadius);
+            TRACE_SCOPE("captureSharpening", "stage");
+            imgsrc->captureSharpening(params->pdsharpening, sharpMask, pdSharpencontrastThreshold, pdSharpenRadius, &cancelToken);
+
+            if (updateCancelled()) {
+                return;
+            }
 
             if (pdSharpenAutoContrastListener && params->pdsharpening.autoContrast) {
                 pdSharpenAutoContrastListener->autoContrastChanged(pdSharpencontrastThreshold);
@@ -464,10 +608,10 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
         }
 
 
-        if ((todo & M_RAW)
+        if (!sourceOwner && ((todo & M_RAW)
                 || (!highDetailRawComputed && highDetailNeeded)
                 || (params->toneCurve.hrenabled && params->toneCurve.method != "Color" && imgsrc->isRGBSourceModified())
-                || (!params->toneCurve.hrenabled && params->toneCurve.method == "Color" && imgsrc->isRGBSourceModified())) {
+                || (!params->toneCurve.hrenabled && params->toneCurve.method == "Color" && imgsrc->isRGBSourceModified()))) {
             if (highDetailNeeded) {
                 highDetailRawComputed = true;
             } else {
@@ -482,19 +626,27 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
             }
         }
 
+        if (todo & (M_PREPROC | M_RAW | M_CSHARP | M_RETINEX)) {
+            // the image source data changed
+            pipelineCache.clear();
+            ++sourceRevision;
+            sourceChanged = true;
+        }
+
         if (todo & (M_INIT | M_LINDENOISE | M_HDR)) {
             if (params->wb.method == "autitcgreen") {
                 imgsrc->getrgbloc(0, 0, fh, fw, 0, 0, fh, fw);
             }
         }
 
-        if ((todo & (M_RETINEX | M_INIT)) && params->retinex.enabled) {
+        if (!sourceOwner && (todo & (M_RETINEX | M_INIT)) && params->retinex.enabled) {
             bool dehacontlutili = false;
             bool mapcontlutili = false;
             bool useHsl = false;
             LUTf cdcurve(65536, 0);
             LUTf mapcurve(65536, 0);
 
+            TRACE_SCOPE("retinex", "stage");
             imgsrc->retinexPrepareCurves(params->retinex, cdcurve, mapcurve, dehatransmissionCurve, dehagaintransmissionCurve, dehacontlutili, mapcontlutili, useHsl, lhist16RETI, histLRETI);
             float minCD, maxCD, mini, maxi, Tmean, Tsigma, Tmin, Tmax;
             imgsrc->retinex(params->icm, params->retinex,  params->toneCurve, cdcurve, mapcurve, dehatransmissionCurve, dehagaintransmissionCurve, conversionBuffer, dehacontlutili, mapcontlutili, useHsl, minCD, maxCD, mini, maxi, Tmean, Tsigma, Tmin, Tmax, histLRETI);   //enabled Retinex
@@ -538,7 +690,14 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
                         printf("tempref=%f greref=%f\n", tempref, greenref);
                     }
 
-                    imgsrc->getAutoWBMultipliersitc(tempref, greenref, tempitc, greenitc, studgood, 0, 0, fh, fw, 0, 0, fh, fw, rm, gm, bm,  params->wb, params->icm, params->raw);
+                    if (rawAutoWB && params->wb.method == "autold") {
+                        analyses.join(rawAutoWBTask);
+                        rm = rawAutoWBMul[0];
+                        gm = rawAutoWBMul[1];
+                        bm = rawAutoWBMul[2];
+                    } else {
+                        imgsrc->getAutoWBMultipliersitc(tempref, greenref, tempitc, greenitc, studgood, 0, 0, fh, fw, 0, 0, fh, fw, rm, gm, bm,  params->wb, params->icm, params->raw);
+                    }
 
                     if (params->wb.method ==  "autitcgreen") {
                         params->wb.temperature = tempitc;
@@ -618,6 +777,7 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
             // Tells to the ImProcFunctions' tools what is the preview scale, which may lead to some simplifications
             ipf.setScale(scale);
 
+            TRACE_SCOPE("getImage", "stage");
             imgsrc->getImage(currWB, tr, orig_prev, pp, params->toneCurve, params->raw);
 
             if ((todo & M_SPOT) && params->spot.enabled && !params->spot.entries.empty()) {
@@ -710,28 +870,69 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
                 }
             }
         }
+
+        // the analyses read the source data too
+        if (autoExpHistogram) {
+            analyses.join(autoExpHistogramTask);
+        }
+
+        if (rawAutoWB) {
+            analyses.join(rawAutoWBTask);
+        }
+
+        if (matchToneCurve) {
+            analyses.join(matchedToneCurveTask);
+        }
+
+        sourceLock.release();
+
+        if (sourceChanged) {
+            // the coordinators sharing the source have to render from the new data
+            MyMutex::MyLock sharersLock(sharersMutex);
+
+            for (const auto sharer : sourceSharers) {
+                sharer->startProcessing(M_INIT);
+            }
+        }
+
         if (spotprev) {
             spotprev->copyData(orig_prev);
         }
         
+        bool upstreamCached = false;
+
         if ((todo & M_HDR) && (params->fattal.enabled || params->dehaze.enabled)) {
             if (fattal_11_dcrop_cache) {
                 delete fattal_11_dcrop_cache;
                 fattal_11_dcrop_cache = nullptr;
             }
 
-            ipf.dehaze(orig_prev, params->dehaze);
-            ipf.ToneMapFattal02(orig_prev, params->fattal, 3, 0, nullptr, 0, 0, 0);
+            upstreamCached = pipelineCache.fetch(pipelineCache.getKey(*params, currWB, 0, 0, pW, pH, scale), orig_prev);
+
+            if (!upstreamCached) {
+                TRACE_SCOPE("dehaze+fattal", "stage");
+                ipf.dehaze(orig_prev, params->dehaze);
+                ipf.ToneMapFattal02(orig_prev, params->fattal, 3, 0, nullptr, 0, 0, 0, true);
+
+                if (oprevi != orig_prev) {
+                    delete oprevi;
+                }
 
-            if (oprevi != orig_prev) {
-                delete oprevi;
+                if (updateCancelled()) {
+                    return;
+                }
             }
         }
 
+        if ((todo & M_HDR) && !upstreamCached) {
+            pipelineCache.store(pipelineCache.getKey(*params, currWB, 0, 0, pW, pH, scale), orig_prev, static_cast<size_t>(options.pipelineCacheMemory) << 20);
+        }
+
         // Remove transformation if unneeded
         bool needstransform = ipf.needsTransform(fw, fh, imgsrc->getRotateDegree(), imgsrc->getMetaData());
 
         if ((needstransform || ((todo & (M_TRANSFORM | M_RGBCURVE))  && params->dirpyrequalizer.cbdlMethod == "bef" && params->dirpyrequalizer.enabled && !params->colorappearance.enabled))) {
+            TRACE_SCOPE("transform", "stage");
             // Forking the image
             assert(oprevi);
             Imagefloat *op = oprevi;
@@ -756,9 +957,7 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
 
         if (todo & M_AUTOEXP) {
             if (params->toneCurve.autoexp) {
-                LUTu aehist;
-                int aehistcompr;
-                imgsrc->getAutoExpHistogram(aehist, aehistcompr);
+                analyses.join(autoExpHistogramTask);
                 ipf.getAutoExp(aehist, aehistcompr, params->toneCurve.clip, params->toneCurve.expcomp,
                                params->toneCurve.brightness, params->toneCurve.contrast, params->toneCurve.black, params->toneCurve.hlcompr, params->toneCurve.hlcomprthresh);
 
@@ -769,7 +968,8 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
 
             if (params->toneCurve.histmatching) {
                 if (!params->toneCurve.fromHistMatching) {
-                    imgsrc->getAutoMatchedToneCurve(params->icm, params->toneCurve.curve);
+                    analyses.join(matchedToneCurveTask);
+                    params->toneCurve.curve = matchedToneCurve;
                 }
 
                 if (params->toneCurve.autoexp) {
@@ -916,6 +1116,7 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
         if ((todo & (M_AUTOEXP | M_RGBCURVE | M_CROP)) && params->locallab.enabled && !params->locallab.spots.empty()) {
             
             ipf.rgb2lab(*oprevi, *oprevl, params->icm.workingProfile);
+            labCheckpoints.clear();
 
             nprevl->CopyFrom(oprevl);
             //  int maxspot = 1;
@@ -978,6 +1179,9 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
             fabrefp = new float[sizespot];
 
             for (int sp = 0; sp < (int)params->locallab.spots.size(); sp++) {
+                if (ipf.isCancelled()) {
+                    break;
+                }
 
                 if (params->locallab.spots.at(sp).equiltm  && params->locallab.spots.at(sp).exptonemap) {
                     savenormtm.reset(new LabImage(*oprevl, true));
@@ -1319,6 +1523,10 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
                 locallListener->minmaxChanged(locallretiminmax, params->locallab.selspot);
             }
             */
+            if (updateCancelled()) {
+                return;
+            }
+
             ipf.lab2rgb(*nprevl, *oprevi, params->icm.workingProfile);
             //*************************************************************
             // end locallab
@@ -1416,11 +1624,13 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
                 double ggm = 33.;
                 double bbm = 33.;
 
+                TRACE_SCOPE("rgbProc", "stage");
                 DCPProfileApplyState as;
                 DCPProfile *dcpProf = imgsrc->getDCP(params->icm, as);
 
                 ipf.rgbProc(oprevi, oprevl, nullptr, hltonecurve, shtonecurve, tonecurve, params->toneCurve.saturation,
                             rCurve, gCurve, bCurve, colourToningSatLimit, colourToningSatLimitOpacity, ctColorCurve, ctOpacityCurve, opautili, clToningcurve, cl2Toningcurve, customToneCurve1, customToneCurve2, beforeToneCurveBW, afterToneCurveBW, rrm, ggm, bbm, bwAutoR, bwAutoG, bwAutoB, params->toneCurve.expcomp, params->toneCurve.hlcompr, params->toneCurve.hlcomprthresh, dcpProf, as, histToneCurve);
+                labCheckpoints.clear();
 
                 if (params->blackwhite.enabled && params->blackwhite.autoc && abwListener) {
                     if (settings->verbose) {
@@ -1487,553 +1697,702 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
         //scale = 1;
 
         if ((todo & (M_LUMINANCE + M_COLOR)) || (todo & M_AUTOEXP)) {
-            nprevl->CopyFrom(oprevl);
-            histCCurve.clear();
-            histLCurve.clear();
-            if (params->colorToning.enabled && params->colorToning.method == "LabGrid") {
-            ipf.colorToningLabGrid(nprevl, 0, nprevl->W, 0, nprevl->H, false);
+            // restart from the output of the last stage which is not affected by the changes
+            const LabCheckpoints::Stage firstStage = labCheckpoints.restart(*params, oprevl, nprevl, static_cast<size_t>(options.labCheckpointMemory) << 20);
+
+            if (options.progressivePreview && firstStage < LabCheckpoints::STAGE_COUNT && (panningRelatedChange || (todo & M_MONITOR))) {
+                // show a quick low resolution result of the changed tools before the full quality one is ready
+                updateCoarsePreview(firstStage);
+            }
+
+            processLab(nprevl, scale, firstStage, false);
+
+            if (updateCancelled()) {
+                return;
             }
+        }
 
-            ipf.shadowsHighlights(nprevl, params->sh.enabled, params->sh.lab,params->sh.highlights ,params->sh.shadows, params->sh.radius, scale, params->sh.htonalwidth, params->sh.stonalwidth);
+      //  if (todo & (M_AUTOEXP | M_RGBCURVE)) {
 
-            if (params->localContrast.enabled) {
-            // Alberto's local contrast
-                ipf.localContrast(nprevl, nprevl->L, params->localContrast, false, scale);
+        // Update the monitor color transform if necessary
+        if ((todo & M_MONITOR) || (lastOutputProfile != params->icm.outputProfile) || lastOutputIntent != params->icm.outputIntent || lastOutputBPC != params->icm.outputBPC) {
+            lastOutputProfile = params->icm.outputProfile;
+            lastOutputIntent = params->icm.outputIntent;
+            lastOutputBPC = params->icm.outputBPC;
+            ipf.updateColorProfiles(monitorProfile, monitorIntent, softProof, gamutCheck);
+        }
+    }
+
+// process crop, if needed
+    for (size_t i = 0; i < crops.size(); i++)
+        if (crops[i]->hasListener() && (panningRelatedChange || (highDetailNeeded && options.prevdemo != PD_Sidecar) || (todo & (M_MONITOR | M_RGBCURVE | M_LUMACURVE)) || crops[i]->get_skip() == 1)) {
+            crops[i]->update(todo);     // may call ourselves
+        }
+
+    if (updateCancelled()) {
+        return;
+    }
+
+    if (panningRelatedChange || (todo & M_MONITOR)) {
+        if ((todo != CROP && todo != MINUPDATE) || (todo & M_MONITOR)) {
+            MyMutex::MyLock prevImgLock(previmg->getMutex());
+
+            try {
+                TRACE_SCOPE("output", "stage");
+                // Computing the preview image, i.e. converting from WCS->Monitor color space (soft-proofing disabled) or WCS->Printer profile->Monitor color space (soft-proofing enabled)
+                ipf.lab2monitorRgb(nprevl, previmg);
+
+                // Computing the internal image for analysis, i.e. conversion from WCS->Output profile
+                delete workimg;
+                workimg = nullptr;
+
+                workimg = ipf.lab2rgb(nprevl, 0, 0, pW, pH, params->icm);
+            } catch (std::exception&) {
+                return;
             }
-            ipf.chromiLuminanceCurve(nullptr, pW, nprevl, nprevl, chroma_acurve, chroma_bcurve, satcurve, lhskcurve, clcurve, lumacurve, utili, autili, butili, ccutili, cclutili, clcutili, histCCurve, histLCurve);
-            ipf.vibrance(nprevl, params->vibrance, params->toneCurve.hrenabled, params->icm.workingProfile);
-            ipf.labColorCorrectionRegions(nprevl);
+        }
+
+        if (!resultValid) {
+            resultValid = true;
 
-            if ((params->colorappearance.enabled && !params->colorappearance.tonecie) || (!params->colorappearance.enabled)) {
-                ipf.EPDToneMap(nprevl, 0, scale);
+            if (imageListener) {
+                imageListener->setImage(previmg, scale, params->crop);
             }
+        }
 
-            if (params->dirpyrequalizer.cbdlMethod == "aft") {
-                if (((params->colorappearance.enabled && !settings->autocielab) || (!params->colorappearance.enabled))) {
-                    ipf.dirpyrequalizer(nprevl, scale);
-                }
+        if (imageListener)
+            // TODO: The WB tool should be advertised too in order to get the AutoWB's temp and green values
+        {
+            imageListener->imageReady(params->crop);
+        }
+
+        hist_lrgb_dirty = vectorscope_hc_dirty = vectorscope_hs_dirty = waveform_dirty = true;
+        if (hListener) {
+            // only the scopes which are shown
+            updateScopes(hListener->updateHistogram(), hListener->updateVectorscopeHC(), hListener->updateVectorscopeHS(), hListener->updateWaveform());
+            notifyHistogramChanged();
+        }
+    }
+
+    if (orig_prev != oprevi) {
+        delete oprevi;
+        oprevi = nullptr;
+    }
+}
+
+bool ImProcCoordinator::updateCancelled()
+{
+    if (!cancelToken.isRequested()) {
+        return false;
+    }
+
+    // same cleanup as at the end of updatePreviewImage
+    if (orig_prev != oprevi) {
+        delete oprevi;
+        oprevi = nullptr;
+    }
+
+    return true;
+}
+
+void ImProcCoordinator::processLab(LabImage *lab, int labScale, LabCheckpoints::Stage firstStage, bool coarse)
+{
+    TRACE_SCOPE(coarse ? "processLab (coarse)" : "processLab", "stage");
+    // the coarse pass neither feeds the checkpoints, nor the histograms or the listeners
+    const auto storeCheckpoint = [this, lab, coarse](LabCheckpoints::Stage stage) {
+        // the output of a cancelled update must not be reused either
+        if (!coarse && !ipf.isCancelled()) {
+            labCheckpoints.store(stage, lab);
+        }
+    };
+
+    if (firstStage <= LabCheckpoints::ADJUSTMENTS) {
+        if (!coarse) {
+            histCCurve.clear();
+            histLCurve.clear();
+        }
+
+        if (params->colorToning.enabled && params->colorToning.method == "LabGrid") {
+            ipf.colorToningLabGrid(lab, 0, lab->W, 0, lab->H, false);
+        }
+
+        ipf.shadowsHighlights(lab, params->sh.enabled, params->sh.lab,params->sh.highlights ,params->sh.shadows, params->sh.radius, labScale, params->sh.htonalwidth, params->sh.stonalwidth);
+
+        if (params->localContrast.enabled) {
+        // Alberto's local contrast
+            ipf.localContrast(lab, lab->L, params->localContrast, false, labScale);
+        }
+        ipf.chromiLuminanceCurve(nullptr, coarse ? 1 : lab->W, lab, lab, chroma_acurve, chroma_bcurve, satcurve, lhskcurve, clcurve, lumacurve, utili, autili, butili, ccutili, cclutili, clcutili, histCCurve, histLCurve);
+        ipf.vibrance(lab, params->vibrance, params->toneCurve.hrenabled, params->icm.workingProfile);
+        ipf.labColorCorrectionRegions(lab);
+        storeCheckpoint(LabCheckpoints::ADJUSTMENTS);
+    }
+
+    if (firstStage <= LabCheckpoints::TONEMAPPING && params->epd.enabled) {
+        if ((params->colorappearance.enabled && !params->colorappearance.tonecie) || (!params->colorappearance.enabled)) {
+            ipf.EPDToneMap(lab, 0, labScale);
+        }
+
+        storeCheckpoint(LabCheckpoints::TONEMAPPING);
+    }
+
+    if (firstStage <= LabCheckpoints::DETAIL && params->dirpyrequalizer.enabled) {
+        if (params->dirpyrequalizer.cbdlMethod == "aft") {
+            if (((params->colorappearance.enabled && !settings->autocielab) || (!params->colorappearance.enabled))) {
+                ipf.dirpyrequalizer(lab, labScale);
             }
+        }
 
-            wavcontlutili = CurveFactory::diagonalCurve2Lut(params->wavelet.wavclCurve, wavclCurve, scale == 1 ? 1 : 16);
-
-            if ((params->wavelet.enabled)) {
-                WaveletParams WaveParams = params->wavelet;
-                WaveParams.getCurves(wavCLVCurve, wavdenoise, wavdenoiseh, wavblcurve, waOpacityCurveRG, waOpacityCurveSH, waOpacityCurveBY, waOpacityCurveW, waOpacityCurveWL);
-                int kall = 0;
-                LabImage *unshar = nullptr;
-                Glib::ustring provis;
-                LabImage *provradius = nullptr;
-                bool procont = WaveParams.expcontrast;
-                bool prochro = WaveParams.expchroma;
-                bool proedge = WaveParams.expedge;
-                bool profin = WaveParams.expfinal;
-                bool proton = WaveParams.exptoning;
-                bool pronois = WaveParams.expnoise; 
-
-                if (WaveParams.showmask) {
-                 //   WaveParams.showmask = false;
-                 //   WaveParams.expclari = true;
-                }
+        storeCheckpoint(LabCheckpoints::DETAIL);
+    }
 
-                if (WaveParams.softrad > 0.f) {
-                    provradius = new LabImage(*nprevl, true);
-                }
+    wavcontlutili = CurveFactory::diagonalCurve2Lut(params->wavelet.wavclCurve, wavclCurve, labScale == 1 ? 1 : 16);
+
+    if (firstStage <= LabCheckpoints::WAVELET && params->wavelet.enabled) {
+        WaveletParams WaveParams = params->wavelet;
+        WaveParams.getCurves(wavCLVCurve, wavdenoise, wavdenoiseh, wavblcurve, waOpacityCurveRG, waOpacityCurveSH, waOpacityCurveBY, waOpacityCurveW, waOpacityCurveWL);
+        int kall = 0;
+        LabImage *unshar = nullptr;
+        Glib::ustring provis;
+        LabImage *provradius = nullptr;
+        bool procont = WaveParams.expcontrast;
+        bool prochro = WaveParams.expchroma;
+        bool proedge = WaveParams.expedge;
+        bool profin = WaveParams.expfinal;
+        bool proton = WaveParams.exptoning;
+        bool pronois = WaveParams.expnoise; 
+
+        if (WaveParams.showmask) {
+         //   WaveParams.showmask = false;
+         //   WaveParams.expclari = true;
+        }
 
-                if ((WaveParams.ushamethod == "sharp" || WaveParams.ushamethod == "clari") && WaveParams.expclari && WaveParams.CLmethod != "all") {
-                    provis = params->wavelet.CLmethod;
-                    params->wavelet.CLmethod = "all";
-                    ipf.ip_wavelet(nprevl, nprevl, kall, WaveParams, wavCLVCurve, wavdenoise, wavdenoiseh, wavblcurve, waOpacityCurveRG, waOpacityCurveSH, waOpacityCurveBY, waOpacityCurveW, waOpacityCurveWL, wavclCurve, scale);
-                    unshar = new LabImage(*nprevl, true);
+        if (WaveParams.softrad > 0.f) {
+            provradius = new LabImage(*lab, true);
+        }
 
-                    params->wavelet.CLmethod = provis;
+        if ((WaveParams.ushamethod == "sharp" || WaveParams.ushamethod == "clari") && WaveParams.expclari && WaveParams.CLmethod != "all") {
+            provis = params->wavelet.CLmethod;
+            params->wavelet.CLmethod = "all";
+            ipf.ip_wavelet(lab, lab, kall, WaveParams, wavCLVCurve, wavdenoise, wavdenoiseh, wavblcurve, waOpacityCurveRG, waOpacityCurveSH, waOpacityCurveBY, waOpacityCurveW, waOpacityCurveWL, wavclCurve, labScale);
+            unshar = new LabImage(*lab, true);
 
-                    WaveParams.expcontrast = false;
-                    WaveParams.expchroma = false;
-                    WaveParams.expedge = false;
-                    WaveParams.expfinal = false;
-                    WaveParams.exptoning = false;
-                    WaveParams.expnoise = false; 
-                }
+            params->wavelet.CLmethod = provis;
 
-                ipf.ip_wavelet(nprevl, nprevl, kall, WaveParams, wavCLVCurve, wavdenoise, wavdenoiseh, wavblcurve, waOpacityCurveRG, waOpacityCurveSH, waOpacityCurveBY, waOpacityCurveW, waOpacityCurveWL, wavclCurve, scale);
+            WaveParams.expcontrast = false;
+            WaveParams.expchroma = false;
+            WaveParams.expedge = false;
+            WaveParams.expfinal = false;
+            WaveParams.exptoning = false;
+            WaveParams.expnoise = false; 
+        }
 
+        // the coarse pass would replace the decompositions of the full preview
+        ipf.ip_wavelet(lab, lab, kall, WaveParams, wavCLVCurve, wavdenoise, wavdenoiseh, wavblcurve, waOpacityCurveRG, waOpacityCurveSH, waOpacityCurveBY, waOpacityCurveW, waOpacityCurveWL, wavclCurve, labScale, coarse ? nullptr : &waveletCache);
 
-                if ((WaveParams.ushamethod == "sharp" || WaveParams.ushamethod == "clari") && WaveParams.expclari && WaveParams.CLmethod != "all") {
-                    WaveParams.expcontrast = procont;
-                    WaveParams.expchroma = prochro;
-                    WaveParams.expedge = proedge;
-                    WaveParams.expfinal = profin;
-                    WaveParams.exptoning = proton;
-                    WaveParams.expnoise = pronois;
-                    
-                    if (WaveParams.softrad > 0.f) {
 
-                        array2D<float> ble(pW, pH);
-                        array2D<float> guid(pW, pH);
-                        Imagefloat *tmpImage = nullptr;
-                        tmpImage = new Imagefloat(pW, pH);
+        if ((WaveParams.ushamethod == "sharp" || WaveParams.ushamethod == "clari") && WaveParams.expclari && WaveParams.CLmethod != "all") {
+            WaveParams.expcontrast = procont;
+            WaveParams.expchroma = prochro;
+            WaveParams.expedge = proedge;
+            WaveParams.expfinal = profin;
+            WaveParams.exptoning = proton;
+            WaveParams.expnoise = pronois;
+            
+            if (WaveParams.softrad > 0.f) {
+
+                array2D<float> ble(lab->W, lab->H);
+                array2D<float> guid(lab->W, lab->H);
+                Imagefloat *tmpImage = nullptr;
+                tmpImage = new Imagefloat(lab->W, lab->H);
 
 #ifdef _OPENMP
-                        #pragma omp parallel for
+                #pragma omp parallel for
 #endif
 
-                        for (int ir = 0; ir < pH; ir++)
-                            for (int jr = 0; jr < pW; jr++) {
-                                float X, Y, Z;
-                                float L = provradius->L[ir][jr];
-                                float a = provradius->a[ir][jr];
-                                float b = provradius->b[ir][jr];
-                                Color::Lab2XYZ(L, a, b, X, Y, Z);
-
-                                guid[ir][jr] = Y / 32768.f;
-                                float La = nprevl->L[ir][jr];
-                                float aa = nprevl->a[ir][jr];
-                                float ba = nprevl->b[ir][jr];
-                                Color::Lab2XYZ(La, aa, ba, X, Y, Z);
-                                tmpImage->r(ir, jr) = X;
-                                tmpImage->g(ir, jr) = Y;
-                                tmpImage->b(ir, jr) = Z;
-                                ble[ir][jr] = Y / 32768.f;
-                            }
-    
-                        double epsilmax = 0.0001;
-                        double epsilmin = 0.00001;
-                        double aepsil = (epsilmax - epsilmin) / 100.f;
-                        double bepsil = epsilmin; //epsilmax - 100.f * aepsil;
-                        double epsil = aepsil * WaveParams.softrad + bepsil;
+                for (int ir = 0; ir < lab->H; ir++)
+                    for (int jr = 0; jr < lab->W; jr++) {
+                        float X, Y, Z;
+                        float L = provradius->L[ir][jr];
+                        float a = provradius->a[ir][jr];
+                        float b = provradius->b[ir][jr];
+                        Color::Lab2XYZ(L, a, b, X, Y, Z);
+
+                        guid[ir][jr] = Y / 32768.f;
+                        float La = lab->L[ir][jr];
+                        float aa = lab->a[ir][jr];
+                        float ba = lab->b[ir][jr];
+                        Color::Lab2XYZ(La, aa, ba, X, Y, Z);
+                        tmpImage->r(ir, jr) = X;
+                        tmpImage->g(ir, jr) = Y;
+                        tmpImage->b(ir, jr) = Z;
+                        ble[ir][jr] = Y / 32768.f;
+                    }
+
+                double epsilmax = 0.0001;
+                double epsilmin = 0.00001;
+                double aepsil = (epsilmax - epsilmin) / 100.f;
+                double bepsil = epsilmin; //epsilmax - 100.f * aepsil;
+                double epsil = aepsil * WaveParams.softrad + bepsil;
 
-                        float blur = 10.f / scale * (0.5f + 0.8f * WaveParams.softrad);
-                        // rtengine::guidedFilter(guid, ble, ble, blur, 0.001, multiTh);
-                        rtengine::guidedFilter(guid, ble, ble, blur, epsil, false);
+                float blur = 10.f / labScale * (0.5f + 0.8f * WaveParams.softrad);
+                // rtengine::guidedFilter(guid, ble, ble, blur, 0.001, multiTh);
+                rtengine::guidedFilter(guid, ble, ble, blur, epsil, false);
 
 
 
 #ifdef _OPENMP
-                        #pragma omp parallel for
+                #pragma omp parallel for
 #endif
 
-                        for (int ir = 0; ir < pH; ir++)
-                            for (int jr = 0; jr < pW; jr++) {
-                                float X = tmpImage->r(ir, jr);
-                                float Y = 32768.f * ble[ir][jr];
-                                float Z = tmpImage->b(ir, jr);
-                                float L, a, b;
-                                Color::XYZ2Lab(X, Y, Z, L, a, b);
-                                nprevl->L[ir][jr] =  L;
-                            }
-      
-                    delete tmpImage;
-
+                for (int ir = 0; ir < lab->H; ir++)
+                    for (int jr = 0; jr < lab->W; jr++) {
+                        float X = tmpImage->r(ir, jr);
+                        float Y = 32768.f * ble[ir][jr];
+                        float Z = tmpImage->b(ir, jr);
+                        float L, a, b;
+                        Color::XYZ2Lab(X, Y, Z, L, a, b);
+                        lab->L[ir][jr] =  L;
                     }
-                    
-                }
 
-                if ((WaveParams.ushamethod == "sharp" || WaveParams.ushamethod == "clari")  && WaveParams.expclari && WaveParams.CLmethod != "all") {
-                    float mL = (float)(WaveParams.mergeL / 100.f);
-                    float mC = (float)(WaveParams.mergeC / 100.f);
-                    float mL0;
-                    float mC0;
-                    float background = 0.f;
-                    int show = 0; 
-
-
-
-                    if ((WaveParams.CLmethod == "one" || WaveParams.CLmethod == "inf")  && WaveParams.Backmethod == "black") {
-                        mL0 = mC0 = 0.f;
-                        mL = - 1.5f * mL;
-                        mC = -mC;
-                        background = 12000.f;
-                        show = 0;
-                    } else if (WaveParams.CLmethod == "sup" && WaveParams.Backmethod == "resid") {
-                        mL0 = mL;
-                        mC0 = mC;
-                        background = 0.f;
-                        show = 0;
-                    } else {
-                        mL0 = mL = mC0 = mC = 0.f;
-                        background = 0.f;
-                        show = 0;
-                    }
-                float indic = 1.f;
-
-                if (WaveParams.showmask){
-                    mL0 = mC0 = -1.f;
-                    indic = -1.f;
-                    mL = fabs(mL);
-                    mC = fabs(mC);
-                    show = 1;
-                }
+            delete tmpImage;
+
+            }
+            
+        }
+
+        if ((WaveParams.ushamethod == "sharp" || WaveParams.ushamethod == "clari")  && WaveParams.expclari && WaveParams.CLmethod != "all") {
+            float mL = (float)(WaveParams.mergeL / 100.f);
+            float mC = (float)(WaveParams.mergeC / 100.f);
+            float mL0;
+            float mC0;
+            float background = 0.f;
+            int show = 0; 
+
+
+
+            if ((WaveParams.CLmethod == "one" || WaveParams.CLmethod == "inf")  && WaveParams.Backmethod == "black") {
+                mL0 = mC0 = 0.f;
+                mL = - 1.5f * mL;
+                mC = -mC;
+                background = 12000.f;
+                show = 0;
+            } else if (WaveParams.CLmethod == "sup" && WaveParams.Backmethod == "resid") {
+                mL0 = mL;
+                mC0 = mC;
+                background = 0.f;
+                show = 0;
+            } else {
+                mL0 = mL = mC0 = mC = 0.f;
+                background = 0.f;
+                show = 0;
+            }
+        float indic = 1.f;
+
+        if (WaveParams.showmask){
+            mL0 = mC0 = -1.f;
+            indic = -1.f;
+            mL = fabs(mL);
+            mC = fabs(mC);
+            show = 1;
+        }
 #ifdef _OPENMP
-                    #pragma omp parallel for
+            #pragma omp parallel for
 #endif
 
-                    for (int x = 0; x < pH; x++)
-                        for (int y = 0; y < pW; y++) {
-                            nprevl->L[x][y] = LIM((1.f + mL0) * (unshar->L[x][y]) + show * background - mL * indic * nprevl->L[x][y], 0.f, 32768.f);
-                            nprevl->a[x][y] = (1.f + mC0) * (unshar->a[x][y]) - mC * indic * nprevl->a[x][y];
-                            nprevl->b[x][y] = (1.f + mC0) * (unshar->b[x][y]) - mC * indic * nprevl->b[x][y];
-                        }
+            for (int x = 0; x < lab->H; x++)
+                for (int y = 0; y < lab->W; y++) {
+                    lab->L[x][y] = LIM((1.f + mL0) * (unshar->L[x][y]) + show * background - mL * indic * lab->L[x][y], 0.f, 32768.f);
+                    lab->a[x][y] = (1.f + mC0) * (unshar->a[x][y]) - mC * indic * lab->a[x][y];
+                    lab->b[x][y] = (1.f + mC0) * (unshar->b[x][y]) - mC * indic * lab->b[x][y];
+                }
 
-                    delete unshar;
-                    unshar    = NULL;
-                    
-                    
+            delete unshar;
+            unshar    = NULL;
+            
+            
 /*
-                    if (WaveParams.softrad > 0.f) {
-                        array2D<float> ble(pW, pH);
-                        array2D<float> guid(pW, pH);
+            if (WaveParams.softrad > 0.f) {
+                array2D<float> ble(lab->W, lab->H);
+                array2D<float> guid(lab->W, lab->H);
 #ifdef _OPENMP
-                        #pragma omp parallel for
+                #pragma omp parallel for
 #endif
 
-                        for (int ir = 0; ir < pH; ir++)
-                            for (int jr = 0; jr < pW; jr++) {
-                                ble[ir][jr] = (nprevl->L[ir][jr]  - provradius->L[ir][jr]) / 32768.f;
-                                guid[ir][jr] = provradius->L[ir][jr] / 32768.f;
-                            }
-                        double epsilmax = 0.001;
-                        double epsilmin = 0.0001;
-                        double aepsil = (epsilmax - epsilmin) / 90.f;
-                        double bepsil = epsilmax - 100.f * aepsil;
-                        double epsil = aepsil * WaveParams.softrad + bepsil;
+                for (int ir = 0; ir < lab->H; ir++)
+                    for (int jr = 0; jr < lab->W; jr++) {
+                        ble[ir][jr] = (lab->L[ir][jr]  - provradius->L[ir][jr]) / 32768.f;
+                        guid[ir][jr] = provradius->L[ir][jr] / 32768.f;
+                    }
+                double epsilmax = 0.001;
+                double epsilmin = 0.0001;
+                double aepsil = (epsilmax - epsilmin) / 90.f;
+                double bepsil = epsilmax - 100.f * aepsil;
+                double epsil = aepsil * WaveParams.softrad + bepsil;
 
-                        float blur = 10.f / scale * (0.001f + 0.8f * WaveParams.softrad);
-                        // rtengine::guidedFilter(guid, ble, ble, blur, 0.001, multiTh);
-                        rtengine::guidedFilter(guid, ble, ble, blur, epsil, false);
+                float blur = 10.f / labScale * (0.001f + 0.8f * WaveParams.softrad);
+                // rtengine::guidedFilter(guid, ble, ble, blur, 0.001, multiTh);
+                rtengine::guidedFilter(guid, ble, ble, blur, epsil, false);
 
 
 
 #ifdef _OPENMP
-                        #pragma omp parallel for
+                #pragma omp parallel for
 #endif
 
-                        for (int ir = 0; ir < pH; ir++)
-                            for (int jr = 0; jr < pW; jr++) {
-                                nprevl->L[ir][jr] =  provradius->L[ir][jr] + 32768.f * ble[ir][jr];
-                            }
+                for (int ir = 0; ir < lab->H; ir++)
+                    for (int jr = 0; jr < lab->W; jr++) {
+                        lab->L[ir][jr] =  provradius->L[ir][jr] + 32768.f * ble[ir][jr];
                     }
+            }
 */
-                    if (WaveParams.softrad > 0.f) {
+            if (WaveParams.softrad > 0.f) {
 
-                        delete provradius;
-                        provradius    = NULL;
+                delete provradius;
+                provradius    = NULL;
 
-                    }
+            }
 
 
-                }
-               
-            }
+        }
 
-            ipf.softLight(nprevl, params->softlight);
+        storeCheckpoint(LabCheckpoints::WAVELET);
+    }
 
-            if (params->icm.workingTRC != ColorManagementParams::WorkingTrc::NONE) {
-                const int GW = nprevl->W;
-                const int GH = nprevl->H;
-                std::unique_ptr<LabImage> provis;
-                const float pres = 0.01f * params->icm.preser;
-                if (pres > 0.f && params->icm.wprim != ColorManagementParams::Primaries::DEFAULT) {
-                    provis.reset(new LabImage(GW, GH));
-                    provis->CopyFrom(nprevl);
-                }
+    if (firstStage <= LabCheckpoints::FINISHING) {
+        ipf.softLight(lab, params->softlight);
+    }
 
-                std::unique_ptr<Imagefloat> tmpImage1(new Imagefloat(GW, GH));
+    if (firstStage <= LabCheckpoints::FINISHING && params->icm.workingTRC != ColorManagementParams::WorkingTrc::NONE) {
+        const int GW = lab->W;
+        const int GH = lab->H;
+        std::unique_ptr<LabImage> provis;
+        const float pres = 0.01f * params->icm.preser;
+        if (pres > 0.f && params->icm.wprim != ColorManagementParams::Primaries::DEFAULT) {
+            provis.reset(new LabImage(GW, GH));
+            provis->CopyFrom(lab);
+        }
 
-                ipf.lab2rgb(*nprevl, *tmpImage1, params->icm.workingProfile);
+        std::unique_ptr<Imagefloat> tmpImage1(new Imagefloat(GW, GH));
 
-                const float gamtone = params->icm.workingTRCGamma;
-                const float slotone = params->icm.workingTRCSlope;
+        ipf.lab2rgb(*lab, *tmpImage1, params->icm.workingProfile);
 
-                int illum = toUnderlying(params->icm.will);
-                const int prim = toUnderlying(params->icm.wprim);
+        const float gamtone = params->icm.workingTRCGamma;
+        const float slotone = params->icm.workingTRCSlope;
 
-                Glib::ustring prof = params->icm.workingProfile;
-                cmsHTRANSFORM dummy = nullptr;
-                int ill = 0;
-                ipf.workingtrc(tmpImage1.get(), tmpImage1.get(), GW, GH, -5, prof, 2.4, 12.92310, ill, 0, dummy, true, false, false);
-                ipf.workingtrc(tmpImage1.get(), tmpImage1.get(), GW, GH, 5, prof, gamtone, slotone, illum, prim, dummy, false, true, true);
+        int illum = toUnderlying(params->icm.will);
+        const int prim = toUnderlying(params->icm.wprim);
 
-                ipf.rgb2lab(*tmpImage1, *nprevl, params->icm.workingProfile);
-                //nprevl and provis
-                if (provis) {
-                    ipf.preserv(nprevl, provis.get(), GW, GH);
-                }
-                if (params->icm.fbw) {
+        Glib::ustring prof = params->icm.workingProfile;
+        cmsHTRANSFORM dummy = nullptr;
+        int ill = 0;
+        ipf.workingtrc(tmpImage1.get(), tmpImage1.get(), GW, GH, -5, prof, 2.4, 12.92310, ill, 0, dummy, true, false, false);
+        ipf.workingtrc(tmpImage1.get(), tmpImage1.get(), GW, GH, 5, prof, gamtone, slotone, illum, prim, dummy, false, true, true);
+
+        ipf.rgb2lab(*tmpImage1, *lab, params->icm.workingProfile);
+        //lab and provis
+        if (provis) {
+            ipf.preserv(lab, provis.get(), GW, GH);
+        }
+        if (params->icm.fbw) {
 #ifdef _OPENMP
-                    #pragma omp parallel for
+            #pragma omp parallel for
 #endif
-                    for (int x = 0; x < GH; x++)
-                        for (int y = 0; y < GW; y++) {
-                            nprevl->a[x][y] = 0.f;
-                            nprevl->b[x][y] = 0.f;
-                        }
+            for (int x = 0; x < GH; x++)
+                for (int y = 0; y < GW; y++) {
+                    lab->a[x][y] = 0.f;
+                    lab->b[x][y] = 0.f;
                 }
-                
-                tmpImage1.reset();
-
-                if (prim == 12) {//pass red gre blue xy in function of area dats Ciexy
-                    float redgraphx =  params->icm.labgridcieALow;
-                    float redgraphy =  params->icm.labgridcieBLow;
-                    float blugraphx =  params->icm.labgridcieAHigh;
-                    float blugraphy =  params->icm.labgridcieBHigh;
-                    float gregraphx =  params->icm.labgridcieGx;
-                    float gregraphy =  params->icm.labgridcieGy;
-                    float redxx = 0.55f * (redgraphx + 1.f) - 0.1f;
-                    redxx = rtengine::LIM(redxx, 0.41f, 1.f);
-                    float redyy = 0.55f * (redgraphy + 1.f) - 0.1f;
-                    redyy = rtengine::LIM(redyy, 0.f, 0.7f);
-                    float bluxx = 0.55f * (blugraphx + 1.f) - 0.1f;
-                    bluxx = rtengine::LIM(bluxx, -0.1f, 0.5f);
-                    float bluyy = 0.55f * (blugraphy + 1.f) - 0.1f;
-                    bluyy = rtengine::LIM(bluyy, -0.1f, 0.5f);
-
-                    float grexx = 0.55f * (gregraphx + 1.f) - 0.1f;
-                    grexx = rtengine::LIM(grexx, -0.1f, 0.4f);
-                    float greyy = 0.55f * (gregraphy + 1.f) - 0.1f;
-                    greyy = rtengine::LIM(greyy, 0.5f, 1.f);
-
-                    if (primListener) {
-                        primListener->primChanged (redxx, redyy, bluxx, bluyy, grexx, greyy);
-                    }
-                } else {//all other cases - pass Cie xy to update graph Ciexy
-                    float r_x =  params->icm.redx;
-                    float r_y =  params->icm.redy;
-                    float b_x =  params->icm.blux;
-                    float b_y =  params->icm.bluy;
-                    float g_x =  params->icm.grex;
-                    float g_y =  params->icm.grey;
-                    //printf("rx=%f ry=%f \n", (double) r_x, (double) r_y);
-                    float wx = 0.33f;
-                    float wy = 0.33f;
-
-                    switch (illum) {
-                    case 1://D41
-                        wx = 0.37798f;
-                        wy = 0.38123f;
-                        break;
-                    case 2://D50
-                        wx = 0.3457f;
-                        wy = 0.3585f;
-                        break;
-                    case 3://D55
-                        wx = 0.3324f;
-                        wy = 0.3474f;
-                        break;
-                    case 4://D60
-                        wx = 0.3217f;
-                        wy = 0.3377f;
-                        break;
-                    case 5://D65
-                        wx = 0.3127f;
-                        wy = 0.3290f;
-                        break;
-                    case 6://D80
-                        wx = 0.2937f;
-                        wy = 0.3092f;
-                        break;
-                    case 7://D120
-                        wx = 0.2697f;
-                        wy = 0.2808f;
-                        break;
-                    case 8://stdA
-                        wx = 0.4476f;
-                        wy = 0.4074f;
-                        break;
-                    case 9://2000K
-                        wx = 0.5266f;
-                        wy = 0.4133f;
-                        break;
-                    case 10://1500K
-                        wx = 0.5857f;
-                        wy = 0.3932f;
-                        break;
-                    }
+        }
+        
+        tmpImage1.reset();
+
+        if (prim == 12) {//pass red gre blue xy in function of area dats Ciexy
+            float redgraphx =  params->icm.labgridcieALow;
+            float redgraphy =  params->icm.labgridcieBLow;
+            float blugraphx =  params->icm.labgridcieAHigh;
+            float blugraphy =  params->icm.labgridcieBHigh;
+            float gregraphx =  params->icm.labgridcieGx;
+            float gregraphy =  params->icm.labgridcieGy;
+            float redxx = 0.55f * (redgraphx + 1.f) - 0.1f;
+            redxx = rtengine::LIM(redxx, 0.41f, 1.f);
+            float redyy = 0.55f * (redgraphy + 1.f) - 0.1f;
+            redyy = rtengine::LIM(redyy, 0.f, 0.7f);
+            float bluxx = 0.55f * (blugraphx + 1.f) - 0.1f;
+            bluxx = rtengine::LIM(bluxx, -0.1f, 0.5f);
+            float bluyy = 0.55f * (blugraphy + 1.f) - 0.1f;
+            bluyy = rtengine::LIM(bluyy, -0.1f, 0.5f);
+
+            float grexx = 0.55f * (gregraphx + 1.f) - 0.1f;
+            grexx = rtengine::LIM(grexx, -0.1f, 0.4f);
+            float greyy = 0.55f * (gregraphy + 1.f) - 0.1f;
+            greyy = rtengine::LIM(greyy, 0.5f, 1.f);
+
+            if (primListener && !coarse) {
+                primListener->primChanged (redxx, redyy, bluxx, bluyy, grexx, greyy);
+            }
+        } else {//all other cases - pass Cie xy to update graph Ciexy
+            float r_x =  params->icm.redx;
+            float r_y =  params->icm.redy;
+            float b_x =  params->icm.blux;
+            float b_y =  params->icm.bluy;
+            float g_x =  params->icm.grex;
+            float g_y =  params->icm.grey;
+            //printf("rx=%f ry=%f \n", (double) r_x, (double) r_y);
+            float wx = 0.33f;
+            float wy = 0.33f;
+
+            switch (illum) {
+            case 1://D41
+                wx = 0.37798f;
+                wy = 0.38123f;
+                break;
+            case 2://D50
+                wx = 0.3457f;
+                wy = 0.3585f;
+                break;
+            case 3://D55
+                wx = 0.3324f;
+                wy = 0.3474f;
+                break;
+            case 4://D60
+                wx = 0.3217f;
+                wy = 0.3377f;
+                break;
+            case 5://D65
+                wx = 0.3127f;
+                wy = 0.3290f;
+                break;
+            case 6://D80
+                wx = 0.2937f;
+                wy = 0.3092f;
+                break;
+            case 7://D120
+                wx = 0.2697f;
+                wy = 0.2808f;
+                break;
+            case 8://stdA
+                wx = 0.4476f;
+                wy = 0.4074f;
+                break;
+            case 9://2000K
+                wx = 0.5266f;
+                wy = 0.4133f;
+                break;
+            case 10://1500K
+                wx = 0.5857f;
+                wy = 0.3932f;
+                break;
+            }
 
-                    if (primListener) {
-                        primListener->iprimChanged (r_x, r_y, b_x, b_y, g_x, g_y, wx, wy);
-                    }
-                }
+            if (primListener && !coarse) {
+                primListener->iprimChanged (r_x, r_y, b_x, b_y, g_x, g_y, wx, wy);
             }
+        }
+    }
 
-            if (params->colorappearance.enabled) {
-                // L histo  and Chroma histo for ciecam
-                // histogram well be for Lab (Lch) values, because very difficult to do with J,Q, M, s, C
-                int x1, y1, x2, y2;
-                params->crop.mapToResized(pW, pH, scale, x1, x2,  y1, y2);
-                lhist16CAM.clear();
-                lhist16CCAM.clear();
-
-                if (!params->colorappearance.datacie) {
-                    for (int x = 0; x < pH; x++)
-                        for (int y = 0; y < pW; y++) {
-                            int pos = CLIP((int)(nprevl->L[x][y]));
-                            int posc = CLIP((int)sqrt(nprevl->a[x][y] * nprevl->a[x][y] + nprevl->b[x][y] * nprevl->b[x][y]));
-                            lhist16CAM[pos]++;
-                            lhist16CCAM[posc]++;
-                        }
-                }
+    if (firstStage <= LabCheckpoints::FINISHING) {
+        storeCheckpoint(LabCheckpoints::FINISHING);
+    }
 
-                CurveFactory::curveLightBrightColor(params->colorappearance.curve, params->colorappearance.curve2, params->colorappearance.curve3,
-                                                    lhist16CAM, histLCAM, lhist16CCAM, histCCAM,
-                                                    customColCurve1, customColCurve2, customColCurve3, 1);
+    if (firstStage <= LabCheckpoints::CIECAM && params->colorappearance.enabled) {
+        // L histo  and Chroma histo for ciecam
+        // histogram well be for Lab (Lch) values, because very difficult to do with J,Q, M, s, C
+        int x1, y1, x2, y2;
+        params->crop.mapToResized(lab->W, lab->H, labScale, x1, x2,  y1, y2);
+        lhist16CAM.clear();
+        lhist16CCAM.clear();
+
+        if (!params->colorappearance.datacie) {
+            for (int x = 0; x < lab->H; x++)
+                for (int y = 0; y < lab->W; y++) {
+                    int pos = CLIP((int)(lab->L[x][y]));
+                    int posc = CLIP((int)sqrt(lab->a[x][y] * lab->a[x][y] + lab->b[x][y] * lab->b[x][y]));
+                    lhist16CAM[pos]++;
+                    lhist16CCAM[posc]++;
+                }
+        }
 
-                const FramesMetaData* metaData = imgsrc->getMetaData();
-                int imgNum = 0;
+        CurveFactory::curveLightBrightColor(params->colorappearance.curve, params->colorappearance.curve2, params->colorappearance.curve3,
+                                            lhist16CAM, histLCAM, lhist16CCAM, histCCAM,
+                                            customColCurve1, customColCurve2, customColCurve3, 1);
 
-                if (imgsrc->isRAW()) {
-                    if (imgsrc->getSensorType() == ST_BAYER) {
-                        imgNum = rtengine::LIM<unsigned int>(params->raw.bayersensor.imageNum, 0, metaData->getFrameCount() - 1);
-                    } else if (imgsrc->getSensorType() == ST_FUJI_XTRANS) {
-                        //imgNum = rtengine::LIM<unsigned int>(params->raw.xtranssensor.imageNum, 0, metaData->getFrameCount() - 1);
-                    }
-                }
+        const FramesMetaData* metaData = imgsrc->getMetaData();
+        int imgNum = 0;
 
-                float fnum = metaData->getFNumber(imgNum);          // F number
-                float fiso = metaData->getISOSpeed(imgNum) ;        // ISO
-                float fspeed = metaData->getShutterSpeed(imgNum) ;  // Speed
-                double fcomp = metaData->getExpComp(imgNum);        // Compensation +/-
-                double adap;
+        if (imgsrc->isRAW()) {
+            if (imgsrc->getSensorType() == ST_BAYER) {
+                imgNum = rtengine::LIM<unsigned int>(params->raw.bayersensor.imageNum, 0, metaData->getFrameCount() - 1);
+            } else if (imgsrc->getSensorType() == ST_FUJI_XTRANS) {
+                //imgNum = rtengine::LIM<unsigned int>(params->raw.xtranssensor.imageNum, 0, metaData->getFrameCount() - 1);
+            }
+        }
 
-                if (fnum < 0.3f || fiso < 5.f || fspeed < 0.00001f) { //if no exif data or wrong
-                    adap = 2000.;
-                } else {
-                    double E_V = fcomp + log2(double ((fnum * fnum) / fspeed / (fiso / 100.f)));
-                    double kexp = 0.;
-                    E_V += kexp * params->toneCurve.expcomp;// exposure compensation in tonecurve ==> direct EV
-                    E_V += 0.5 * log2(params->raw.expos);  // exposure raw white point ; log2 ==> linear to EV
-                    adap = pow(2.0, E_V - 3.0);  // cd / m2
-                    // end calculation adaptation scene luminosity
-                }
+        float fnum = metaData->getFNumber(imgNum);          // F number
+        float fiso = metaData->getISOSpeed(imgNum) ;        // ISO
+        float fspeed = metaData->getShutterSpeed(imgNum) ;  // Speed
+        double fcomp = metaData->getExpComp(imgNum);        // Compensation +/-
+        double adap;
 
-                float d, dj, yb;
-                bool execsharp = false;
+        if (fnum < 0.3f || fiso < 5.f || fspeed < 0.00001f) { //if no exif data or wrong
+            adap = 2000.;
+        } else {
+            double E_V = fcomp + log2(double ((fnum * fnum) / fspeed / (fiso / 100.f)));
+            double kexp = 0.;
+            E_V += kexp * params->toneCurve.expcomp;// exposure compensation in tonecurve ==> direct EV
+            E_V += 0.5 * log2(params->raw.expos);  // exposure raw white point ; log2 ==> linear to EV
+            adap = pow(2.0, E_V - 3.0);  // cd / m2
+            // end calculation adaptation scene luminosity
+        }
 
-                if (!ncie) {
-                    ncie = new CieImage(pW, pH);
-                }
+        float d, dj, yb;
+        bool execsharp = false;
 
-                if (!CAMBrightCurveJ && (params->colorappearance.algo == "JC" || params->colorappearance.algo == "JS" || params->colorappearance.algo == "ALL")) {
-                    CAMBrightCurveJ(32768, 0);
-                }
+        CieImage *cie = ncie;
+        std::unique_ptr<CieImage> coarseCie;
 
-                if (!CAMBrightCurveQ && (params->colorappearance.algo == "QM" || params->colorappearance.algo == "ALL")) {
-                    CAMBrightCurveQ(32768, 0);
-                }
+        if (coarse) {
+            coarseCie.reset(new CieImage(lab->W, lab->H));
+            cie = coarseCie.get();
+        } else if (!ncie) {
+            ncie = new CieImage(lab->W, lab->H);
+            cie = ncie;
+        }
 
-                // Issue 2785, only float version of ciecam02 for navigator and pan background
-                CAMMean = NAN;
-                CAMBrightCurveJ.dirty = true;
-                CAMBrightCurveQ.dirty = true;
+        if (!CAMBrightCurveJ && (params->colorappearance.algo == "JC" || params->colorappearance.algo == "JS" || params->colorappearance.algo == "ALL")) {
+            CAMBrightCurveJ(32768, 0);
+        }
 
-                ipf.ciecam_02float(ncie, float (adap), pW, 2, nprevl, params.get(), customColCurve1, customColCurve2, customColCurve3, histLCAM, histCCAM, CAMBrightCurveJ, CAMBrightCurveQ, CAMMean, 0, scale, execsharp, d, dj, yb, 1);
+        if (!CAMBrightCurveQ && (params->colorappearance.algo == "QM" || params->colorappearance.algo == "ALL")) {
+            CAMBrightCurveQ(32768, 0);
+        }
 
-                if ((params->colorappearance.autodegree || params->colorappearance.autodegreeout) && acListener && params->colorappearance.enabled && !params->colorappearance.presetcat02) {
-                    acListener->autoCamChanged(100.* (double)d, 100.* (double)dj);
-                }
+        // Issue 2785, only float version of ciecam02 for navigator and pan background
+        CAMMean = NAN;
+        CAMBrightCurveJ.dirty = true;
+        CAMBrightCurveQ.dirty = true;
 
-                if (params->colorappearance.autoadapscen && acListener && params->colorappearance.enabled && !params->colorappearance.presetcat02) {
-                    acListener->adapCamChanged(adap);    //real value of adapt scene
-                }
+        ipf.ciecam_02float(cie, float (adap), coarse ? 1 : lab->W, 2, lab, params.get(), customColCurve1, customColCurve2, customColCurve3, histLCAM, histCCAM, CAMBrightCurveJ, CAMBrightCurveQ, CAMMean, 0, labScale, execsharp, d, dj, yb, 1);
 
-                if (params->colorappearance.autoybscen && acListener && params->colorappearance.enabled && !params->colorappearance.presetcat02) {
-                    acListener->ybCamChanged((int) yb);    //real value Yb scene
-                }
+        if ((params->colorappearance.autodegree || params->colorappearance.autodegreeout) && acListener && !coarse && params->colorappearance.enabled && !params->colorappearance.presetcat02) {
+            acListener->autoCamChanged(100.* (double)d, 100.* (double)dj);
+        }
 
-             //   if (params->colorappearance.enabled && params->colorappearance.presetcat02  && params->colorappearance.autotempout) {
-              //  if (params->colorappearance.enabled && params->colorappearance.presetcat02) {
-              //      acListener->wbCamChanged(params->wb.temperature, params->wb.green);    //real temp and tint
-               //     acListener->wbCamChanged(params->wb.temperature, 1.f);    //real temp and tint = 1.
-               // }
-                
-            } else {
-                // CIECAM is disabled, we free up its image buffer to save some space
-                if (ncie) {
-                    delete ncie;
-                }
+        if (params->colorappearance.autoadapscen && acListener && !coarse && params->colorappearance.enabled && !params->colorappearance.presetcat02) {
+            acListener->adapCamChanged(adap);    //real value of adapt scene
+        }
 
-                ncie = nullptr;
+        if (params->colorappearance.autoybscen && acListener && !coarse && params->colorappearance.enabled && !params->colorappearance.presetcat02) {
+            acListener->ybCamChanged((int) yb);    //real value Yb scene
+        }
 
-                if (CAMBrightCurveJ) {
-                    CAMBrightCurveJ.reset();
-                }
+        storeCheckpoint(LabCheckpoints::CIECAM);
 
-                if (CAMBrightCurveQ) {
-                    CAMBrightCurveQ.reset();
-                }
-            }
+     //   if (params->colorappearance.enabled && params->colorappearance.presetcat02  && params->colorappearance.autotempout) {
+      //  if (params->colorappearance.enabled && params->colorappearance.presetcat02) {
+      //      acListener->wbCamChanged(params->wb.temperature, params->wb.green);    //real temp and tint
+       //     acListener->wbCamChanged(params->wb.temperature, 1.f);    //real temp and tint = 1.
+       // }
+        
+    } else if (!params->colorappearance.enabled && !coarse) {
+        // CIECAM is disabled, we free up its image buffer to save some space
+        if (ncie) {
+            delete ncie;
         }
 
-      //  if (todo & (M_AUTOEXP | M_RGBCURVE)) {
+        ncie = nullptr;
 
-        // Update the monitor color transform if necessary
-        if ((todo & M_MONITOR) || (lastOutputProfile != params->icm.outputProfile) || lastOutputIntent != params->icm.outputIntent || lastOutputBPC != params->icm.outputBPC) {
-            lastOutputProfile = params->icm.outputProfile;
-            lastOutputIntent = params->icm.outputIntent;
-            lastOutputBPC = params->icm.outputBPC;
-            ipf.updateColorProfiles(monitorProfile, monitorIntent, softProof, gamutCheck);
+        if (CAMBrightCurveJ) {
+            CAMBrightCurveJ.reset();
         }
-    }
 
-// process crop, if needed
-    for (size_t i = 0; i < crops.size(); i++)
-        if (crops[i]->hasListener() && (panningRelatedChange || (highDetailNeeded && options.prevdemo != PD_Sidecar) || (todo & (M_MONITOR | M_RGBCURVE | M_LUMACURVE)) || crops[i]->get_skip() == 1)) {
-            crops[i]->update(todo);     // may call ourselves
+        if (CAMBrightCurveQ) {
+            CAMBrightCurveQ.reset();
         }
+    }
+}
 
-    if (panningRelatedChange || (todo & M_MONITOR)) {
-        if ((todo != CROP && todo != MINUPDATE) || (todo & M_MONITOR)) {
-            MyMutex::MyLock prevImgLock(previmg->getMutex());
+void ImProcCoordinator::updateCoarsePreview(LabCheckpoints::Stage firstStage)
+{
+    constexpr int factor = 4;
+    const int cW = pW / factor;
+    const int cH = pH / factor;
 
-            try {
-                // Computing the preview image, i.e. converting from WCS->Monitor color space (soft-proofing disabled) or WCS->Printer profile->Monitor color space (soft-proofing enabled)
-                ipf.lab2monitorRgb(nprevl, previmg);
+    if (!resultValid || !imageListener || cW < 64 || cH < 64) {
+        return;
+    }
 
-                // Computing the internal image for analysis, i.e. conversion from WCS->Output profile
-                delete workimg;
-                workimg = nullptr;
+    // box filtered copy of the input of the first changed stage
+    LabImage coarse(cW, cH);
+    constexpr float norm = 1.f / (factor * factor);
 
-                workimg = ipf.lab2rgb(nprevl, 0, 0, pW, pH, params->icm);
-            } catch (std::exception&) {
-                return;
+#ifdef _OPENMP
+    #pragma omp parallel for
+#endif
+
+    for (int i = 0; i < cH; ++i) {
+        for (int j = 0; j < cW; ++j) {
+            float L = 0.f;
+            float a = 0.f;
+            float b = 0.f;
+
+            for (int y = i * factor; y < (i + 1) * factor; ++y) {
+                for (int x = j * factor; x < (j + 1) * factor; ++x) {
+                    L += nprevl->L[y][x];
+                    a += nprevl->a[y][x];
+                    b += nprevl->b[y][x];
+                }
             }
+
+            coarse.L[i][j] = L * norm;
+            coarse.a[i][j] = a * norm;
+            coarse.b[i][j] = b * norm;
         }
+    }
 
-        if (!resultValid) {
-            resultValid = true;
+    // the radii of the tools follow the scale, as for any other preview scale
+    ipf.setScale(scale * factor);
+    processLab(&coarse, scale * factor, firstStage, true);
+    ipf.setScale(scale);
 
-            if (imageListener) {
-                imageListener->setImage(previmg, scale, params->crop);
-            }
-        }
+    if (ipf.isCancelled()) {
+        return;
+    }
 
-        if (imageListener)
-            // TODO: The WB tool should be advertised too in order to get the AutoWB's temp and green values
-        {
-            imageListener->imageReady(params->crop);
-        }
+    const std::unique_ptr<Image8> coarseImg(new Image8(cW, cH));
+    ipf.lab2monitorRgb(&coarse, coarseImg.get());
 
-        hist_lrgb_dirty = vectorscope_hc_dirty = vectorscope_hs_dirty = waveform_dirty = true;
-        if (hListener) {
-            if (hListener->updateHistogram()) {
-                updateLRGBHistograms();
-            }
-            if (hListener->updateVectorscopeHC()) {
-                updateVectorscopeHC();
-            }
-            if (hListener->updateVectorscopeHS()) {
-                updateVectorscopeHS();
-            }
-            if (hListener->updateWaveform()) {
-                updateWaveforms();
+    {
+        MyMutex::MyLock prevImgLock(previmg->getMutex());
+
+        // bilinear upscaling to the preview size
+#ifdef _OPENMP
+        #pragma omp parallel for
+#endif
+
+        for (int y = 0; y < pH; ++y) {
+            const float sy = LIM((y + 0.5f) / factor - 0.5f, 0.f, cH - 1.f);
+            const int y0 = std::min(static_cast<int>(sy), cH - 2);
+            const float fy = sy - y0;
+            const unsigned char *row0 = coarseImg->data + 3 * y0 * cW;
+            const unsigned char *row1 = row0 + 3 * cW;
+            unsigned char *dst = previmg->data + 3 * y * pW;
+
+            for (int x = 0; x < pW; ++x) {
+                const float sx = LIM((x + 0.5f) / factor - 0.5f, 0.f, cW - 1.f);
+                const int x0 = std::min(static_cast<int>(sx), cW - 2);
+                const float fx = sx - x0;
+
+                for (int c = 0; c < 3; ++c) {
+                    const float top = intp(fx, static_cast<float>(row0[3 * (x0 + 1) + c]), static_cast<float>(row0[3 * x0 + c]));
+                    const float bottom = intp(fx, static_cast<float>(row1[3 * (x0 + 1) + c]), static_cast<float>(row1[3 * x0 + c]));
+                    dst[3 * x + c] = intp(fy, bottom, top) + 0.5f;
+                }
             }
-            notifyHistogramChanged();
         }
     }
 
-    if (orig_prev != oprevi) {
-        delete oprevi;
-        oprevi = nullptr;
-    }
+    imageListener->imageReady(params->crop);
 }
 
 void ImProcCoordinator::setTweakOperator (TweakOperator *tOperator)
@@ -2070,6 +2429,7 @@ void ImProcCoordinator::freeAll()
         oprevl    = nullptr;
         delete nprevl;
         nprevl    = nullptr;
+        labCheckpoints.clear();
 
         if (ncie) {
             delete ncie;
@@ -2185,168 +2545,17 @@ void ImProcCoordinator::notifyHistogramChanged()
 
 bool ImProcCoordinator::updateLRGBHistograms()
 {
-
-    if (!hist_lrgb_dirty) {
-        return false;
-    }
-
-    int x1, y1, x2, y2;
-    params->crop.mapToResized(pW, pH, scale, x1, x2, y1, y2);
-
-#ifdef _OPENMP
-    #pragma omp parallel sections
-#endif
-    {
-#ifdef _OPENMP
-        #pragma omp section
-#endif
-        {
-            histChroma.clear();
-
-            for (int i = y1; i < y2; i++)
-                for (int j = x1; j < x2; j++)
-                {
-                    histChroma[(int)(sqrtf(SQR(nprevl->a[i][j]) + SQR(nprevl->b[i][j])) / 188.f)]++;      //188 = 48000/256
-                }
-        }
-#ifdef _OPENMP
-        #pragma omp section
-#endif
-        {
-            histLuma.clear();
-
-            for (int i = y1; i < y2; i++)
-                for (int j = x1; j < x2; j++)
-                {
-                    histLuma[(int)(nprevl->L[i][j] / 128.f)]++;
-                }
-        }
-#ifdef _OPENMP
-        #pragma omp section
-#endif
-        {
-            histRed.clear();
-            histGreen.clear();
-            histBlue.clear();
-
-            for (int i = y1; i < y2; i++)
-            {
-                int ofs = (i * pW + x1) * 3;
-
-                for (int j = x1; j < x2; j++) {
-                    int r = workimg->data[ofs++];
-                    int g = workimg->data[ofs++];
-                    int b = workimg->data[ofs++];
-
-                    histRed[r]++;
-                    histGreen[g]++;
-                    histBlue[b]++;
-                }
-            }
-        }
-    }
-
-    hist_lrgb_dirty = false;
-    return true;
-
+    return updateScopes(true, false, false, false);
 }
 
 bool ImProcCoordinator::updateVectorscopeHC()
 {
-    if (!workimg || !vectorscope_hc_dirty) {
-        return false;
-    }
-
-    int x1, y1, x2, y2;
-    params->crop.mapToResized(pW, pH, scale, x1, x2, y1, y2);
-
-    constexpr int size = VECTORSCOPE_SIZE;
-    constexpr float norm_factor = size / (128.f * 655.36f);
-    vectorscope_hc.fill(0);
-
-    vectorscopeScale = (x2 - x1) * (y2 - y1);
-
-    const std::unique_ptr<float[]> a(new float[vectorscopeScale]);
-    const std::unique_ptr<float[]> b(new float[vectorscopeScale]);
-    const std::unique_ptr<float[]> L(new float[vectorscopeScale]);
-    ipf.rgb2lab(*workimg, x1, y1, x2 - x1, y2 - y1, L.get(), a.get(), b.get(), params->icm);
-#ifdef _OPENMP
-    #pragma omp parallel
-#endif
-    {
-        array2D<int> vectorscopeThr(size, size, ARRAY2D_CLEAR_DATA);
-#ifdef _OPENMP
-        #pragma omp for nowait
-#endif
-        for (int i = y1; i < y2; ++i) {
-            for (int j = x1, ofs_lab = (i - y1) * (x2 - x1); j < x2; ++j, ++ofs_lab) {
-                const int col = norm_factor * a[ofs_lab] + size / 2 + 0.5f;
-                const int row = norm_factor * b[ofs_lab] + size / 2 + 0.5f;
-                if (col >= 0 && col < size && row >= 0 && row < size) {
-                    vectorscopeThr[row][col]++;
-                }
-            }
-        }
-#ifdef _OPENMP
-        #pragma omp critical
-#endif
-        {
-            vectorscope_hc += vectorscopeThr;
-        }
-    }
-
-    vectorscope_hc_dirty = false;
-    return true;
+    return updateScopes(false, true, false, false);
 }
 
 bool ImProcCoordinator::updateVectorscopeHS()
 {
-    if (!workimg || !vectorscope_hs_dirty) {
-        return false;
-    }
-
-    int x1, y1, x2, y2;
-    params->crop.mapToResized(pW, pH, scale, x1, x2, y1, y2);
-
-    constexpr int size = VECTORSCOPE_SIZE;
-    vectorscope_hs.fill(0);
-
-    vectorscopeScale = (x2 - x1) * (y2 - y1);
-
-#ifdef _OPENMP
-    #pragma omp parallel
-#endif
-    {
-        array2D<int> vectorscopeThr(size, size, ARRAY2D_CLEAR_DATA);
-#ifdef _OPENMP
-        #pragma omp for nowait
-#endif
-        for (int i = y1; i < y2; ++i) {
-            int ofs = (i * pW + x1) * 3;
-            for (int j = x1; j < x2; ++j) {
-                const float red = 257.f * workimg->data[ofs++];
-                const float green = 257.f * workimg->data[ofs++];
-                const float blue = 257.f * workimg->data[ofs++];
-                float h, s, l;
-                Color::rgb2hslfloat(red, green, blue, h, s, l);
-                const auto sincosval = xsincosf(2.f * RT_PI_F * h);
-                const int col = s * sincosval.y * (size / 2) + size / 2;
-                const int row = s * sincosval.x * (size / 2) + size / 2;
-                if (col >= 0 && col < size && row >= 0 && row < size) {
-                    vectorscopeThr[row][col]++;
-                }
-            }
-        }
-#ifdef _OPENMP
-        #pragma omp critical
-#endif
-        {
-            vectorscope_hs += vectorscopeThr;
-        }
-    }
-
-    vectorscope_hs_dirty = false;
-    return true;
+    return updateScopes(false, false, true, false);
 }
 
 bool ImProcCoordinator::updateWaveforms()
@@ -2360,44 +2569,69 @@ bool ImProcCoordinator::updateWaveforms()
         return true;
     }
 
-    if (!waveform_dirty) {
+    return updateScopes(false, false, false, true);
+}
+
+bool ImProcCoordinator::updateScopes(bool lrgb, bool vectorscopeHC, bool vectorscopeHS, bool waveform)
+{
+    lrgb = lrgb && hist_lrgb_dirty;
+    vectorscopeHC = vectorscopeHC && vectorscope_hc_dirty;
+    vectorscopeHS = vectorscopeHS && vectorscope_hs_dirty;
+    waveform = waveform && waveform_dirty;
+
+    if (!workimg || !(lrgb || vectorscopeHC || vectorscopeHS || waveform)) {
         return false;
     }
 
     int x1, y1, x2, y2;
     params->crop.mapToResized(pW, pH, scale, x1, x2, y1, y2);
-    int waveform_width = waveformRed.getWidth();
 
-    if (waveform_width != x2 - x1) {
-        // Resize waveform arrays.
-        waveform_width = x2 - x1;
-        waveformRed(waveform_width, 256);
-        waveformGreen(waveform_width, 256);
-        waveformBlue(waveform_width, 256);
-        waveformLuma(waveform_width, 256);
+    ScopeStatistics statistics(*workimg, *nprevl, x1, y1, x2, y2);
+
+    if (lrgb) {
+        statistics.requestHistograms(histRed, histGreen, histBlue, histLuma, histChroma);
     }
 
-    // Start with zero.
-    waveformRed.fill(0);
-    waveformGreen.fill(0);
-    waveformBlue.fill(0);
-    waveformLuma.fill(0);
+    std::unique_ptr<float[]> a;
+    std::unique_ptr<float[]> b;
+
+    if (vectorscopeHC) {
+        const int size = (x2 - x1) * (y2 - y1);
+        a.reset(new float[size]);
+        b.reset(new float[size]);
+        const std::unique_ptr<float[]> L(new float[size]);
+        ipf.rgb2lab(*workimg, x1, y1, x2 - x1, y2 - y1, L.get(), a.get(), b.get(), params->icm);
+        statistics.requestVectorscopeHC(vectorscope_hc, a.get(), b.get());
+    }
 
-    constexpr float luma_factor = 255.f / 32768.f;
-    for (int i = y1; i < y2; i++) {
-        int ofs = (i * pW + x1) * 3;
-        float* L_row = nprevl->L[i] + x1;
+    if (vectorscopeHS) {
+        statistics.requestVectorscopeHS(vectorscope_hs);
+    }
 
-        for (int j = 0; j < waveform_width; j++) {
-            waveformRed[workimg->data[ofs++]][j]++;
-            waveformGreen[workimg->data[ofs++]][j]++;
-            waveformBlue[workimg->data[ofs++]][j]++;
-            waveformLuma[LIM<int>(L_row[j] * luma_factor, 0, 255)][j]++;
+    if (vectorscopeHC || vectorscopeHS) {
+        vectorscopeScale = (x2 - x1) * (y2 - y1);
+    }
+
+    if (waveform) {
+        if (waveformRed.getWidth() != x2 - x1) {
+            // Resize waveform arrays.
+            waveformRed(x2 - x1, 256);
+            waveformGreen(x2 - x1, 256);
+            waveformBlue(x2 - x1, 256);
+            waveformLuma(x2 - x1, 256);
         }
+
+        statistics.requestWaveforms(waveformRed, waveformGreen, waveformBlue, waveformLuma);
+        waveformScale = y2 - y1;
     }
 
-    waveformScale = y2 - y1;
-    waveform_dirty = false;
+    // one pass over the preview for all of them
+    statistics.compute();
+
+    hist_lrgb_dirty = hist_lrgb_dirty && !lrgb;
+    vectorscope_hc_dirty = vectorscope_hc_dirty && !vectorscopeHC;
+    vectorscope_hs_dirty = vectorscope_hs_dirty && !vectorscopeHS;
+    waveform_dirty = waveform_dirty && !waveform;
     return true;
 }
 
@@ -2714,15 +2948,22 @@ void ImProcCoordinator::startProcessing(int changeCode)
 
 void ImProcCoordinator::process()
 {
+    trace::setThreadName("ImProcCoordinator");
+
     if (plistener) {
         plistener->setProgressState(true);
     }
 
     paramsUpdateMutex.lock();
 
+    // changes of a cancelled update which have to be redone by the next one
+    int cancelledChange = 0;
+    bool cancelledPanningChange = false;
+
     while (changeSinceLast) {
         const bool panningRelatedChange =
-            params->toneCurve.isPanningRelatedChange(nextParams->toneCurve)
+            cancelledPanningChange
+            || params->toneCurve.isPanningRelatedChange(nextParams->toneCurve)
             || params->labCurve != nextParams->labCurve
             || params->locallab != nextParams->locallab
             || params->localContrast != nextParams->localContrast
@@ -2763,8 +3004,10 @@ void ImProcCoordinator::process()
 
         sharpMaskChanged = false;
         *params = *nextParams;
-        int change = changeSinceLast;
+        int change = changeSinceLast | cancelledChange;
         changeSinceLast = 0;
+        cancelToken.reset();
+        processingUpdate = true;
 
         if (tweakOperator) {
             // TWEAKING THE PROCPARAMS FOR THE SPOT ADJUSTMENT MODE
@@ -2779,11 +3022,26 @@ void ImProcCoordinator::process()
         // M_VOID means no update, and is a bit higher that the rest
         if (change & (M_VOID - 1)) {
             updatePreviewImage(change, panningRelatedChange);
+
+            if (settings->verbose) {
+                const BufferPool::Statistics poolStatistics = BufferPool::getStatistics();
+                printf("Buffer pool: %lu of %lu requests served, %zu MB retained (peak %zu MB)\n", poolStatistics.hits, poolStatistics.requests, poolStatistics.retainedBytes >> 20, poolStatistics.peakRetainedBytes >> 20);
+            }
         }
 
         paramsUpdateMutex.lock();
+
+        if (cancelToken.isRequested()) {
+            cancelledChange = change;
+            cancelledPanningChange = panningRelatedChange;
+        } else {
+            cancelledChange = 0;
+            cancelledPanningChange = false;
+        }
     }
 
+    processingUpdate = false;
+    cancelToken.reset();
     paramsUpdateMutex.unlock();
     updaterRunning = false;
 
@@ -2809,6 +3067,18 @@ void ImProcCoordinator::endUpdateParams(int changeFlags)
 {
     changeSinceLast |= changeFlags;
 
+    if (processingUpdate && (changeFlags & (M_VOID - 1))) {
+        // the running update is outdated, abort it as soon as possible
+        cancelToken.request();
+    }
+
+    if (changeFlags & (M_VOID - 1)) {
+        // startProcessing() waits for the updater lock, which a render ahead of the panning holds until it ends
+        for (const auto crop : crops) {
+            crop->cancelPrefetch();
+        }
+    }
+
     paramsUpdateMutex.unlock();
     startProcessing();
 }
@@ -18,16 +18,22 @@
  */
 #pragma once
 
+#include <atomic>
 #include <memory>
+#include <vector>
 
 #include "array2D.h"
 #include "colortemp.h"
 #include "curves.h"
+#include "canceltoken.h"
 #include "dcrop.h"
 #include "imagesource.h"
 #include "improcfun.h"
+#include "labcheckpoints.h"
 #include "LUT.h"
+#include "pipelinecache.h"
 #include "rtengine.h"
+#include "waveletcache.h"
 
 #include "../rtgui/threadutils.h"
 
@@ -66,6 +72,12 @@ protected:
     Imagefloat *spotprev;
     LabImage *oprevl;
     LabImage *nprevl;
+    LabCheckpoints labCheckpoints; // cached outputs of the Lab stages computing nprevl from oprevl
+    WaveletCache waveletCache; // decompositions of the wavelet levels tool of the preview
+    ImProcCoordinator* const sourceOwner; // coordinator running the raw stages of the shared image source, nullptr if this one does, see createShared()
+    PipelineCache ownPipelineCache;
+    PipelineCache& pipelineCache; // RGB pipeline output in front of the transform, shared with the crops and with the coordinators sharing the source
+    unsigned int paramsGeneration; // incremented by each update, tags the output the crops keep for panning
     Imagefloat *fattal_11_dcrop_cache; // global cache for ToneMapFattal02 used in 1:1 detail windows (except when denoise is active)
     Image8 *previmg;  // displayed image in monitor color space, showing the output profile as well (soft-proofing enabled, which then correspond to workimg) or not
     Image8 *workimg;  // internal image in output color space for analysis
@@ -208,6 +220,15 @@ protected:
 
     MyMutex minit;  // to gain mutually exclusive access to ... to what exactly?
 
+    // The data of the image source is written by the raw stages of its owner, and read by the init stage of
+    // the coordinators and crops sharing it. Always locked before minit.
+    MyMutex ownSourceMutex;
+    MyMutex& sourceMutex;
+    MyMutex sharersMutex;
+    std::vector<ImProcCoordinator*> sourceSharers; // guarded by sharersMutex
+    std::atomic<unsigned int> sourceRevision; // incremented by the owner whenever its raw stages changed the source data
+    unsigned int renderedSourceRevision; // revision of the owner's source data the last update of a sharer started from
+
     void backupParams();
     void restoreParams();
     void allocCache (Imagefloat* &imgfloat);
@@ -221,8 +242,16 @@ protected:
     bool updateVectorscopeHS();
     /// Updates all waveforms. Returns true unless not updated.
     bool updateWaveforms();
+    /// Updates the requested scopes which are outdated, in a single pass over the preview. Returns true unless none was updated.
+    bool updateScopes(bool lrgb, bool vectorscopeHC, bool vectorscopeHS, bool waveform);
     void setScale(int prevscale);
     void updatePreviewImage (int todo, bool panningRelatedChange);
+    /// Processes the Lab tools from firstStage on. The coarse pass works on a reduced copy and leaves the cached and reported data alone.
+    void processLab(LabImage *lab, int labScale, LabCheckpoints::Stage firstStage, bool coarse);
+    /// Pushes a preview rendered at 1/4 of the preview size to the image listener, before the full quality one.
+    void updateCoarsePreview(LabCheckpoints::Stage firstStage);
+    /// Returns true if newer params arrived during the running update, which has to be left then.
+    bool updateCancelled();
 
     MyMutex mProcessing;
     const std::unique_ptr<ProcParams> params;  // used for the rendering, can be eventually tweaked
@@ -244,6 +273,8 @@ protected:
     bool updaterRunning;
     const std::unique_ptr<ProcParams> nextParams;
     bool destroying;
+    CancelToken cancelToken;  // requested when endUpdateParams delivers newer params during an update
+    bool processingUpdate;    // guarded by paramsUpdateMutex
     bool utili;
     bool autili;
     bool butili;
@@ -386,7 +417,8 @@ protected:
 
 public:
 
-    ImProcCoordinator ();
+    // 'sourceOwner' is the coordinator whose image source, raw stages and pipeline cache are shared, it has to outlive this one
+    explicit ImProcCoordinator (ImProcCoordinator* sourceOwner = nullptr);
     ~ImProcCoordinator () override;
     void assign     (ImageSource* imgsrc);
 
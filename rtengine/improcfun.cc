@@ -27,6 +27,7 @@
 
 #include "alignedbuffer.h"
 #include "calc_distort.h"
+#include "canceltoken.h"
 #include "ciecam02.h"
 #include "cieimage.h"
 #include "clutstore.h"
@@ -47,6 +48,7 @@
 #include "rtthumbnail.h"
 #include "satandvalueblendingcurve.h"
 #include "StopWatch.h"
+#include "trace.h"
 #include "utils.h"
 
 #include "../rtgui/editcallbacks.h"
@@ -289,6 +291,16 @@ void ImProcFunctions::setScale(double iscale)
     scale = iscale;
 }
 
+void ImProcFunctions::setCancelToken(const CancelToken* token)
+{
+    cancelToken = token;
+}
+
+bool ImProcFunctions::isCancelled() const
+{
+    return cancelToken && cancelToken->isRequested();
+}
+
 
 void ImProcFunctions::updateColorProfiles(const Glib::ustring& monitorProfile, RenderingIntent monitorIntent, bool softProof, bool gamutCheck)
 {
@@ -5135,6 +5147,7 @@ void ImProcFunctions::EPDToneMaplocal(int sp, LabImage *lab, LabImage *tmp1, uns
 //Map tones by way of edge preserving decomposition.
 void ImProcFunctions::EPDToneMap(LabImage *lab, unsigned int Iterates, int skip)
 {
+    TRACEFUN;
 
     if (!params->epd.enabled) {
         return;
@@ -29,11 +29,13 @@
 #include "improccoordinator.h"
 #include "dfmanager.h"
 #include "ffmanager.h"
+#include "fftwplans.h"
 #include "rtthumbnail.h"
 #include "profilestore.h"
 #include "../rtgui/threadutils.h"
 #include "rtlensfun.h"
 #include "procparams.h"
+#include "trace.h"
 
 namespace rtengine
 {
@@ -46,6 +48,16 @@ MyMutex *fftwMutex = nullptr;
 int init (const Settings* s, const Glib::ustring& baseDir, const Glib::ustring& userSettingsDir, bool loadAll)
 {
     settings = s;
+
+    const gchar* const traceFile = g_getenv("RT_TRACE");
+
+    if (traceFile && *traceFile) {
+        trace::start(traceFile);
+    } else if (!s->traceFile.empty()) {
+        trace::start(s->traceFile);
+    }
+
+    trace::setThreadName("main");
     ProcParams::init();
     PerceptualToneCurve::init();
     RawImageSource::init();
@@ -106,14 +118,17 @@ int init (const Settings* s, const Glib::ustring& baseDir, const Glib::ustring&
     delete lcmsMutex;
     lcmsMutex = new MyMutex;
     fftwMutex = new MyMutex;
+    fftw::init(s->fftwWisdomFile);
     return 0;
 }
 
 void cleanup ()
 {
+    trace::stop();
     ProcParams::cleanup ();
     Color::cleanup ();
     RawImageSource::cleanup ();
+    fftw::cleanup ();
 
 #ifdef RT_FFTW3F_OMP
     fftwf_cleanup_threads();
@@ -131,6 +146,12 @@ StagedImageProcessor* StagedImageProcessor::create (InitialImage* initialImage)
     return ipc;
 }
 
+StagedImageProcessor* StagedImageProcessor::createShared (StagedImageProcessor* main)
+{
+
+    return new ImProcCoordinator (static_cast<ImProcCoordinator*>(main));
+}
+
 void StagedImageProcessor::destroy (StagedImageProcessor* sip)
 {
 
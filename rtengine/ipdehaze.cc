@@ -43,6 +43,7 @@
 #include "rt_math.h"
 //#define BENCHMARK
 #include "StopWatch.h"
+#include "trace.h"
 
 #include "../rtgui/options.h"
 
@@ -307,6 +308,7 @@ void extract_channels(Imagefloat *img, array2D<float> &r, array2D<float> &g, arr
 
 void ImProcFunctions::dehaze(Imagefloat *img, const DehazeParams &dehazeParams)
 {
+    TRACEFUN;
     if (!dehazeParams.enabled || dehazeParams.strength == 0.0) {
         return;
     }
@@ -26,6 +26,7 @@
 #include "improcfun.h"
 #include "colortemp.h"
 #include "curves.h"
+#include "fftwplans.h"
 #include "gauss.h"
 #include "iccstore.h"
 #include "imagefloat.h"
@@ -49,6 +50,7 @@
 
 #define BENCHMARK
 #include "StopWatch.h"
+#include "trace.h"
 #include "guidedfilter.h"
 #include "boxblur.h"
 #include "rescale.h"
@@ -4758,18 +4760,14 @@ void ImProcFunctions::DeNoise_Local(int call, const struct local_params& lp, Lab
         #pragma omp parallel if (multiThread)
 #endif
         {
-            gaussianBlur(originalmask->L, origblur->L, GW, GH, radius);
-            gaussianBlur(originalmask->a, origblur->a, GW, GH, radius);
-            gaussianBlur(originalmask->b, origblur->b, GW, GH, radius);
+            gaussianBlur({originalmask->L, originalmask->a, originalmask->b}, {origblur->L, origblur->a, origblur->b}, GW, GH, radius);
         }
     } else {
 #ifdef _OPENMP
         #pragma omp parallel if (multiThread)
 #endif
         {
-            gaussianBlur(original->L, origblur->L, GW, GH, radius);
-            gaussianBlur(original->a, origblur->a, GW, GH, radius);
-            gaussianBlur(original->b, origblur->b, GW, GH, radius);
+            gaussianBlur({original->L, original->a, original->b}, {origblur->L, origblur->a, origblur->b}, GW, GH, radius);
         }
     }
 
@@ -4912,18 +4910,14 @@ void ImProcFunctions::DeNoise_Local2(const struct local_params& lp, LabImage* or
         #pragma omp parallel if (multiThread)
 #endif
         {
-            gaussianBlur(originalmask->L, origblur->L, GW, GH, radius);
-            gaussianBlur(originalmask->a, origblur->a, GW, GH, radius);
-            gaussianBlur(originalmask->b, origblur->b, GW, GH, radius);
+            gaussianBlur({originalmask->L, originalmask->a, originalmask->b}, {origblur->L, origblur->a, origblur->b}, GW, GH, radius);
         }
     } else {
 #ifdef _OPENMP
         #pragma omp parallel if (multiThread)
 #endif
         {
-            gaussianBlur(original->L, origblur->L, GW, GH, radius);
-            gaussianBlur(original->a, origblur->a, GW, GH, radius);
-            gaussianBlur(original->b, origblur->b, GW, GH, radius);
+            gaussianBlur({original->L, original->a, original->b}, {origblur->L, origblur->a, origblur->b}, GW, GH, radius);
         }
     }
 
@@ -5044,9 +5038,7 @@ void ImProcFunctions::InverseReti_Local(const struct local_params & lp, const fl
     #pragma omp parallel if (multiThread)
 #endif
     {
-        gaussianBlur(original->L, origblur->L, GW, GH, radius);
-        gaussianBlur(original->a, origblur->a, GW, GH, radius);
-        gaussianBlur(original->b, origblur->b, GW, GH, radius);
+        gaussianBlur({original->L, original->a, original->b}, {origblur->L, origblur->a, origblur->b}, GW, GH, radius);
 
     }
 #ifdef _OPENMP
@@ -5172,9 +5164,7 @@ void ImProcFunctions::InverseBlurNoise_Local(LabImage * originalmask, const stru
         #pragma omp parallel if (multiThread)
 #endif
         {
-            gaussianBlur(originalmask->L, origblurmask->L, GW, GH, radius);
-            gaussianBlur(originalmask->a, origblurmask->a, GW, GH, radius);
-            gaussianBlur(originalmask->b, origblurmask->b, GW, GH, radius);
+            gaussianBlur({originalmask->L, originalmask->a, originalmask->b}, {origblurmask->L, origblurmask->a, origblurmask->b}, GW, GH, radius);
         }
     }
 
@@ -5183,9 +5173,7 @@ void ImProcFunctions::InverseBlurNoise_Local(LabImage * originalmask, const stru
     #pragma omp parallel if (multiThread)
 #endif
     {
-        gaussianBlur(original->L, origblur->L, GW, GH, radius);
-        gaussianBlur(original->a, origblur->a, GW, GH, radius);
-        gaussianBlur(original->b, origblur->b, GW, GH, radius);
+        gaussianBlur({original->L, original->a, original->b}, {origblur->L, origblur->a, origblur->b}, GW, GH, radius);
 
     }
 #ifdef _OPENMP
@@ -5987,13 +5975,6 @@ void ImProcFunctions::retinex_pde(const float * datain, float * dataout, int bfw
      */
 
    // BENCHFUN
-   
-#ifdef RT_FFTW3F_OMP
-    if (multiThread) {
-        fftwf_init_threads();
-        fftwf_plan_with_nthreads(omp_get_max_threads());
-    }
-#endif
 
     float *datashow = nullptr;
     if (show != 0) {
@@ -6028,9 +6009,8 @@ void ImProcFunctions::retinex_pde(const float * datain, float * dataout, int bfw
     }
 
     //execute first
-    const auto dct_fw = fftwf_plan_r2r_2d(bfh, bfw, data_tmp, data_fft, FFTW_REDFT10, FFTW_REDFT10, FFTW_ESTIMATE | FFTW_DESTROY_INPUT);
-    fftwf_execute(dct_fw);
-    fftwf_destroy_plan(dct_fw);
+    const fftw::Plan dct_fw = fftw::planR2r2d(bfh, bfw, FFTW_REDFT10, FFTW_ESTIMATE | FFTW_DESTROY_INPUT, data_tmp, data_fft, multiThread);
+    fftwf_execute_r2r(dct_fw.get(), data_tmp, data_fft);
 
     //execute second
     if (dEenable == 1) {
@@ -6042,9 +6022,8 @@ void ImProcFunctions::retinex_pde(const float * datain, float * dataout, int bfw
         }
         //second call to laplacian with 40% strength ==> reduce effect if we are far from ref (deltaE)
         discrete_laplacian_threshold(data_tmp04, datain, bfw, bfh, 0.4f * thresh);
-        const auto dct_fw04 = fftwf_plan_r2r_2d(bfh, bfw, data_tmp04, data_fft04, FFTW_REDFT10, FFTW_REDFT10, FFTW_ESTIMATE | FFTW_DESTROY_INPUT);
-        fftwf_execute(dct_fw04);
-        fftwf_destroy_plan(dct_fw04);
+        const fftw::Plan dct_fw04 = fftw::planR2r2d(bfh, bfw, FFTW_REDFT10, FFTW_ESTIMATE | FFTW_DESTROY_INPUT, data_tmp04, data_fft04, multiThread);
+        fftwf_execute_r2r(dct_fw04.get(), data_tmp04, data_fft04);
         constexpr float exponent = 4.5f;
 
 #ifdef _OPENMP
@@ -6092,9 +6071,8 @@ void ImProcFunctions::retinex_pde(const float * datain, float * dataout, int bfw
         }
     }
 
-    const auto dct_bw = fftwf_plan_r2r_2d(bfh, bfw, data_fft, data_tmp, FFTW_REDFT01, FFTW_REDFT01, FFTW_ESTIMATE | FFTW_DESTROY_INPUT);
-    fftwf_execute(dct_bw);
-    fftwf_destroy_plan(dct_bw);
+    const fftw::Plan dct_bw = fftw::planR2r2d(bfh, bfw, FFTW_REDFT01, FFTW_ESTIMATE | FFTW_DESTROY_INPUT, data_fft, data_tmp, multiThread);
+    fftwf_execute_r2r(dct_bw.get(), data_fft, data_tmp);
     fftwf_free(data_fft);
 
     if (show != 4 && normalize == 1) {
@@ -6123,13 +6101,6 @@ void ImProcFunctions::retinex_pde(const float * datain, float * dataout, int bfw
     if (datashow) {
         fftwf_free(datashow);
     }
-    fftwf_cleanup();
-
-#ifdef RT_FFTW3F_OMP
-    if (multiThread) {
-        fftwf_cleanup_threads();
-    }
-#endif
 }
 
 void ImProcFunctions::maskcalccol(bool invmask, bool pde, int bfw, int bfh, int xstart, int ystart, int sk, int cx, int cy, LabImage* bufcolorig, LabImage* bufmaskblurcol, LabImage* originalmaskcol, LabImage* original, LabImage* reserved, int inv, struct local_params & lp,
@@ -6888,9 +6859,7 @@ void ImProcFunctions::InverseSharp_Local(float **loctemp, const float hueref, co
     #pragma omp parallel
 #endif
     {
-        gaussianBlur(original->L, origblur->L, GW, GH, radius);
-        gaussianBlur(original->a, origblur->a, GW, GH, radius);
-        gaussianBlur(original->b, origblur->b, GW, GH, radius);
+        gaussianBlur({original->L, original->a, original->b}, {origblur->L, origblur->a, origblur->b}, GW, GH, radius);
     }
 
 #ifdef _OPENMP
@@ -7028,9 +6997,7 @@ void ImProcFunctions::Sharp_Local(int call, float **loctemp, int senstype, const
     #pragma omp parallel if (multiThread)
 #endif
     {
-        gaussianBlur(original->L, origblur->L, GW, GH, radius);
-        gaussianBlur(original->a, origblur->a, GW, GH, radius);
-        gaussianBlur(original->b, origblur->b, GW, GH, radius);
+        gaussianBlur({original->L, original->a, original->b}, {origblur->L, origblur->a, origblur->b}, GW, GH, radius);
     }
 
 #ifdef _OPENMP
@@ -7151,9 +7118,7 @@ void ImProcFunctions::Exclude_Local(float **deltaso, float hueref, float chromar
         #pragma omp parallel if (multiThread)
 #endif
         {
-            gaussianBlur(reserv->L, origblur->L, GW, GH, radius);
-            gaussianBlur(reserv->a, origblur->a, GW, GH, radius);
-            gaussianBlur(reserv->b, origblur->b, GW, GH, radius);
+            gaussianBlur({reserv->L, reserv->a, reserv->b}, {origblur->L, origblur->a, origblur->b}, GW, GH, radius);
 
 
 #ifdef _OPENMP
@@ -7311,9 +7276,7 @@ void ImProcFunctions::transit_shapedetect_retinex(int call, int senstype, LabIma
         #pragma omp parallel
 #endif
         {
-            gaussianBlur(original->L, origblur->L, GW, GH, radius);
-            gaussianBlur(original->a, origblur->a, GW, GH, radius);
-            gaussianBlur(original->b, origblur->b, GW, GH, radius);
+            gaussianBlur({original->L, original->a, original->b}, {origblur->L, origblur->a, origblur->b}, GW, GH, radius);
         }
 
 
@@ -7547,9 +7510,7 @@ void ImProcFunctions::transit_shapedetect(int senstype, const LabImage * bufexpo
         #pragma omp parallel if (multiThread)
 #endif
         {
-            gaussianBlur(originalmask->L, origblurmask->L, bfw, bfh, radius);
-            gaussianBlur(originalmask->a, origblurmask->a, bfw, bfh, radius);
-            gaussianBlur(originalmask->b, origblurmask->b, bfw, bfh, radius);
+            gaussianBlur({originalmask->L, originalmask->a, originalmask->b}, {origblurmask->L, origblurmask->a, origblurmask->b}, bfw, bfh, radius);
         }
     }
     if (lp.equtm  && senstype == 8) //normalize luminance for Tone mapping , at this place we can use for others senstype!
@@ -7595,9 +7556,7 @@ void ImProcFunctions::transit_shapedetect(int senstype, const LabImage * bufexpo
             }
         }
 
-        gaussianBlur(origblur->L, origblur->L, bfw, bfh, radius);
-        gaussianBlur(origblur->a, origblur->a, bfw, bfh, radius);
-        gaussianBlur(origblur->b, origblur->b, bfw, bfh, radius);
+        gaussianBlur({origblur->L, origblur->a, origblur->b}, {origblur->L, origblur->a, origblur->b}, bfw, bfh, radius);
 
     }
 
@@ -7913,9 +7872,7 @@ void ImProcFunctions::InverseColorLight_Local(bool tonequ, bool tonecurv, int sp
         #pragma omp parallel if (multiThread)
 #endif
         {
-            gaussianBlur(originalmask->L, origblurmask->L, GW, GH, radius);
-            gaussianBlur(originalmask->a, origblurmask->a, GW, GH, radius);
-            gaussianBlur(originalmask->b, origblurmask->b, GW, GH, radius);
+            gaussianBlur({originalmask->L, originalmask->a, originalmask->b}, {origblurmask->L, origblurmask->a, origblurmask->b}, GW, GH, radius);
         }
     }
 
@@ -7931,9 +7888,7 @@ void ImProcFunctions::InverseColorLight_Local(bool tonequ, bool tonecurv, int sp
     #pragma omp parallel if (multiThread)
 #endif
     {
-        gaussianBlur(original->L, origblur->L, GW, GH, radius);
-        gaussianBlur(original->a, origblur->a, GW, GH, radius);
-        gaussianBlur(original->b, origblur->b, GW, GH, radius);
+        gaussianBlur({original->L, original->a, original->b}, {origblur->L, origblur->a, origblur->b}, GW, GH, radius);
     }
 
 #ifdef _OPENMP
@@ -8180,9 +8135,7 @@ void ImProcFunctions::calc_ref(int sp, LabImage * original, LabImage * transform
             float radius = 3.f / sk;
             {
                 //No omp
-                gaussianBlur(origblur->L, blurorig->L, spotSi, spotSi, radius);
-                gaussianBlur(origblur->a, blurorig->a, spotSi, spotSi, radius);
-                gaussianBlur(origblur->b, blurorig->b, spotSi, spotSi, radius);
+                gaussianBlur({origblur->L, origblur->a, origblur->b}, {blurorig->L, blurorig->a, blurorig->b}, spotSi, spotSi, radius);
 
             }
 
@@ -8442,9 +8395,7 @@ void ImProcFunctions::BlurNoise_Local(LabImage *tmp1, LabImage * originalmask, c
         #pragma omp parallel if (multiThread)
 #endif
         {
-            gaussianBlur(originalmask->L, origblurmask->L, GW, GH, radius);
-            gaussianBlur(originalmask->a, origblurmask->a, GW, GH, radius);
-            gaussianBlur(originalmask->b, origblurmask->b, GW, GH, radius);
+            gaussianBlur({originalmask->L, originalmask->a, originalmask->b}, {origblurmask->L, origblurmask->a, origblurmask->b}, GW, GH, radius);
         }
     }
 
@@ -8452,9 +8403,7 @@ void ImProcFunctions::BlurNoise_Local(LabImage *tmp1, LabImage * originalmask, c
     #pragma omp parallel if (multiThread)
 #endif
     {
-        gaussianBlur(original->L, origblur->L, GW, GH, radius);
-        gaussianBlur(original->a, origblur->a, GW, GH, radius);
-        gaussianBlur(original->b, origblur->b, GW, GH, radius);
+        gaussianBlur({original->L, original->a, original->b}, {origblur->L, origblur->a, origblur->b}, GW, GH, radius);
     }
 
 #ifdef _OPENMP
@@ -8672,9 +8621,7 @@ void ImProcFunctions::transit_shapedetect2(int sp, float meantm, float stdtm, in
         #pragma omp parallel if (multiThread)
 #endif
         {
-            gaussianBlur(originalmask->L, origblurmask->L, bfw, bfh, radius);
-            gaussianBlur(originalmask->a, origblurmask->a, bfw, bfh, radius);
-            gaussianBlur(originalmask->b, origblurmask->b, bfw, bfh, radius);
+            gaussianBlur({originalmask->L, originalmask->a, originalmask->b}, {origblurmask->L, origblurmask->a, origblurmask->b}, bfw, bfh, radius);
         }
     }
 
@@ -8752,9 +8699,7 @@ void ImProcFunctions::transit_shapedetect2(int sp, float meantm, float stdtm, in
             }
         }
 
-        gaussianBlur(origblur->L, origblur->L, bfw, bfh, radius);
-        gaussianBlur(origblur->a, origblur->a, bfw, bfh, radius);
-        gaussianBlur(origblur->b, origblur->b, bfw, bfh, radius);
+        gaussianBlur({origblur->L, origblur->a, origblur->b}, {origblur->L, origblur->a, origblur->b}, bfw, bfh, radius);
 
     }
     
@@ -8934,13 +8879,6 @@ void ImProcFunctions::exposure_pde(float * dataor, float * datain, float * datao
 {
 
     //BENCHFUN
-#ifdef RT_FFTW3F_OMP
-    if (multiThread) {
-        fftwf_init_threads();
-        fftwf_plan_with_nthreads(omp_get_max_threads());
-    }
-
-#endif
     float *data_fft, *data_tmp, *data;
 
     if (NULL == (data_tmp = (float *) fftwf_malloc(sizeof(float) * bfw * bfh))) {
@@ -8960,8 +8898,8 @@ void ImProcFunctions::exposure_pde(float * dataor, float * datain, float * datao
         abort();
     }
 
-    const auto dct_fw = fftwf_plan_r2r_2d(bfh, bfw, data_tmp, data_fft, FFTW_REDFT10, FFTW_REDFT10, FFTW_ESTIMATE | FFTW_DESTROY_INPUT);
-    fftwf_execute(dct_fw);
+    const fftw::Plan dct_fw = fftw::planR2r2d(bfh, bfw, FFTW_REDFT10, FFTW_ESTIMATE | FFTW_DESTROY_INPUT, data_tmp, data_fft, multiThread);
+    fftwf_execute_r2r(dct_fw.get(), data_tmp, data_fft);
 
     fftwf_free(data_tmp);
 
@@ -8969,18 +8907,9 @@ void ImProcFunctions::exposure_pde(float * dataor, float * datain, float * datao
     /* 1. / (float) (bfw * bfh)) is the DCT normalisation term, see libfftw */
     ImProcFunctions::rex_poisson_dct(data_fft, bfw, bfh, 1. / (double)(bfw * bfh));
 
-    const auto dct_bw = fftwf_plan_r2r_2d(bfh, bfw, data_fft, data, FFTW_REDFT01, FFTW_REDFT01, FFTW_ESTIMATE | FFTW_DESTROY_INPUT);
-    fftwf_execute(dct_bw);
-    fftwf_destroy_plan(dct_fw);
-    fftwf_destroy_plan(dct_bw);
+    const fftw::Plan dct_bw = fftw::planR2r2d(bfh, bfw, FFTW_REDFT01, FFTW_ESTIMATE | FFTW_DESTROY_INPUT, data_fft, data, multiThread);
+    fftwf_execute_r2r(dct_bw.get(), data_fft, data);
     fftwf_free(data_fft);
-    fftwf_cleanup();
-
-#ifdef RT_FFTW3F_OMP
-    if (multiThread) {
-        fftwf_cleanup_threads();
-    }
-#endif
 
     normalize_mean_dt(data, dataor, bfw * bfh, mod, 1.f, 0.f, 0.f, 0.f, 0.f);
     {
@@ -9020,19 +8949,9 @@ void ImProcFunctions::fftw_convol_blur(float * input, float * output, int bfw, i
     */
     //BENCHFUN
 
-#ifdef RT_FFTW3F_OMP
-    if (multiThread) {
-        fftwf_init_threads();
-        fftwf_plan_with_nthreads(omp_get_max_threads());
-    }
-#endif
-
-
     float *out; //for FFT data
     float *kern = nullptr;//for kernel gauss
     float *outkern = nullptr;//for FFT kernel
-    fftwf_plan p;
-    fftwf_plan pkern;//plan for FFT
     int image_size, image_sizechange;
     float n_x = 1.f;
     float n_y = 1.f;//relative coordinates for kernel Gauss
@@ -9048,10 +8967,8 @@ void ImProcFunctions::fftw_convol_blur(float * input, float * output, int bfw, i
 
     /*compute the Fourier transform of the input data*/
 
-    p = fftwf_plan_r2r_2d(bfh, bfw, input, out, FFTW_REDFT10, FFTW_REDFT10,  FFTW_ESTIMATE);//FFT 2 dimensions forward  FFTW_MEASURE FFTW_ESTIMATE
-
-    fftwf_execute(p);
-    fftwf_destroy_plan(p);
+    const fftw::Plan pforward = fftw::planR2r2d(bfh, bfw, FFTW_REDFT10, FFTW_ESTIMATE, input, out, multiThread);//FFT 2 dimensions forward  FFTW_MEASURE FFTW_ESTIMATE
+    fftwf_execute_r2r(pforward.get(), input, out);
 
     /*define the gaussian constants for the convolution kernel*/
     if (algo == 0) {
@@ -9085,9 +9002,8 @@ void ImProcFunctions::fftw_convol_blur(float * input, float * output, int bfw, i
         }
 
         /*compute the Fourier transform of the kernel data*/
-        pkern = fftwf_plan_r2r_2d(bfh, bfw, kern, outkern, FFTW_REDFT10, FFTW_REDFT10, FFTW_ESTIMATE); //FFT 2 dimensions forward
-        fftwf_execute(pkern);
-        fftwf_destroy_plan(pkern);
+        const fftw::Plan pkern = fftw::planR2r2d(bfh, bfw, FFTW_REDFT10, FFTW_ESTIMATE, kern, outkern, multiThread); //FFT 2 dimensions forward
+        fftwf_execute_r2r(pkern.get(), kern, outkern);
 
 #ifdef _OPENMP
         #pragma omp parallel for if (multiThread)
@@ -9131,8 +9047,8 @@ void ImProcFunctions::fftw_convol_blur(float * input, float * output, int bfw, i
         }
     }
 
-    p = fftwf_plan_r2r_2d(bfh, bfw, out, output, FFTW_REDFT01, FFTW_REDFT01, FFTW_ESTIMATE);//FFT 2 dimensions backward
-    fftwf_execute(p);
+    const fftw::Plan pbackward = fftw::planR2r2d(bfh, bfw, FFTW_REDFT01, FFTW_ESTIMATE, out, output, multiThread);//FFT 2 dimensions backward
+    fftwf_execute_r2r(pbackward.get(), out, output);
 
 #ifdef _OPENMP
     #pragma omp parallel for if (multiThread)
@@ -9141,14 +9057,7 @@ void ImProcFunctions::fftw_convol_blur(float * input, float * output, int bfw, i
         output[index] /= image_sizechange;
     }
 
-    fftwf_destroy_plan(p);
     fftwf_free(out);
-
-#ifdef RT_FFTW3F_OMP
-    if (multiThread) {
-        fftwf_cleanup_threads();
-    }
-#endif
 }
 
 void ImProcFunctions::fftw_convol_blur2(float **input2, float **output2, int bfw, int bfh, float radius, int fftkern, int algo)
@@ -9198,28 +9107,17 @@ void ImProcFunctions::fftw_tile_blur(int GW, int GH, int tilssize, int max_numbl
 {
     //BENCHFUN
     float epsil = 0.001f / (tilssize * tilssize);
-    fftwf_plan plan_forward_blox[2];
-    fftwf_plan plan_backward_blox[2];
+    fftw::Plan plan_forward_blox[2];
+    fftw::Plan plan_backward_blox[2];
 
     array2D<float> tilemask_in(tilssize, tilssize);
     array2D<float> tilemask_out(tilssize, tilssize);
 
-    float *Lbloxtmp  = reinterpret_cast<float*>(fftwf_malloc(max_numblox_W * tilssize * tilssize * sizeof(float)));
-    float *fLbloxtmp = reinterpret_cast<float*>(fftwf_malloc(max_numblox_W * tilssize * tilssize * sizeof(float)));
-
-    int nfwd[2] = {tilssize, tilssize};
-
-    //for DCT:
-    fftw_r2r_kind fwdkind[2] = {FFTW_REDFT10, FFTW_REDFT10};
-    fftw_r2r_kind bwdkind[2] = {FFTW_REDFT01, FFTW_REDFT01};
-
     // Creating the plans with FFTW_MEASURE instead of FFTW_ESTIMATE speeds up the execute a bit
-    plan_forward_blox[0]  = fftwf_plan_many_r2r(2, nfwd, max_numblox_W, Lbloxtmp, nullptr, 1, tilssize * tilssize, fLbloxtmp, nullptr, 1, tilssize * tilssize, fwdkind, FFTW_MEASURE | FFTW_DESTROY_INPUT);
-    plan_backward_blox[0] = fftwf_plan_many_r2r(2, nfwd, max_numblox_W, fLbloxtmp, nullptr, 1, tilssize * tilssize, Lbloxtmp, nullptr, 1, tilssize * tilssize, bwdkind, FFTW_MEASURE | FFTW_DESTROY_INPUT);
-    plan_forward_blox[1]  = fftwf_plan_many_r2r(2, nfwd, min_numblox_W, Lbloxtmp, nullptr, 1, tilssize * tilssize, fLbloxtmp, nullptr, 1, tilssize * tilssize, fwdkind, FFTW_MEASURE | FFTW_DESTROY_INPUT);
-    plan_backward_blox[1] = fftwf_plan_many_r2r(2, nfwd, min_numblox_W, fLbloxtmp, nullptr, 1, tilssize * tilssize, Lbloxtmp, nullptr, 1, tilssize * tilssize, bwdkind, FFTW_MEASURE | FFTW_DESTROY_INPUT);
-    fftwf_free(Lbloxtmp);
-    fftwf_free(fLbloxtmp);
+    plan_forward_blox[0]  = fftw::planR2r2d(tilssize, tilssize, FFTW_REDFT10, FFTW_MEASURE | FFTW_DESTROY_INPUT, nullptr, nullptr, false, max_numblox_W);
+    plan_backward_blox[0] = fftw::planR2r2d(tilssize, tilssize, FFTW_REDFT01, FFTW_MEASURE | FFTW_DESTROY_INPUT, nullptr, nullptr, false, max_numblox_W);
+    plan_forward_blox[1]  = fftw::planR2r2d(tilssize, tilssize, FFTW_REDFT10, FFTW_MEASURE | FFTW_DESTROY_INPUT, nullptr, nullptr, false, min_numblox_W);
+    plan_backward_blox[1] = fftw::planR2r2d(tilssize, tilssize, FFTW_REDFT01, FFTW_MEASURE | FFTW_DESTROY_INPUT, nullptr, nullptr, false, min_numblox_W);
     const int border = rtengine::max(2, tilssize / 16);
 
     for (int i = 0; i < tilssize; ++i) {
@@ -9325,9 +9223,9 @@ void ImProcFunctions::fftw_tile_blur(int GW, int GH, int tilssize, int max_numbl
 
             //fftwf_print_plan (plan_forward_blox);
             if (numblox_W == max_numblox_W) {
-                fftwf_execute_r2r(plan_forward_blox[0], Lblox, fLblox);    // DCT an entire row of tiles
+                fftwf_execute_r2r(plan_forward_blox[0].get(), Lblox, fLblox);    // DCT an entire row of tiles
             } else {
-                fftwf_execute_r2r(plan_forward_blox[1], Lblox, fLblox);    // DCT an entire row of tiles
+                fftwf_execute_r2r(plan_forward_blox[1].get(), Lblox, fLblox);    // DCT an entire row of tiles
             }
 
             const float n_xy = rtengine::SQR(rtengine::RT_PI / tilssize);
@@ -9347,9 +9245,9 @@ void ImProcFunctions::fftw_tile_blur(int GW, int GH, int tilssize, int max_numbl
 
             //now perform inverse FT of an entire row of blocks
             if (numblox_W == max_numblox_W) {
-                fftwf_execute_r2r(plan_backward_blox[0], fLblox, Lblox);    //for DCT
+                fftwf_execute_r2r(plan_backward_blox[0].get(), fLblox, Lblox);    //for DCT
             } else {
-                fftwf_execute_r2r(plan_backward_blox[1], fLblox, Lblox);    //for DCT
+                fftwf_execute_r2r(plan_backward_blox[1].get(), fLblox, Lblox);    //for DCT
             }
 
             int topproc = (vblk - 1) * offset;
@@ -9390,12 +9288,6 @@ void ImProcFunctions::fftw_tile_blur(int GW, int GH, int tilssize, int max_numbl
         fftwf_free(LbloxArray[i]);
         fftwf_free(fLbloxArray[i]);
     }
-
-    fftwf_destroy_plan(plan_forward_blox[0]);
-    fftwf_destroy_plan(plan_backward_blox[0]);
-    fftwf_destroy_plan(plan_forward_blox[1]);
-    fftwf_destroy_plan(plan_backward_blox[1]);
-    fftwf_cleanup();
 }
 
 void ImProcFunctions::wavcbd(wavelet_decomposition &wdspot, int level_bl, int maxlvl,
@@ -10567,29 +10459,19 @@ void ImProcFunctions::fftw_denoise(int sk, int GW, int GH, int max_numblox_W, in
 {
    // BENCHFUN
 
-    fftwf_plan plan_forward_blox[2];
-    fftwf_plan plan_backward_blox[2];
+    fftw::Plan plan_forward_blox[2];
+    fftw::Plan plan_backward_blox[2];
 
     array2D<float> tilemask_in(TS, TS);
     array2D<float> tilemask_out(TS, TS);
 
-    float *Lbloxtmp  = reinterpret_cast<float*>(fftwf_malloc(max_numblox_W * TS * TS * sizeof(float)));
-    float *fLbloxtmp = reinterpret_cast<float*>(fftwf_malloc(max_numblox_W * TS * TS * sizeof(float)));
     float params_Ldetail = 0.f;
 
-    int nfwd[2] = {TS, TS};
-
-    //for DCT:
-    fftw_r2r_kind fwdkind[2] = {FFTW_REDFT10, FFTW_REDFT10};
-    fftw_r2r_kind bwdkind[2] = {FFTW_REDFT01, FFTW_REDFT01};
-
     // Creating the plans with FFTW_MEASURE instead of FFTW_ESTIMATE speeds up the execute a bit
-    plan_forward_blox[0]  = fftwf_plan_many_r2r(2, nfwd, max_numblox_W, Lbloxtmp, nullptr, 1, TS * TS, fLbloxtmp, nullptr, 1, TS * TS, fwdkind, FFTW_MEASURE | FFTW_DESTROY_INPUT);
-    plan_backward_blox[0] = fftwf_plan_many_r2r(2, nfwd, max_numblox_W, fLbloxtmp, nullptr, 1, TS * TS, Lbloxtmp, nullptr, 1, TS * TS, bwdkind, FFTW_MEASURE | FFTW_DESTROY_INPUT);
-    plan_forward_blox[1]  = fftwf_plan_many_r2r(2, nfwd, min_numblox_W, Lbloxtmp, nullptr, 1, TS * TS, fLbloxtmp, nullptr, 1, TS * TS, fwdkind, FFTW_MEASURE | FFTW_DESTROY_INPUT);
-    plan_backward_blox[1] = fftwf_plan_many_r2r(2, nfwd, min_numblox_W, fLbloxtmp, nullptr, 1, TS * TS, Lbloxtmp, nullptr, 1, TS * TS, bwdkind, FFTW_MEASURE | FFTW_DESTROY_INPUT);
-    fftwf_free(Lbloxtmp);
-    fftwf_free(fLbloxtmp);
+    plan_forward_blox[0]  = fftw::planR2r2d(TS, TS, FFTW_REDFT10, FFTW_MEASURE | FFTW_DESTROY_INPUT, nullptr, nullptr, false, max_numblox_W);
+    plan_backward_blox[0] = fftw::planR2r2d(TS, TS, FFTW_REDFT01, FFTW_MEASURE | FFTW_DESTROY_INPUT, nullptr, nullptr, false, max_numblox_W);
+    plan_forward_blox[1]  = fftw::planR2r2d(TS, TS, FFTW_REDFT10, FFTW_MEASURE | FFTW_DESTROY_INPUT, nullptr, nullptr, false, min_numblox_W);
+    plan_backward_blox[1] = fftw::planR2r2d(TS, TS, FFTW_REDFT01, FFTW_MEASURE | FFTW_DESTROY_INPUT, nullptr, nullptr, false, min_numblox_W);
     const int border = rtengine::max(2, TS / 16);
 
     for (int i = 0; i < TS; ++i) {
@@ -10704,9 +10586,9 @@ void ImProcFunctions::fftw_denoise(int sk, int GW, int GH, int max_numblox_W, in
 
             //fftwf_print_plan (plan_forward_blox);
             if (numblox_W == max_numblox_W) {
-                fftwf_execute_r2r(plan_forward_blox[0], Lblox, fLblox);    // DCT an entire row of tiles
+                fftwf_execute_r2r(plan_forward_blox[0].get(), Lblox, fLblox);    // DCT an entire row of tiles
             } else {
-                fftwf_execute_r2r(plan_forward_blox[1], Lblox, fLblox);    // DCT an entire row of tiles
+                fftwf_execute_r2r(plan_forward_blox[1].get(), Lblox, fLblox);    // DCT an entire row of tiles
             }
 
             // now process the vblk row of blocks for noise reduction
@@ -10728,9 +10610,9 @@ void ImProcFunctions::fftw_denoise(int sk, int GW, int GH, int max_numblox_W, in
 
             //now perform inverse FT of an entire row of blocks
             if (numblox_W == max_numblox_W) {
-                fftwf_execute_r2r(plan_backward_blox[0], fLblox, Lblox);    //for DCT
+                fftwf_execute_r2r(plan_backward_blox[0].get(), fLblox, Lblox);    //for DCT
             } else {
-                fftwf_execute_r2r(plan_backward_blox[1], fLblox, Lblox);    //for DCT
+                fftwf_execute_r2r(plan_backward_blox[1].get(), fLblox, Lblox);    //for DCT
             }
 
             int topproc = (vblk - 1) * offset;
@@ -10818,12 +10700,6 @@ void ImProcFunctions::fftw_denoise(int sk, int GW, int GH, int max_numblox_W, in
         fftwf_free(fLbloxArray[i]);
     }
 
-    fftwf_destroy_plan(plan_forward_blox[0]);
-    fftwf_destroy_plan(plan_backward_blox[0]);
-    fftwf_destroy_plan(plan_forward_blox[1]);
-    fftwf_destroy_plan(plan_backward_blox[1]);
-    fftwf_cleanup();
-
 
 }
 
@@ -13230,6 +13106,7 @@ void ImProcFunctions::Lab_Local(
     float& meantm, float& stdtm, float& meanreti, float& stdreti, float &fab
     )
 {
+    TRACEFUN;
     //general call of others functions : important return hueref, chromaref, lumaref
     if (!params->locallab.enabled) {
         return;
@@ -13732,9 +13609,7 @@ void ImProcFunctions::Lab_Local(
                                 gaussianBlur(tmp1->a, tmp1->a, bfw, bfh, radius);
                                 gaussianBlur(tmp1->b, tmp1->b, bfw, bfh, radius);
                             } else if (lp.chromet == 2) {
-                                gaussianBlur(tmp1->L, tmp1->L, bfw, bfh, radius);
-                                gaussianBlur(tmp1->a, tmp1->a, bfw, bfh, radius);
-                                gaussianBlur(tmp1->b, tmp1->b, bfw, bfh, radius);
+                                gaussianBlur({tmp1->L, tmp1->a, tmp1->b}, {tmp1->L, tmp1->a, tmp1->b}, bfw, bfh, radius);
                             }
                         }
                     }
@@ -13762,9 +13637,7 @@ void ImProcFunctions::Lab_Local(
                                 gaussianBlur(original->a, tmp1->a, TW, TH, radius);
                                 gaussianBlur(original->b, tmp1->b, TW, TH, radius);
                             } else if (lp.chromet == 2) {
-                                gaussianBlur(original->L, tmp1->L, TW, TH, radius);
-                                gaussianBlur(original->a, tmp1->a, TW, TH, radius);
-                                gaussianBlur(original->b, tmp1->b, TW, TH, radius);
+                                gaussianBlur({original->L, original->a, original->b}, {tmp1->L, tmp1->a, tmp1->b}, TW, TH, radius);
                             }
                         }
                     }
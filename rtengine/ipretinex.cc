@@ -40,13 +40,18 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <vector>
+
+#include <fftw3.h>
 
 #include "color.h"
 #include "curves.h"
+#include "fftwplans.h"
 #include "gauss.h"
 #include "improcfun.h"
 #include "labimage.h"
 #include "median.h"
+#include "noncopyable.h"
 #include "opthelper.h"
 #include "procparams.h"
 #include "rawimagesource.h"
@@ -54,6 +59,7 @@
 #include "shmap.h"
 #define BENCHMARK
 #include "StopWatch.h"
+#include "trace.h"
 #include "guidedfilter.h"
 #include "boxblur.h"
 
@@ -61,6 +67,11 @@
 #define CLIPLOC(x) LIM(x,0.f,32767.f)
 #define CLIPC(a) LIM(a, -42000.f, 42000.f)  // limit a and b  to 130 probably enough ?
 
+namespace rtengine
+{
+extern MyMutex *fftwMutex;
+}
+
 namespace
 {
 
@@ -180,6 +191,106 @@ void mean_stddv2(float **dst, float &mean, float &stddv, int W_L, int H_L, float
     stddv = std::sqrt(stddv);
 }
 
+/*
+ * Blurs of one image by the FFT kernels of ImProcFunctions::fftw_convol_blur() (fftkern = 0, algo = 0), all computed
+ * from a single DCT of the image.
+ *
+ * The kernel of radius r multiplies the coefficient of frequency (i, j) by exp(-r * (n_x * i^2 + n_y * j^2)). Kernels
+ * add their radii when they are chained, so blurring a blur again is blurring the image once by the sum of the radii.
+ * The kernels are separable as well, and each blur takes width + height exponentials and an inverse transform.
+ */
+class RetinexSpectrum :
+    public rtengine::NonCopyable
+{
+public:
+    RetinexSpectrum(const float* const* src, int width, int height, bool multiThread) :
+        width(width),
+        height(height),
+        multiThread(multiThread),
+        spectrum(static_cast<float*>(fftwf_malloc(sizeof(float) * width * height))),
+        data(static_cast<float*>(fftwf_malloc(sizeof(float) * width * height))),
+        blurred(static_cast<float*>(fftwf_malloc(sizeof(float) * width * height)))
+    {
+        if (!spectrum || !data || !blurred) {
+            fprintf(stderr, "allocation error\n");
+            abort();
+        }
+
+#ifdef _OPENMP
+        #pragma omp parallel for if (multiThread)
+#endif
+        for (int y = 0; y < height; ++y) {
+            memcpy(data + y * width, src[y], sizeof(float) * width);
+        }
+
+        MyMutex::MyLock lock(*rtengine::fftwMutex);
+        const rtengine::fftw::Plan forward = rtengine::fftw::planR2r2d(height, width, FFTW_REDFT10, FFTW_ESTIMATE, data, spectrum, multiThread);
+        fftwf_execute_r2r(forward.get(), data, spectrum);
+    }
+
+    ~RetinexSpectrum()
+    {
+        fftwf_free(spectrum);
+        fftwf_free(data);
+        fftwf_free(blurred);
+    }
+
+    void blur(float radius, float** dst)
+    {
+        float n_x = rtengine::RT_PI / static_cast<double>(width);
+        float n_y = rtengine::RT_PI / static_cast<double>(height);
+        n_x *= n_x;
+        n_y *= n_y;
+
+        // the normalisation of the DCT pair is folded into the horizontal factors
+        const float norm = 1.f / (4.f * width * height);
+        std::vector<float> kernelX(width);
+        std::vector<float> kernelY(height);
+
+        for (int i = 0; i < width; ++i) {
+            kernelX[i] = norm * std::exp(-radius * n_x * i * i);
+        }
+
+        for (int j = 0; j < height; ++j) {
+            kernelY[j] = std::exp(-radius * n_y * j * j);
+        }
+
+#ifdef _OPENMP
+        #pragma omp parallel for if (multiThread)
+#endif
+        for (int j = 0; j < height; ++j) {
+            const float ky = kernelY[j];
+            const float* const in = spectrum + j * width;
+            float* const out = data + j * width;
+
+            for (int i = 0; i < width; ++i) {
+                out[i] = in[i] * ky * kernelX[i];
+            }
+        }
+
+        {
+            MyMutex::MyLock lock(*rtengine::fftwMutex);
+            const rtengine::fftw::Plan backward = rtengine::fftw::planR2r2d(height, width, FFTW_REDFT01, FFTW_ESTIMATE, data, blurred, multiThread);
+            fftwf_execute_r2r(backward.get(), data, blurred);
+        }
+
+#ifdef _OPENMP
+        #pragma omp parallel for if (multiThread)
+#endif
+        for (int y = 0; y < height; ++y) {
+            memcpy(dst[y], blurred + y * width, sizeof(float) * width);
+        }
+    }
+
+private:
+    const int width;
+    const int height;
+    const bool multiThread;
+    float* const spectrum;
+    float* const data;
+    float* const blurred;
+};
+
 }
 
 
@@ -188,6 +299,7 @@ namespace rtengine
 
 void RawImageSource::MSR(float** luminance, float** originalLuminance, float **exLuminance, const LUTf& mapcurve, bool mapcontlutili, int width, int height, const procparams::RetinexParams &deh, const RetinextransmissionCurve & dehatransmissionCurve, const RetinexgaintransmissionCurve & dehagaintransmissionCurve, float &minCD, float &maxCD, float &mini, float &maxi, float &Tmean, float &Tsigma, float &Tmin, float &Tmax)
 {
+    TRACEFUN;
     BENCHFUN
 
     if (!deh.enabled) {
@@ -1124,9 +1236,7 @@ void ImProcFunctions::maskforretinex(int sp, int before, float ** luminance, flo
         #pragma omp parallel if (multiThread)
 #endif
         {
-            gaussianBlur(buforig->L, buforigmas->L, W_L, H_L, radius);
-            gaussianBlur(buforig->a, buforigmas->a, W_L, H_L, radius);
-            gaussianBlur(buforig->b, buforigmas->b, W_L, H_L, radius);
+            gaussianBlur({buforig->L, buforig->a, buforig->b}, {buforigmas->L, buforigmas->a, buforigmas->b}, W_L, H_L, radius);
         }
 
     }
@@ -1161,6 +1271,7 @@ void ImProcFunctions::MSRLocal(int call, int sp, bool fftw, int lum, float** red
                                float maxdE, float mindE, float maxdElim,  float mindElim, float iterat, float limscope, int scope, float balance, float balanceh, float lumask)
 
 {
+    TRACEFUN;
     BENCHFUN
 
     float mean, stddv, maxtr, mintr;
@@ -1264,6 +1375,9 @@ void ImProcFunctions::MSRLocal(int call, int sp, bool fftw, int lum, float** red
 
     float kr;//on FFTW
     float kg = 1.f;//on Gaussianblur
+    float radius = 0.f;//of the FFT kernel of the current scale
+    std::unique_ptr<RetinexSpectrum> spectrum;
+    bool equalized = false;
 
     for (int scale = scal - 1; scale >= 0; --scale) {
         //    printf("retscale=%f scale=%i \n", mulradiusfftw * RetinexScales[scale], scale);
@@ -1310,24 +1424,40 @@ void ImProcFunctions::MSRLocal(int call, int sp, bool fftw, int lum, float** red
                 gaussianBlur(out, out, W_L, H_L, sqrtf(SQR(kg * RetinexScales[scale]) - SQR(kg * RetinexScales[scale + 1])), true);
             }
         } else {
+            float increment;
+
             if (scale == scal - 1) {
                 if (settings->fftwsigma == false) { //empirical formula
-                    ImProcFunctions::fftw_convol_blur2(src, out, bfwr, bfhr, (kr * RetinexScales[scale]), 0, 0);
+                    increment = kr * RetinexScales[scale];
                 } else {
-                    ImProcFunctions::fftw_convol_blur2(src, out, bfwr, bfhr, (SQR(RetinexScales[scale])), 0, 0);
+                    increment = SQR(RetinexScales[scale]);
                 }
             } else { // reuse result of last iteration
-                // out was modified in last iteration => restore it
                 if (settings->fftwsigma == false) { //empirical formula
-                    ImProcFunctions::fftw_convol_blur2(out, out, bfwr, bfhr, sqrtf(SQR(kr * RetinexScales[scale]) - SQR(kr * RetinexScales[scale + 1])), 0, 0);
+                    increment = sqrtf(SQR(kr * RetinexScales[scale]) - SQR(kr * RetinexScales[scale + 1]));
                 } else {
-                    ImProcFunctions::fftw_convol_blur2(out, out, bfwr, bfhr, (SQR(RetinexScales[scale]) - SQR(RetinexScales[scale + 1])), 0, 0);
+                    increment = SQR(RetinexScales[scale]) - SQR(RetinexScales[scale + 1]);
                 }
             }
+
+            radius += increment;
+
+            if (equalized) {
+                // out was modified in last iteration => blur it further
+                ImProcFunctions::fftw_convol_blur2(out, out, bfwr, bfhr, increment, 0, 0);
+            } else {
+                // the FFT kernels add their radii, all scales are blurred from one transform of src
+                if (!spectrum) {
+                    spectrum.reset(new RetinexSpectrum(src, bfwr, bfhr, multiThread));
+                }
+
+                spectrum->blur(radius, out);
+            }
         }
 
         if (scale == 1) { //equalize last scale with darkness and lightness of course acts on TM!
             if (dar != 1.f || lig != 1.f) {
+                equalized = true;
 
 #ifdef _OPENMP
                 #pragma omp parallel for
@@ -27,6 +27,7 @@
 #include "rtengine.h"
 #include "rtlensfun.h"
 #include "sleef.h"
+#include "trace.h"
 
 using namespace std;
 
@@ -653,6 +654,7 @@ void ImProcFunctions::transform (Imagefloat* original, Imagefloat* transformed,
                                  const FramesMetaData *metadata,
                                  int rawRotationDeg, bool fullImage, bool useOriginalBuffer)
 {
+    TRACEFUN;
     double focalLen = metadata->getFocalLen();
     double focalLen35mm = metadata->getFocalLen35mm();
     float focusDist = metadata->getFocusDist();
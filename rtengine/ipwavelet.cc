@@ -50,8 +50,10 @@
 #endif
 
 #include "cplx_wavelet_dec.h"
+#include "waveletcache.h"
 #define BENCHMARK
 #include "StopWatch.h"
+#include "trace.h"
 
 namespace rtengine
 {
@@ -177,6 +179,21 @@ struct cont_params {
 
 int wavNestedLevels = 1;
 
+namespace
+{
+
+// Untiled decompositions go through the cache, most edits of the tool don't change their input
+std::unique_ptr<wavelet_decomposition> decompose(WaveletCache *cache, WaveletCache::Channel channel, float *src, int width, int height, int levels, int skip, int daubLen)
+{
+    if (cache) {
+        return cache->decompose(channel, src, width, height, levels, 1, skip, max(1, wavNestedLevels), daubLen, static_cast<size_t>(options.waveletCacheMemory) << 20, options.waveletCacheHalfFloat);
+    }
+
+    return std::unique_ptr<wavelet_decomposition>(new wavelet_decomposition(src, width, height, levels, 1, skip, max(1, wavNestedLevels), daubLen));
+}
+
+}
+
 std::unique_ptr<LUTf> ImProcFunctions::buildMeaLut(const float inVals[11], const float mea[10], float& lutFactor)
 {
     constexpr int lutSize = 100;
@@ -213,10 +230,11 @@ std::unique_ptr<LUTf> ImProcFunctions::buildMeaLut(const float inVals[11], const
     return std::unique_ptr<LUTf>(new LUTf(lutVals));
 }
 
-void ImProcFunctions::ip_wavelet(LabImage * lab, LabImage * dst, int kall, const procparams::WaveletParams & waparams, const WavCurve & wavCLVCcurve, const WavCurve & wavdenoise,  WavCurve & wavdenoiseh, const Wavblcurve & wavblcurve, const WavOpacityCurveRG & waOpacityCurveRG, const WavOpacityCurveSH & waOpacityCurveSH, const WavOpacityCurveBY & waOpacityCurveBY,  const WavOpacityCurveW & waOpacityCurveW, const WavOpacityCurveWL & waOpacityCurveWL, const LUTf &wavclCurve, int skip)
+void ImProcFunctions::ip_wavelet(LabImage * lab, LabImage * dst, int kall, const procparams::WaveletParams & waparams, const WavCurve & wavCLVCcurve, const WavCurve & wavdenoise,  WavCurve & wavdenoiseh, const Wavblcurve & wavblcurve, const WavOpacityCurveRG & waOpacityCurveRG, const WavOpacityCurveSH & waOpacityCurveSH, const WavOpacityCurveBY & waOpacityCurveBY,  const WavOpacityCurveW & waOpacityCurveW, const WavOpacityCurveWL & waOpacityCurveWL, const LUTf &wavclCurve, int skip, WaveletCache *waveletCache)
 
 
 {
+    TRACEFUN;
     TMatrix wiprof = ICCStore::getInstance()->workingSpaceInverseMatrix(params->icm.workingProfile);
     const double wip[3][3] = {
         {wiprof[0][0], wiprof[0][1], wiprof[0][2]},
@@ -725,6 +743,7 @@ void ImProcFunctions::ip_wavelet(LabImage * lab, LabImage * dst, int kall, const
     Tile_calc(tilesize, overlap, kall, imwidth, imheight, numtiles_W, numtiles_H, tilewidth, tileheight, tileWskip, tileHskip);
 
     const int numtiles = numtiles_W * numtiles_H;
+    WaveletCache* const cache = numtiles == 1 ? waveletCache : nullptr;
     LabImage * dsttmp;
 
     if (numtiles == 1) {
@@ -876,6 +895,11 @@ void ImProcFunctions::ip_wavelet(LabImage * lab, LabImage * dst, int kall, const
 
         for (int tiletop = 0; tiletop < imheight; tiletop += tileHskip) {
             for (int tileleft = 0; tileleft < imwidth ; tileleft += tileWskip) {
+                if (isCancelled()) {
+                    // the preview is redone with the new parameters, stop decomposing tiles
+                    continue;
+                }
+
                 int tileright = rtengine::min(imwidth, tileleft + tilewidth);
                 int tilebottom = rtengine::min(imheight, tiletop + tileheight);
                 int width  = tileright - tileleft;
@@ -1088,7 +1112,7 @@ void ImProcFunctions::ip_wavelet(LabImage * lab, LabImage * dst, int kall, const
                 }
 
                 if (levwavL > 0) {
-                    const std::unique_ptr<wavelet_decomposition> Ldecomp(new wavelet_decomposition(labco->data, labco->W, labco->H, levwavL, 1, skip, rtengine::max(1, wavNestedLevels), DaubLen));
+                    const std::unique_ptr<wavelet_decomposition> Ldecomp(decompose(cache, WaveletCache::L, labco->data, labco->W, labco->H, levwavL, skip, DaubLen));
                  //   const std::unique_ptr<wavelet_decomposition> Ldecomp2(new wavelet_decomposition(labco->data, labco->W, labco->H, levwavL, 1, skip, rtengine::max(1, wavNestedLevels), DaubLen));
 
                     if (!Ldecomp->memory_allocation_failed()) {
@@ -1749,8 +1773,8 @@ void ImProcFunctions::ip_wavelet(LabImage * lab, LabImage * dst, int kall, const
                                 printf("Leval decomp a=%i\n", levwava);
                             }
 
-                            if (levwava > 0) {
-                                const std::unique_ptr<wavelet_decomposition> adecomp(new wavelet_decomposition(labco->data + datalen, labco->W, labco->H, levwava, 1, skip, rtengine::max(1, wavNestedLevels), DaubLen));
+                            if (levwava > 0 && !isCancelled()) {
+                                const std::unique_ptr<wavelet_decomposition> adecomp(decompose(cache, WaveletCache::A, labco->data + datalen, labco->W, labco->H, levwava, skip, DaubLen));
                                 if (!adecomp->memory_allocation_failed()) {
                                     if(levwava == 6) {
                                         edge = 1;
@@ -1804,8 +1828,8 @@ void ImProcFunctions::ip_wavelet(LabImage * lab, LabImage * dst, int kall, const
                                 printf("Leval decomp b=%i\n", levwavb);
                             }
 
-                            if (levwavb > 0) {
-                                const std::unique_ptr<wavelet_decomposition> bdecomp(new wavelet_decomposition(labco->data + 2 * datalen, labco->W, labco->H, levwavb, 1, skip, rtengine::max(1, wavNestedLevels), DaubLen));
+                            if (levwavb > 0 && !isCancelled()) {
+                                const std::unique_ptr<wavelet_decomposition> bdecomp(decompose(cache, WaveletCache::B, labco->data + 2 * datalen, labco->W, labco->H, levwavb, skip, DaubLen));
                                 if(levwavb == 6) {
                                     edge = 1;
                                 }
@@ -1841,7 +1865,7 @@ void ImProcFunctions::ip_wavelet(LabImage * lab, LabImage * dst, int kall, const
                                 }
                             }
 
-                            if (levwavab > 0) {
+                            if (levwavab > 0 && !isCancelled()) {
                                 const std::unique_ptr<wavelet_decomposition> adecomp(new wavelet_decomposition(labco->data + datalen, labco->W, labco->H, levwavab, 1, skip, rtengine::max(1, wavNestedLevels), DaubLen));
                                 const std::unique_ptr<wavelet_decomposition> bdecomp(new wavelet_decomposition(labco->data + 2 * datalen, labco->W, labco->H, levwavab, 1, skip, rtengine::max(1, wavNestedLevels), DaubLen));
 
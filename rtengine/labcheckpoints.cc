@@ -0,0 +1,190 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "labcheckpoints.h"
+
+#include "labimage.h"
+#include "procparams.h"
+
+namespace
+{
+
+size_t imageSize(const rtengine::LabImage *image)
+{
+    return 3 * sizeof(float) * image->W * image->H;
+}
+
+}
+
+namespace rtengine
+{
+
+using namespace procparams;
+
+LabCheckpoints::LabCheckpoints() :
+    budget(0),
+    useCounter(0)
+{
+}
+
+LabCheckpoints::~LabCheckpoints() = default;
+
+LabCheckpoints::Stage LabCheckpoints::firstChangedStage(const ProcParams &oldParams, const ProcParams &newParams)
+{
+    // Everything which is not owned by one of the later stages belongs to the first one.
+    // The parameters of a later stage which are read by an earlier one stay in the comparison.
+    ProcParams residual = newParams;
+    residual.epd = oldParams.epd;
+    residual.impulseDenoise = oldParams.impulseDenoise;
+    residual.defringe = oldParams.defringe;
+    residual.sharpenEdge = oldParams.sharpenEdge;
+    residual.sharpenMicro = oldParams.sharpenMicro;
+    residual.sharpening = oldParams.sharpening;
+    residual.dirpyrequalizer = oldParams.dirpyrequalizer;
+    residual.wavelet = oldParams.wavelet;
+    residual.softlight = oldParams.softlight;
+    residual.colorappearance = oldParams.colorappearance;
+    residual.colorappearance.enabled = newParams.colorappearance.enabled;
+    residual.colorappearance.gamut = newParams.colorappearance.gamut;
+
+    if (residual != oldParams) {
+        return ADJUSTMENTS;
+    }
+
+    if (newParams.epd != oldParams.epd || newParams.colorappearance.tonecie != oldParams.colorappearance.tonecie) {
+        return TONEMAPPING;
+    }
+
+    if (
+        newParams.impulseDenoise != oldParams.impulseDenoise
+        || newParams.defringe != oldParams.defringe
+        || newParams.sharpenEdge != oldParams.sharpenEdge
+        || newParams.sharpenMicro != oldParams.sharpenMicro
+        || newParams.sharpening != oldParams.sharpening
+        || newParams.dirpyrequalizer != oldParams.dirpyrequalizer
+    ) {
+        return DETAIL;
+    }
+
+    if (newParams.wavelet != oldParams.wavelet) {
+        return WAVELET;
+    }
+
+    if (newParams.softlight != oldParams.softlight) {
+        return FINISHING;
+    }
+
+    if (newParams.colorappearance != oldParams.colorappearance) {
+        return CIECAM;
+    }
+
+    return STAGE_COUNT;
+}
+
+LabCheckpoints::Stage LabCheckpoints::restart(const ProcParams &params, const LabImage *input, LabImage *lab, size_t memoryBudget)
+{
+    budget = memoryBudget;
+
+    if (budget == 0) {
+        clear();
+        lab->CopyFrom(input);
+        return ADJUSTMENTS;
+    }
+
+    int first = ADJUSTMENTS;
+
+    if (lastParams) {
+        first = firstChangedStage(*lastParams, params);
+        *lastParams = params;
+    } else {
+        lastParams.reset(new ProcParams(params));
+    }
+
+    // the outputs of the changed stage and of all the following ones are outdated
+    for (int i = first; i < STAGE_COUNT; ++i) {
+        checkpoints[i].image.reset();
+    }
+
+    // restart from the nearest cached output upstream of the changed stage
+    for (int i = first - 1; i >= 0; --i) {
+        const std::unique_ptr<LabImage> &image = checkpoints[i].image;
+
+        if (image && image->W == lab->W && image->H == lab->H) {
+            lab->CopyFrom(image.get());
+            checkpoints[i].lastUse = ++useCounter;
+            return static_cast<Stage>(i + 1);
+        }
+    }
+
+    lab->CopyFrom(input);
+    return ADJUSTMENTS;
+}
+
+void LabCheckpoints::store(Stage stage, const LabImage *lab)
+{
+    if (budget == 0) {
+        return;
+    }
+
+    Checkpoint &checkpoint = checkpoints[stage];
+    checkpoint.image.reset();
+
+    const size_t needed = imageSize(lab);
+
+    // evict the least recently used checkpoints until the new one fits
+    while (usedMemory() + needed > budget) {
+        Checkpoint *oldest = nullptr;
+
+        for (auto &candidate : checkpoints) {
+            if (candidate.image && (!oldest || candidate.lastUse < oldest->lastUse)) {
+                oldest = &candidate;
+            }
+        }
+
+        if (!oldest) {
+            return;
+        }
+
+        oldest->image.reset();
+    }
+
+    checkpoint.image.reset(new LabImage(*lab, true));
+    checkpoint.lastUse = ++useCounter;
+}
+
+void LabCheckpoints::clear()
+{
+    for (auto &checkpoint : checkpoints) {
+        checkpoint.image.reset();
+    }
+
+    lastParams.reset();
+}
+
+size_t LabCheckpoints::usedMemory() const
+{
+    size_t used = 0;
+
+    for (const auto &checkpoint : checkpoints) {
+        if (checkpoint.image) {
+            used += imageSize(checkpoint.image.get());
+        }
+    }
+
+    return used;
+}
+
+}
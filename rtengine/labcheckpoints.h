@@ -0,0 +1,91 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <memory>
+
+#include "noncopyable.h"
+
+namespace rtengine
+{
+
+class LabImage;
+
+namespace procparams
+{
+
+class ProcParams;
+
+}
+
+/**
+ * Cached outputs of the tools of the Lab part of the pipeline (the M_LUMINANCE | M_COLOR block
+ * of ImProcCoordinator::updatePreviewImage and Crop::update).
+ *
+ * All these tools share the same refresh flags, so a change of the last tool used to re-run all
+ * of them. The chain is split into stages, and the output of each stage is kept as long as the
+ * memory budget allows. An update restarts at the first stage whose parameters changed, from the
+ * nearest cached output upstream of it.
+ */
+class LabCheckpoints final :
+    public NonCopyable
+{
+public:
+    enum Stage {
+        ADJUSTMENTS, // Lab grid colour toning, shadows/highlights, local contrast, Lab curves, vibrance, colour correction regions
+        TONEMAPPING, // edge preserving decomposition
+        DETAIL,      // impulse denoise, defringe, sharpening, microcontrast (detail windows at 100% only), contrast by detail levels
+        WAVELET,
+        FINISHING,   // soft light, working TRC
+        CIECAM,
+        STAGE_COUNT
+    };
+
+    LabCheckpoints();
+    ~LabCheckpoints();
+
+    /**
+     * Returns the first stage that has to be processed and copies its input to 'lab'.
+     * @param input input of the first stage
+     * @param memoryBudget memory for the checkpoints in bytes, 0 disables them
+     */
+    Stage restart(const procparams::ProcParams &params, const LabImage *input, LabImage *lab, size_t memoryBudget);
+
+    // Stores the output of 'stage', if it fits into the memory budget
+    void store(Stage stage, const LabImage *lab);
+
+    // Has to be called whenever the input of the first stage changes
+    void clear();
+
+private:
+    struct Checkpoint {
+        std::unique_ptr<LabImage> image;
+        unsigned long lastUse = 0;
+    };
+
+    static Stage firstChangedStage(const procparams::ProcParams &oldParams, const procparams::ProcParams &newParams);
+    size_t usedMemory() const;
+
+    std::array<Checkpoint, STAGE_COUNT> checkpoints;
+    std::unique_ptr<procparams::ProcParams> lastParams;
+    size_t budget;
+    unsigned long useCounter;
+};
+
+}
@@ -18,9 +18,12 @@
  */
 
 #include <memory>
+#include <new>
 
 #include "labimage.h"
 
+#include "bufferpool.h"
+
 namespace rtengine
 {
 
@@ -90,7 +93,12 @@ void LabImage::allocLab(size_t w, size_t h)
     a = new float*[h];
     b = new float*[h];
 
-    data = new float [w * h * 3];
+    data = static_cast<float*>(BufferPool::allocate(w * h * 3 * sizeof(float)));
+
+    if (!data && w && h) {
+        throw std::bad_alloc();
+    }
+
     float * index = data;
 
     for (size_t i = 0; i < h; i++) {
@@ -115,7 +123,7 @@ void LabImage::deleteLab()
     delete [] L;
     delete [] a;
     delete [] b;
-    delete [] data;
+    BufferPool::release(data, static_cast<size_t>(W) * H * 3 * sizeof(float));
 }
 
 void LabImage::reallocLab()
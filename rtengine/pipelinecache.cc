@@ -0,0 +1,260 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "pipelinecache.h"
+
+#include "colortemp.h"
+#include "imagefloat.h"
+#include "procparams.h"
+#include "settings.h"
+
+namespace
+{
+
+size_t imageSize(const rtengine::Imagefloat *image)
+{
+    return 3 * sizeof(float) * image->getWidth() * image->getHeight();
+}
+
+}
+
+namespace rtengine
+{
+
+extern const Settings* settings;
+
+using namespace procparams;
+
+// The parameters read by the cached tools. ProcParams can't be hashed, so each distinct set gets an id instead.
+struct PipelineCache::UpstreamParams {
+    explicit UpstreamParams(const ProcParams &params, const ColorTemp &wb) :
+        id(0),
+        icm(params.icm),
+        coarse(params.coarse)
+    {
+        wb.getMultipliers(wbMul[0], wbMul[1], wbMul[2]);
+
+        // getImage() only reads the highlight reconstruction settings of the tone curve
+        toneCurve.hrenabled = params.toneCurve.hrenabled;
+        toneCurve.method = params.toneCurve.method;
+        toneCurve.hlbl = params.toneCurve.hlbl;
+        toneCurve.clampOOG = params.toneCurve.clampOOG;
+
+        // the settings of disabled tools don't matter
+        if (params.spot.enabled) {
+            spot = params.spot;
+        }
+
+        if (params.filmNegative.enabled) {
+            filmNegative = params.filmNegative;
+        }
+
+        if (params.dehaze.enabled) {
+            dehaze = params.dehaze;
+        }
+
+        if (params.fattal.enabled) {
+            fattal = params.fattal;
+        }
+    }
+
+    bool operator ==(const UpstreamParams &other) const
+    {
+        return
+            std::equal(wbMul, wbMul + 3, other.wbMul)
+            && toneCurve == other.toneCurve
+            && icm == other.icm
+            && coarse == other.coarse
+            && spot == other.spot
+            && filmNegative == other.filmNegative
+            && dehaze == other.dehaze
+            && fattal == other.fattal;
+    }
+
+    unsigned int id;
+    double wbMul[3];
+    ToneCurveParams toneCurve;
+    ColorManagementParams icm;
+    CoarseTransformParams coarse;
+    SpotParams spot;
+    FilmNegativeParams filmNegative;
+    DehazeParams dehaze;
+    FattalToneMappingParams fattal;
+};
+
+PipelineCache::PipelineCache() :
+    nextParamsId(0),
+    useCounter(0)
+{
+}
+
+PipelineCache::~PipelineCache() = default;
+
+PipelineCache::Key PipelineCache::getKey(const ProcParams &params, const ColorTemp &wb, int x, int y, int width, int height, int skip)
+{
+    MyMutex::MyLock lock(mutex);
+
+    std::unique_ptr<UpstreamParams> upstream(new UpstreamParams(params, wb));
+    unsigned int paramsId = 0;
+    bool found = false;
+
+    for (const auto &paramSet : paramSets) {
+        if (*paramSet == *upstream) {
+            paramsId = paramSet->id;
+            found = true;
+            break;
+        }
+    }
+
+    if (!found) {
+        // forget the parameter sets without any cached image
+        paramSets.erase(
+            std::remove_if(
+                paramSets.begin(),
+                paramSets.end(),
+                [this](const std::unique_ptr<UpstreamParams> &paramSet)
+                {
+                    return std::none_of(
+                        entries.begin(),
+                        entries.end(),
+                        [&paramSet](const Entry &entry)
+                        {
+                            return entry.key.paramsId == paramSet->id;
+                        }
+                    );
+                }
+            ),
+            paramSets.end()
+        );
+
+        paramsId = upstream->id = nextParamsId++;
+        paramSets.push_back(std::move(upstream));
+    }
+
+    return {paramsId, x, y, width, height, skip};
+}
+
+bool PipelineCache::fetch(const Key &key, Imagefloat *image)
+{
+    MyMutex::MyLock lock(mutex);
+
+    for (auto &entry : entries) {
+        const Key &cached = entry.key;
+
+        if (
+            cached.paramsId != key.paramsId
+            || cached.skip != key.skip
+            || key.x < cached.x
+            || key.y < cached.y
+            || (key.x - cached.x) % key.skip
+            || (key.y - cached.y) % key.skip
+        ) {
+            continue;
+        }
+
+        const int ox = (key.x - cached.x) / key.skip;
+        const int oy = (key.y - cached.y) / key.skip;
+
+        if (ox + key.width > cached.width || oy + key.height > cached.height) {
+            continue;
+        }
+
+        const Imagefloat *const src = entry.image.get();
+
+        for (int i = 0; i < key.height; ++i) {
+            std::memcpy(image->r(i), src->r(oy + i) + ox, key.width * sizeof(float));
+            std::memcpy(image->g(i), src->g(oy + i) + ox, key.width * sizeof(float));
+            std::memcpy(image->b(i), src->b(oy + i) + ox, key.width * sizeof(float));
+        }
+
+        entry.lastUse = ++useCounter;
+
+        if (settings->verbose) {
+            printf("PipelineCache: %dx%d region at skip %d served from a %dx%d entry\n", key.width, key.height, key.skip, cached.width, cached.height);
+        }
+
+        return true;
+    }
+
+    return false;
+}
+
+void PipelineCache::store(const Key &key, const Imagefloat *image, size_t memoryBudget)
+{
+    MyMutex::MyLock lock(mutex);
+
+    // entries covered by the new one are useless from now on
+    entries.remove_if(
+        [&key](const Entry &entry)
+        {
+            return
+                entry.key.paramsId == key.paramsId
+                && entry.key.skip == key.skip
+                && entry.key.x >= key.x
+                && entry.key.y >= key.y
+                && entry.key.x + entry.key.width * key.skip <= key.x + key.width * key.skip
+                && entry.key.y + entry.key.height * key.skip <= key.y + key.height * key.skip;
+        }
+    );
+
+    const size_t needed = imageSize(image);
+
+    if (needed > memoryBudget) {
+        return;
+    }
+
+    // evict the least recently used entries until the new one fits
+    while (!entries.empty() && usedMemory() + needed > memoryBudget) {
+        entries.erase(
+            std::min_element(
+                entries.begin(),
+                entries.end(),
+                [](const Entry &a, const Entry &b)
+                {
+                    return a.lastUse < b.lastUse;
+                }
+            )
+        );
+    }
+
+    entries.push_back({key, std::unique_ptr<Imagefloat>(new Imagefloat), ++useCounter});
+    image->copyData(entries.back().image.get());
+}
+
+void PipelineCache::clear()
+{
+    MyMutex::MyLock lock(mutex);
+
+    entries.clear();
+    paramSets.clear();
+}
+
+size_t PipelineCache::usedMemory() const
+{
+    size_t used = 0;
+
+    for (const auto &entry : entries) {
+        used += imageSize(entry.image.get());
+    }
+
+    return used;
+}
+
+}
@@ -0,0 +1,98 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <vector>
+
+#include "noncopyable.h"
+
+#include "../rtgui/threadutils.h"
+
+namespace rtengine
+{
+
+class ColorTemp;
+class Imagefloat;
+
+namespace procparams
+{
+
+class ProcParams;
+
+}
+
+/**
+ * Cache of the RGB pipeline output in front of the transform (raw image, spot removal, film negative,
+ * colour space conversion, dehaze and dynamic range compression), shared by the preview and the crops.
+ *
+ * Entries are keyed by the scale, the region and the parameters of these tools. A region can be served
+ * by any entry of the same scale and parameters covering it, so a crop showing a part of the preview at
+ * the preview scale, or moving back to a place it was before, doesn't have to compute it again.
+ * Denoised crops are not cached, as their result depends on the tiling of the crop.
+ */
+class PipelineCache final :
+    public NonCopyable
+{
+public:
+    struct Key {
+        unsigned int paramsId; // id of the parameters of the cached tools, equal ids mean equal parameters
+        int x;                 // left border of the region in full size coordinates
+        int y;                 // top border of the region in full size coordinates
+        int width;             // width of the region at 'skip'
+        int height;            // height of the region at 'skip'
+        int skip;
+    };
+
+    PipelineCache();
+    ~PipelineCache();
+
+    Key getKey(const procparams::ProcParams &params, const ColorTemp &wb, int x, int y, int width, int height, int skip);
+
+    // Copies the cached region to 'image', which has to be sized key.width x key.height. Returns false if it is not cached.
+    bool fetch(const Key &key, Imagefloat *image);
+
+    /**
+     * Stores 'image' as the region of 'key', if it fits into the memory budget.
+     * @param memoryBudget memory for the cache in bytes, 0 disables it
+     */
+    void store(const Key &key, const Imagefloat *image, size_t memoryBudget);
+
+    // Has to be called whenever the data of the image source changes
+    void clear();
+
+private:
+    struct UpstreamParams;
+
+    struct Entry {
+        Key key;
+        std::unique_ptr<Imagefloat> image;
+        unsigned long lastUse;
+    };
+
+    size_t usedMemory() const;
+
+    MyMutex mutex;
+    std::vector<std::unique_ptr<UpstreamParams>> paramSets;
+    std::list<Entry> entries;
+    unsigned int nextParamsId;
+    unsigned long useCounter;
+};
+
+}
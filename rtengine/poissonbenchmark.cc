@@ -0,0 +1,260 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <ostream>
+#include <sstream>
+#include <utility>
+
+#include "poissonbenchmark.h"
+#include "rt_math.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace
+{
+
+// log luminance of the synthetic scene, in coordinates relative to the image size so that all sizes show the same scene
+float sceneLogLuminance(float u, float v)
+{
+    // smooth shading over about 6 EV
+    float value = 2.f * std::sin(3.f * u) * std::cos(2.f * v) + 1.5f * u;
+
+    // hard edged blocks, a bright window and dark shadows
+    if (u > 0.6f && u < 0.85f && v > 0.15f && v < 0.5f) {
+        value += 3.f;
+    } else if (u < 0.3f && v > 0.6f) {
+        value -= 2.5f;
+    }
+
+    // fine texture, about 2 to 4 pixels per period on a 24 MP image
+    value += 0.2f * std::sin(2500.f * u + 1700.f * v) + 0.1f * std::sin(4100.f * v);
+
+    return value;
+}
+
+}
+
+namespace rtengine
+{
+
+void PoissonBenchmark::buildDivergence(array2D<float> &divergence)
+{
+    const int width = divergence.getWidth();
+    const int height = divergence.getHeight();
+    array2D<float> logLuminance(width, height);
+
+#ifdef _OPENMP
+    #pragma omp parallel for
+#endif
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            logLuminance[y][x] = sceneLogLuminance(x / float(width), y / float(height));
+        }
+    }
+
+    // gradients attenuated like in tmo_fattal02(), (|g| / alpha)^(beta - 1) with beta = 0.85 and the boundary assumption H(N+1) = H(N-1)
+    array2D<float> gx(width, height);
+    array2D<float> gy(width, height);
+    constexpr float alpha = 0.01f;
+    constexpr float beta = 0.85f;
+
+#ifdef _OPENMP
+    #pragma omp parallel for
+#endif
+    for (int y = 0; y < height; ++y) {
+        const int yp1 = y + 1 >= height ? height - 2 : y + 1;
+
+        for (int x = 0; x < width; ++x) {
+            const int xp1 = x + 1 >= width ? width - 2 : x + 1;
+            const float dx = logLuminance[y][xp1] - logLuminance[y][x];
+            const float dy = logLuminance[yp1][x] - logLuminance[y][x];
+            const float attenuation = std::pow(std::sqrt(SQR(dx) + SQR(dy)) / alpha + 1e-4f, beta - 1.f);
+            gx[y][x] = dx * attenuation;
+            gy[y][x] = dy * attenuation;
+        }
+    }
+
+#ifdef _OPENMP
+    #pragma omp parallel for
+#endif
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            float value = gx[y][x] + gy[y][x];
+
+            if (x > 0) {
+                value -= gx[y][x - 1];
+            } else {
+                value += gx[y][x];
+            }
+
+            if (y > 0) {
+                value -= gy[y - 1][x];
+            } else {
+                value += gy[y][x];
+            }
+
+            divergence[y][x] = value;
+        }
+    }
+}
+
+std::vector<PoissonBenchmark::Result> PoissonBenchmark::run(const Config &config, std::ostream &log)
+{
+    std::vector<Result> results;
+    std::vector<std::pair<int, int>> sizes;
+
+    if (config.width > 0 && config.height > 0) {
+        sizes.emplace_back(config.width, config.height);
+    } else {
+        for (const double megapixels : config.megapixels) {
+            if (megapixels > 0.0) {
+                const int height = std::sqrt(megapixels * 1000000.0 / 1.5) + 0.5;
+                sizes.emplace_back(height * 3 / 2, height);
+            }
+        }
+    }
+
+#ifdef _OPENMP
+    const int maxThreads = omp_get_max_threads();
+#else
+    const int maxThreads = 1;
+#endif
+    std::vector<int> threads = config.threads;
+
+    if (threads.empty()) {
+        threads.push_back(maxThreads);
+    }
+
+    for (const auto &size : sizes) {
+        if (size.first < 64 || size.second < 64) {
+            continue;
+        }
+
+        int fftWidth, fftHeight, multigridWidth, multigridHeight;
+        getSolverSize(size.first, size.second, false, fftWidth, fftHeight);
+        getSolverSize(size.first, size.second, true, multigridWidth, multigridHeight);
+
+        double maxDifference = 0.0;
+        double rmsDifference = 0.0;
+        {
+            // the output does not depend on the number of threads, so compare the solutions only once
+            array2D<float> divergence(multigridWidth, multigridHeight);
+            buildDivergence(divergence);
+            array2D<float> reference(multigridWidth, multigridHeight);
+            array2D<float> solution(multigridWidth, multigridHeight);
+            solve(divergence, reference, false);
+            solve(divergence, solution, true);
+
+            // the tone mapper normalizes the result, a constant in the log luminance doesn't matter
+            double offset = 0.0;
+
+            for (int y = 0; y < multigridHeight; ++y) {
+                for (int x = 0; x < multigridWidth; ++x) {
+                    offset += solution[y][x] - reference[y][x];
+                }
+            }
+
+            offset /= multigridWidth * static_cast<double>(multigridHeight);
+
+            for (int y = 0; y < multigridHeight; ++y) {
+                for (int x = 0; x < multigridWidth; ++x) {
+                    const double difference = solution[y][x] - reference[y][x] - offset;
+                    maxDifference = std::max(maxDifference, std::fabs(difference));
+                    rmsDifference += SQR(difference);
+                }
+            }
+
+            rmsDifference = std::sqrt(rmsDifference / (multigridWidth * static_cast<double>(multigridHeight)));
+        }
+
+        for (const int numThreads : threads) {
+#ifdef _OPENMP
+            omp_set_num_threads(std::max(1, numThreads));
+#endif
+            Result result;
+            result.width = size.first;
+            result.height = size.second;
+            result.threads = std::max(1, numThreads);
+            result.maxLogDifference = maxDifference;
+            result.rmsLogDifference = rmsDifference;
+
+            for (const bool multigrid : {false, true}) {
+                const int width = multigrid ? multigridWidth : fftWidth;
+                const int height = multigrid ? multigridHeight : fftHeight;
+                array2D<float> divergence(width, height);
+                buildDivergence(divergence);
+                array2D<float> solution(width, height);
+                double bestTime = 0.0;
+
+                for (int run = 0; run < std::max(1, config.runs); ++run) {
+                    const double elapsed = solve(divergence, solution, multigrid);
+                    bestTime = run == 0 ? elapsed : std::min(bestTime, elapsed);
+                }
+
+                (multigrid ? result.multigridSeconds : result.fftSeconds) = bestTime;
+            }
+
+            results.push_back(result);
+
+            log << result.width << "x" << result.height << std::setw(4) << result.threads << " threads: "
+                << std::fixed << std::setprecision(2) << "FFT " << result.fftSeconds << " s, multigrid " << result.multigridSeconds << " s, "
+                << std::scientific << std::setprecision(1) << "max difference " << result.maxLogDifference << std::endl;
+        }
+    }
+
+#ifdef _OPENMP
+    omp_set_num_threads(maxThreads);
+#endif
+
+    return results;
+}
+
+void PoissonBenchmark::printReport(const std::vector<Result> &results, std::ostream &out)
+{
+    out << std::left << std::setw(12) << "Size" << std::right << std::setw(8) << "MPix" << std::setw(8) << "Threads"
+        << std::setw(10) << "FFT s" << std::setw(12) << "Multigrid s" << std::setw(9) << "Speedup"
+        << std::setw(12) << "Max diff" << std::setw(12) << "RMS diff" << std::endl;
+
+    for (const auto &r : results) {
+        std::ostringstream size;
+        size << r.width << "x" << r.height;
+
+        out << std::left << std::setw(12) << size.str() << std::right << std::fixed
+            << std::setw(8) << std::setprecision(1) << r.width * static_cast<double>(r.height) / 1000000.0 << std::setw(8) << r.threads
+            << std::setprecision(2) << std::setw(10) << r.fftSeconds << std::setw(12) << r.multigridSeconds
+            << std::setw(9) << r.fftSeconds / std::max(r.multigridSeconds, 1e-6)
+            << std::scientific << std::setprecision(2) << std::setw(12) << r.maxLogDifference << std::setw(12) << r.rmsLogDifference << std::endl;
+    }
+
+    out << std::endl << "Differences are in natural log luminance, 0.01 is a 1% luminance difference." << std::endl;
+}
+
+void PoissonBenchmark::writeCSV(const std::vector<Result> &results, std::ostream &out)
+{
+    out << "width,height,threads,fft_s,multigrid_s,max_log_diff,rms_log_diff" << std::endl;
+
+    for (const auto &r : results) {
+        out << r.width << ',' << r.height << ',' << r.threads << ',' << r.fftSeconds << ',' << r.multigridSeconds << ','
+            << r.maxLogDifference << ',' << r.rmsLogDifference << std::endl;
+    }
+}
+
+}
@@ -0,0 +1,69 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <iosfwd>
+#include <vector>
+
+#include "array2D.h"
+
+namespace rtengine
+{
+
+/**
+ * Offline benchmark of the Poisson solvers of the dynamic range compression (Fattal02).
+ *
+ * The divergence of a synthetic attenuated gradient field (smooth shading, hard edged blocks
+ * and fine texture) is solved by the FFT solver and by the multigrid solver, each one at the
+ * size the tone mapper pads the image to for it. The multigrid solution is compared with the
+ * FFT one on the same grid, in log luminance and up to the constant the tone mapper drops.
+ */
+class PoissonBenchmark
+{
+public:
+    struct Config {
+        std::vector<double> megapixels = {24.0, 50.0, 100.0}; ///< image sizes, 3:2 landscape
+        int width = 0;                 ///< if width and height are > 0, they are used instead of megapixels
+        int height = 0;
+        int runs = 3;                  ///< timed runs per solver and thread count, the fastest one is reported
+        std::vector<int> threads;      ///< thread counts to test, empty = maximum available
+    };
+
+    struct Result {
+        int width = 0;
+        int height = 0;
+        int threads = 1;
+        double fftSeconds = 0.0;
+        double multigridSeconds = 0.0;
+        double maxLogDifference = 0.0; ///< largest difference of the log luminances of both solutions
+        double rmsLogDifference = 0.0;
+    };
+
+    static std::vector<Result> run(const Config &config, std::ostream &log);
+    static void printReport(const std::vector<Result> &results, std::ostream &out);
+    static void writeCSV(const std::vector<Result> &results, std::ostream &out);
+
+private:
+    static void buildDivergence(array2D<float> &divergence);
+
+    // defined in tmo_fattal02.cc, next to the solvers
+    static void getSolverSize(int width, int height, bool multigrid, int &solverWidth, int &solverHeight);
+    // returns the time taken by the solver in seconds
+    static double solve(const array2D<float> &divergence, array2D<float> &solution, bool multigrid);
+};
+
+}
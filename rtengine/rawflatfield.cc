@@ -20,8 +20,10 @@
 #include <cstring>
 #include <memory>
 #include <new>
+#include <sstream>
 
 #include "rawimagesource.h"
+#include "ffmanager.h"
 #include "procparams.h"
 #include "rawimage.h"
 //#define BENCHMARK
@@ -258,29 +260,187 @@ void cfaboxblur(const float* const * riFlatFile, float* cfablur, int boxH, int b
     }
 }
 
+int getFlatFieldBlurSize(const rtengine::procparams::RAWParams &raw)
+{
+    return raw.ff_BlurRadius + (raw.ff_BlurRadius & 1);
+}
+
+bool isVHBlur(const rtengine::procparams::RAWParams &raw)
+{
+    return raw.ff_BlurType == rtengine::procparams::RAWParams::getFlatFieldBlurTypeString(rtengine::procparams::RAWParams::FlatFieldBlurType::VH);
+}
+
+// the blurred flat field only depends on the flat field and the blur settings, so it is shared by all images of a batch
+rtengine::FFManager::FlatFieldMap getBlurredFlatField(const rtengine::procparams::RAWParams &raw, const rtengine::RawImage *riFlatFile, int H, int W)
+{
+    const int BS = getFlatFieldBlurSize(raw);
+    int boxH = BS;
+    int boxW = BS;
+
+    if (raw.ff_BlurType == rtengine::procparams::RAWParams::getFlatFieldBlurTypeString(rtengine::procparams::RAWParams::FlatFieldBlurType::V)) {
+        boxH = 2 * BS;
+        boxW = 0;
+    } else if (raw.ff_BlurType == rtengine::procparams::RAWParams::getFlatFieldBlurTypeString(rtengine::procparams::RAWParams::FlatFieldBlurType::H)) {
+        boxH = 0;
+        boxW = 2 * BS;
+    } // for VH we first do area blur to correct vignette, same as for area blur
+
+    return rtengine::ffm.getFlatFieldMap(riFlatFile, "blur " + std::to_string(boxH) + " " + std::to_string(boxW), [&](float *dst) {
+        cfaboxblur(riFlatFile->data, dst, boxH, boxW, H, W);
+    });
+}
+
+// gain map of the VH blur type to correct vertical and horizontal anomalies, only depends on the flat field, the blur size and the black levels.
+// blackIndex(row, col) returns the index into black[] for a pixel.
+template<typename F>
+rtengine::FFManager::FlatFieldMap getLineCorrection(int BS, const rtengine::RawImage *riFlatFile, const float *cfablur, const float black[4], const F &blackIndex, int H, int W)
+{
+    std::ostringstream id;
+    id.precision(9);
+    id << "linecorr " << BS << " " << black[0] << " " << black[1] << " " << black[2] << " " << black[3];
+
+    return rtengine::ffm.getFlatFieldMap(riFlatFile, id.str(), [&](float *linecorr) {
+        std::unique_ptr<float []> cfablur1(new float[H * W]);
+        std::unique_ptr<float []> cfablur2(new float[H * W]);
+        cfaboxblur(riFlatFile->data, cfablur1.get(), 0, 2 * BS, H, W); //now do horizontal blur
+        cfaboxblur(riFlatFile->data, cfablur2.get(), 2 * BS, 0, H, W); //now do vertical blur
+
+#ifdef _OPENMP
+        #pragma omp parallel for
+#endif
+
+        for (int row = 0; row < H; ++row) {
+            for (int col = 0; col < W; ++col) {
+                const float blk = black[blackIndex(row, col)];
+                linecorr[row * W + col] = rtengine::SQR(std::max(1e-5f, cfablur[row * W + col] - blk)) /
+                                          (std::max(1e-5f, cfablur1[row * W + col] - blk) * std::max(1e-5f, cfablur2[row * W + col] - blk));
+            }
+        }
+    });
+}
+
 }
 
 namespace rtengine
 {
 
+void RawImageSource::getBayerBlackIndices(unsigned int c4[2][2]) const
+{
+    // four colors, 0=R, 1=G1, 2=B, 3=G2, all 0 for monochrome
+    for (int i = 0; i < 2; ++i) {
+        for (int j = 0; j < 2; ++j) {
+            if (ri->get_colors() == 1) {
+                c4[i][j] = 0;
+            } else {
+                const unsigned int c = FC(i, j);
+                c4[i][j] = (c == 1 && !(i & 1)) ? 3 : c;
+            }
+        }
+    }
+}
+
+FFManager::FlatFieldMap RawImageSource::getFlatFieldGainMap(const procparams::RAWParams &raw, const RawImage *riFlatFile, const float black[4])
+{
+    if (raw.ff_AutoClipControl || !(ri->getSensorType() == ST_BAYER || ri->get_colors() == 1)) {
+        // auto clip control depends on the image data
+        return nullptr;
+    }
+
+    std::ostringstream id;
+    id.precision(9);
+    id << "gain " << raw.ff_BlurType << " " << getFlatFieldBlurSize(raw) << " " << raw.ff_clipControl << " " << black[0] << " " << black[1] << " " << black[2] << " " << black[3];
+
+    return ffm.getFlatFieldMap(riFlatFile, id.str(), [&](float *gain) {
+        const FFManager::FlatFieldMap cfablurMap = getBlurredFlatField(raw, riFlatFile, H, W);
+        const float *const cfablur = cfablurMap->data();
+        unsigned int c4[2][2];
+        getBayerBlackIndices(c4);
+
+        // find center values by channel
+        const float limitFactor = std::max((100 - raw.ff_clipControl) / 100.f, 0.01f);
+        float refcolor[2][2];
+
+        for (int m = 0; m < 2; ++m) {
+            for (int n = 0; n < 2; ++n) {
+                const int row = 2 * (H >> 2) + m;
+                const int col = 2 * (W >> 2) + n;
+                refcolor[m][n] = std::max(0.0f, cfablur[row * W + col] - black[c4[m][n]]) * limitFactor;
+            }
+        }
+
+        constexpr float minValue = 1.f; // if the pixel value in the flat field is less or equal this value, no correction will be applied.
+
+#ifdef _OPENMP
+        #pragma omp parallel for
+#endif
+
+        for (int row = 0; row < H; ++row) {
+            for (int col = 0; col < W; ++col) {
+                const float blur = cfablur[row * W + col] - black[c4[row & 1][col & 1]];
+                gain[row * W + col] = blur <= minValue ? 1.f : refcolor[row & 1][col & 1] / blur;
+            }
+        }
+
+        if (isVHBlur(raw)) {
+            const FFManager::FlatFieldMap linecorrMap = getLineCorrection(getFlatFieldBlurSize(raw), riFlatFile, cfablur, black, [&](int row, int col) {
+                return c4[row & 1][col & 1];
+            }, H, W);
+            const float *const linecorr = linecorrMap->data();
+
+#ifdef _OPENMP
+            #pragma omp parallel for
+#endif
+
+            for (int i = 0; i < H * W; ++i) {
+                gain[i] *= linecorr[i];
+            }
+        }
+    });
+}
+
 void RawImageSource::processFlatField(const procparams::RAWParams &raw, const RawImage *riFlatFile, array2D<float> &rawData, const float black[4])
 {
 //    BENCHFUN
-    std::unique_ptr<float[]> cfablur(new float[H * W]);
+    const FFManager::FlatFieldMap gainMap = getFlatFieldGainMap(raw, riFlatFile, black);
 
-    const int BS = raw.ff_BlurRadius + (raw.ff_BlurRadius & 1);
+    if (gainMap) {
+        // without auto clip control the whole correction is one gain per pixel
+        const float *const gain = gainMap->data();
+        unsigned int c4[2][2];
+        getBayerBlackIndices(c4);
+#ifdef __SSE2__
+        const vfloat blackv[2] = {_mm_set_ps(black[c4[0][1]], black[c4[0][0]], black[c4[0][1]], black[c4[0][0]]),
+                                  _mm_set_ps(black[c4[1][1]], black[c4[1][0]], black[c4[1][1]], black[c4[1][0]])
+                                 };
+#endif
+#ifdef _OPENMP
+        #pragma omp parallel for schedule(dynamic,16)
+#endif
 
-    if (raw.ff_BlurType == procparams::RAWParams::getFlatFieldBlurTypeString(procparams::RAWParams::FlatFieldBlurType::V)) {
-        cfaboxblur(riFlatFile->data, cfablur.get(), 2 * BS, 0, H, W);
-    } else if (raw.ff_BlurType == procparams::RAWParams::getFlatFieldBlurTypeString(procparams::RAWParams::FlatFieldBlurType::H)) {
-        cfaboxblur(riFlatFile->data, cfablur.get(), 0, 2 * BS, H, W);
-    } else if (raw.ff_BlurType == procparams::RAWParams::getFlatFieldBlurTypeString(procparams::RAWParams::FlatFieldBlurType::VH)) {
-        //slightly more complicated blur if trying to correct both vertical and horizontal anomalies
-        cfaboxblur(riFlatFile->data, cfablur.get(), BS, BS, H, W);    //first do area blur to correct vignette
-    } else { //(raw.ff_BlurType == RAWParams::getFlatFieldBlurTypeString(RAWParams::area_ff))
-        cfaboxblur(riFlatFile->data, cfablur.get(), BS, BS, H, W);
+        for (int row = 0; row < H; ++row) {
+            int col = 0;
+#ifdef __SSE2__
+            const vfloat rowBlackv = blackv[row & 1];
+
+            for (; col < W - 3; col += 4) {
+                const vfloat valv = LVFU(rawData[row][col]) - rowBlackv;
+                STVFU(rawData[row][col], valv * LVFU(gain[row * W + col]) + rowBlackv);
+            }
+
+#endif
+
+            for (; col < W; ++col) {
+                rawData[row][col] = (rawData[row][col] - black[c4[row & 1][col & 1]]) * gain[row * W + col] + black[c4[row & 1][col & 1]];
+            }
+        }
+
+        return;
     }
 
+    const int BS = getFlatFieldBlurSize(raw);
+    const FFManager::FlatFieldMap cfablurMap = getBlurredFlatField(raw, riFlatFile, H, W);
+    const float *const cfablur = cfablurMap->data();
+
     if (ri->getSensorType() == ST_BAYER || ri->get_colors() == 1) {
         float refcolor[2][2];
 
@@ -464,70 +624,54 @@ void RawImageSource::processFlatField(const procparams::RAWParams &raw, const Ra
         }
     }
 
-    if (raw.ff_BlurType == procparams::RAWParams::getFlatFieldBlurTypeString(procparams::RAWParams::FlatFieldBlurType::VH)) {
-        std::unique_ptr<float []> cfablur1(new float[H * W]);
-        std::unique_ptr<float []> cfablur2(new float[H * W]);
+    if (isVHBlur(raw)) {
         //slightly more complicated blur if trying to correct both vertical and horizontal anomalies
-        cfaboxblur(riFlatFile->data, cfablur1.get(), 0, 2 * BS, H, W); //now do horizontal blur
-        cfaboxblur(riFlatFile->data, cfablur2.get(), 2 * BS, 0, H, W); //now do vertical blur
+        unsigned int c4[2][2];
+        getBayerBlackIndices(c4);
+        const bool isXtrans = ri->getSensorType() == ST_FUJI_XTRANS;
 
-        if (ri->getSensorType() == ST_BAYER || ri->get_colors() == 1) {
-            unsigned int c[2][2] {};
-            unsigned int c4[2][2] {};
-            if (ri->get_colors() != 1) {
-                for (int i = 0; i < 2; ++i) {
-                    for (int j = 0; j < 2; ++j) {
-                        c[i][j] = FC(i, j);
-                    }
-                }
-                c4[0][0] = (c[0][0] == 1) ? 3 : c[0][0];
-                c4[0][1] = (c[0][1] == 1) ? 3 : c[0][1];
-                c4[1][0] = c[1][0];
-                c4[1][1] = c[1][1];
-            }
+        if (ri->getSensorType() == ST_BAYER || ri->get_colors() == 1 || isXtrans) {
+            const FFManager::FlatFieldMap linecorrMap = getLineCorrection(BS, riFlatFile, cfablur, black, [&](int row, int col) {
+                return isXtrans ? ri->XTRANSFC(row, col) : c4[row & 1][col & 1];
+            }, H, W);
+            const float *const linecorr = linecorrMap->data();
 
+            if (!isXtrans) {
 #ifdef __SSE2__
-            const vfloat blackv[2] = {_mm_set_ps(black[c4[0][1]], black[c4[0][0]], black[c4[0][1]], black[c4[0][0]]),
-                                      _mm_set_ps(black[c4[1][1]], black[c4[1][0]], black[c4[1][1]], black[c4[1][0]])
-                                     };
-
-            const vfloat epsv = F2V(1e-5f);
+                const vfloat blackv[2] = {_mm_set_ps(black[c4[0][1]], black[c4[0][0]], black[c4[0][1]], black[c4[0][0]]),
+                                          _mm_set_ps(black[c4[1][1]], black[c4[1][0]], black[c4[1][1]], black[c4[1][0]])
+                                         };
 #endif
 #ifdef _OPENMP
-            #pragma omp parallel for schedule(dynamic,16)
+                #pragma omp parallel for schedule(dynamic,16)
 #endif
 
-            for (int row = 0; row < H; ++row) {
-                int col = 0;
+                for (int row = 0; row < H; ++row) {
+                    int col = 0;
 #ifdef __SSE2__
-                const vfloat rowBlackv = blackv[row & 1];
+                    const vfloat rowBlackv = blackv[row & 1];
 
-                for (; col < W - 3; col += 4) {
-                    const vfloat linecorrv = SQRV(vmaxf(LVFU(cfablur[row * W + col]) - rowBlackv, epsv)) /
-                                             (vmaxf(LVFU(cfablur1[row * W + col]) - rowBlackv, epsv) * vmaxf(LVFU(cfablur2[row * W + col]) - rowBlackv, epsv));
-                    const vfloat valv = LVFU(rawData[row][col]) - rowBlackv;
-                    STVFU(rawData[row][col], valv * linecorrv + rowBlackv);
-                }
+                    for (; col < W - 3; col += 4) {
+                        const vfloat valv = LVFU(rawData[row][col]) - rowBlackv;
+                        STVFU(rawData[row][col], valv * LVFU(linecorr[row * W + col]) + rowBlackv);
+                    }
 
 #endif
 
-                for (; col < W; ++col) {
-                    const float linecorr = SQR(std::max(1e-5f, cfablur[row * W + col] - black[c4[row & 1][col & 1]])) /
-                                           (std::max(1e-5f, cfablur1[row * W + col] - black[c4[row & 1][col & 1]]) * std::max(1e-5f, cfablur2[row * W + col] - black[c4[row & 1][col & 1]]));
-                    rawData[row][col] = (rawData[row][col] - black[c4[row & 1][col & 1]]) * linecorr + black[c4[row & 1][col & 1]];
+                    for (; col < W; ++col) {
+                        rawData[row][col] = (rawData[row][col] - black[c4[row & 1][col & 1]]) * linecorr[row * W + col] + black[c4[row & 1][col & 1]];
+                    }
                 }
-            }
-        } else if (ri->getSensorType() == ST_FUJI_XTRANS) {
+            } else {
 #ifdef _OPENMP
-            #pragma omp parallel for
+                #pragma omp parallel for
 #endif
 
-            for (int row = 0; row < H; ++row) {
-                for (int col = 0; col < W; ++col) {
-                    const int c  = ri->XTRANSFC(row, col);
-                    const float hlinecorr = std::max(1e-5f, cfablur[(row) * W + col] - black[c]) / std::max(1e-5f, cfablur1[(row) * W + col] - black[c]);
-                    const float vlinecorr = std::max(1e-5f, cfablur[(row) * W + col] - black[c]) / std::max(1e-5f, cfablur2[(row) * W + col] - black[c]);
-                    rawData[row][col] = (rawData[row][col] - black[c]) * hlinecorr * vlinecorr + black[c];
+                for (int row = 0; row < H; ++row) {
+                    for (int col = 0; col < W; ++col) {
+                        const int c  = ri->XTRANSFC(row, col);
+                        rawData[row][col] = (rawData[row][col] - black[c]) * linecorr[row * W + col] + black[c];
+                    }
                 }
             }
         }
@@ -840,6 +840,55 @@ RawImage::is_ppmThumb() const
             !thumb_load_raw);
 }
 
+void RawImage::initSyntheticCFA(int w, int h, unsigned cfaFilters, const int xtransMatrix[6][6])
+{
+    strcpy(make, "RawTherapee");
+    strcpy(model, "Synthetic");
+    raw_width = w;
+    raw_height = h;
+    top_margin = left_margin = 0;
+    fuji_width = 0;
+    is_raw = 1;
+    is_foveon = 0;
+    colors = 3;
+    filters = prefilters = cfaFilters;
+    maximum = 65535;
+    memset(cblack, 0, sizeof(cblack));
+
+    for (int row = 0; row < 6; row++) {
+        for (int col = 0; col < 6; col++) {
+            xtrans[row][col] = xtransMatrix ? xtransMatrix[row][col] : 0;
+        }
+    }
+
+    for (int c = 0; c < 4; c++) {
+        cam_mul[c] = pre_mul[c] = 1.f;
+    }
+
+    for (int row = 0; row < 3; row++) {
+        for (int col = 0; col < 4; col++) {
+            rgb_cam[row][col] = row == col ? 1.f : 0.f;
+        }
+    }
+
+    allocateData(w, h, 1);
+}
+
+void RawImage::allocateData(int w, int h, int valuesPerPixel)
+{
+    width = iwidth = w;
+    height = iheight = h;
+
+    delete [] allocation;
+    delete [] data;
+    allocation = new float[static_cast<unsigned long>(h) * static_cast<unsigned long>(w) * valuesPerPixel]();
+    data = new float*[h];
+
+    for (int i = 0; i < h; i++) {
+        data[i] = allocation + static_cast<unsigned long>(i) * w * valuesPerPixel;
+    }
+}
+
 void RawImage::getXtransMatrix(int XtransMatrix[6][6])
 {
     for (int row = 0; row < 6; row++)
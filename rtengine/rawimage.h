@@ -37,6 +37,10 @@ public:
     ~RawImage();
 
     int loadRaw(bool loadData, unsigned int imageNum = 0, bool closeFile = true, ProgressListener *plistener = nullptr, double progressRange = 1.0);
+    // set up an empty mosaic of the given layout instead of loading a file (used by the demosaic benchmark)
+    void initSyntheticCFA(int w, int h, unsigned cfaFilters, const int xtransMatrix[6][6]);
+    // allocate pixel storage of the given size, for pixel data which does not come from loadRaw() (e.g. cached master frames)
+    void allocateData(int w, int h, int valuesPerPixel);
     void get_colorsCoeff(float* pre_mul_, float* scale_mul_, float* cblack_, bool forceAutoWB);
     void set_prefilters()
     {
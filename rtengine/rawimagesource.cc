@@ -45,6 +45,7 @@
 
 #define BENCHMARK
 #include "StopWatch.h"
+#include "trace.h"
 
 #ifdef _OPENMP
 #include <omp.h>
@@ -1060,6 +1061,7 @@ void RawImageSource::vflip (Imagefloat* image)
 
 int RawImageSource::load (const Glib::ustring &fname, bool firstFrameOnly)
 {
+    TRACEFUN;
 
     MyTime t1, t2;
     t1.set();
@@ -1321,19 +1323,6 @@ void RawImageSource::preprocess  (const RAWParams &raw, const LensProfParams &le
         printf("Subtracting Darkframe:%s\n", rid->get_filename().c_str());
     }
 
-    std::unique_ptr<PixelsMap> bitmapBads;
-
-    int totBP = 0; // Hold count of bad pixels to correct
-
-    if (ri->zeroIsBad()) { // mark all pixels with value zero as bad, has to be called before FF and DF. dcraw sets this flag only for some cameras (mainly Panasonic and Leica)
-        bitmapBads.reset(new PixelsMap(W, H));
-        totBP = findZeroPixels(*bitmapBads);
-
-        if (settings->verbose) {
-            printf("%d pixels with value zero marked as bad pixels\n", totBP);
-        }
-    }
-
     //FLATFIELD start
     RawImage *rif = nullptr;
 
@@ -1352,7 +1341,33 @@ void RawImageSource::preprocess  (const RAWParams &raw, const LensProfParams &le
         printf("Flat Field Correction:%s\n", rif->get_filename().c_str());
     }
 
-    if (numFrames == 4) {
+    // single frame bayer images are copied, dark frame and flat field corrected and scaled in one sweep
+    const bool fused = numFrames != 4 && !(numFrames == 2 && currFrame == 2) && canPreprocessFused(raw, rif);
+
+    std::unique_ptr<PixelsMap> bitmapBads;
+
+    int totBP = 0; // Hold count of bad pixels to correct
+
+    if (ri->zeroIsBad()) { // mark all pixels with value zero as bad, has to be called before FF and DF. dcraw sets this flag only for some cameras (mainly Panasonic and Leica)
+        bitmapBads.reset(new PixelsMap(W, H));
+
+        if (!fused) {
+            totBP = findZeroPixels(*bitmapBads);
+
+            if (settings->verbose) {
+                printf("%d pixels with value zero marked as bad pixels\n", totBP);
+            }
+        }
+    }
+
+    if (fused) {
+        const int nZero = preprocessFused(raw, rid, rif, ri->zeroIsBad() ? bitmapBads.get() : nullptr);
+        totBP += nZero;
+
+        if (settings->verbose && ri->zeroIsBad()) {
+            printf("%d pixels with value zero marked as bad pixels\n", nZero);
+        }
+    } else if (numFrames == 4) {
         int bufferNumber = 0;
         for (unsigned int i=0; i<4; ++i) {
             if (i==currFrame) {
@@ -1426,7 +1441,7 @@ void RawImageSource::preprocess  (const RAWParams &raw, const LensProfParams &le
         for (int i=0; i<4; ++i) {
             scaleColors(0, 0, W, H, raw, *rawDataFrames[i]);
         }
-    } else {
+    } else if (!fused) {
         scaleColors(0, 0, W, H, raw, rawData); //+ + raw parameters for black level(raw.blackxx)
     }
 
@@ -2553,48 +2568,152 @@ void RawImageSource::copyOriginalPixels(const RAWParams &raw, RawImage *src, Raw
     }
 }
 
-// Scale original pixels into the range 0 65535 using black offsets and multipliers
-void RawImageSource::scaleColors(int winx, int winy, int winw, int winh, const RAWParams &raw, array2D<float> &rawData)
+bool RawImageSource::canPreprocessFused(const RAWParams &raw, const RawImage *riFlatFile) const
+{
+    // auto clip control of the flat field needs the whole dark frame corrected image before the correction can be applied
+    return ri->getSensorType() == ST_BAYER && !(riFlatFile && W == riFlatFile->get_width() && H == riFlatFile->get_height() && raw.ff_AutoClipControl);
+}
+
+/* Single sweep replacement of findZeroPixels(), copyOriginalPixels() and scaleColors() for bayer images:
+ * zero pixel detection, dark frame subtraction, flat field correction and color scaling are done row by row
+ * while the pixels are in cache. Returns the number of zero pixels marked in zeroPixels (if not null).
+ */
+int RawImageSource::preprocessFused(const RAWParams &raw, RawImage *riDark, RawImage *riFlatFile, PixelsMap *zeroPixels)
 {
+//    BENCHFUN
+    const auto tmpfilters = ri->get_filters();
+    ri->set_filters(ri->prefilters); // we need 4 blacks for bayer processing
+    float black[4];
+    ri->get_colorsCoeff(nullptr, nullptr, black, false);
+    ri->set_filters(tmpfilters);
+
+    if (!rawData) {
+        rawData(W, H);
+    }
+
+    const bool useDark = riDark && W == riDark->get_width() && H == riDark->get_height();
+    FFManager::FlatFieldMap gainMap;
+
+    if (riFlatFile && W == riFlatFile->get_width() && H == riFlatFile->get_height()) {
+        gainMap = getFlatFieldGainMap(raw, riFlatFile, black);
+    }
+
+    const float *const gain = gainMap ? gainMap->data() : nullptr;
+
+    calculateScaleColors(raw);
     chmax[0] = chmax[1] = chmax[2] = chmax[3] = 0; //channel maxima
-    float black_lev[4] = {0.f};//black level
 
-    //adjust black level  (eg Canon)
-    bool isMono = false;
+    unsigned int c4[2][2];
+    getBayerBlackIndices(c4);
+    int zeroCount = 0;
 
-    if (getSensorType() == ST_BAYER || getSensorType() == ST_FOVEON) {
+#ifdef _OPENMP
+    #pragma omp parallel
+#endif
+    {
+        float tmpchmax[4] = {}; // four colors, combined below
+#ifdef __SSE2__
+        vfloat blackv[2], cblackv[2], scalev[2];
 
-        black_lev[0] = raw.bayersensor.black1; //R
-        black_lev[1] = raw.bayersensor.black0; //G1
-        black_lev[2] = raw.bayersensor.black2; //B
-        black_lev[3] = raw.bayersensor.black3; //G2
+        for (int i = 0; i < 2; ++i) {
+            blackv[i] = _mm_set_ps(black[c4[i][1]], black[c4[i][0]], black[c4[i][1]], black[c4[i][0]]);
+            cblackv[i] = _mm_set_ps(cblacksom[c4[i][1]], cblacksom[c4[i][0]], cblacksom[c4[i][1]], cblacksom[c4[i][0]]);
+            scalev[i] = _mm_set_ps(scale_mul[c4[i][1]], scale_mul[c4[i][0]], scale_mul[c4[i][1]], scale_mul[c4[i][0]]);
+        }
 
-        isMono = RAWParams::BayerSensor::getMethodString(RAWParams::BayerSensor::Method::MONO) == raw.bayersensor.method;
-    } else if (getSensorType() == ST_FUJI_XTRANS) {
+        vfloat chmaxv[2] = {ZEROV, ZEROV};
+#endif
+#ifdef _OPENMP
+        #pragma omp for reduction(+:zeroCount) schedule(dynamic,16) nowait
+#endif
 
-        black_lev[0] = raw.xtranssensor.blackred; //R
-        black_lev[1] = raw.xtranssensor.blackgreen; //G1
-        black_lev[2] = raw.xtranssensor.blackblue; //B
-        black_lev[3] = raw.xtranssensor.blackgreen; //G2  (set, only used with a Bayer filter)
+        for (int row = 0; row < H; ++row) {
+            const float *const src = ri->data[row];
+            const float *const dark = useDark ? riDark->data[row] : nullptr;
+            const float *const rowGain = gain ? gain + row * W : nullptr;
+            float *const dst = rawData[row];
+
+            if (zeroPixels) { // has to be done on the original data
+                for (int col = 0; col < W; ++col) {
+                    if (src[col] == 0.f) {
+                        zeroPixels->set(col, row);
+                        ++zeroCount;
+                    }
+                }
+            }
 
-        isMono = RAWParams::XTransSensor::getMethodString(RAWParams::XTransSensor::Method::MONO) == raw.xtranssensor.method;
-    }
+            int col = 0;
+#ifdef __SSE2__
+            const vfloat rowBlackv = blackv[row & 1];
+            const vfloat rowCblackv = cblackv[row & 1];
+            const vfloat rowScalev = scalev[row & 1];
+            vfloat rowChmaxv = chmaxv[row & 1];
 
-    for (int i = 0; i < 4 ; i++) {
-        cblacksom[i] = max(c_black[i] + black_lev[i], 0.0f);    // adjust black level
-    }
+            for (; col < W - 3; col += 4) {
+                vfloat valv = LVFU(src[col]);
 
-    for (int i = 0; i < 4; ++i) {
-        c_white[i] = (ri->get_white(i) - cblacksom[i]) / raw.expos + cblacksom[i];
-    }
+                if (dark) {
+                    valv = vmaxf(valv + rowBlackv - LVFU(dark[col]), ZEROV);
+                }
 
-    initialGain = calculate_scale_mul(scale_mul, ref_pre_mul, c_white, cblacksom, isMono, ri->get_colors()); // recalculate scale colors with adjusted levels
+                if (rowGain) {
+                    valv = (valv - rowBlackv) * LVFU(rowGain[col]) + rowBlackv;
+                }
 
-    //fprintf(stderr, "recalc: %f [%f %f %f %f]\n", initialGain, scale_mul[0], scale_mul[1], scale_mul[2], scale_mul[3]);
-    for (int i = 0; i < 4 ; i++) {
-        clmax[i] = (c_white[i] - cblacksom[i]) * scale_mul[i];    // raw clip level
+                valv = vmaxf(valv - rowCblackv, ZEROV) * rowScalev;
+                STVFU(dst[col], valv);
+                rowChmaxv = vmaxf(rowChmaxv, valv);
+            }
+
+            chmaxv[row & 1] = rowChmaxv;
+#endif
+
+            for (; col < W; ++col) {
+                const unsigned int c = c4[row & 1][col & 1];
+                float val = src[col];
+
+                if (dark) {
+                    val = max(val + black[c] - dark[col], 0.f);
+                }
+
+                if (rowGain) {
+                    val = (val - black[c]) * rowGain[col] + black[c];
+                }
+
+                val = max(0.f, val - cblacksom[c]) * scale_mul[c];
+                dst[col] = val;
+                tmpchmax[c] = max(tmpchmax[c], val);
+            }
+        }
+
+#ifdef __SSE2__
+        for (int i = 0; i < 2; ++i) {
+            float lanes[4];
+            STVFU(lanes[0], chmaxv[i]);
+            tmpchmax[c4[i][0]] = max(tmpchmax[c4[i][0]], lanes[0], lanes[2]);
+            tmpchmax[c4[i][1]] = max(tmpchmax[c4[i][1]], lanes[1], lanes[3]);
+        }
+#endif
+#ifdef _OPENMP
+        #pragma omp critical
+#endif
+        {
+            chmax[0] = max(tmpchmax[0], chmax[0]);
+            chmax[1] = max(tmpchmax[1], tmpchmax[3], chmax[1]);
+            chmax[2] = max(tmpchmax[2], chmax[2]);
+        }
     }
 
+    return zeroCount;
+}
+
+// Scale original pixels into the range 0 65535 using black offsets and multipliers
+void RawImageSource::scaleColors(int winx, int winy, int winw, int winh, const RAWParams &raw, array2D<float> &rawData)
+{
+    chmax[0] = chmax[1] = chmax[2] = chmax[3] = 0; //channel maxima
+
+    calculateScaleColors(raw);
+
     // this seems strange, but it works
 
     // scale image colors
@@ -2722,6 +2841,48 @@ void RawImageSource::scaleColors(int winx, int winy, int winw, int winh, const R
 
 }
 
+// Calculate black levels, white levels and multipliers used by scaleColors()
+void RawImageSource::calculateScaleColors(const RAWParams &raw)
+{
+    float black_lev[4] = {0.f};//black level
+
+    //adjust black level  (eg Canon)
+    bool isMono = false;
+
+    if (getSensorType() == ST_BAYER || getSensorType() == ST_FOVEON) {
+
+        black_lev[0] = raw.bayersensor.black1; //R
+        black_lev[1] = raw.bayersensor.black0; //G1
+        black_lev[2] = raw.bayersensor.black2; //B
+        black_lev[3] = raw.bayersensor.black3; //G2
+
+        isMono = RAWParams::BayerSensor::getMethodString(RAWParams::BayerSensor::Method::MONO) == raw.bayersensor.method;
+    } else if (getSensorType() == ST_FUJI_XTRANS) {
+
+        black_lev[0] = raw.xtranssensor.blackred; //R
+        black_lev[1] = raw.xtranssensor.blackgreen; //G1
+        black_lev[2] = raw.xtranssensor.blackblue; //B
+        black_lev[3] = raw.xtranssensor.blackgreen; //G2  (set, only used with a Bayer filter)
+
+        isMono = RAWParams::XTransSensor::getMethodString(RAWParams::XTransSensor::Method::MONO) == raw.xtranssensor.method;
+    }
+
+    for (int i = 0; i < 4 ; i++) {
+        cblacksom[i] = max(c_black[i] + black_lev[i], 0.0f);    // adjust black level
+    }
+
+    for (int i = 0; i < 4; ++i) {
+        c_white[i] = (ri->get_white(i) - cblacksom[i]) / raw.expos + cblacksom[i];
+    }
+
+    initialGain = calculate_scale_mul(scale_mul, ref_pre_mul, c_white, cblacksom, isMono, ri->get_colors()); // recalculate scale colors with adjusted levels
+
+    //fprintf(stderr, "recalc: %f [%f %f %f %f]\n", initialGain, scale_mul[0], scale_mul[1], scale_mul[2], scale_mul[3]);
+    for (int i = 0; i < 4 ; i++) {
+        clmax[i] = (c_white[i] - cblacksom[i]) * scale_mul[i];    // raw clip level
+    }
+}
+
 //%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 
 int RawImageSource::defTransform (int tran)
@@ -19,11 +19,13 @@
 #pragma once
 
 #include <array>
+#include <cstdint>
 #include <iostream>
 #include <memory>
 
 #include "array2D.h"
 #include "colortemp.h"
+#include "ffmanager.h"
 #include "iimage.h"
 #include "imagesource.h"
 #include "procparams.h"
@@ -32,6 +34,7 @@
 
 namespace rtengine
 {
+class DemosaicBenchmark;
 class PixelsMap;
 class RawImage;
 class DiagonalCurve;
@@ -40,6 +43,8 @@ class RetinexgaintransmissionCurve;
 
 class RawImageSource final : public ImageSource
 {
+    friend class DemosaicBenchmark;
+
 private:
     static DiagonalCurve *phaseOneIccCurve;
     static DiagonalCurve *phaseOneIccCurveInv;
@@ -104,6 +109,18 @@ protected:
     float psGreenBrightness[4];
     float psBlueBrightness[4];
 
+    // fits of the auto CA correction iterations, see CA_correct_RT()
+    struct CAFitCache {
+        struct Fit {
+            int polyord;
+            double params[2][2][16];
+        };
+        uint64_t inputHash = 0; ///< checksum of the raw data the fits were calculated from
+        bool avoidColourshift = false;
+        bool failed = false; ///< the fit of the iteration after the cached ones failed
+        std::vector<Fit> fits;
+    } caFitCache;
+
     std::vector<double> histMatchingCache;
     const std::unique_ptr<procparams::ColorManagementParams> histMatchingParams;
 
@@ -138,8 +155,13 @@ public:
     }
 
     void        processFlatField(const procparams::RAWParams &raw, const RawImage *riFlatFile, array2D<float> &rawData, const float black[4]);
+    FFManager::FlatFieldMap getFlatFieldGainMap(const procparams::RAWParams &raw, const RawImage *riFlatFile, const float black[4]);
+    void        getBayerBlackIndices(unsigned int c4[2][2]) const;
     void        copyOriginalPixels(const procparams::RAWParams &raw, RawImage *ri, RawImage *riDark, RawImage *riFlatFile, array2D<float> &rawData  );
+    bool        canPreprocessFused(const procparams::RAWParams &raw, const RawImage *riFlatFile) const;
+    int         preprocessFused(const procparams::RAWParams &raw, RawImage *riDark, RawImage *riFlatFile, PixelsMap *zeroPixels);
     void        scaleColors (int winx, int winy, int winw, int winh, const procparams::RAWParams &raw, array2D<float> &rawData); // raw for cblack
+    void        calculateScaleColors(const procparams::RAWParams &raw);
     void        WBauto(double &tempref, double &greenref, array2D<float> &redloc, array2D<float> &greenloc, array2D<float> &blueloc, int bfw, int bfh, double &avg_rm, double &avg_gm, double &avg_bm, double &tempitc, double &greenitc, float &studgood, bool &twotimes, const procparams::WBParams & wbpar, int begx, int begy, int yEn, int xEn, int cx, int cy, const procparams::ColorManagementParams &cmp, const procparams::RAWParams &raw) override;
     void        getAutoWBMultipliersitc(double &tempref, double &greenref, double &tempitc, double &greenitc, float &studgood, int begx, int begy, int yEn, int xEn, int cx, int cy, int bf_h, int bf_w, double &rm, double &gm, double &bm, const procparams::WBParams & wbpar, const procparams::ColorManagementParams &cmp, const procparams::RAWParams &raw) override;
     void        getrgbloc(int begx, int begy, int yEn, int xEn, int cx, int cy, int bf_h, int bf_w) override;
@@ -303,7 +325,7 @@ protected:
     void    hflip       (Imagefloat* im);
     void    vflip       (Imagefloat* im);
     void getRawValues(int x, int y, int rotate, int &R, int &G, int &B) override;
-    void captureSharpening(const procparams::CaptureSharpeningParams &sharpeningParams, bool showMask, double &conrastThreshold, double &radius) override;
+    void captureSharpening(const procparams::CaptureSharpeningParams &sharpeningParams, bool showMask, double &conrastThreshold, double &radius, const CancelToken *cancelToken) override;
 };
 
 }
@@ -665,6 +665,14 @@ public:
     * @param initialImage is a loaded and pre-processed initial image
     * @return the staged image processing manager */
     static StagedImageProcessor* create (InitialImage* initialImage);
+    /** Returns a staged image processing manager for a second set of parameters of the image of another one, e.g. for
+    * the "before" view. It shares the image source, its raw stages and the cached upstream stages of 'main', and only
+    * renders the stages following them. It has to be destroyed before 'main'.
+    * @param main is the processing manager owning the image source
+    * @return the staged image processing manager */
+    static StagedImageProcessor* createShared (StagedImageProcessor* main);
+    /** Returns true if the raw stages of both parameter sets produce the same data, see createShared() */
+    static bool canShareSource (const procparams::ProcParams& a, const procparams::ProcParams& b);
     static void destroy (StagedImageProcessor* sip);
 };
 
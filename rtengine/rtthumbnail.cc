@@ -46,6 +46,7 @@
 #include "settings.h"
 #include "stdimagesource.h"
 #include "StopWatch.h"
+#include "trace.h"
 #include "utils.h"
 
 namespace
@@ -196,6 +197,7 @@ using namespace procparams;
 
 Thumbnail* Thumbnail::loadFromImage (const Glib::ustring& fname, int &w, int &h, int fixwh, double wbEq, bool inspectorMode)
 {
+    TRACEFUN;
 
     StdImageSource imgSrc;
 
@@ -381,6 +383,7 @@ Image8 *load_inspector_mode(const Glib::ustring &fname, RawMetaDataLocation &rml
 
 Thumbnail* Thumbnail::loadQuickFromRaw (const Glib::ustring& fname, RawMetaDataLocation& rml, eSensorType &sensorType, int &w, int &h, int fixwh, bool rotate, bool inspectorMode, bool forHistogramMatching)
 {
+    TRACEFUN;
     Thumbnail* tpp = new Thumbnail ();
     tpp->isRaw = 1;
     memset (tpp->colorMatrix, 0, sizeof (tpp->colorMatrix));
@@ -545,6 +548,7 @@ RawMetaDataLocation Thumbnail::loadMetaDataFromRaw (const Glib::ustring& fname)
 
 Thumbnail* Thumbnail::loadFromRaw (const Glib::ustring& fname, RawMetaDataLocation& rml, eSensorType &sensorType, int &w, int &h, int fixwh, double wbEq, bool rotate, bool forHistogramMatching)
 {
+    TRACEFUN;
     RawImage *ri = new RawImage (fname);
     unsigned int tempImageNum = 0;
 
@@ -1107,6 +1111,7 @@ IImage8* Thumbnail::quickProcessImage (const procparams::ProcParams& params, int
 // Full thumbnail processing, second stage if complete profile exists
 IImage8* Thumbnail::processImage (const procparams::ProcParams& params, eSensorType sensorType, int rheight, TypeInterpolation interp, const FramesMetaData *metadata, double& myscale, bool forMonitor, bool forHistogramMatching)
 {
+    TRACEFUN;
     unsigned int imgNum = 0;
     if (isRaw) {
         if (sensorType == ST_BAYER) {
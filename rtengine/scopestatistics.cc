@@ -0,0 +1,272 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "scopestatistics.h"
+
+#include "color.h"
+#include "image8.h"
+#include "labimage.h"
+#include "LUT.h"
+#include "opthelper.h"
+#include "rt_math.h"
+#include "sleef.h"
+
+namespace
+{
+
+// width of the column stripes processed by one thread at a time
+constexpr int STRIPE_WIDTH = 32;
+
+// Sums up the per thread accumulators. Has to be called by all threads of the parallel region, each one sums up a range of bins.
+template<typename T, typename F>
+void sumUp(const std::vector<T> &accumulators, size_t length, int numThreads, const F &store)
+{
+#ifdef _OPENMP
+    #pragma omp for nowait
+#endif
+    for (size_t k = 0; k < length; ++k) {
+        T sum = 0;
+
+        for (int t = 0; t < numThreads; ++t) {
+            sum += accumulators[t * length + k];
+        }
+
+        store(k, sum);
+    }
+}
+
+}
+
+namespace rtengine
+{
+
+ScopeStatistics::ScopeStatistics(const Image8 &rgb, const LabImage &lab, int x1, int y1, int x2, int y2) :
+    rgb(rgb),
+    lab(lab),
+    x1(x1),
+    y1(y1),
+    x2(x2),
+    y2(y2),
+    hist{},
+    vectorscopeHC(nullptr),
+    hcA(nullptr),
+    hcB(nullptr),
+    vectorscopeHS(nullptr),
+    waveform{}
+{
+}
+
+void ScopeStatistics::requestHistograms(LUTu &red, LUTu &green, LUTu &blue, LUTu &luma, LUTu &chroma)
+{
+    hist[0] = &red;
+    hist[1] = &green;
+    hist[2] = &blue;
+    hist[3] = &luma;
+    hist[4] = &chroma;
+}
+
+void ScopeStatistics::requestVectorscopeHC(array2D<int> &scope, const float *a, const float *b)
+{
+    vectorscopeHC = &scope;
+    hcA = a;
+    hcB = b;
+}
+
+void ScopeStatistics::requestVectorscopeHS(array2D<int> &scope)
+{
+    vectorscopeHS = &scope;
+}
+
+void ScopeStatistics::requestWaveforms(array2D<int> &red, array2D<int> &green, array2D<int> &blue, array2D<int> &luma)
+{
+    waveform[0] = &red;
+    waveform[1] = &green;
+    waveform[2] = &blue;
+    waveform[3] = &luma;
+}
+
+void ScopeStatistics::compute() const
+{
+    if (x2 <= x1 || y2 <= y1) {
+        return;
+    }
+
+#ifdef _OPENMP
+    const int numThreads = omp_get_max_threads();
+#else
+    const int numThreads = 1;
+#endif
+
+    // per thread accumulators, the waveforms don't need any as every column belongs to one stripe
+    const size_t histBins = hist[0] ? 256 : 0;
+    const size_t histLength = 5 * histBins;
+    const size_t hcLength = vectorscopeHC ? SQR<size_t>(vectorscopeHC->getWidth()) : 0;
+    const size_t hsLength = vectorscopeHS ? SQR<size_t>(vectorscopeHS->getWidth()) : 0;
+    std::vector<uint32_t> histThr(numThreads * histLength);
+    std::vector<int> hcThr(numThreads * hcLength);
+    std::vector<int> hsThr(numThreads * hsLength);
+
+    if (waveform[0]) {
+        for (auto wf : waveform) {
+            wf->fill(0);
+        }
+    }
+
+#ifdef _OPENMP
+    #pragma omp parallel num_threads(numThreads)
+#endif
+    {
+#ifdef _OPENMP
+        const int thread = omp_get_thread_num();
+#else
+        const int thread = 0;
+#endif
+
+#ifdef _OPENMP
+        #pragma omp for schedule(dynamic)
+#endif
+        for (int x = x1; x < x2; x += STRIPE_WIDTH) {
+            processStripe(x, std::min(x + STRIPE_WIDTH, x2), histThr.data() + thread * histLength, hcThr.data() + thread * hcLength, hsThr.data() + thread * hsLength);
+        }
+
+        sumUp(histThr, histLength, numThreads, [this, histBins](size_t k, uint32_t sum) {
+            (*hist[k / histBins])[k % histBins] = sum;
+        });
+
+        if (vectorscopeHC) {
+            int *const data = *vectorscopeHC;
+            sumUp(hcThr, hcLength, numThreads, [data](size_t k, int sum) {
+                data[k] = sum;
+            });
+        }
+
+        if (vectorscopeHS) {
+            int *const data = *vectorscopeHS;
+            sumUp(hsThr, hsLength, numThreads, [data](size_t k, int sum) {
+                data[k] = sum;
+            });
+        }
+    }
+}
+
+void ScopeStatistics::processStripe(int x1Stripe, int x2Stripe, uint32_t *histThr, int *hcThr, int *hsThr) const
+{
+    const int width = rgb.getWidth();
+    const int areaWidth = x2 - x1;
+
+    const int hcSize = vectorscopeHC ? vectorscopeHC->getWidth() : 0;
+    const float hcNorm = hcSize / (128.f * 655.36f);
+    const int hsSize = vectorscopeHS ? vectorscopeHS->getWidth() : 0;
+
+    int **const waveR = waveform[0] ? static_cast<int**>(*waveform[0]) : nullptr;
+    int **const waveG = waveform[0] ? static_cast<int**>(*waveform[1]) : nullptr;
+    int **const waveB = waveform[0] ? static_cast<int**>(*waveform[2]) : nullptr;
+    int **const waveL = waveform[0] ? static_cast<int**>(*waveform[3]) : nullptr;
+    constexpr float lumaFactor = 255.f / 32768.f;
+
+    // H-S vectorscope coordinates of the current row of the stripe, the costly part of the scopes
+    int hsCol[STRIPE_WIDTH];
+    int hsRow[STRIPE_WIDTH];
+
+    for (int i = y1; i < y2; ++i) {
+        const unsigned char *const rgbRow = rgb.data + 3 * i * width;
+
+        if (vectorscopeHS) {
+            int j = x1Stripe;
+#ifdef __SSE2__
+            const vfloat c257v = F2V(257.f);
+            const vfloat twoPiv = F2V(2.f * RT_PI_F);
+            const vfloat halfSizev = F2V(hsSize / 2);
+
+            for (; j < x2Stripe - 3; j += 4) {
+                const unsigned char *const p = rgbRow + 3 * j;
+                const vfloat redv = c257v * _mm_setr_ps(p[0], p[3], p[6], p[9]);
+                const vfloat greenv = c257v * _mm_setr_ps(p[1], p[4], p[7], p[10]);
+                const vfloat bluev = c257v * _mm_setr_ps(p[2], p[5], p[8], p[11]);
+                vfloat hv, sv, lv;
+                Color::rgb2hsl(redv, greenv, bluev, hv, sv, lv);
+                const vfloat2 sincosv = xsincosf(twoPiv * hv);
+                _mm_storeu_si128(reinterpret_cast<vint*>(&hsCol[j - x1Stripe]), _mm_cvttps_epi32(sv * sincosv.y * halfSizev + halfSizev));
+                _mm_storeu_si128(reinterpret_cast<vint*>(&hsRow[j - x1Stripe]), _mm_cvttps_epi32(sv * sincosv.x * halfSizev + halfSizev));
+            }
+
+#endif
+
+            for (; j < x2Stripe; ++j) {
+                const unsigned char *const p = rgbRow + 3 * j;
+                float h, s, l;
+                Color::rgb2hslfloat(257.f * p[0], 257.f * p[1], 257.f * p[2], h, s, l);
+                const auto sincosval = xsincosf(2.f * RT_PI_F * h);
+                hsCol[j - x1Stripe] = s * sincosval.y * (hsSize / 2) + hsSize / 2;
+                hsRow[j - x1Stripe] = s * sincosval.x * (hsSize / 2) + hsSize / 2;
+            }
+        }
+
+        const float *const L = lab.L[i];
+        const float *const a = lab.a[i];
+        const float *const b = lab.b[i];
+        const int hcOffset = (i - y1) * areaWidth - x1;
+
+        for (int j = x1Stripe; j < x2Stripe; ++j) {
+            const int red = rgbRow[3 * j];
+            const int green = rgbRow[3 * j + 1];
+            const int blue = rgbRow[3 * j + 2];
+
+            if (hist[0]) {
+                histThr[red]++;
+                histThr[256 + green]++;
+                histThr[2 * 256 + blue]++;
+                histThr[3 * 256 + LIM<int>(L[j] / 128.f, 0, 255)]++;
+                histThr[4 * 256 + LIM<int>(std::sqrt(SQR(a[j]) + SQR(b[j])) / 188.f, 0, 255)]++; //188 = 48000/256
+            }
+
+            if (vectorscopeHC) {
+                const int col = hcNorm * hcA[hcOffset + j] + hcSize / 2 + 0.5f;
+                const int row = hcNorm * hcB[hcOffset + j] + hcSize / 2 + 0.5f;
+
+                if (col >= 0 && col < hcSize && row >= 0 && row < hcSize) {
+                    hcThr[row * hcSize + col]++;
+                }
+            }
+
+            if (vectorscopeHS) {
+                const int col = hsCol[j - x1Stripe];
+                const int row = hsRow[j - x1Stripe];
+
+                if (col >= 0 && col < hsSize && row >= 0 && row < hsSize) {
+                    hsThr[row * hsSize + col]++;
+                }
+            }
+
+            if (waveR) {
+                waveR[red][j - x1]++;
+                waveG[green][j - x1]++;
+                waveB[blue][j - x1]++;
+                waveL[LIM<int>(L[j] * lumaFactor, 0, 255)][j - x1]++;
+            }
+        }
+    }
+}
+
+}
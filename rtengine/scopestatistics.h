@@ -0,0 +1,73 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <cstdint>
+
+#include "array2D.h"
+#include "noncopyable.h"
+
+template<typename T>
+class LUT;
+
+using LUTu = LUT<uint32_t>;
+
+namespace rtengine
+{
+
+class Image8;
+class LabImage;
+
+/**
+ * Computes the histograms, vectorscopes and waveforms of the preview in a single pass.
+ *
+ * The scopes to compute are requested first, compute() then walks the image once. The image is
+ * split into column stripes, so every waveform column is owned by one thread. The histograms and
+ * vectorscopes are accumulated per thread and summed up at the end, without any lock.
+ */
+class ScopeStatistics final :
+    public NonCopyable
+{
+public:
+    /// Analyses the area [x1, x2[ x [y1, y2[ of the preview in output space ('rgb') and in working space ('lab')
+    ScopeStatistics(const Image8 &rgb, const LabImage &lab, int x1, int y1, int x2, int y2);
+
+    void requestHistograms(LUTu &red, LUTu &green, LUTu &blue, LUTu &luma, LUTu &chroma);
+    /// 'a' and 'b' hold the Lab values of the area in output space, row by row
+    void requestVectorscopeHC(array2D<int> &scope, const float *a, const float *b);
+    void requestVectorscopeHS(array2D<int> &scope);
+    /// The waveforms have to be sized x2 - x1 by 256 already
+    void requestWaveforms(array2D<int> &red, array2D<int> &green, array2D<int> &blue, array2D<int> &luma);
+
+    void compute() const;
+
+private:
+    void processStripe(int x1Stripe, int x2Stripe, uint32_t *hist, int *hc, int *hs) const;
+
+    const Image8 &rgb;
+    const LabImage &lab;
+    const int x1, y1, x2, y2;
+
+    LUTu *hist[5]; // red, green, blue, luma, chroma
+    array2D<int> *vectorscopeHC;
+    const float *hcA;
+    const float *hcB;
+    array2D<int> *vectorscopeHS;
+    array2D<int> *waveform[4]; // red, green, blue, luma
+};
+
+}
@@ -82,6 +82,8 @@ public:
     //  bool            bw_complementary;
     double          level0_cbdl;
     double          level123_cbdl;
+    Glib::ustring   traceFile;              // Chrome trace JSON of the engine activity written at exit, empty = no tracing
+    Glib::ustring   fftwWisdomFile;         // FFTW wisdom read at startup and written at exit, empty = not kept
     Glib::ustring   lensfunDbDirectory; // The directory containing the lensfun database. If empty, the system defaults will be used, as described in https://lensfun.github.io/manual/latest/dbsearch.html
     int             cropsleep;
     double          reduchigh;
@@ -114,6 +116,22 @@ public:
     };
     ThumbnailInspectorMode thumbnail_inspector_mode;
 
+    enum class FattalSolver {
+        FFT,                // exact, full size transforms
+        MULTIGRID_PREVIEW,  // multigrid for the editor, FFT for the saved images
+        MULTIGRID           // multigrid everywhere
+    };
+    // Poisson solver of the dynamic range compression. With MULTIGRID_PREVIEW, the preview and the detail windows
+    // don't match the saved image exactly, the solutions of both solvers differ by up to about 0.1% in luminance
+    // (see rawtherapee-poisson-benchmark, built with WITH_POISSON_BENCHMARK)
+    FattalSolver fattal_solver;
+
+    enum class EPDSolver {
+        INCOMPLETE_CHOLESKY,    // preconditioner of the conjugate gradient, sequential
+        MULTIGRID               // preconditioner of the conjugate gradient, parallel
+    };
+    EPDSolver epd_solver; // linear solver of the edge preserving decompositions
+
     /** Creates a new instance of Settings.
       * @return a pointer to the new Settings instance. */
     static Settings* create();
@@ -20,6 +20,7 @@
 #include <glibmm/thread.h>
 #include <glibmm/ustring.h>
 
+#include "bufferpool.h"
 #include "cieimage.h"
 #include "clutstore.h"
 #include "color.h"
@@ -37,6 +38,7 @@
 #include "procparams.h"
 #include "rawimagesource.h"
 #include "rtengine.h"
+#include "trace.h"
 #include "utils.h"
 
 #include "../rtgui/multilangmgr.h"
@@ -148,6 +150,7 @@ private:
 
     bool stage_init()
     {
+        TRACEFUN;
         errorCode = 0;
 
         if (pl) {
@@ -232,7 +235,7 @@ private:
 
         imgsrc->demosaic (params.raw, autoContrast, contrastThreshold, params.pdsharpening.enabled && pl);
         if (params.pdsharpening.enabled) {
-            imgsrc->captureSharpening(params.pdsharpening, false, params.pdsharpening.contrast, params.pdsharpening.deconvradius);
+            imgsrc->captureSharpening(params.pdsharpening, false, params.pdsharpening.contrast, params.pdsharpening.deconvradius, nullptr);
         }
 
 
@@ -813,6 +816,7 @@ private:
 
     void stage_denoise()
     {
+        TRACEFUN;
         const procparams::ProcParams& params = job->pparams;
 
         DirPyrDenoiseParams denoiseParams = params.dirpyrDenoise;   // make a copy because we cheat here
@@ -868,6 +872,7 @@ private:
 
     void stage_transform()
     {
+        TRACEFUN;
         const procparams::ProcParams& params = job->pparams;
         //ImProcFunctions ipf (&params, true);
         ImProcFunctions &ipf = * (ipf_p.get());
@@ -920,6 +925,7 @@ private:
 
     Imagefloat *stage_finish()
     {
+        TRACEFUN;
         procparams::ProcParams& params = job->pparams;
         //ImProcFunctions ipf (&params, true);
         ImProcFunctions &ipf = * (ipf_p.get());
@@ -1888,6 +1894,7 @@ private:
 
     void stage_early_resize()
     {
+        TRACEFUN;
         procparams::ProcParams& params = job->pparams;
         //ImProcFunctions ipf (&params, true);
         ImProcFunctions &ipf = * (ipf_p.get());
@@ -2098,12 +2105,15 @@ private:
 
 IImagefloat* processImage(ProcessingJob* pjob, int& errorCode, ProgressListener* pl, bool flush)
 {
+    BufferPool::Scope bufferScope;
+    TRACE_SCOPE("processImage", "pipeline");
     ImageProcessor proc(pjob, errorCode, pl, flush);
     return proc();
 }
 
 void batchProcessingThread(ProcessingJob* job, BatchProcessingListener* bpl)
 {
+    trace::setThreadName("batch");
 
     ProcessingJob* currentJob = job;
 
@@ -0,0 +1,99 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "taskgraph.h"
+#include "trace.h"
+
+namespace rtengine
+{
+
+TaskGraph::TaskGraph() = default;
+
+TaskGraph::~TaskGraph()
+{
+    for (auto &node : nodes) {
+        if (node->thread.joinable()) {
+            node->thread.join();
+        }
+    }
+}
+
+TaskGraph::TaskId TaskGraph::add(std::function<void()> task, const std::vector<TaskId> &dependencies)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    const TaskId id = nodes.size();
+    nodes.emplace_back(new Node);
+    Node *const node = nodes.back().get();
+
+    node->thread = std::thread(
+        [this, node, task, dependencies]()
+        {
+            std::exception_ptr exception;
+
+            try {
+                for (const TaskId dependency : dependencies) {
+                    waitFor(dependency);
+                }
+
+                trace::setThreadName("TaskGraph");
+                TRACE_SCOPE("task", "task");
+                task();
+            } catch (...) {
+                exception = std::current_exception();
+            }
+
+            std::lock_guard<std::mutex> finishedLock(mutex);
+            node->exception = exception;
+            node->finished = true;
+            finishedCondition.notify_all();
+        }
+    );
+
+    return id;
+}
+
+void TaskGraph::join(TaskId id)
+{
+    waitFor(id);
+
+    std::exception_ptr exception;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Node &node = *nodes[id];
+
+        if (node.joined) {
+            return;
+        }
+
+        node.joined = true;
+        exception = node.exception;
+    }
+
+    if (exception) {
+        std::rethrow_exception(exception);
+    }
+}
+
+void TaskGraph::waitFor(TaskId id)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    const Node &node = *nodes[id];
+    finishedCondition.wait(lock, [&node]() { return node.finished; });
+}
+
+}
@@ -0,0 +1,68 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "noncopyable.h"
+
+namespace rtengine
+{
+
+/**
+ * Runs independent analyses concurrently with the thread building the graph.
+ *
+ * A task starts as soon as the tasks it depends on are finished. The owner calls join() right
+ * before it consumes the results of a task; an exception thrown by the task is rethrown there.
+ * The destructor waits for all tasks, so the results may safely live next to the graph.
+ */
+class TaskGraph final :
+    public NonCopyable
+{
+public:
+    using TaskId = size_t;
+
+    TaskGraph();
+    ~TaskGraph();
+
+    TaskId add(std::function<void()> task, const std::vector<TaskId> &dependencies = {});
+
+    // Waits for the task and rethrows its exception, if any. Does nothing if the task was joined already.
+    void join(TaskId id);
+
+private:
+    struct Node {
+        std::thread thread;
+        std::exception_ptr exception;
+        bool finished = false;
+        bool joined = false;
+    };
+
+    void waitFor(TaskId id);
+
+    std::vector<std::unique_ptr<Node>> nodes;
+    std::mutex mutex;
+    std::condition_variable finishedCondition;
+};
+
+}
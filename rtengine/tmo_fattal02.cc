@@ -59,6 +59,7 @@
 #include <iostream>
 #include <iterator>
 #include <limits>
+#include <memory>
 #include <vector>
 
 #include <assert.h>
@@ -66,7 +67,9 @@
 #include <math.h>
 
 #include "array2D.h"
+#include "canceltoken.h"
 #include "color.h"
+#include "fftwplans.h"
 #include "iccstore.h"
 #include "imagefloat.h"
 #include "improcfun.h"
@@ -77,6 +80,12 @@
 #include "settings.h"
 #include "sleef.h"
 #include "StopWatch.h"
+#include "trace.h"
+
+#ifdef POISSON_BENCHMARK
+#include "mytime.h"
+#include "poissonbenchmark.h"
+#endif
 
 namespace rtengine
 {
@@ -85,8 +94,6 @@ namespace rtengine
  * RT code
  ******************************************************************************/
 
-extern MyMutex *fftwMutex;
-
 using namespace std;
 
 namespace
@@ -417,6 +424,7 @@ void calculateFiMatrix(Array2Df* FI, Array2Df* gradients[],
 }
 
 void solve_pde_fft(Array2Df *F, Array2Df *U, Array2Df *buf, bool multithread, int algo);
+void solve_pde_multigrid(Array2Df *F, Array2Df *U, bool multithread, int algo);
 
 void tmo_fattal02(size_t width,
                   size_t height,
@@ -426,7 +434,9 @@ void tmo_fattal02(size_t width,
                   float beta,
                   float noise,
                   int detail_level,
-                  bool multithread, int algo)
+                  bool multithread, int algo,
+                  bool multigrid, // RT -- width - 1 and height - 1 have to suit solve_pde_multigrid(), see find_multigrid_dim()
+                  const CancelToken *cancelToken)
 {
 // #ifdef TIMER_PROFILING
 //     msec_timer stop_watch;
@@ -516,6 +526,11 @@ void tmo_fattal02(size_t width,
         }
     }
 
+    if (cancelToken && cancelToken->isRequested()) {
+        delete H;
+        return;
+    }
+
     /** RT - this is also here to reduce the dependency of the results on the
      * input image size, with the primary aim of having a preview in RT that is
      * reasonably close to the actual output image. Intuitively, what we do is
@@ -652,12 +667,21 @@ void tmo_fattal02(size_t width,
 
     //delete Gx; // RT - reused as temp buffer in solve_pde_fft, deleted later
 
+    if (cancelToken && cancelToken->isRequested()) {
+        delete Gx;
+        delete FI;
+        return;
+    }
+
     // solve pde and exponentiate (ie recover compressed image)
-    {
-        MyMutex::MyLock lock(*fftwMutex);
+    if (multigrid) { // RT
+        delete Gx;
+        solve_pde_multigrid(FI, &L, multithread, algo);
+    } else {
         solve_pde_fft(FI, &L, Gx, multithread, algo);
+        delete Gx;
     }
-    delete Gx;
+
     delete FI;
 
 #ifdef _OPENMP
@@ -728,9 +752,8 @@ void tmo_fattal02(size_t width,
 // - our system: assume U(-1)=U(1) --> this becomes
 //        i=0: U(1) - 2(0) + U(1) = -2 U(0) + 2 U(1)
 //
-// The multi grid solver solve_pde_multigrid() solves the 2d Poisson pde
-// with the right Neumann boundary conditions, U(-1)=U(0), see function
-// atimes(). This means the assembly of the right hand side F is different
+// RT -- The multigrid solver solve_pde_multigrid() below solves the same
+// system, U(-1)=U(1), so the right hand side F is assembled the same way
 // for both solvers.
 
 
@@ -773,11 +796,8 @@ void transform_ev2normal(Array2Df *A, Array2Df *T, bool multithread)
     // fftwf_free(in);
 
     // executes 2d discrete cosine transform
-    fftwf_plan p;
-    p = fftwf_plan_r2r_2d(height, width, A->data(), T->data(),
-                          FFTW_REDFT00, FFTW_REDFT00, FFTW_ESTIMATE);
-    fftwf_execute(p);
-    fftwf_destroy_plan(p);
+    const fftw::Plan p = fftw::planR2r2d(height, width, FFTW_REDFT00, FFTW_ESTIMATE, A->data(), T->data(), multithread);
+    fftwf_execute_r2r(p.get(), A->data(), T->data());
 }
 
 
@@ -789,11 +809,8 @@ void transform_normal2ev(Array2Df *A, Array2Df *T, bool multithread)
     assert((int)T->getCols() == width && (int)T->getRows() == height);
 
     // executes 2d discrete cosine transform
-    fftwf_plan p;
-    p = fftwf_plan_r2r_2d(height, width, A->data(), T->data(),
-                          FFTW_REDFT00, FFTW_REDFT00, FFTW_ESTIMATE);
-    fftwf_execute(p);
-    fftwf_destroy_plan(p);
+    const fftw::Plan p = fftw::planR2r2d(height, width, FFTW_REDFT00, FFTW_ESTIMATE, A->data(), T->data(), multithread);
+    fftwf_execute_r2r(p.get(), A->data(), T->data());
 
     // need to scale the output matrix to get the right transform
     float factor = (1.0f / ((height - 1) * (width - 1)));
@@ -868,6 +885,28 @@ std::vector<double> get_lambda(int n)
 
 
 
+// RT -- shifts U so that its maximum is 0
+void remove_max(Array2Df *U, bool multithread)
+{
+    const int size = U->getCols() * U->getRows();
+    float maxVal = 0.f;
+#ifdef _OPENMP
+    #pragma omp parallel for reduction(max:maxVal) if(multithread)
+#endif
+
+    for (int i = 0; i < size; i++) {
+        maxVal = std::max(maxVal, (*U)(i));
+    }
+
+#ifdef _OPENMP
+    #pragma omp parallel for if(multithread)
+#endif
+
+    for (int i = 0; i < size; i++) {
+        (*U)(i) -= maxVal;
+    }
+}
+
 // solves Laplace U = F with Neumann boundary conditions
 // if adjust_bound is true then boundary values in F are modified so that
 // the equation has a solution, if adjust_bound is set to false then F is
@@ -884,18 +923,6 @@ void solve_pde_fft(Array2Df *F, Array2Df *U, Array2Df *buf, bool multithread, in
     assert((int)U->getCols() == width && (int)U->getRows() == height);
     assert(buf->getCols() == width && buf->getRows() == height);
 
-    // activate parallel execution of fft routines
-#ifdef RT_FFTW3F_OMP
-
-    if (multithread) {
-        fftwf_init_threads();
-        fftwf_plan_with_nthreads(omp_get_max_threads());
-    }
-
-// #else
-//   fftwf_plan_with_nthreads( 2 );
-#endif
-
     // in general there might not be a solution to the Poisson pde
     // with Neumann boundary conditions unless the boundary satisfies
     // an integral condition, this function modifies the boundary so that
@@ -940,25 +967,294 @@ void solve_pde_fft(Array2Df *F, Array2Df *U, Array2Df *buf, bool multithread, in
     // (not really needed but good for numerics as we later take exp(U))
     //DEBUG_STR << "solve_pde_fft: removing constant from solution" << std::endl;
     if (algo == 0) {
-        float maxVal = 0.f;
+        remove_max(U, multithread);
+    }
+}
+
+
+/*****************************************************************************
+ * RT -- multigrid solver
+ *****************************************************************************/
+
+// solve_pde_multigrid() solves the system of solve_pde_fft() on a hierarchy of
+// grids which halve the intervals of both dimensions. width - 1 and height - 1
+// have to be divisible by the spacing of the coarsest grid, see
+// find_multigrid_dim(). The number of levels is set by the smaller dimension,
+// so the coarsest grid of an elongated image is long, it is solved by
+// solve_pde_fft().
+// A full multigrid pass followed by V-cycles on each level gets the solution
+// close to the exact one in a few passes over the image per level, without
+// the full size transforms and their buffers. Its cost grows linearly with
+// the image size.
+
+constexpr int MG_COARSEST = 32; // largest number of intervals of the smaller dimension of the coarsest grid
+constexpr int MG_SMOOTHING = 2; // Gauss-Seidel iterations before and after the coarse grid correction
+constexpr int MG_CYCLES = 2; // V-cycles on each level after the interpolation of the coarser solution
+
+int multigrid_levels(int width, int height)
+{
+    int levels = 0;
+
+    while (
+        std::min(width - 1, height - 1) >> levels > MG_COARSEST
+        && ((width - 1) >> levels) % 2 == 0
+        && ((height - 1) >> levels) % 2 == 0
+    ) {
+        ++levels;
+    }
+
+    return levels;
+}
+
+// the system has a solution only for a right hand side without constant part, solve_pde_fft() drops that
+// part in the eigenvector space. Here it is subtracted, the weights are those of the transposed system.
+// For the solution, this makes it the one of solve_pde_fft().
+void remove_weighted_mean(Array2Df *A, bool multithread)
+{
+    const int width = A->getCols();
+    const int height = A->getRows();
+    double sum = 0.0;
+
 #ifdef _OPENMP
-        #pragma omp parallel for reduction(max:maxVal) if(multithread)
+    #pragma omp parallel for reduction(+:sum) if(multithread)
 #endif
 
-        for (int i = 0; i < width * height; i++) {
-            maxVal = std::max(maxVal, (*U)(i));
+    for (int y = 0; y < height; ++y) {
+        const float* const row = (*A)[y];
+        double rowSum = 0.5 * (row[0] + row[width - 1]);
+
+        for (int x = 1; x < width - 1; ++x) {
+            rowSum += row[x];
         }
 
+        sum += (y == 0 || y == height - 1) ? 0.5 * rowSum : rowSum;
+    }
+
+    const float mean = sum / ((width - 1) * (height - 1));
+
+#ifdef _OPENMP
+    #pragma omp parallel for if(multithread)
+#endif
+
+    for (int i = 0; i < width * height; ++i) {
+        (*A)(i) -= mean;
+    }
+}
+
+// red-black Gauss-Seidel iterations of U(x-1) + U(x+1) + U(y-1) + U(y+1) - 4 U = F
+void smooth_red_black(Array2Df *U, const Array2Df *F, int iterations, bool multithread)
+{
+    const int width = U->getCols();
+    const int height = U->getRows();
+
+    for (int i = 0; i < 2 * iterations; ++i) {
 #ifdef _OPENMP
         #pragma omp parallel for if(multithread)
 #endif
 
-        for (int i = 0; i < width * height; i++) {
-            (*U)(i) -= maxVal;
+        for (int y = 0; y < height; ++y) {
+            const float* const above = (*U)[y > 0 ? y - 1 : 1];
+            const float* const below = (*U)[y < height - 1 ? y + 1 : height - 2];
+            float* const row = (*U)[y];
+            const float* const f = (*F)[y];
+            int x = (y + i) & 1;
+
+            if (x == 0) {
+                row[0] = 0.25f * (2.f * row[1] + above[0] + below[0] - f[0]);
+                x = 2;
+            }
+
+            for (; x < width - 1; x += 2) {
+                row[x] = 0.25f * (row[x - 1] + row[x + 1] + above[x] + below[x] - f[x]);
+            }
+
+            if (x == width - 1) {
+                row[x] = 0.25f * (2.f * row[x - 1] + above[x] + below[x] - f[x]);
+            }
         }
     }
 }
 
+// residual F - Laplace U of row y, no U stands for U = 0
+void residual_row(const Array2Df *U, const Array2Df *F, int y, float *r)
+{
+    const int width = F->getCols();
+    const int height = F->getRows();
+    const float* const f = (*F)[y];
+
+    if (!U) {
+        std::copy(f, f + width, r);
+        return;
+    }
+
+    const float* const above = (*U)[y > 0 ? y - 1 : 1];
+    const float* const below = (*U)[y < height - 1 ? y + 1 : height - 2];
+    const float* const row = (*U)[y];
+
+    r[0] = f[0] - (2.f * row[1] + above[0] + below[0] - 4.f * row[0]);
+
+    for (int x = 1; x < width - 1; ++x) {
+        r[x] = f[x] - (row[x - 1] + row[x + 1] + above[x] + below[x] - 4.f * row[x]);
+    }
+
+    r[width - 1] = f[width - 1] - (2.f * row[width - 2] + above[width - 1] + below[width - 1] - 4.f * row[width - 1]);
+}
+
+// right hand side of the coarser grid: the residual, full weighted, times 4 for the doubled grid spacing.
+// The residual is computed on the fly, a row at a time.
+void restrict_residual(const Array2Df *U, const Array2Df *F, Array2Df *Fc, bool multithread)
+{
+    const int width = F->getCols();
+    const int height = F->getRows();
+    const int cwidth = Fc->getCols();
+    const int cheight = Fc->getRows();
+
+#ifdef _OPENMP
+    #pragma omp parallel if(multithread)
+#endif
+    {
+        std::vector<float> above(width);
+        std::vector<float> center(width);
+        std::vector<float> below(width);
+        int belowRow = -1;
+
+#ifdef _OPENMP
+        #pragma omp for schedule(static)
+#endif
+
+        for (int j = 0; j < cheight; ++j) {
+            const int y = 2 * j;
+
+            // rows are mirrored around the borders, like U
+            if (y > 0 && belowRow == y - 1) {
+                std::swap(above, below);
+            } else {
+                residual_row(U, F, y > 0 ? y - 1 : 1, above.data());
+            }
+
+            residual_row(U, F, y, center.data());
+
+            if (y < height - 1) {
+                residual_row(U, F, y + 1, below.data());
+                belowRow = y + 1;
+            } else {
+                below = above;
+                belowRow = -1;
+            }
+
+            for (int x = 0; x < width; ++x) {
+                center[x] = above[x] + 2.f * center[x] + below[x];
+            }
+
+            float* const fc = (*Fc)[j];
+            fc[0] = 0.25f * (2.f * center[1] + 2.f * center[0]);
+
+            for (int i = 1; i < cwidth - 1; ++i) {
+                fc[i] = 0.25f * (center[2 * i - 1] + 2.f * center[2 * i] + center[2 * i + 1]);
+            }
+
+            fc[cwidth - 1] = 0.25f * (2.f * center[width - 2] + 2.f * center[width - 1]);
+        }
+    }
+}
+
+// bilinear interpolation of the coarser grid, added to U or replacing it
+void prolongate(const Array2Df *Uc, Array2Df *U, bool add, bool multithread)
+{
+    const int width = U->getCols();
+    const int height = U->getRows();
+    const int cwidth = Uc->getCols();
+
+#ifdef _OPENMP
+    #pragma omp parallel for if(multithread)
+#endif
+
+    for (int y = 0; y < height; ++y) {
+        const float* const c0 = (*Uc)[y / 2];
+        const float* const c1 = (*Uc)[(y + 1) / 2];
+        float* const row = (*U)[y];
+
+        if (!add) {
+            std::fill(row, row + width, 0.f);
+        }
+
+        float left = 0.5f * (c0[0] + c1[0]);
+
+        for (int i = 0; i < cwidth - 1; ++i) {
+            const float right = 0.5f * (c0[i + 1] + c1[i + 1]);
+            row[2 * i] += left;
+            row[2 * i + 1] += 0.5f * (left + right);
+            left = right;
+        }
+
+        row[width - 1] += left;
+    }
+}
+
+void v_cycle(const std::vector<Array2Df*> &F, const std::vector<Array2Df*> &U, int level, Array2Df *buf, bool multithread)
+{
+    if (level == static_cast<int>(F.size()) - 1) {
+        solve_pde_fft(F[level], U[level], buf, multithread, 1);
+        return;
+    }
+
+    smooth_red_black(U[level], F[level], MG_SMOOTHING, multithread);
+    restrict_residual(U[level], F[level], F[level + 1], multithread);
+    U[level + 1]->fill(0.f, multithread);
+    v_cycle(F, U, level + 1, buf, multithread);
+    prolongate(U[level + 1], U[level], true, multithread);
+    smooth_red_black(U[level], F[level], MG_SMOOTHING, multithread);
+}
+
+// solves Laplace U = F like solve_pde_fft(), modifies F
+void solve_pde_multigrid(Array2Df *F, Array2Df *U, bool multithread, int algo)
+{
+    const int width = F->getCols();
+    const int height = F->getRows();
+    assert(U->getCols() == width && U->getRows() == height);
+
+    const int levels = multigrid_levels(width, height);
+
+    std::vector<Array2Df*> Fs = {F};
+    std::vector<Array2Df*> Us = {U};
+    std::vector<std::unique_ptr<Array2Df>> grids;
+
+    for (int level = 1; level <= levels; ++level) {
+        const int w = ((width - 1) >> level) + 1;
+        const int h = ((height - 1) >> level) + 1;
+        grids.emplace_back(new Array2Df(w, h));
+        Fs.push_back(grids.back().get());
+        grids.emplace_back(new Array2Df(w, h));
+        Us.push_back(grids.back().get());
+    }
+
+    Array2Df buf(Fs.back()->getCols(), Fs.back()->getRows());
+
+    remove_weighted_mean(F, multithread);
+
+    // full multigrid: the right hand side is restricted down to the coarsest grid, which is solved exactly,
+    // and each solution is the initial guess of the next finer grid
+    for (int level = 0; level < levels; ++level) {
+        restrict_residual(nullptr, Fs[level], Fs[level + 1], multithread);
+    }
+
+    solve_pde_fft(Fs[levels], Us[levels], &buf, multithread, 1);
+
+    for (int level = levels - 1; level >= 0; --level) {
+        prolongate(Us[level + 1], Us[level], false, multithread);
+
+        for (int cycle = 0; cycle < MG_CYCLES; ++cycle) {
+            v_cycle(Fs, Us, level, &buf, multithread);
+        }
+    }
+
+    remove_weighted_mean(U, multithread);
+
+    if (algo == 0) {
+        remove_max(U, multithread);
+    }
+}
+
 
 // ---------------------------------------------------------------------
 // the functions below are only for test purposes to check the accuracy
@@ -1021,6 +1317,20 @@ inline int round_up_pow2(int dim)
     return v;
 }
 
+// RT -- spacing of the coarsest grid of solve_pde_multigrid() for a width x height image, set by the
+// smaller dimension so that the padding of both dimensions stays below one spacing and the image is
+// not stretched much more in one direction than in the other
+inline int find_multigrid_spacing(int width, int height)
+{
+    int spacing = 1;
+
+    while (std::min(width, height) > MG_COARSEST * spacing) {
+        spacing *= 2;
+    }
+
+    return spacing;
+}
+
 inline int find_fast_dim(int dim)
 {
     // as per the FFTW docs:
@@ -1059,15 +1369,23 @@ inline int find_fast_dim(int dim)
     return dim;
 }
 
+// RT -- dim - 1 has to be a multiple of the spacing of the coarsest grid of solve_pde_multigrid(),
+// the number of its intervals is a fast size for solve_pde_fft()
+inline int find_multigrid_dim(int dim, int spacing)
+{
+    return find_fast_dim((dim + spacing - 1) / spacing) * spacing;
+}
+
 
 
 } // namespace
 
 
-void ImProcFunctions::ToneMapFattal02(Imagefloat *rgb, const FattalToneMappingParams &fatParams, int detail_level, int Lalone, float **Lum, int WW, int HH, int algo)
+void ImProcFunctions::ToneMapFattal02(Imagefloat *rgb, const FattalToneMappingParams &fatParams, int detail_level, int Lalone, float **Lum, int WW, int HH, int algo, bool preview)
 //algo allows to use ART algorithme algo = 0 RT, algo = 1 ART
 //Lalone allows to use L without RGB values in RT mode
 {
+    TRACEFUN;
     if (!fatParams.enabled) {
         return;
     }
@@ -1130,10 +1448,14 @@ void ImProcFunctions::ToneMapFattal02(Imagefloat *rgb, const FattalToneMappingPa
         findMinMaxPercentile(Yr.data(), static_cast<size_t>(Yr.getRows()) * Yr.getCols(), percentile, oldMedian, percentile, oldMedian, multiThread);
     }
 
+    const bool multigrid =
+        settings->fattal_solver == Settings::FattalSolver::MULTIGRID
+        || (settings->fattal_solver == Settings::FattalSolver::MULTIGRID_PREVIEW && preview);
+
     // median filter on the deep shadows, to avoid boosting noise
     // because w2 >= w and h2 >= h, we can use the L buffer as temporary buffer for Median_Denoise()
-    int w2 = find_fast_dim(w) + 1;
-    int h2 = find_fast_dim(h) + 1;
+    int w2 = (multigrid ? find_multigrid_dim(w, find_multigrid_spacing(w, h)) : find_fast_dim(w)) + 1;
+    int h2 = (multigrid ? find_multigrid_dim(h, find_multigrid_spacing(w, h)) : find_fast_dim(h)) + 1;
     Array2Df L(w2, h2);
     {
 #ifdef _OPENMP
@@ -1166,7 +1488,12 @@ void ImProcFunctions::ToneMapFattal02(Imagefloat *rgb, const FattalToneMappingPa
 
     rescale_nearest(Yr, L, multiThread);
 
-    tmo_fattal02(w2, h2, L, L, alpha, beta, noise, detail_level, multiThread, 0);
+    tmo_fattal02(w2, h2, L, L, alpha, beta, noise, detail_level, multiThread, 0, multigrid, cancelToken);
+
+    if (isCancelled()) {
+        // L is incomplete, leave the input untouched
+        return;
+    }
 
     const float hr = float(h2) / float(h);
     const float wr = float(w2) / float(w);
@@ -1339,4 +1666,45 @@ void buildGradientsMask(int W, int H, float **luminance, float **out,
     // }
 }
 
+#ifdef POISSON_BENCHMARK
+void PoissonBenchmark::getSolverSize(int width, int height, bool multigrid, int &solverWidth, int &solverHeight)
+{
+    // same as ImProcFunctions::ToneMapFattal02()
+    solverWidth = (multigrid ? find_multigrid_dim(width, find_multigrid_spacing(width, height)) : find_fast_dim(width)) + 1;
+    solverHeight = (multigrid ? find_multigrid_dim(height, find_multigrid_spacing(width, height)) : find_fast_dim(height)) + 1;
+}
+
+double PoissonBenchmark::solve(const array2D<float> &divergence, array2D<float> &solution, bool multigrid)
+{
+    const int width = divergence.getWidth();
+    const int height = divergence.getHeight();
+    Array2Df F(width, height);
+    Array2Df U(width, height);
+
+    for (int y = 0; y < height; ++y) {
+        std::copy(divergence[y], divergence[y] + width, F[y]);
+    }
+
+    // tmo_fattal02() reuses a buffer of the gradients for the FFT solver, so its allocation isn't timed
+    std::unique_ptr<Array2Df> buf(multigrid ? nullptr : new Array2Df(width, height));
+
+    MyTime t1, t2;
+    t1.set();
+
+    if (multigrid) {
+        solve_pde_multigrid(&F, &U, true, 0);
+    } else {
+        solve_pde_fft(&F, &U, buf.get(), true, 0);
+    }
+
+    t2.set();
+
+    for (int y = 0; y < height; ++y) {
+        std::copy(U[y], U[y] + width, solution[y]);
+    }
+
+    return t2.etime(t1) / 1000000.0;
+}
+#endif
+
 } // namespace rtengine
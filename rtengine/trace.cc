@@ -0,0 +1,183 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "trace.h"
+
+namespace
+{
+
+struct Event {
+    const char* name;
+    const char* category;
+    int64_t start;
+    int64_t duration;
+};
+
+// Events of one thread. The buffers outlive their threads, so the short lived threads are kept too.
+struct ThreadBuffer {
+    std::mutex mutex; // uncontended except while the trace is written
+    std::vector<Event> events;
+    std::string name;
+    unsigned int tid;
+};
+
+struct TraceState {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> threads;
+    std::string fileName;
+    std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+};
+
+// Never destroyed, threads may still record while static objects are destroyed
+TraceState& getState()
+{
+    static TraceState* const state = new TraceState;
+    return *state;
+}
+
+thread_local ThreadBuffer* threadBuffer = nullptr;
+
+ThreadBuffer& getThreadBuffer()
+{
+    if (!threadBuffer) {
+        TraceState& state = getState();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        state.threads.emplace_back(new ThreadBuffer);
+        threadBuffer = state.threads.back().get();
+        threadBuffer->tid = state.threads.size();
+    }
+
+    return *threadBuffer;
+}
+
+void writeString(FILE* file, const char* str)
+{
+    fputc('"', file);
+
+    for (; *str; ++str) {
+        const unsigned char c = *str;
+
+        if (c == '"' || c == '\\') {
+            fputc('\\', file);
+            fputc(c, file);
+        } else if (c < 0x20) {
+            fprintf(file, "\\u%04x", c);
+        } else {
+            fputc(c, file);
+        }
+    }
+
+    fputc('"', file);
+}
+
+}
+
+namespace rtengine
+{
+
+namespace trace
+{
+
+std::atomic<bool> enabled(false);
+
+void start(const std::string &fileName)
+{
+    TraceState& state = getState();
+
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        state.fileName = fileName;
+        state.origin = std::chrono::steady_clock::now();
+    }
+
+    enabled.store(true, std::memory_order_relaxed);
+}
+
+void stop()
+{
+    if (!enabled.exchange(false)) {
+        return;
+    }
+
+    TraceState& state = getState();
+    std::lock_guard<std::mutex> lock(state.mutex);
+
+    FILE* const file = fopen(state.fileName.c_str(), "wt");
+
+    if (!file) {
+        fprintf(stderr, "Could not write trace file %s\n", state.fileName.c_str());
+        return;
+    }
+
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", file);
+    bool first = true;
+
+    for (const auto &thread : state.threads) {
+        std::lock_guard<std::mutex> threadLock(thread->mutex);
+
+        if (!thread->name.empty()) {
+            fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", first ? "" : ",\n", thread->tid);
+            writeString(file, thread->name.c_str());
+            fputs("}}", file);
+            first = false;
+        }
+
+        for (const auto &event : thread->events) {
+            fprintf(file, "%s{\"name\":", first ? "" : ",\n");
+            writeString(file, event.name);
+            fputs(",\"cat\":", file);
+            writeString(file, event.category);
+            fprintf(file, ",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":1,\"tid\":%u}", static_cast<long long>(event.start), static_cast<long long>(event.duration), thread->tid);
+            first = false;
+        }
+    }
+
+    fputs("\n]}\n", file);
+    fclose(file);
+}
+
+void setThreadName(const char *name)
+{
+    if (!isEnabled()) {
+        return;
+    }
+
+    ThreadBuffer& buffer = getThreadBuffer();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    buffer.name = name;
+}
+
+void record(const char *name, const char *category, int64_t start, int64_t end)
+{
+    ThreadBuffer& buffer = getThreadBuffer();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    buffer.events.push_back({name, category, start, end - start});
+}
+
+int64_t now()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - getState().origin).count();
+}
+
+}
+
+}
@@ -0,0 +1,96 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "noncopyable.h"
+
+/*
+ * Timeline of the engine activity, exported as Chrome trace JSON (chrome://tracing, ui.perfetto.dev).
+ *
+ * Tracing is started by rtengine::init() when Performance/TraceFile is set in options, or when the
+ * environment variable RT_TRACE holds a file name, and the file is written by rtengine::cleanup().
+ * When it is off, a scope costs one relaxed atomic load.
+ *
+ * Usage:
+ *
+ *      TRACEFUN;                           // the enclosing function
+ *      TRACE_SCOPE("demosaic", "stage");   // until the end of the enclosing block
+ *
+ * The names have to be string literals or otherwise outlive the trace.
+ */
+
+#define TRACE_CONCAT_IMPL(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_IMPL(a, b)
+#define TRACE_SCOPE(name, category) rtengine::trace::Scope TRACE_CONCAT(traceScope, __LINE__)(name, category)
+#define TRACEFUN rtengine::trace::Scope traceFun(__func__, "function")
+
+namespace rtengine
+{
+
+namespace trace
+{
+
+extern std::atomic<bool> enabled;
+
+inline bool isEnabled()
+{
+    return enabled.load(std::memory_order_relaxed);
+}
+
+void start(const std::string &fileName);
+// Writes the trace file and stops tracing
+void stop();
+
+// Names the calling thread in the trace
+void setThreadName(const char *name);
+
+// Records a complete event, 'start' and 'end' as returned by now()
+void record(const char *name, const char *category, int64_t start, int64_t end);
+// Microseconds since the start of the trace
+int64_t now();
+
+class Scope final :
+    public NonCopyable
+{
+public:
+    Scope(const char *name, const char *category) :
+        name(isEnabled() ? name : nullptr),
+        category(category),
+        begin(this->name ? now() : 0)
+    {
+    }
+
+    ~Scope()
+    {
+        if (name) {
+            record(name, category, begin, now());
+        }
+    }
+
+private:
+    const char *const name;
+    const char *const category;
+    const int64_t begin;
+};
+
+}
+
+}
@@ -0,0 +1,129 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <cstring>
+
+#include "viewportcache.h"
+
+#include "image8.h"
+
+namespace
+{
+
+void copyWindow(const rtengine::Image8 *src, int x, int y, rtengine::Image8 *dst)
+{
+    const int width = dst->getWidth();
+
+    for (int row = 0; row < dst->getHeight(); ++row) {
+        memcpy(dst->data + 3 * row * width, src->data + 3 * ((row + y) * src->getWidth() + x), 3 * width);
+    }
+}
+
+}
+
+namespace rtengine
+{
+
+constexpr size_t ViewportCache::MAX_ENTRIES;
+
+ViewportCache::ViewportCache() :
+    useCounter(0)
+{
+}
+
+ViewportCache::~ViewportCache() = default;
+
+const ViewportCache::Entry* ViewportCache::find(unsigned int generation, int x, int y, int width, int height) const
+{
+    for (const auto &entry : entries) {
+        if (
+            entry.generation == generation
+            && x >= entry.x
+            && y >= entry.y
+            && x + width <= entry.x + entry.img->getWidth()
+            && y + height <= entry.y + entry.img->getHeight()
+        ) {
+            return &entry;
+        }
+    }
+
+    return nullptr;
+}
+
+bool ViewportCache::contains(unsigned int generation, int x, int y, int width, int height) const
+{
+    return find(generation, x, y, width, height);
+}
+
+bool ViewportCache::fetch(unsigned int generation, int x, int y, Image8 *img, Image8 *imgTrue)
+{
+    const Entry* const entry = find(generation, x, y, img->getWidth(), img->getHeight());
+
+    if (!entry) {
+        return false;
+    }
+
+    copyWindow(entry->img.get(), x - entry->x, y - entry->y, img);
+    copyWindow(entry->imgTrue.get(), x - entry->x, y - entry->y, imgTrue);
+    const_cast<Entry*>(entry)->lastUse = ++useCounter;
+    return true;
+}
+
+void ViewportCache::store(unsigned int generation, int x, int y, const Image8 *img, const Image8 *imgTrue)
+{
+    // the entries of older params will never be used again, and neither will the ones the new entry covers
+    entries.erase(
+        std::remove_if(
+            entries.begin(),
+            entries.end(),
+            [=](const Entry &entry)
+            {
+                return
+                    entry.generation != generation
+                    || (
+                        entry.x >= x
+                        && entry.y >= y
+                        && entry.x + entry.img->getWidth() <= x + img->getWidth()
+                        && entry.y + entry.img->getHeight() <= y + img->getHeight()
+                    );
+            }
+        ),
+        entries.end()
+    );
+
+    if (entries.size() >= MAX_ENTRIES) {
+        entries.erase(
+            std::min_element(
+                entries.begin(),
+                entries.end(),
+                [](const Entry &a, const Entry &b)
+                {
+                    return a.lastUse < b.lastUse;
+                }
+            )
+        );
+    }
+
+    entries.push_back({generation, x, y, std::unique_ptr<Image8>(img->copy()), std::unique_ptr<Image8>(imgTrue->copy()), ++useCounter});
+}
+
+void ViewportCache::clear()
+{
+    entries.clear();
+}
+
+}
@@ -0,0 +1,72 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "noncopyable.h"
+
+namespace rtengine
+{
+
+class Image8;
+
+/**
+ * Rendered output of a detail window at 100% (skip == 1), used while panning.
+ *
+ * Each entry is the output of one render, the displayed and the "true" image, tagged with the
+ * params generation it was rendered with. A window fully contained in an entry is cut from it
+ * instead of running the pipeline. Windows are never stitched from several entries, as tools
+ * depending on the whole window (denoise tiling, wavelet statistics, dehaze...) would show seams.
+ *
+ * Not thread safe, the owning Crop guards it with its mutex.
+ */
+class ViewportCache final :
+    public NonCopyable
+{
+public:
+    static constexpr size_t MAX_ENTRIES = 4;
+
+    ViewportCache();
+    ~ViewportCache();
+
+    // 'x' and 'y' are the image coordinates of the top left pixel of the window
+    bool contains(unsigned int generation, int x, int y, int width, int height) const;
+    // 'img' and 'imgTrue' have to be allocated with the size of the window
+    bool fetch(unsigned int generation, int x, int y, Image8 *img, Image8 *imgTrue);
+    void store(unsigned int generation, int x, int y, const Image8 *img, const Image8 *imgTrue);
+    void clear();
+
+private:
+    struct Entry {
+        unsigned int generation;
+        int x;
+        int y;
+        std::unique_ptr<Image8> img;
+        std::unique_ptr<Image8> imgTrue;
+        unsigned long lastUse;
+    };
+
+    const Entry* find(unsigned int generation, int x, int y, int width, int height) const;
+
+    std::vector<Entry> entries;
+    unsigned long useCounter;
+};
+
+}
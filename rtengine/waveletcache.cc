@@ -0,0 +1,143 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "waveletcache.h"
+
+#include "cplx_wavelet_dec.h"
+#include "settings.h"
+
+namespace
+{
+
+constexpr uint64_t FNV_OFFSET = 14695981039346656037ULL;
+constexpr uint64_t FNV_PRIME = 1099511628211ULL;
+
+uint64_t hashWord(uint64_t hash, uint32_t word)
+{
+    return (hash ^ word) * FNV_PRIME;
+}
+
+// FNV-1a of 32 bit words, the chunks are hashed in parallel and their hashes combined in order
+uint64_t hashData(const float *data, size_t size)
+{
+    constexpr size_t CHUNK_SIZE = 1 << 16;
+    const size_t numChunks = (size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    std::vector<uint64_t> chunkHashes(numChunks);
+
+#ifdef _OPENMP
+    #pragma omp parallel for
+#endif
+    for (size_t chunk = 0; chunk < numChunks; ++chunk) {
+        uint64_t hash = FNV_OFFSET;
+        const size_t end = std::min(size, (chunk + 1) * CHUNK_SIZE);
+
+        for (size_t i = chunk * CHUNK_SIZE; i < end; ++i) {
+            uint32_t word;
+            memcpy(&word, data + i, sizeof(word));
+            hash = hashWord(hash, word);
+        }
+
+        chunkHashes[chunk] = hash;
+    }
+
+    uint64_t hash = FNV_OFFSET;
+
+    for (const uint64_t chunkHash : chunkHashes) {
+        hash = hashWord(hashWord(hash, chunkHash), chunkHash >> 32);
+    }
+
+    return hash;
+}
+
+}
+
+namespace rtengine
+{
+
+extern const Settings* settings;
+
+WaveletCache::WaveletCache() = default;
+
+WaveletCache::~WaveletCache() = default;
+
+std::unique_ptr<wavelet_decomposition> WaveletCache::decompose(Channel channel, float *src, int width, int height, int maxLevel, int subsampling, int skipCrop, int numThreads, int daubLen, size_t memoryBudget, bool halfFloat)
+{
+    Entry &entry = entries[channel];
+
+    if (!memoryBudget) {
+        entry = Entry();
+        return std::unique_ptr<wavelet_decomposition>(new wavelet_decomposition(src, width, height, maxLevel, subsampling, skipCrop, numThreads, daubLen));
+    }
+
+    uint64_t hash = hashData(src, static_cast<size_t>(width) * height);
+
+    for (const int param : {width, height, maxLevel, subsampling, skipCrop, daubLen, int(halfFloat)}) {
+        hash = hashWord(hash, param);
+    }
+
+    if (entry.decomposition && entry.hash == hash) {
+        std::unique_ptr<wavelet_decomposition> result = entry.decomposition->copy();
+
+        if (!result->memory_allocation_failed()) {
+            if (settings->verbose) {
+                printf("Wavelet decomposition of channel %d taken from the cache\n", channel);
+            }
+
+            return result;
+        }
+    }
+
+    entry = Entry();
+    std::unique_ptr<wavelet_decomposition> result(new wavelet_decomposition(src, width, height, maxLevel, subsampling, skipCrop, numThreads, daubLen));
+
+    if (result->memory_allocation_failed()) {
+        return result;
+    }
+
+    // the other channels keep their entries, this one is only kept if it fits next to them
+    size_t usedMemory = 0;
+
+    for (const auto &other : entries) {
+        usedMemory += other.size;
+    }
+
+    // packing at least halves the size, the packed size is checked again
+    const size_t minSize = halfFloat ? result->memory_size() / 2 : result->memory_size();
+
+    if (usedMemory + minSize <= memoryBudget) {
+        entry.decomposition = result->copy();
+
+        if (halfFloat) {
+            entry.decomposition->pack();
+        }
+
+        if (entry.decomposition->memory_allocation_failed() || usedMemory + entry.decomposition->memory_size() > memoryBudget) {
+            entry = Entry();
+        } else {
+            entry.hash = hash;
+            entry.size = entry.decomposition->memory_size();
+        }
+    }
+
+    return result;
+}
+
+}
@@ -0,0 +1,71 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "noncopyable.h"
+
+namespace rtengine
+{
+
+class wavelet_decomposition;
+
+/**
+ * Cached wavelet decompositions of the L, a and b channels of the wavelet levels tool.
+ *
+ * Most edits of the tool only change how the coefficients are modified, not the data they are
+ * computed from. The decomposition of a channel is kept together with a hash of its input and its
+ * parameters, and as long as both match, a copy of it is handed out instead of analysing the
+ * channel again. Keying by the input data keeps the cache valid whatever happened upstream.
+ */
+class WaveletCache final :
+    public NonCopyable
+{
+public:
+    enum Channel {
+        L,
+        A,
+        B,
+        CHANNEL_COUNT
+    };
+
+    WaveletCache();
+    ~WaveletCache();
+
+    /**
+     * Returns the decomposition of 'src', like new wavelet_decomposition(src, width, height, maxLevel, subsampling, skipCrop, numThreads, daubLen).
+     * @param memoryBudget memory for the decompositions of all channels in bytes, 0 disables the cache
+     * @param halfFloat if true, the detail levels are kept as half floats, which about halves the memory
+     *                  but makes the coefficients taken from the cache differ slightly from computed ones
+     */
+    std::unique_ptr<wavelet_decomposition> decompose(Channel channel, float *src, int width, int height, int maxLevel, int subsampling, int skipCrop, int numThreads, int daubLen, size_t memoryBudget, bool halfFloat);
+
+private:
+    struct Entry {
+        uint64_t hash = 0;
+        std::unique_ptr<wavelet_decomposition> decomposition;
+        size_t size = 0;
+    };
+
+    std::array<Entry, CHANNEL_COUNT> entries;
+};
+
+}
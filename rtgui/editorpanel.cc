@@ -24,6 +24,7 @@
 #include "../rtengine/array2D.h"
 #include "../rtengine/imagesource.h"
 #include "../rtengine/iccstore.h"
+#include "../rtengine/refreshmap.h"
 #include "batchqueue.h"
 #include "batchqueueentry.h"
 #include "soundman.h"
@@ -473,7 +474,7 @@ EditorPanel::EditorPanel (FilePanel* filePanel)
       iBeforeLockON (nullptr), iBeforeLockOFF (nullptr), previewHandler (nullptr), beforePreviewHandler (nullptr),
       beforeIarea (nullptr), beforeBox (nullptr), afterBox (nullptr), beforeLabel (nullptr), afterLabel (nullptr),
       beforeHeaderBox (nullptr), afterHeaderBox (nullptr), parent (nullptr), parentWindow (nullptr), openThm (nullptr),
-      selectedFrame(0), isrc (nullptr), ipc (nullptr), beforeIpc (nullptr), err (0), isProcessing (false),
+      selectedFrame(0), isrc (nullptr), ipc (nullptr), beforeIpc (nullptr), beforeSharesSource (false), err (0), isProcessing (false),
       histogram_observable(nullptr), histogram_scope_type(ScopeType::NONE)
 {
 
@@ -1049,8 +1050,7 @@ void EditorPanel::open (Thumbnail* tmb, rtengine::InitialImage* isrc)
     openThm->addThumbnailListener (this);
     info_toggled ();
 
-    if (beforeIarea) {
-        beforeAfterToggled();
+    if (beforeAfter->get_active ()) {
         beforeAfterToggled();
     }
 
@@ -1085,8 +1085,9 @@ void EditorPanel::close ()
             ipc->setPreviewImageListener (nullptr);
         }
 
-        if (beforeIpc) {
-            beforeIpc->setPreviewImageListener (nullptr);
+        // the before view may share the image source of ipc, it must not outlive it
+        if (beforeIarea) {
+            closeBeforeView ();
         }
 
         delete previewHandler;
@@ -1167,6 +1168,15 @@ void EditorPanel::procParamsChanged(
     selectedFrame = rtengine::LIM<int>(selectedFrame, 0, isrc->getImageSource()->getMetaData()->getFrameCount() - 1);
 
     info_toggled();
+
+    if (beforeIpc && beforeSharesSource && (rtengine::RefreshMapper::getInstance()->getAction(ev) & (M_PREPROC | M_RAW | M_CSHARP | M_RETINEX | M_INIT))) {
+        rtengine::procparams::ProcParams beforeParams;
+
+        if (history->getBeforeLineParams (beforeParams) && !rtengine::StagedImageProcessor::canShareSource (beforeParams, *params)) {
+            // the raw stages of the before view differ from now on, it needs its own image source
+            updateBeforeView (*params);
+        }
+    }
 }
 
 void EditorPanel::clearParamChanges()
@@ -2142,6 +2152,15 @@ void EditorPanel::historyBeforeLineChanged (const rtengine::procparams::ProcPara
 {
 
     if (beforeIpc) {
+        rtengine::procparams::ProcParams afterParams;
+        ipc->getParams (&afterParams);
+
+        if (rtengine::StagedImageProcessor::canShareSource (params, afterParams) != beforeSharesSource) {
+            // switch between sharing the image source of the main view and loading its own one
+            updateBeforeView (afterParams);
+            return;
+        }
+
         ProcParams* pparams = beforeIpc->beginUpdateParams ();
         *pparams = params;
         beforeIpc->endUpdateParams (rtengine::EvProfileChanged);  // starts the IPC processing
@@ -2155,6 +2174,14 @@ void EditorPanel::beforeAfterToggled ()
         return;
     }
 
+    rtengine::procparams::ProcParams params;
+    ipc->getParams (&params);
+    updateBeforeView (params);
+}
+
+void EditorPanel::closeBeforeView ()
+{
+
     removeIfThere (beforeAfterBox,  beforeBox, false);
     removeIfThere (afterBox,  afterHeaderBox, false);
 
@@ -2181,14 +2208,29 @@ void EditorPanel::beforeAfterToggled ()
 
         beforeIpc = nullptr;
     }
+}
+
+void EditorPanel::updateBeforeView (const rtengine::procparams::ProcParams& afterParams)
+{
+
+    closeBeforeView ();
 
     if (beforeAfter->get_active ()) {
 
-        int errorCode = 0;
-        rtengine::InitialImage *beforeImg = rtengine::InitialImage::load ( isrc->getImageSource ()->getFileName(),  openThm->getType() == FT_Raw, &errorCode, nullptr);
+        rtengine::procparams::ProcParams beforeParams;
+        const bool hasBeforeParams = history->getBeforeLineParams (beforeParams);
 
-        if ( !beforeImg || errorCode ) {
-            return;
+        // when the raw stages match, the before view only renders the stages following them from the source of ipc
+        beforeSharesSource = hasBeforeParams && rtengine::StagedImageProcessor::canShareSource (beforeParams, afterParams);
+        rtengine::InitialImage *beforeImg = nullptr;
+
+        if (!beforeSharesSource) {
+            int errorCode = 0;
+            beforeImg = rtengine::InitialImage::load ( isrc->getImageSource ()->getFileName(),  openThm->getType() == FT_Raw, &errorCode, nullptr);
+
+            if ( !beforeImg || errorCode ) {
+                return;
+            }
         }
 
         beforeIarea = new ImageAreaPanel ();
@@ -2228,7 +2270,7 @@ void EditorPanel::beforeAfterToggled ()
 
         beforePreviewHandler = new PreviewHandler ();
 
-        beforeIpc = rtengine::StagedImageProcessor::create (beforeImg);
+        beforeIpc = beforeSharesSource ? rtengine::StagedImageProcessor::createShared (ipc) : rtengine::StagedImageProcessor::create (beforeImg);
         beforeIpc->setPreviewScale (10);
         beforeIpc->setPreviewImageListener (beforePreviewHandler);
         Glib::ustring monitorProfile;
@@ -2246,10 +2288,10 @@ void EditorPanel::beforeAfterToggled ()
         iareapanel->setBeforeAfterViews (beforeIarea, iareapanel);
         beforeIarea->setBeforeAfterViews (beforeIarea, iareapanel);
 
-        rtengine::procparams::ProcParams params;
-
-        if (history->getBeforeLineParams (params)) {
-            historyBeforeLineChanged (params);
+        if (hasBeforeParams) {
+            ProcParams* pparams = beforeIpc->beginUpdateParams ();
+            *pparams = beforeParams;
+            beforeIpc->endUpdateParams (rtengine::EvProfileChanged);  // starts the IPC processing
         }
     }
 }
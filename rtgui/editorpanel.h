@@ -194,6 +194,8 @@ public:
 
 private:
     void close ();
+    void closeBeforeView ();
+    void updateBeforeView (const rtengine::procparams::ProcParams& afterParams);
 
     BatchQueueEntry*    createBatchQueueEntry ();
     bool                idle_imageSaved (ProgressConnector<int> *pc, rtengine::IImagefloat* img, Glib::ustring fname, SaveFormat sf, rtengine::procparams::ProcParams &pparams);
@@ -272,6 +274,7 @@ private:
     rtengine::InitialImage* isrc;
     rtengine::StagedImageProcessor* ipc;
     rtengine::StagedImageProcessor* beforeIpc;    // for the before-after view
+    bool beforeSharesSource;                      // beforeIpc renders from the image source of ipc
 
     EditorPanelIdleHelper* epih;
 
@@ -221,6 +221,9 @@ int main (int argc, char **argv)
         std::cout << "Terminating without anything to do." << std::endl;
     }
 
+    // writes the trace and the FFTW wisdom
+    rtengine::cleanup();
+
     return ret;
 }
 
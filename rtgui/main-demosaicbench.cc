@@ -0,0 +1,145 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Offline demosaic benchmark: mosaics a synthetic test chart and reports speed and quality of all demosaicers.
+// Nothing is downloaded and no raw file is needed.
+
+#include "config.h"
+#include <giomm.h>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <locale.h>
+#include <sstream>
+
+#include "../rtengine/demosaicbenchmark.h"
+#include "options.h"
+
+Glib::ustring argv0;
+Glib::ustring creditsPath;
+Glib::ustring licensePath;
+Glib::ustring argv1;
+
+namespace
+{
+
+void printUsage(const char *name)
+{
+    std::cout << "Usage: " << name << " [-w <width>] [-h <height>] [-r <runs>] [-t <threads,...>] [-m <method>]... [-s bayer|xtrans] [-o <file.csv>]" << std::endl;
+    std::cout << std::endl;
+    std::cout << "  -w <width>       Width of the synthetic test chart (default 3000)." << std::endl;
+    std::cout << "  -h <height>      Height of the synthetic test chart (default 2000)." << std::endl;
+    std::cout << "  -r <runs>        Timed runs per method and thread count, the fastest is reported (default 3)." << std::endl;
+    std::cout << "  -t <threads,...> Comma separated list of thread counts (default: all available)." << std::endl;
+    std::cout << "  -m <method>      Only benchmark this method, e.g. \"amaze\". Can be given several times." << std::endl;
+    std::cout << "  -s bayer|xtrans  Only benchmark one sensor type." << std::endl;
+    std::cout << "  -o <file.csv>    Also write the results to a CSV file." << std::endl;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    setlocale(LC_ALL, "");
+    setlocale(LC_NUMERIC, "C"); // to set decimal point to "."
+
+    Gio::init();
+
+    argv0 = DATA_SEARCH_PATH;
+    creditsPath = CREDITS_SEARCH_PATH;
+    licensePath = LICENCE_SEARCH_PATH;
+    options.rtSettings.lensfunDbDirectory = LENSFUN_DB_PATH;
+
+    rtengine::DemosaicBenchmark::Config config;
+    std::string csvFile;
+
+    for (int iArg = 1; iArg < argc; ++iArg) {
+        const std::string param(argv[iArg]);
+
+        if (param.size() != 2 || param[0] != '-' || iArg + 1 >= argc) {
+            printUsage(argv[0]);
+            return -1;
+        }
+
+        const std::string value(argv[++iArg]);
+
+        switch (param[1]) {
+            case 'w':
+                config.width = std::atoi(value.c_str());
+                break;
+
+            case 'h':
+                config.height = std::atoi(value.c_str());
+                break;
+
+            case 'r':
+                config.runs = std::atoi(value.c_str());
+                break;
+
+            case 't': {
+                std::istringstream list(value);
+                std::string threads;
+
+                while (std::getline(list, threads, ',')) {
+                    config.threads.push_back(std::atoi(threads.c_str()));
+                }
+
+                break;
+            }
+
+            case 'm':
+                config.methods.push_back(value);
+                break;
+
+            case 's':
+                config.bayer = value == "bayer";
+                config.xtrans = value == "xtrans";
+                break;
+
+            case 'o':
+                csvFile = value;
+                break;
+
+            default:
+                printUsage(argv[0]);
+                return -1;
+        }
+    }
+
+    try {
+        Options::load(true);
+    } catch (Options::Error &e) {
+        std::cerr << "FATAL ERROR:" << std::endl << e.get_msg() << std::endl;
+        return -2;
+    }
+
+    const std::vector<rtengine::DemosaicBenchmark::Result> results = rtengine::DemosaicBenchmark::run(config, std::cerr);
+
+    if (results.empty()) {
+        std::cerr << "Nothing to benchmark." << std::endl;
+        return -1;
+    }
+
+    rtengine::DemosaicBenchmark::printReport(results, std::cout);
+
+    if (!csvFile.empty()) {
+        std::ofstream csv(csvFile);
+        rtengine::DemosaicBenchmark::writeCSV(results, csv);
+    }
+
+    return 0;
+}
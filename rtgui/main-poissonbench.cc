@@ -0,0 +1,147 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Offline benchmark of the Poisson solvers of the dynamic range compression: solves a synthetic gradient field
+// with the FFT and the multigrid solver and reports their speed and the difference of their solutions.
+
+#include "config.h"
+#include <giomm.h>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <locale.h>
+#include <sstream>
+
+#include "../rtengine/poissonbenchmark.h"
+#include "options.h"
+
+Glib::ustring argv0;
+Glib::ustring creditsPath;
+Glib::ustring licensePath;
+Glib::ustring argv1;
+
+namespace
+{
+
+void printUsage(const char *name)
+{
+    std::cout << "Usage: " << name << " [-s <megapixels,...>] [-w <width> -h <height>] [-r <runs>] [-t <threads,...>] [-o <file.csv>]" << std::endl;
+    std::cout << std::endl;
+    std::cout << "  -s <megapixels,...> Comma separated list of image sizes in megapixels, 3:2 landscape (default 24,50,100)." << std::endl;
+    std::cout << "  -w <width>          Width of the image, used instead of -s together with -h." << std::endl;
+    std::cout << "  -h <height>         Height of the image, used instead of -s together with -w." << std::endl;
+    std::cout << "  -r <runs>           Timed runs per solver and thread count, the fastest is reported (default 3)." << std::endl;
+    std::cout << "  -t <threads,...>    Comma separated list of thread counts (default: all available)." << std::endl;
+    std::cout << "  -o <file.csv>       Also write the results to a CSV file." << std::endl;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    setlocale(LC_ALL, "");
+    setlocale(LC_NUMERIC, "C"); // to set decimal point to "."
+
+    Gio::init();
+
+    argv0 = DATA_SEARCH_PATH;
+    creditsPath = CREDITS_SEARCH_PATH;
+    licensePath = LICENCE_SEARCH_PATH;
+    options.rtSettings.lensfunDbDirectory = LENSFUN_DB_PATH;
+
+    rtengine::PoissonBenchmark::Config config;
+    std::string csvFile;
+
+    for (int iArg = 1; iArg < argc; ++iArg) {
+        const std::string param(argv[iArg]);
+
+        if (param.size() != 2 || param[0] != '-' || iArg + 1 >= argc) {
+            printUsage(argv[0]);
+            return -1;
+        }
+
+        const std::string value(argv[++iArg]);
+
+        switch (param[1]) {
+            case 's': {
+                std::istringstream list(value);
+                std::string megapixels;
+                config.megapixels.clear();
+
+                while (std::getline(list, megapixels, ',')) {
+                    config.megapixels.push_back(std::atof(megapixels.c_str()));
+                }
+
+                break;
+            }
+
+            case 'w':
+                config.width = std::atoi(value.c_str());
+                break;
+
+            case 'h':
+                config.height = std::atoi(value.c_str());
+                break;
+
+            case 'r':
+                config.runs = std::atoi(value.c_str());
+                break;
+
+            case 't': {
+                std::istringstream list(value);
+                std::string threads;
+
+                while (std::getline(list, threads, ',')) {
+                    config.threads.push_back(std::atoi(threads.c_str()));
+                }
+
+                break;
+            }
+
+            case 'o':
+                csvFile = value;
+                break;
+
+            default:
+                printUsage(argv[0]);
+                return -1;
+        }
+    }
+
+    try {
+        Options::load(true);
+    } catch (Options::Error &e) {
+        std::cerr << "FATAL ERROR:" << std::endl << e.get_msg() << std::endl;
+        return -2;
+    }
+
+    const std::vector<rtengine::PoissonBenchmark::Result> results = rtengine::PoissonBenchmark::run(config, std::cerr);
+
+    if (results.empty()) {
+        std::cerr << "Nothing to benchmark." << std::endl;
+        return -1;
+    }
+
+    rtengine::PoissonBenchmark::printReport(results, std::cout);
+
+    if (!csvFile.empty()) {
+        std::ofstream csv(csvFile);
+        rtengine::PoissonBenchmark::writeCSV(results, csv);
+    }
+
+    return 0;
+}
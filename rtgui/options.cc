@@ -470,6 +470,13 @@ void Options::setDefaults()
 #endif
     filledProfile = false;
     maxInspectorBuffers = 2; //  a rather conservative value for low specced systems...
+    labCheckpointMemory = 256;
+    waveletCacheMemory = 256;
+    waveletCacheHalfFloat = false;
+    pipelineCacheMemory = 256;
+    bufferPoolMemory = 256;
+    denoiseMemory = 4096;
+    progressivePreview = false;
     inspectorDelay = 0;
     serializeTiffRead = true;
     measure = false;
@@ -685,11 +692,14 @@ void Options::setDefaults()
     lastICCProfCreatorDir = "";
     gimpPluginShowInfoDialog = true;
     maxRecentFolders = 15;
+    rtSettings.traceFile = "";
     rtSettings.lensfunDbDirectory = ""; // set also in main.cc and main-cli.cc
     cropGuides = CROP_GUIDE_FULL;
     cropAutoFit = false;
 
     rtSettings.thumbnail_inspector_mode = rtengine::Settings::ThumbnailInspectorMode::JPEG;
+    rtSettings.fattal_solver = rtengine::Settings::FattalSolver::MULTIGRID_PREVIEW;
+    rtSettings.epd_solver = rtengine::Settings::EPDSolver::MULTIGRID;
 }
 
 Options* Options::copyFrom(Options* other)
@@ -1176,6 +1186,38 @@ void Options::readFromFile(Glib::ustring fname)
                     maxInspectorBuffers = keyFile.get_integer("Performance", "MaxInspectorBuffers");
                 }
 
+                if (keyFile.has_key("Performance", "LabCheckpointMemory")) {
+                    labCheckpointMemory = std::max(0, keyFile.get_integer("Performance", "LabCheckpointMemory"));
+                }
+
+                if (keyFile.has_key("Performance", "WaveletCacheMemory")) {
+                    waveletCacheMemory = std::max(0, keyFile.get_integer("Performance", "WaveletCacheMemory"));
+                }
+
+                if (keyFile.has_key("Performance", "WaveletCacheHalfFloat")) {
+                    waveletCacheHalfFloat = keyFile.get_boolean("Performance", "WaveletCacheHalfFloat");
+                }
+
+                if (keyFile.has_key("Performance", "PipelineCacheMemory")) {
+                    pipelineCacheMemory = std::max(0, keyFile.get_integer("Performance", "PipelineCacheMemory"));
+                }
+
+                if (keyFile.has_key("Performance", "BufferPoolMemory")) {
+                    bufferPoolMemory = std::max(0, keyFile.get_integer("Performance", "BufferPoolMemory"));
+                }
+
+                if (keyFile.has_key("Performance", "DenoiseMemory")) {
+                    denoiseMemory = std::max(0, keyFile.get_integer("Performance", "DenoiseMemory"));
+                }
+
+                if (keyFile.has_key("Performance", "TraceFile")) {
+                    rtSettings.traceFile = keyFile.get_string("Performance", "TraceFile");
+                }
+
+                if (keyFile.has_key("Performance", "ProgressivePreview")) {
+                    progressivePreview = keyFile.get_boolean("Performance", "ProgressivePreview");
+                }
+
                 if (keyFile.has_key("Performance", "InspectorDelay")) {
                     inspectorDelay = keyFile.get_integer("Performance", "InspectorDelay");
                 }
@@ -1215,6 +1257,14 @@ void Options::readFromFile(Glib::ustring fname)
                 if (keyFile.has_key("Performance", "ThumbnailInspectorMode")) {
                     rtSettings.thumbnail_inspector_mode = static_cast<rtengine::Settings::ThumbnailInspectorMode>(keyFile.get_integer("Performance", "ThumbnailInspectorMode"));
                 }
+
+                if (keyFile.has_key("Performance", "FattalSolver")) {
+                    rtSettings.fattal_solver = static_cast<rtengine::Settings::FattalSolver>(std::min(2, std::max(0, keyFile.get_integer("Performance", "FattalSolver"))));
+                }
+
+                if (keyFile.has_key("Performance", "EPDSolver")) {
+                    rtSettings.epd_solver = static_cast<rtengine::Settings::EPDSolver>(std::min(1, std::max(0, keyFile.get_integer("Performance", "EPDSolver"))));
+                }
             }
 
             if (keyFile.has_group("GUI")) {
@@ -2222,6 +2272,14 @@ void Options::saveToFile(Glib::ustring fname)
         keyFile.set_integer("Performance", "ClutCacheSize", clutCacheSize);
         keyFile.set_integer("Performance", "MaxInspectorBuffers", maxInspectorBuffers);
         keyFile.set_integer("Performance", "InspectorDelay", inspectorDelay);
+        keyFile.set_integer("Performance", "LabCheckpointMemory", labCheckpointMemory);
+        keyFile.set_integer("Performance", "WaveletCacheMemory", waveletCacheMemory);
+        keyFile.set_boolean("Performance", "WaveletCacheHalfFloat", waveletCacheHalfFloat);
+        keyFile.set_integer("Performance", "PipelineCacheMemory", pipelineCacheMemory);
+        keyFile.set_integer("Performance", "BufferPoolMemory", bufferPoolMemory);
+        keyFile.set_integer("Performance", "DenoiseMemory", denoiseMemory);
+        keyFile.set_string("Performance", "TraceFile", rtSettings.traceFile);
+        keyFile.set_boolean("Performance", "ProgressivePreview", progressivePreview);
         keyFile.set_integer("Performance", "PreviewDemosaicFromSidecar", prevdemo);
         keyFile.set_boolean("Performance", "SerializeTiffRead", serializeTiffRead);
         keyFile.set_integer("Performance", "Measure", measure);
@@ -2231,6 +2289,8 @@ void Options::saveToFile(Glib::ustring fname)
         keyFile.set_integer("Performance", "ChunkSizeXT", chunkSizeXT);
         keyFile.set_integer("Performance", "ChunkSizeCA", chunkSizeCA);
         keyFile.set_integer("Performance", "ThumbnailInspectorMode", int(rtSettings.thumbnail_inspector_mode));
+        keyFile.set_integer("Performance", "FattalSolver", int(rtSettings.fattal_solver));
+        keyFile.set_integer("Performance", "EPDSolver", int(rtSettings.epd_solver));
 
 
         keyFile.set_string("Output", "Format", saveFormat.format);
@@ -2711,6 +2771,7 @@ void Options::load(bool lightweight)
 
     langMgr.load(options.language, {localeTranslation, languageTranslation, defaultTranslation});
 
+    options.rtSettings.fftwWisdomFile = Glib::build_filename(cacheBaseDir, "fftwf_wisdom");
     rtengine::init(&options.rtSettings, argv0, rtdir, !lightweight);
 }
 
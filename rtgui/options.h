@@ -356,6 +356,13 @@ public:
     int maxInspectorBuffers;   // maximum number of buffers (i.e. images) for the Inspector feature
     int inspectorDelay;
     int clutCacheSize;
+    int labCheckpointMemory;   // memory in MB for the cached outputs of the Lab tools, per preview/detail window ; 0 = disabled
+    int waveletCacheMemory;    // memory in MB for the cached wavelet decompositions of the wavelet levels tool, per preview/detail window ; 0 = disabled
+    bool waveletCacheHalfFloat; // keep the detail levels of the cached wavelet decompositions as half floats, slightly less precise
+    int pipelineCacheMemory;   // memory in MB for the RGB pipeline output shared by the preview and the detail windows ; 0 = disabled
+    int bufferPoolMemory;      // maximum memory in MB kept by the engine for reusing large image buffers ; 0 = disabled
+    int denoiseMemory;         // memory in MB the tiles of the noise reduction may use at once, bounds the tiles processed in parallel ; 0 = no limit
+    bool progressivePreview;   // show a 1/4 scale preview of the changed Lab tools before the full quality one
     bool filledProfile;  // Used as reminder for the ProfilePanel "mode"
     prevdemo_t prevdemo; // Demosaicing method used for the <100% preview
     bool serializeTiffRead;
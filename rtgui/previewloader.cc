@@ -24,6 +24,8 @@
 #include "guiutils.h"
 #include "threadutils.h"
 
+#include "../rtengine/trace.h"
+
 #ifdef _OPENMP
 #include <omp.h>
 #endif
@@ -92,6 +94,9 @@ public:
 
     void processNextJob()
     {
+        rtengine::trace::setThreadName("PreviewLoader");
+        TRACE_SCOPE("PreviewLoader job", "thumbnail");
+
         Job j;
 // Issue 2406       OutputJob *oj;
         {
@@ -30,6 +30,7 @@
 #include "thumbnail.h"
 
 #include "../rtengine/procparams.h"
+#include "../rtengine/trace.h"
 
 #ifdef _OPENMP
 #include <omp.h>
@@ -100,6 +101,9 @@ public:
     void
     processNextJob()
     {
+        rtengine::trace::setThreadName("ThumbImageUpdater");
+        TRACE_SCOPE("ThumbImageUpdater job", "thumbnail");
+
         Job j;
 
         {